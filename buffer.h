@@ -143,6 +143,54 @@ private:
 	bool		auto_release_;
 };
 
+/// \class
+/// \brief ֿĶء
+///
+/// ÿδӶϷܷ chunk_nr һ飬ٴӿȡ󡣶ܵͷţ
+/// ʱͷţмСʱ估ͷŵĴֻȡ
+/// T  POD ͣȡĶûгʼ
+template <class T>
+class chunk_arena
+{
+public:
+	/// \brief
+	/// һÿ chunk_nr Ķء
+	/// \param chunk_nr[in]	ÿĶ
+	chunk_arena (const uint32_t chunk_nr = 4096) : chunk_nr_ (chunk_nr), used_ (chunk_nr) {}
+	~chunk_arena () { clear (); }
+	/// \brief
+	/// ȡһ󣬵ǰʱ¿顣
+	/// \return ָ룬ڶͷǰһֱЧ
+	/// \throw  xdelta_exeption ڴ治㡣
+	T * alloc ()
+	{
+		if (used_ == chunk_nr_) {
+			T * chunk = (T *)malloc (chunk_nr_ * sizeof (T));
+			if (chunk == 0)
+				THROW_XDELTA_EXCEPTION_NO_ERRNO ("Out of memory.");
+			chunks_.push_back (chunk);
+			used_ = 0;
+		}
+		return &chunks_.back ()[used_++];
+	}
+	/// \brief
+	/// ͷеĿ顣
+	void clear ()
+	{
+		for (size_t i = 0; i < chunks_.size (); ++i)
+			free (chunks_[i]);
+		chunks_.clear ();
+		used_ = chunk_nr_;
+	}
+private:
+	chunk_arena (const chunk_arena &);
+	chunk_arena & operator = (const chunk_arena &);
+
+	std::vector<T *>	chunks_;
+	uint32_t			chunk_nr_;
+	uint32_t			used_;		///< һѾȡĶ
+};
+
 /// \fn char_buffer<char_type> & operator << (char_buffer<char_type> & buff, uint16_t var)
 /// \brief  buff С
 /// \param[in] buff char_buff 
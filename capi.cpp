@@ -40,7 +40,9 @@
 #endif
 
 #include <algorithm>
+#include <map>
 #include <set>
+#include <vector>
 #include <string>
 #include <list>
 #include <iterator>
@@ -48,6 +50,7 @@
 
 #include "mytypes.h"
 #include "tinythread.h"
+#include "ringbuf.h"
 #include "buffer.h"
 #include "platform.h"
 #include "md4.h"
@@ -57,87 +60,230 @@
 #include "capi.h"
 
 namespace xdelta {
+/// \struct
+/// ͵ʱһͬ飺Ŀļ t_offset  blength ֽڣд s_offset
 struct equal_node
 {
-	uint64_t	s_offset;	///< Դļеƫ
-	target_pos	tpos;		///< ĿļеλϢ
-	void *	 	data;
-	uint32_t	blength:29; ///< 鳤ȣᳬ MAX_XDELTA_BLOCK_BYTES  MULTIROUND_MAX_BLOCK_SIZE
-	uint32_t	visited:1;  ///< ʾĿǷѾ
-	uint32_t	stacked:1;	///< ʾĿǷѾڴջС
-	uint32_t	deleted:1;	///< ʾĿǷѾɾѭ
+	uint64_t	s_offset;	///< ԴļеƫƣҲдλá
+	uint64_t	t_offset;	///< ĿļеƫƣҲǶȡλá
+	xit_t *		item;		///< ӦĽ
+	uint32_t	blength;	///< 鳤ȡ
+	uint32_t	state;		///<  NODE_XXX
+	size_t		dep_begin;	///< ȡдصĿ deps еķΧ
+	size_t		dep_end;
+	uint32_t	degree;		///< 򣩣ֻ XDELTA_INPLACE_MIN_COST ʱ㡣
+};
+
+#define NODE_NEW		0	///< ûд
+#define NODE_STACKED	1	///< ڴջУڵȴĿ顣
+#define NODE_DONE		2	///< Ѿź˳
+#define NODE_DELETED	3	///< ѭΪݡ
+
+/// \struct
+/// ʽջջ֡node ڵȴ deps  [next, end) Ŀȴ
+struct resolve_frame
+{
+	uint32_t	node;
+	size_t		next;
+	size_t		end;
+};
+
+/// \struct
+/// ȡλʱֻ飬 equal_node ȥ
+struct target_entry
+{
+	uint64_t	t_offset;
+	uint32_t	blength;
+	uint32_t	node;	///<  nodes е±ꡣ
+	uint32_t	rank;	///< 鳤 log2 (blength) ֡
+};
+
+/// Ȱ鳤飬ڰȡλλͬʱԴļе˳
+struct target_less
+{
+	bool operator () (const target_entry & left, const target_entry & right) const
+	{
+		if (left.rank != right.rank)
+			return left.rank < right.rank;
+		return left.t_offset < right.t_offset
+			|| (left.t_offset == right.t_offset && left.node < right.node);
+	}
+	bool operator () (const target_entry & left, const uint64_t offset) const
+	{
+		return left.t_offset < offset;
+	}
 };
 
 /// \struct
-/// һͬݶ
-struct diff_node
+/// by_target п鳤ͬһ飬[lo, hi) Ϊ鰴Դļеλʱϲõαꡣ
+struct rank_bucket
 {
-	uint64_t s_offset;	///< Դļеƫƣ洢Ŀļͬλá
-	uint32_t blength;	///< 鳤ȡ
+	size_t		begin;
+	size_t		end;
+	uint64_t	maxlen;	///< Ŀ鳤̵
+	size_t		lo;
+	size_t		hi;
 };
 
-void resolve_inplace_identical_block (std::set<equal_node *> & enode_set
-									, equal_node * node
-									, std::list<equal_node*> & ident_blocks
-									, std::list<diff_node> * diff_blocks = 0)
-{
-	if (node->stacked == TRUE) { // cyclic condition, convert it to adding bytes to target.
-		if (diff_blocks) {
-			diff_node dn;
-			dn.blength = node->blength;
-			dn.s_offset = node->s_offset;
-			diff_blocks->push_back (dn);
+static uint32_t length_rank (uint32_t len)
+{
+	uint32_t rank = 0;
+	while (len >>= 1)
+		++rank;
+	return rank;
+}
+
+/// \fn resolve_inplace_order()
+/// \brief
+/// źִͬ˳򡣿 A д B ȡصʱB  A ֮ǰִУ
+/// ÿִ֮ǰִжȡдصĿ飨ȣ
+/// ջеĿ˵ѭΪɾĳɲд룬ٶĿļѭ
+/// ͶϿˡʽջݹ飬ܳļƽƣʱҲջ
+/// ȡ򰴿鳤2 ݣ飬ڰλ򣬶ÿһҶȡλ
+/// (s_offset - Ŀ鳤, s_offset + blength) еĿ顣Ŀ鲻̵鵽Ŀ
+/// ˶ͬһλõظصԲΪмܳĿ飬ÿζɨһ
+/// ̿顣ܵʱ O(n log n + n *  + 鵽Ŀ) 32صĿҺ÷ deps С
+/// XDELTA_INPLACE_MIN_COST ʱɾѭдСĿ飨Rasch/Burns  locally-minimum ԣ
+/// ư鳤ȨС㼯鳤̵ģ鳤ͬʱȡģͬʱ
+/// ѭСɾĿ֮ϵջ֡˻صδ״̬֮´
+/// \param[in,out] nodes	еͬ飬ԴļеλС
+/// \param[out] order		ִ˳nodes е±꣩ɾĿ顣
+/// \param[in] policy		XDELTA_INPLACE_FAST  XDELTA_INPLACE_MIN_COST
+static void resolve_inplace_order (std::vector<equal_node> & nodes, std::vector<uint32_t> & order
+								, const int policy)
+{
+	const uint32_t nr = (uint32_t)nodes.size ();
+	std::vector<target_entry> by_target (nr);
+	for (uint32_t i = 0; i < nr; ++i) {
+		by_target[i].t_offset = nodes[i].t_offset;
+		by_target[i].blength = nodes[i].blength;
+		by_target[i].node = i;
+		by_target[i].rank = length_rank (nodes[i].blength);
+	}
+	const target_less less = target_less ();
+	std::sort (by_target.begin (), by_target.end (), less);
+
+	std::vector<rank_bucket> buckets;
+	for (size_t i = 0; i < nr; ) {
+		rank_bucket bucket;
+		bucket.begin = bucket.lo = bucket.hi = i;
+		bucket.maxlen = 1;
+		const uint32_t rank = by_target[i].rank;
+		for (; i < nr && by_target[i].rank == rank; ++i)
+			if (by_target[i].blength > bucket.maxlen)
+				bucket.maxlen = by_target[i].blength;
+		bucket.end = i;
+		buckets.push_back (bucket);
+	}
+
+	// 鰴ԴļеλʱÿһԴļеĿкϲ
+	// һͿҳпķΧܶʱֲҼÿһл棬ֻʱá
+	bool sorted = true;
+	for (uint32_t i = 1; i < nr && sorted; ++i)
+		sorted = nodes[i - 1].s_offset < nodes[i].s_offset;
+
+	std::vector<uint32_t> deps;
+	deps.reserve (nr);
+	for (uint32_t i = 0; i < nr; ++i) {
+		equal_node & node = nodes[i];
+		node.dep_begin = deps.size ();
+		node.degree = 0;
+		const uint64_t high = node.s_offset + node.blength;
+		for (size_t b = 0; b < buckets.size (); ++b) {
+			rank_bucket & bucket = buckets[b];
+			const uint64_t low = node.s_offset >= bucket.maxlen ? node.s_offset - bucket.maxlen + 1 : 0;
+			size_t begin, end;
+			if (sorted) {
+				while (bucket.lo < bucket.end && by_target[bucket.lo].t_offset < low)
+					++bucket.lo;
+				if (bucket.hi < bucket.lo)
+					bucket.hi = bucket.lo;
+				while (bucket.hi < bucket.end && by_target[bucket.hi].t_offset < high)
+					++bucket.hi;
+				begin = bucket.lo;
+				end = bucket.hi;
+			}
+			else {
+				begin = std::lower_bound (by_target.begin () + bucket.begin, by_target.begin () + bucket.end
+					, low, less) - by_target.begin ();
+				end = std::lower_bound (by_target.begin () + begin, by_target.begin () + bucket.end
+					, high, less) - by_target.begin ();
+			}
+			for (size_t k = begin; k < end; ++k) {
+				const target_entry & entry = by_target[k];
+				if (entry.node != i && entry.t_offset + entry.blength > node.s_offset)
+					deps.push_back (entry.node);
+			}
 		}
-		node->deleted = TRUE;
-		return;
+		node.dep_end = deps.size ();
 	}
 
-	if (node->visited == TRUE)
-		return;
+	if (policy == XDELTA_INPLACE_MIN_COST) {
+		for (uint32_t i = 0; i < nr; ++i) {
+			for (size_t k = nodes[i].dep_begin; k < nodes[i].dep_end; ++k) {
+				++nodes[i].degree;
+				++nodes[deps[k]].degree;
+			}
+		}
+	}
 
-	node->stacked = TRUE;
-	//
-	// ͬģ˵ûоƶ
-	// Ĳ߼ģ
-	// enode_set ѾڵĿļĿˣset ԣ
-	// ĳĿڿƶǰҪ s_offset ΪĿλòңǷĳӰ֮£
-	// ҪȴǵĿ飬һԼҪһߡ
-	//
-	uint64_t left_index = node->s_offset / node->blength, 
-			right_index = (node->s_offset - 1 + node->blength) / node->blength;
+	std::vector<resolve_frame> stack;
+	for (uint32_t root = 0; root < nr; ++root) {
+		if (nodes[root].state != NODE_NEW)
+			continue;
 
-	equal_node enode;
-	enode = *node;
-	enode.tpos.index = (uint32_t)left_index;
+		uint32_t push = root;
+		while (true) {
+			if (push != (uint32_t)-1) {
+				equal_node & node = nodes[push];
+				resolve_frame frame;
+				frame.node = push;
+				frame.next = node.dep_begin;
+				frame.end = node.dep_end;
+				node.state = NODE_STACKED;
+				stack.push_back (frame);
+				push = (uint32_t)-1;
+			}
+			if (stack.empty ())
+				break;
 
-	typedef std::set<equal_node*>::iterator it_t;
-	// to forge a node, only t_index member will be used.
-	it_t pos = enode_set.find (&enode);
-	//
-	// to check if this equal node is overlap with one and/or its 
-	// directly following block on target.ȴ
-	//
-	if (pos != enode_set.end () && *pos != node)
-		xdelta::resolve_inplace_identical_block (enode_set, *pos, ident_blocks, diff_blocks);
+			resolve_frame & top = stack.back ();
+			if (top.next == top.end) { // Ŀ鶼Ѿˡ
+				equal_node & node = nodes[top.node];
+				if (node.state != NODE_DELETED) {
+					node.state = NODE_DONE;
+					order.push_back (top.node);
+				}
+				stack.pop_back ();
+				continue;
+			}
 
-	//
-	// ٴұߡ
-	//
-	enode.tpos.index = (uint32_t)right_index;
-	pos = enode_set.find (&enode);
-	if (pos != enode_set.end () && *pos != node)
-		resolve_inplace_identical_block (enode_set, *pos, ident_blocks, diff_blocks);
-
-	// this node's all dependencies have been resolved.
-	// so push the node to the back, and when return from this call,
-	// blocks depend on this node will be pushed to the back just behind
-	// its dependent block.
-	if (node->deleted == FALSE)
-		ident_blocks.push_back (node);
-	
-	node->stacked = FALSE;
-	node->visited = TRUE;
-	return;
+			const uint32_t dep = deps[top.next++];
+			equal_node & depnode = nodes[dep];
+			if (depnode.state == NODE_NEW)
+				push = dep;
+			else if (depnode.state != NODE_STACKED)
+				continue;
+			else if (policy != XDELTA_INPLACE_MIN_COST) // cyclic condition, convert it to adding bytes to target.
+				depnode.state = NODE_DELETED;
+			else {
+				// ѭջд dep ջĿ飬ҳСġ
+				size_t victim = stack.size () - 1;
+				for (size_t i = stack.size (); i-- > 0; ) {
+					const equal_node & a = nodes[stack[i].node], & b = nodes[stack[victim].node];
+					if (a.blength < b.blength || (a.blength == b.blength && a.degree > b.degree))
+						victim = i;
+					if (stack[i].node == dep)
+						break;
+				}
+				// ֮ϵĿΪŴģ˻ȥԺٴԼɾٵȴĿ顣
+				for (size_t i = victim + 1; i < stack.size (); ++i)
+					nodes[stack[i].node].state = NODE_NEW;
+				nodes[stack[victim].node].state = NODE_DELETED;
+				stack.resize (victim);
+			}
+		}
+	}
 }
 
 static void create_pipe (PIPE_HANDLE * rd, PIPE_HANDLE * wr)
@@ -158,82 +304,161 @@ static void create_pipe (PIPE_HANDLE * rd, PIPE_HANDLE * wr)
 	}
 }
 
+// Ĳд capi.h Уֽڡ
+typedef char hrec_layout_check[sizeof (hrec_t) == 40 ? 1 : -1];
+typedef char xrec_layout_check[sizeof (xrec_t) == 32 ? 1 : -1];
+
+/// \struct
+///  realloc ɱ顣󽻸 xdelta_free_*_array ͷţ
+/// Բ std::vector
+template <class T>
+struct rec_array
+{
+	T *			items;
+	uint64_t	count;
+	uint64_t	capacity;
+
+	rec_array () : items (0), count (0), capacity (0) {}
+	~rec_array () { free (items); }
+	T * append ()
+	{
+		if (count == capacity) {
+			const uint64_t nr = capacity == 0 ? 1024 : capacity * 2;
+			T * p = (T *)realloc (items, (size_t)(nr * sizeof (T)));
+			if (p == 0) {
+				std::string errmsg = "Out of memory.";
+				THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+			}
+			items = p;
+			capacity = nr;
+		}
+		return &items[count++];
+	}
+	/// 齻ߣȻȥ
+	T * detach ()
+	{
+		T * p = items;
+		if (count > 0 && count < capacity) {
+			T * q = (T *)realloc (items, (size_t)(count * sizeof (T)));
+			if (q != 0)
+				p = q;
+		}
+		items = 0;
+		count = capacity = 0;
+		return p;
+	}
+};
+
+/// Ľڵÿĸ
+#define RESULT_CHUNK_NODES (64 * 1024)
+
+/// \class
+/// xdelta_get_hashes_in_chunks_free_inner ȷص ownerĽڵ㶼зֿ䣬
+/// xdelta_free_nodes һΰͷš
+struct node_owner
+{
+	virtual ~node_owner () {}
+};
+
+template <class T>
+struct node_arena : public node_owner
+{
+	chunk_arena<T> nodes;
+	node_arena () : nodes (RESULT_CHUNK_NODES) {}
+};
+
+/// һڵ㣬arena Ϊʱ new 䣬߿ delete ͷš
+template <class T>
+inline T * new_node (node_arena<T> * arena)
+{
+	return arena != 0 ? arena->nodes.alloc () : new T;
+}
+
 typedef struct inner_hash_xdelta_result_type
 {
 	thread * pthread;
-	union {
-		struct {
-			hit_t *	 hhead, *htail;
-		}hash;
-		struct {
-			xit_t *	 xhead, *xtail;
-		}xdelta;
-	}head;
-	
-	#define xhead head.xdelta.xhead
-	#define hhead head.hash.hhead
-
-	// ԱڶһԪصġ
-	#define htail head.hash.htail
-	#define xtail head.xdelta.xtail
+	// ȷУӿڷʱתиĽ׷ӡ
+	rec_array<hrec_t>	hashes;
+	rec_array<xrec_t>	xdeltas;
 	
 	PIPE_HANDLE rd;
 	PIPE_HANDLE wr;
 	hole_t	 	hole;
 	uint32_t	blklen;
-	hash_table	table;			// ڼʱʹõĹϣ
+	hash_table	table;			// ڼʱʹõĹϣϣʱֻ¼ϣ㷨ȡ
 	
 	diff_func_t diffcb;	// ڼʱĻص
 	void * cbpriv;		// صݡ
 
+	// xdelta_hash_begin  xdelta_delta_begin ʼĶɵֱӴݡ
+	hasher_stream *	hstream;
+	xdelta_stream *	xstream;
+	hash_feeder *	hfeeder;
+	delta_feeder *	dfeeder;
+	uint64_t		fed;		// Ѿݳȡ
+	bool			short_feed;	// жݲ㶴ĳȣȡʱʧܡ
+	bool			digest;		// ضϣ㴫ݵ MD4 xdelta_get_digest
+	rs_mdfour_t		md4;
+
 	inner_hash_xdelta_result_type () :
 		pthread (0),
 		rd (INVALID_HANDLE_VALUE),
 		wr (INVALID_HANDLE_VALUE),
 		blklen(-1),
 		diffcb(0),
-		cbpriv (0)
-		{
-			xhead = 0;
-			xtail = 0;
-		}
+		cbpriv (0),
+		hstream (0),
+		xstream (0),
+		hfeeder (0),
+		dfeeder (0),
+		fed (0),
+		short_feed (false),
+		digest (false)
+		{}
 }ihx_t;
 
-class pipe_reader : public file_reader {
-	virtual int read_file (uchar_t * data, const uint32_t len)
-	{
-		return local_read (f_handle_, data, len);
-	}
-	virtual uint64_t seek_file (const uint64_t offset, const int whence)
-	{
-		return offset;
+/// ܵӿڵ߳ÿδӹܵôݣٽ feeder
+#define PIPE_FEED_LEN (1024 * 1024)
+
+/// \fn feed_from_pipe()
+/// \brief
+/// ܵӿڵ̣߳ӹܵ붴 len ֽݣ feederֱӵ
+/// xdelta_hash_feed  xdelta_delta_feed ͬpctx Ϊ 0 ʱͬʱ MD4
+template <class feeder_t>
+static void feed_from_pipe (PIPE_HANDLE rd, uint64_t len, feeder_t & feeder, rs_mdfour_t * pctx)
+{
+	char_buffer<uchar_t> buf (PIPE_FEED_LEN);
+	while (len > 0) {
+		const uint32_t want = (uint32_t)(len > PIPE_FEED_LEN ? PIPE_FEED_LEN : len);
+		uint32_t got = 0;
+		while (got < want) {
+			int size = local_read (rd, buf.begin () + got, want - got);
+			if (size <= 0) {
+				std::string errmsg = "Can't not read file or pipe.";
+				THROW_XDELTA_EXCEPTION (errmsg);
+			}
+			got += size;
+		}
+		if (pctx != 0)
+			rs_mdfour_update (pctx, buf.begin (), got);
+		feeder.feed (buf.begin (), got);
+		len -= got;
 	}
-private:
-	PIPE_HANDLE f_handle_;
-public:
-	pipe_reader (PIPE_HANDLE f_handle) : f_handle_ (f_handle) {}
-	~pipe_reader() {}
-};
+}
 
 class pipe_hasher_stream : public hasher_stream
 {
 	ihx_t * pihx_;
 	virtual void add_block (const uint32_t fhash, const slow_hash & shash)
 	{
-		if (pihx_->hhead == 0) {
-			pihx_->hhead = new hit_t;
-			pihx_->htail = pihx_->hhead;
-		}
-		else {
-			pihx_->htail->next = new hit_t;
-			pihx_->htail = pihx_->htail->next;
-		}
-		
-		pihx_->htail->fast_hash = fhash;
-		memcpy (pihx_->htail->slow_hash, shash.hash, DIGEST_BYTES); // 16 Bytes
-		pihx_->htail->t_offset = shash.tpos.t_offset;
-		pihx_->htail->t_index =  shash.tpos.index;
-		pihx_->htail->next = 0;
+		hrec_t * rec = pihx_->hashes.append ();
+		const uint32_t hlen = pihx_->table.get_hash_len ();
+		rec->fast_hash = fhash;
+		memcpy (rec->slow_hash, shash.hash, hlen); //  16 Bytes
+		memset (rec->slow_hash + hlen, 0, DIGEST_BYTES - hlen);
+		rec->check_hash = shash.check;
+		rec->t_offset = shash.tpos.t_offset;
+		rec->t_index =  shash.tpos.index;
 	}
 	
 public:
@@ -246,9 +471,29 @@ static void inner_calc_hash (void *data)
 {
 	ihx_t * pihx = (ihx_t *)data;
 	pipe_hasher_stream pipehasher (pihx);
-	pipe_reader pipereader (pihx->rd);
-	
-	read_and_hash (pipereader, pipehasher, pihx->hole.length, pihx->blklen, pihx->hole.offset, 0);
+	hash_feeder feeder (pipehasher, pihx->blklen, pihx->hole.offset, 0, pihx->table.get_hash_type ());
+	feed_from_pipe (pihx->rd, pihx->hole.length, feeder, pihx->digest ? &pihx->md4 : 0);
+}
+
+/// \fn end_feed()
+/// \brief
+/// ֱӴݵĶʣµĲݡ
+static void end_feed (ihx_t * pihx)
+{
+	if ((pihx->hfeeder != 0 || pihx->dfeeder != 0) && pihx->fed != pihx->hole.length)
+		pihx->short_feed = true; // лûиǵݡ
+	if (pihx->dfeeder != 0)
+		pihx->dfeeder->finish ();
+
+	delete pihx->hfeeder;
+	delete pihx->dfeeder;
+	delete pihx->hstream;
+	delete pihx->xstream;
+	pihx->hfeeder = 0;
+	pihx->dfeeder = 0;
+	pihx->hstream = 0;
+	pihx->xstream = 0;
+	pihx->fed = 0;
 }
 
 static void clear_hash_xdelta_result (ihx_t * pihx)
@@ -256,6 +501,7 @@ static void clear_hash_xdelta_result (ihx_t * pihx)
 	if (pihx == 0)
 		return;
 
+	end_feed (pihx);
 	if (pihx->pthread != 0) {
 		pihx->pthread->join ();
 		delete pihx->pthread;
@@ -273,27 +519,32 @@ static void clear_hash_xdelta_result (ihx_t * pihx)
 	}
 }
 
+/// \fn finish_inner()
+/// \brief
+/// ȡǰ㡣жݲ㶴ĳʱͷڲݣ errno
+/// \return ȡʱ true
+static bool finish_inner (ihx_t * pihx)
+{
+	clear_hash_xdelta_result (pihx);
+	if (!pihx->short_feed)
+		return true;
+	delete pihx;
+	errno = 22;
+	return false;
+}
+
 class pipe_xdelta_stream : public xdelta_stream
 {
 	ihx_t * pihx_;
 	void add_block (uint16_t type, uint64_t t_pos, uint64_t s_pos, uint32_t blklen, uint32_t t_index)
 	{
-		if (pihx_->xhead == 0) {
-			pihx_->xhead = new xit_t;
-			pihx_->xtail = pihx_->xhead;
-		}
-		else {
-			pihx_->xtail->next = new xit_t;
-			pihx_->xtail = pihx_->xtail->next;
-		}
-		
-		pihx_->xtail->next = 0;
-
-		pihx_->xtail->type = type;
-		pihx_->xtail->s_offset = s_pos;
-		pihx_->xtail->t_offset = t_pos;
-		pihx_->xtail->index = t_index;
-		pihx_->xtail->blklen = blklen;
+		xrec_t * rec = pihx_->xdeltas.append ();
+		rec->type = type;
+		rec->reserved[0] = rec->reserved[1] = rec->reserved[2] = 0;
+		rec->s_offset = s_pos;
+		rec->t_offset = t_pos;
+		rec->index = t_index;
+		rec->blklen = blklen;
 	}
 	
 	virtual void add_block (const target_pos & tpos
@@ -315,6 +566,16 @@ class pipe_xdelta_stream : public xdelta_stream
 			pihx_->diffcb((char *)data, blk_len, s_offset, pihx_->cbpriv);
 		return;
 	}
+	virtual bool wants_zero () const { return true; }
+	virtual void add_zero (const uint64_t length, const uint64_t s_offset)
+	{
+		// blklen ֻ 32 λĿնֳɶ
+		const uint64_t maxlen = (uint64_t)1 << 30;
+		for (uint64_t pos = 0; pos < length; pos += maxlen) {
+			const uint64_t len = length - pos > maxlen ? maxlen : length - pos;
+			add_block (DT_ZERO, 0, s_offset + pos, (uint32_t)len, -1);
+		}
+	}
 public:	
 	pipe_xdelta_stream (ihx_t * pihx) : pihx_ (pihx) {}
 	~pipe_xdelta_stream () {}
@@ -324,12 +585,299 @@ static void inner_xdelta (void *data)
 {
 	ihx_t * pihx = (ihx_t *)data;
 	pipe_xdelta_stream pipexdelta (pihx);
-	pipe_reader pipereader (pihx->rd);
-	
-	std::set<hole_t> hs;
-	hs.insert (pihx->hole);
+	delta_feeder feeder (pipexdelta, pihx->table, pihx->blklen, pihx->hole.offset);
+	feed_from_pipe (pihx->rd, pihx->hole.length, feeder, pihx->digest ? &pihx->md4 : 0);
+	feeder.finish ();
+}
+
+/// \fn check_feed()
+/// \brief
+///  xdelta_hash_feed  xdelta_delta_feed ĲϷʱ´ĳȡ
+static bool check_feed (ihx_t * pihx, const bool hash, const char * data, unsigned datalen)
+{
+	if (pihx == 0 || (data == 0 && datalen > 0)
+		|| (hash ? pihx->hfeeder == 0 : pihx->dfeeder == 0)
+		|| pihx->fed + datalen > pihx->hole.length) {
+		errno = 22;
+		return false;
+	}
+	pihx->fed += datalen;
+	return true;
+}
+
+/// \fn load_hash_table()
+/// \brief
+/// ڲݣ nr ϣװϣget (i) ص i 
+template <class getter_t>
+static ihx_t * load_hash_table (getter_t get, const uint64_t nr, unsigned blklen
+						, diff_func_t diffcb
+						, void * cbpriv
+						, int hash_type)
+{
+	if (blklen > MAX_XDELTA_BLOCK_BYTES || XDELTA_BLOCK_SIZE > blklen
+		|| !is_valid_hash_type (hash_type) || nr > (uint32_t)-1) {
+		errno = 22;
+		return 0;
+	}
 	
-	read_and_delta (pipereader, pipexdelta, pihx->table, hs, pihx->blklen, false);
+	ihx_t * pihx = new ihx_t;
+	pihx->blklen = blklen;
+	pihx->table.set_hash_type ((strong_hash_type)hash_type);
+	pihx->table.set_check (getter_t::checked);
+	pihx->table.reserve ((uint32_t)nr);
+
+	for (uint64_t i = 0; i < nr; ++i) {
+		const typename getter_t::item_type * item = get (i);
+		slow_hash sh;
+		memcpy (sh.hash, item->slow_hash, DIGEST_BYTES);
+		sh.check = getter_t::check (item);
+		sh.tpos.t_offset = item->t_offset;
+		sh.tpos.index = item->t_index;
+		pihx->table.add_block (item->fast_hash, sh);
+	}
+
+	pihx->diffcb = diffcb;
+	pihx->cbpriv = cbpriv;
+	return pihx;
+}
+
+/// ˳i ֻܴ 0 ʼӡhit_t ûУ HashʱȽ
+struct list_getter
+{
+	typedef hit_t item_type;
+	static const bool checked = false;
+	static uint64_t check (const hit_t *) { return 0; }
+	hit_t * node;
+	list_getter (hit_t * head) : node (head) {}
+	const hit_t * operator () (uint64_t)
+	{
+		hit_t * p = node;
+		node = node->next;
+		return p;
+	}
+};
+
+struct array_getter
+{
+	typedef hrec_t item_type;
+	static const bool checked = true;
+	static uint64_t check (const hrec_t * p) { return p->check_hash; }
+	const hrec_t * items;
+	array_getter (const hrec_t * p) : items (p) {}
+	const hrec_t * operator () (uint64_t i) const { return &items[i]; }
+};
+
+/// xdelta_apply ÿζд󳤶ȣҲĳȡ
+#define APPLY_BUFFER_LEN ((uint32_t)1 << 22) // 4MB
+
+/// \struct
+/// xdelta_apply кϲһΣͬдλڣͬĶȡλҲڣ
+struct apply_run
+{
+	uint64_t	s_offset;	///< дλá
+	uint64_t	t_offset;	///< DT_IDENT ʱĿļжȡλá
+	uint64_t	length;
+	uint16_t	type;
+};
+
+static bool run_before (const apply_run & left, const apply_run & right)
+{
+	return left.s_offset < right.s_offset;
+}
+
+/// \brief
+/// ѽϲɾĶΡsorted Ϊ true ʱȰдλļʱ˳޹أ
+/// 򱣳˳򣨾͵ʱ xdelta_resolve_inplace ˳򣩡
+static void collect_runs (const xit_t * head, const bool sorted, std::vector<apply_run> & runs)
+{
+	for (const xit_t * p = head; p != 0; p = p->next) {
+		if (p->blklen == 0)
+			continue;
+		apply_run run;
+		run.s_offset = p->s_offset;
+		run.t_offset = p->type == DT_IDENT ? get_target_offset ((xit_t *)p) : 0;
+		run.length = p->blklen;
+		run.type = p->type;
+		runs.push_back (run);
+	}
+	if (sorted)
+		std::stable_sort (runs.begin (), runs.end (), run_before);
+
+	size_t nr = 0;
+	for (size_t i = 0; i < runs.size (); ++i) {
+		const apply_run & run = runs[i];
+		if (nr > 0) {
+			apply_run & last = runs[nr - 1];
+			if (last.type == run.type && last.s_offset + last.length == run.s_offset
+				&& (run.type != DT_IDENT || last.t_offset + last.length == run.t_offset)) {
+				last.length += run.length;
+				continue;
+			}
+			// ͵ʱϵĿͨӺǰСxdelta_resolve_inplace ִ֤еĿ鲻
+			// дִеĿҪȡλãϲΰ memmove ƣͬ
+			if (!sorted && last.type == run.type && run.s_offset + run.length == last.s_offset
+				&& (run.type != DT_IDENT || run.t_offset + run.length == last.t_offset)) {
+				last.s_offset = run.s_offset;
+				last.t_offset = run.t_offset;
+				last.length += run.length;
+				continue;
+			}
+		}
+		runs[nr++] = run;
+	}
+	runs.resize (nr);
+}
+
+/// \struct
+/// һеһݣȲ APPLY_BUFFER_LEN
+struct apply_piece
+{
+	uint64_t	s_offset;	///< дλá
+	uint64_t	from;		///< ȡλãDT_IDENT ʱĿļУDT_DIFF ʱڲļС
+	uint32_t	length;
+	uint32_t	slot;		///< ڻеλá
+	uint16_t	type;
+};
+
+static bool read_before (const apply_piece & left, const apply_piece & right)
+{
+	if (left.type != right.type)
+		return left.type < right.type;
+	return left.from < right.from;
+}
+
+static bool write_before (const apply_piece & left, const apply_piece & right)
+{
+	return left.s_offset < right.s_offset;
+}
+
+static void read_fully (file_reader & reader, uint64_t offset, uchar_t * data, uint32_t len)
+{
+	while (len > 0) {
+		const int size = reader.read_at (offset, data, len);
+		if (size <= 0) {
+			std::string errmsg = fmt_string ("Can't read file %s.", reader.get_fname ().c_str ());
+			THROW_XDELTA_EXCEPTION (errmsg);
+		}
+		offset += size;
+		data += size;
+		len -= size;
+	}
+}
+
+/// \class
+/// xdelta_apply ִУܹ APPLY_BUFFER_LEN ݺȰȡλλڵһ
+/// 룬ٰдλ򣬸ƵУλڵһдһȫд
+/// 밴˳ִеĽͬǰдҪȡλãļʱд
+/// ͬļ͵ʱ xdelta_resolve_inplace ֤
+class apply_batch
+{
+	file_reader *				tgt_;
+	file_reader *				src_;
+	file_writer &				writer_;
+	char_buffer<uchar_t>		data_;
+	char_buffer<uchar_t>		out_;
+	std::vector<apply_piece>	pieces_;
+	uint32_t					length_;
+public:
+	apply_batch (file_reader * tgt, file_reader * src, file_writer & writer) : tgt_ (tgt), src_ (src)
+		, writer_ (writer), data_ (APPLY_BUFFER_LEN), out_ (APPLY_BUFFER_LEN), length_ (0) {}
+	void add (const apply_piece & piece)
+	{
+		if (length_ + piece.length > APPLY_BUFFER_LEN)
+			flush ();
+		pieces_.push_back (piece);
+		length_ += piece.length;
+	}
+	void flush ()
+	{
+		if (pieces_.empty ())
+			return;
+
+		std::sort (pieces_.begin (), pieces_.end (), read_before);
+		uint32_t slot = 0;
+		for (size_t i = 0; i < pieces_.size (); ++i) {
+			pieces_[i].slot = slot;
+			slot += pieces_[i].length;
+		}
+		for (size_t i = 0; i < pieces_.size ();) {
+			const apply_piece & first = pieces_[i];
+			file_reader * reader = first.type == DT_IDENT ? tgt_ : src_;
+			if (reader == 0) {
+				std::string errmsg ("No source file for different data.");
+				THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+			}
+			uint32_t len = first.length;
+			for (++i; i < pieces_.size () && pieces_[i].type == first.type
+					&& pieces_[i].from == first.from + len; ++i)
+				len += pieces_[i].length;
+			read_fully (*reader, first.from, data_.begin () + first.slot, len);
+		}
+
+		std::sort (pieces_.begin (), pieces_.end (), write_before);
+		for (size_t i = 0; i < pieces_.size ();) {
+			const uint64_t offset = pieces_[i].s_offset;
+			uint32_t len = 0;
+			for (; i < pieces_.size () && pieces_[i].s_offset == offset + len; ++i) {
+				memcpy (out_.begin () + len, data_.begin () + pieces_[i].slot, pieces_[i].length);
+				len += pieces_[i].length;
+			}
+			if (writer_.write_at (offset, out_.begin (), len) != (int)len) {
+				std::string errmsg = fmt_string ("Can't not write file %s.", writer_.get_fname ().c_str ());
+				THROW_XDELTA_EXCEPTION (errmsg);
+			}
+		}
+		pieces_.clear ();
+		length_ = 0;
+	}
+};
+
+/// \brief
+/// ˳ѺϲĶηִСDT_ZERO ֮ǰִѾµݡ APPLY_BUFFER_LEN Ķ
+/// ֳɼ飬͵ʱȡд֮ǰصĶδӺǰ֣ͬ memmove֤ǰ
+/// Ŀ鲻дĿҪȡλá
+/// kernel Ϊ true ʱֻļͬĶںиƣһûи֧֣꣨
+/// Ժûռд
+static void apply_runs (const std::vector<apply_run> & runs, f_local_freader & tgt, file_reader * src
+					, f_local_fwriter & out, const bool inplace, bool kernel, xast_t & stat)
+{
+	file_writer & writer = out;
+	apply_batch batch (&tgt, src, writer);
+	bool try_clone = true;
+	for (size_t i = 0; i < runs.size (); ++i) {
+		const apply_run & run = runs[i];
+		if (run.type == DT_ZERO) {
+			batch.flush ();
+			writer.write_zero (run.s_offset, run.length);
+			continue;
+		}
+
+		uint64_t done = 0;
+		if (kernel && run.type == DT_IDENT) {
+			uint64_t cloned = 0;
+			done = out.copy_range (tgt, run.t_offset, run.s_offset, run.length, try_clone, cloned);
+			stat.clone_bytes += cloned;
+			stat.kernel_bytes += done - cloned;
+			kernel = done == run.length;
+		}
+		stat.user_bytes += run.length - done;
+
+		const uint64_t from = run.type == DT_IDENT ? run.t_offset : run.s_offset;
+		const bool backward = inplace && run.type == DT_IDENT && from < run.s_offset
+			&& from + run.length > run.s_offset;
+		while (done < run.length) {
+			apply_piece piece;
+			piece.length = (uint32_t)(run.length - done > APPLY_BUFFER_LEN ? APPLY_BUFFER_LEN : run.length - done);
+			const uint64_t pos = backward ? run.length - done - piece.length : done;
+			piece.s_offset = run.s_offset + pos;
+			piece.from = from + pos;
+			piece.type = run.type;
+			piece.slot = 0;
+			batch.add (piece);
+			done += piece.length;
+		}
+	}
+	batch.flush ();
 }
 
 } // xdelta
@@ -338,13 +886,20 @@ using namespace xdelta;
 
 void * xdelta_start_hash (unsigned blklen)
 {
-	if (blklen > MAX_XDELTA_BLOCK_BYTES || XDELTA_BLOCK_SIZE > blklen) {
+	return xdelta_start_hash_ex (blklen, XDELTA_HASH_MD4);
+}
+
+void * xdelta_start_hash_ex (unsigned blklen, int hash_type)
+{
+	if (blklen > MAX_XDELTA_BLOCK_BYTES || XDELTA_BLOCK_SIZE > blklen
+		|| !is_valid_hash_type (hash_type)) {
 		errno = 22;
 		return 0;
 	}
 	
 	ihx_t * pihx = new ihx_t;
 	pihx->blklen = blklen;
+	pihx->table.set_hash_type ((strong_hash_type)hash_type);
 	return (void*)pihx;
 }
 
@@ -371,48 +926,198 @@ PIPE_HANDLE xdelta_run_hash (fh_t * phole, void * inner_data)
 	return wr;
 }
 
-hit_t * xdelta_get_hashes_free_inner (void * inner_data)
+int xdelta_hash_begin (fh_t * ptgthole, void * inner_data)
+{
+	ihx_t * pihx = (ihx_t *)(inner_data);
+	if (pihx == 0 || ptgthole == 0) {
+		errno = 22;
+		return -1;
+	}
+	try {
+		clear_hash_xdelta_result (pihx);
+		pihx->hole.offset = ptgthole->pos;
+		pihx->hole.length = ptgthole->len;
+		pihx->hstream = new pipe_hasher_stream (pihx);
+		pihx->hfeeder = new hash_feeder (*pihx->hstream, pihx->blklen, pihx->hole.offset, 0
+			, pihx->table.get_hash_type ());
+	}
+	catch (xdelta_exception &e) {
+		errno = e.get_errno ();
+		return -1;
+	}
+	return 0;
+}
+
+int xdelta_hash_feed (void * inner_data, const char * data, unsigned datalen)
+{
+	ihx_t * pihx = (ihx_t *)(inner_data);
+	if (!check_feed (pihx, true, data, datalen))
+		return -1;
+	if (pihx->digest)
+		rs_mdfour_update (&pihx->md4, (const uchar_t *)data, datalen);
+	try {
+		pihx->hfeeder->feed ((const uchar_t *)data, datalen);
+	}
+	catch (xdelta_exception &e) {
+		errno = e.get_errno ();
+		return -1;
+	}
+	return 0;
+}
+
+/// \fn get_hashes_free_inner()
+/// \brief
+/// ѹϣתΪͷڲݣڵ arena з䣬arena Ϊʱ new
+static hit_t * get_hashes_free_inner (void * inner_data, node_arena<hit_t> * arena)
 {
 	ihx_t * pihx = (ihx_t *)inner_data;
 	if (pihx == 0)
 		return 0;
 		
-	clear_hash_xdelta_result (pihx);
+	if (!finish_inner (pihx))
+		return 0;
 		
-	hit_t * head = pihx->hhead;
+	hit_t * head = 0, * tail = 0;
+	for (unsigned long long i = 0; i < pihx->hashes.count; ++i) {
+		const hrec_t & rec = pihx->hashes.items[i];
+		hit_t * node = new_node (arena);
+		node->fast_hash = rec.fast_hash;
+		memcpy (node->slow_hash, rec.slow_hash, DIGEST_BYTES);
+		node->t_offset = rec.t_offset;
+		node->t_index = rec.t_index;
+		node->next = 0;
+		if (tail == 0)
+			head = node;
+		else
+			tail->next = node;
+		tail = node;
+	}
 	delete pihx;
 	
 	return head;
 }
 
+hit_t * xdelta_get_hashes_free_inner (void * inner_data)
+{
+	return get_hashes_free_inner (inner_data, 0);
+}
+
+hit_t * xdelta_get_hashes_in_chunks_free_inner (void * inner_data, void ** owner)
+{
+	if (owner == 0) {
+		errno = 22;
+		return 0;
+	}
+	node_arena<hit_t> * arena = new node_arena<hit_t>;
+	hit_t * head = get_hashes_free_inner (inner_data, arena);
+	if (head == 0) {
+		delete arena;
+		arena = 0;
+	}
+	*owner = arena;
+	return head;
+}
+
+harr_t * xdelta_get_hash_array_free_inner (void * inner_data)
+{
+	ihx_t * pihx = (ihx_t *)inner_data;
+	if (pihx == 0)
+		return 0;
+		
+	if (!finish_inner (pihx))
+		return 0;
+
+	harr_t * hashes = (harr_t *)malloc (sizeof (harr_t));
+	if (hashes != 0) {
+		hashes->count = pihx->hashes.count;
+		hashes->items = pihx->hashes.detach ();
+	}
+	delete pihx;
+	
+	return hashes;
+}
+
+void xdelta_free_hash_array (harr_t * hashes)
+{
+	if (hashes == 0)
+		return;
+	free (hashes->items);
+	free (hashes);
+}
+
 /****************************************** Xdelta *********************************/
 
 void * xdelta_start_xdelta(hit_t * head, unsigned blklen
 						, diff_func_t diffcb
 						, void * cbpriv)
 {
-	//Todo: ..
-	if (blklen > MAX_XDELTA_BLOCK_BYTES || XDELTA_BLOCK_SIZE > blklen) {
+	return xdelta_start_xdelta_ex (head, blklen, diffcb, cbpriv, XDELTA_HASH_MD4);
+}
+
+void * xdelta_start_xdelta_ex (hit_t * head, unsigned blklen
+						, diff_func_t diffcb
+						, void * cbpriv
+						, int hash_type)
+{
+	unsigned long long nr = 0;
+	for (hit_t * p = head; p != 0; p = p->next)
+		++nr;
+	return (void*)load_hash_table (list_getter (head), nr, blklen, diffcb, cbpriv, hash_type);
+}
+
+void * xdelta_start_xdelta_array (const harr_t * hashes
+						, unsigned blklen
+						, diff_func_t diffcb
+						, void * cbpriv
+						, int hash_type)
+{
+	if (hashes == 0 || (hashes->items == 0 && hashes->count > 0)) {
 		errno = 22;
 		return 0;
 	}
+	return (void*)load_hash_table (array_getter (hashes->items), hashes->count
+		, blklen, diffcb, cbpriv, hash_type);
+}
 	
-	ihx_t * pihx = new ihx_t;
-	pihx->blklen = blklen;
-	
-	for (;head != 0;head = head->next) {
-		slow_hash sh;
-		memcpy (sh.hash, head->slow_hash, DIGEST_BYTES);
-		sh.tpos.t_offset = head->t_offset;
-		sh.tpos.index = head->t_index;
-		pihx->table.add_block (head->fast_hash, sh);
+unsigned xdelta_calc_hash_len (unsigned long long filesize, unsigned blklen)
+{
+	return get_strong_hash_len (filesize, blklen);
+}
+
+int xdelta_set_hash_len (void * inner_data, unsigned hash_len)
+{
+	if (inner_data == 0 || hash_len == 0 || hash_len > DIGEST_BYTES) {
+		errno = 22;
+		return -1;
 	}
 
-	pihx->diffcb = diffcb;
-	pihx->cbpriv = cbpriv;
-	return (void*)pihx;
+	ihx_t * pihx = (ihx_t *)(inner_data);
+	pihx->table.set_hash_len (hash_len);
+	pihx->digest = hash_len < DIGEST_BYTES;
+	if (pihx->digest)
+		rs_mdfour_begin (&pihx->md4);
+	return 0;
 }
-	
+
+int xdelta_get_digest (void * inner_data, unsigned char digest[DIGEST_BYTES])
+{
+	ihx_t * pihx = (ihx_t *)(inner_data);
+	if (pihx == 0 || digest == 0 || !pihx->digest) {
+		errno = 22;
+		return -1;
+	}
+
+	// ڼĶͷڲݣ֮Ҫȡ
+	clear_hash_xdelta_result (pihx);
+	if (pihx->short_feed) {
+		errno = 22;
+		return -1;
+	}
+	rs_mdfour_t ctx = pihx->md4;
+	rs_mdfour_result (&ctx, digest);
+	return 0;
+}
+
 PIPE_HANDLE xdelta_run_xdelta (fh_t * srchole, void * inner_data)
 {
 	ihx_t * pihx = (ihx_t *)(inner_data);
@@ -436,27 +1141,141 @@ PIPE_HANDLE xdelta_run_xdelta (fh_t * srchole, void * inner_data)
 	return wr;
 }
 
-xit_t * xdelta_get_xdeltas_free_inner (void * inner_data)
+int xdelta_delta_begin (fh_t * srchole, void * inner_data)
+{
+	ihx_t * pihx = (ihx_t *)(inner_data);
+	if (pihx == 0 || srchole == 0) {
+		errno = 22;
+		return -1;
+	}
+	try {
+		clear_hash_xdelta_result (pihx);
+		pihx->hole.offset = srchole->pos;
+		pihx->hole.length = srchole->len;
+		pihx->xstream = new pipe_xdelta_stream (pihx);
+		pihx->dfeeder = new delta_feeder (*pihx->xstream, pihx->table, pihx->blklen, pihx->hole.offset);
+	}
+	catch (xdelta_exception &e) {
+		errno = e.get_errno ();
+		return -1;
+	}
+	return 0;
+}
+
+int xdelta_delta_feed (void * inner_data, const char * data, unsigned datalen)
+{
+	ihx_t * pihx = (ihx_t *)(inner_data);
+	if (!check_feed (pihx, false, data, datalen))
+		return -1;
+	if (pihx->digest)
+		rs_mdfour_update (&pihx->md4, (const uchar_t *)data, datalen);
+	try {
+		pihx->dfeeder->feed ((const uchar_t *)data, datalen);
+	}
+	catch (xdelta_exception &e) {
+		errno = e.get_errno ();
+		return -1;
+	}
+	return 0;
+}
+
+/// \fn get_xdeltas_free_inner()
+/// \brief
+/// ѲתΪͷڲݣڵ arena з䣬arena Ϊʱ new
+static xit_t * get_xdeltas_free_inner (void * inner_data, node_arena<xit_t> * arena)
 {
-	// Todo:
 	ihx_t * pihx = (ihx_t *)inner_data;
 	if (pihx == 0)
 		return 0;
 		
-	clear_hash_xdelta_result (pihx);
+	if (!finish_inner (pihx))
+		return 0;
 	
 	pihx->table.clear ();
 		
-	xit_t * head = pihx->xhead;
+	xit_t * head = 0, * tail = 0;
+	for (unsigned long long i = 0; i < pihx->xdeltas.count; ++i) {
+		const xrec_t & rec = pihx->xdeltas.items[i];
+		xit_t * node = new_node (arena);
+		node->type = rec.type;
+		node->s_offset = rec.s_offset;
+		node->t_offset = rec.t_offset;
+		node->index = rec.index;
+		node->blklen = rec.blklen;
+		node->next = 0;
+		if (tail == 0)
+			head = node;
+		else
+			tail->next = node;
+		tail = node;
+	}
 	delete pihx;
 	
 	return head;
 }
 
+xit_t * xdelta_get_xdeltas_free_inner (void * inner_data)
+{
+	return get_xdeltas_free_inner (inner_data, 0);
+}
+
+xit_t * xdelta_get_xdeltas_in_chunks_free_inner (void * inner_data, void ** owner)
+{
+	if (owner == 0) {
+		errno = 22;
+		return 0;
+	}
+	node_arena<xit_t> * arena = new node_arena<xit_t>;
+	xit_t * head = get_xdeltas_free_inner (inner_data, arena);
+	if (head == 0) {
+		delete arena;
+		arena = 0;
+	}
+	*owner = arena;
+	return head;
+}
+
+void xdelta_free_nodes (void * owner)
+{
+	delete (node_owner *)owner;
+}
+
+xarr_t * xdelta_get_xdelta_array_free_inner (void * inner_data)
+{
+	ihx_t * pihx = (ihx_t *)inner_data;
+	if (pihx == 0)
+		return 0;
+		
+	if (!finish_inner (pihx))
+		return 0;
+	
+	pihx->table.clear ();
+
+	xarr_t * xdeltas = (xarr_t *)malloc (sizeof (xarr_t));
+	if (xdeltas != 0) {
+		xdeltas->count = pihx->xdeltas.count;
+		xdeltas->items = pihx->xdeltas.detach ();
+	}
+	delete pihx;
+	
+	return xdeltas;
+}
+
+void xdelta_free_xdelta_array (xarr_t * xdeltas)
+{
+	if (xdeltas == 0)
+		return;
+	free (xdeltas->items);
+	free (xdeltas);
+}
+
 /****************************************** multiround *********************************/
 
 void xdelta_divide_hole (fh_t ** head, unsigned long long pos, unsigned len)
 {
+	if (len == 0)
+		return;
+
 	fh_t * prev = 0;
 	fh_t * tmphead = *head;
 
@@ -465,15 +1284,16 @@ void xdelta_divide_hole (fh_t ** head, unsigned long long pos, unsigned len)
 			// split to one or more hole, like this
 			// |--------------------------------------|
 			// |---------| added block |--------------|
-			fh_t * newhole = 0;
-			newhole = (fh_t *)malloc (sizeof (fh_t));
-			newhole->pos = pos + len;
-			newhole->len = (unsigned)(tmphead->pos + tmphead->len - pos - len);
-			
-			newhole->next = tmphead->next; // Ƚ
-			tmphead->next = newhole;
-			tmphead->len = (unsigned)(pos - tmphead->pos);
+			const unsigned long long end = tmphead->pos + tmphead->len;
+			if (end > pos + len) { // ұ߻ʣµĶ
+				fh_t * newhole = (fh_t *)malloc (sizeof (fh_t));
+				newhole->pos = pos + len;
+				newhole->len = end - pos - len;
+				newhole->next = tmphead->next; // Ƚ
+				tmphead->next = newhole;
+			}
 
+			tmphead->len = pos - tmphead->pos;
 			if (tmphead->len == 0) { // Ϊ0˵߽غϡ
 				if (prev == 0) {
 					*head = tmphead->next;  // ͷtmphead  head;
@@ -483,12 +1303,6 @@ void xdelta_divide_hole (fh_t ** head, unsigned long long pos, unsigned len)
 				}
 				free (tmphead);
 			}
-			
-			if (newhole->len == 0) {
-				tmphead->next = newhole->next;
-				free (newhole);
-			}
-			
 			break;
 		}
 		prev = tmphead;
@@ -511,28 +1325,254 @@ void xdelta_free_hole (fh_t * head)
 	return;
 }
 
+/// \class
+/// xdelta_holes_create ʹõĶϡҿ [offset, offset + length) offset
+/// С󱣴ƽУصڵĶͬʱڡڲ std::set<hole_t> ֿ
+/// ı read_and_delta Ƚӿڴ˳
+class hole_set
+{
+	typedef std::map<unsigned long long, unsigned long long> hole_map; // offset -> length
+	hole_map holes_;
+
+	/// ذ offset Ķûʱ end ()
+	hole_map::iterator find (const unsigned long long offset)
+	{
+		hole_map::iterator pos = holes_.upper_bound (offset);
+		if (pos == holes_.begin ())
+			return holes_.end ();
+		--pos;
+		return offset < pos->first + pos->second ? pos : holes_.end ();
+	}
+	///  pos ָĶȥ block Ĳ֣ҰûҰʱغĶblock 
+	/// ʱؼ١
+	bool split (hole_map::iterator & pos, const hole_t & block)
+	{
+		const unsigned long long offset = pos->first, end = pos->first + pos->second,
+					   blkend = block.offset + block.length;
+		if (offset > block.offset || end < blkend)
+			return false;
+
+		holes_.erase (pos++);
+		if (offset < block.offset)
+			holes_.insert (pos, std::make_pair (offset, block.offset - offset));
+		if (end > blkend)
+			pos = holes_.insert (pos, std::make_pair (blkend, end - blkend));
+		return true;
+	}
+public:
+	typedef hole_map::const_iterator const_iterator;
+	const_iterator begin () const { return holes_.begin (); }
+	const_iterator end () const { return holes_.end (); }
+	unsigned long long size () const { return holes_.size (); }
+
+	/// һеĶصʱؼ١
+	bool add (const hole_t & hole)
+	{
+		hole_map::iterator next = holes_.lower_bound (hole.offset);
+		if (next != holes_.end () && next->first < hole.offset + hole.length)
+			return false;
+		if (next != holes_.begin ()) {
+			hole_map::iterator prev = next;
+			--prev;
+			if (prev->first + prev->second > hole.offset)
+				return false;
+		}
+		holes_.insert (next, std::make_pair (hole.offset, hole.length));
+		return true;
+	}
+	/// ȥ blockһƥ飩ĶֳΪ 0 ĲO(log n)
+	/// block ĳʱؼ١
+	bool divide (const hole_t & block)
+	{
+		if (block.length == 0)
+			return true;
+		hole_map::iterator pos = find (block.offset);
+		return pos != holes_.end () && split (pos, block);
+	}
+	/// ÿ divide ͬblocks λźʱһֲĽֻҪ
+	/// ˳żһ飬һĶǸղҰ棻Ŀ²ҡ
+	bool divide (const std::vector<hole_t> & blocks)
+	{
+		hole_map::iterator pos = holes_.end ();
+		unsigned long long last = 0; // һβ
+		for (size_t i = 0; i < blocks.size (); ++i) {
+			const hole_t & block = blocks[i];
+			if (block.length == 0)
+				continue;
+
+			if (pos == holes_.end () || block.offset < last)
+				pos = find (block.offset);
+			else {
+				// мûƥĶһ߱鼯һΡ
+				while (pos != holes_.end () && pos->first + pos->second <= block.offset)
+					++pos;
+			}
+			if (pos == holes_.end () || !split (pos, block))
+				return false;
+			last = block.offset + block.length;
+		}
+		return true;
+	}
+};
+
+void * xdelta_holes_create (const fh_t * head)
+{
+	hole_set * holes = new hole_set;
+	for (; head != 0; head = head->next) {
+		if (head->len == 0)
+			continue;
+		hole_t hole;
+		hole.offset = head->pos;
+		hole.length = head->len;
+		if (!holes->add (hole)) { // еĶص
+			delete holes;
+			errno = 22;
+			return 0;
+		}
+	}
+	return (void*)holes;
+}
+
+int xdelta_holes_divide (void * holes, unsigned long long pos, unsigned len)
+{
+	if (holes == 0) {
+		errno = 22;
+		return -1;
+	}
+	hole_t hole;
+	hole.offset = pos;
+	hole.length = len;
+	if (!((hole_set *)holes)->divide (hole)) {
+		errno = 22;
+		return -1;
+	}
+	return 0;
+}
+
+static bool hole_before (const hole_t & left, const hole_t & right)
+{
+	return left.offset < right.offset;
+}
+
+/// \fn divide_ident_blocks()
+/// \brief
+///  blocks ָϣĿļеͬ鲻ǰλеģָ
+/// ԴļͬļĿļеͬһ飬ǰһصĿѾָȥ
+static int divide_ident_blocks (void * holes, std::vector<hole_t> & blocks, int which)
+{
+	if (which == XDELTA_TARGET_HOLES && !blocks.empty ()) {
+		std::sort (blocks.begin (), blocks.end (), hole_before);
+		size_t kept = 0;
+		for (size_t i = 1; i < blocks.size (); ++i) {
+			if (blocks[i].offset < blocks[kept].offset + blocks[kept].length)
+				continue;
+			blocks[++kept] = blocks[i];
+		}
+		blocks.resize (kept + 1);
+	}
+	if (!((hole_set *)holes)->divide (blocks)) {
+		errno = 22;
+		return -1;
+	}
+	return 0;
+}
+
+int xdelta_holes_divide_xdeltas (void * holes, const xit_t * head, int which)
+{
+	if (holes == 0 || (which != XDELTA_SOURCE_HOLES && which != XDELTA_TARGET_HOLES)) {
+		errno = 22;
+		return -1;
+	}
+
+	std::vector<hole_t> blocks;
+	for (; head != 0; head = head->next) {
+		if (head->type != DT_IDENT)
+			continue;
+		hole_t hole;
+		hole.offset = which == XDELTA_SOURCE_HOLES ? head->s_offset : get_target_offset ((xit_t *)head);
+		hole.length = head->blklen;
+		blocks.push_back (hole);
+	}
+	return divide_ident_blocks (holes, blocks, which);
+}
+
+int xdelta_holes_divide_array (void * holes, const xarr_t * xdeltas, int which)
+{
+	if (holes == 0 || xdeltas == 0 || (xdeltas->items == 0 && xdeltas->count > 0)
+		|| (which != XDELTA_SOURCE_HOLES && which != XDELTA_TARGET_HOLES)) {
+		errno = 22;
+		return -1;
+	}
+
+	std::vector<hole_t> blocks;
+	for (unsigned long long i = 0; i < xdeltas->count; ++i) {
+		const xrec_t * rec = &xdeltas->items[i];
+		if (rec->type != DT_IDENT)
+			continue;
+		hole_t hole;
+		hole.offset = which == XDELTA_SOURCE_HOLES ? rec->s_offset : get_record_target_offset (rec);
+		hole.length = rec->blklen;
+		blocks.push_back (hole);
+	}
+	return divide_ident_blocks (holes, blocks, which);
+}
+
+unsigned long long xdelta_holes_count (void * holes)
+{
+	return holes == 0 ? 0 : ((hole_set *)holes)->size ();
+}
+
+fh_t * xdelta_holes_export (void * holes)
+{
+	if (holes == 0)
+		return 0;
+
+	fh_t * head = 0, * tail = 0;
+	const hole_set & holeset = *(hole_set *)holes;
+	for (hole_set::const_iterator it = holeset.begin (); it != holeset.end (); ++it) {
+		fh_t * node = (fh_t *)malloc (sizeof (fh_t));
+		if (node == 0) {
+			xdelta_free_hole (head);
+			return 0;
+		}
+		node->pos = it->first;
+		node->len = it->second;
+		node->next = 0;
+		if (tail == 0)
+			head = node;
+		else
+			tail->next = node;
+		tail = node;
+	}
+	return head;
+}
+
+void xdelta_holes_free (void * holes)
+{
+	delete (hole_set *)holes;
+}
+
 void xdelta_resolve_inplace (xit_t ** head)
+{
+	xdelta_resolve_inplace_ex (head, XDELTA_INPLACE_FAST);
+}
+
+void xdelta_resolve_inplace_ex (xit_t ** head, int policy)
 {
 	if (*head == 0)
 		return;
 		
-	std::set<equal_node *> enode_set;
-	std::list<equal_node*> ident_blocks, result_ident_blocks;
-	typedef std::list<equal_node*>::iterator it_t;
-
+	std::vector<equal_node> nodes;
 	xit_t * diffhead = 0, * diffprev = 0; // 
 	for (xit_t * node = *head; node != 0; node = node->next) {
 		if (node->type == DT_IDENT) {
-			equal_node * p = new equal_node ();
-			p->blength = node->blklen;
-			p->s_offset = node->s_offset;
-			p->visited = FALSE;
-			p->stacked = FALSE;
-			p->deleted = FALSE;
-			p->tpos.t_offset = node->t_offset;
-			p->tpos.index = node->index;
-			p->data = (void*)node;
-			ident_blocks.push_back (p);
+			equal_node p;
+			p.s_offset = node->s_offset;
+			p.t_offset = get_target_offset (node);
+			p.item = node;
+			p.blength = node->blklen;
+			p.state = NODE_NEW;
+			nodes.push_back (p);
 		}
 		else {
 			if (diffhead == 0)
@@ -547,17 +1587,14 @@ void xdelta_resolve_inplace (xit_t ** head)
 	if (diffprev)
 		diffprev->next = 0;
 
-	std::copy (ident_blocks.begin (), ident_blocks.end ()
-				, std::inserter (enode_set, enode_set.end ()));
-					
-	for (it_t pos = ident_blocks.begin (); pos != ident_blocks.end (); ++pos)
-		xdelta::resolve_inplace_identical_block (enode_set, *pos, result_ident_blocks);
-		
-	for (it_t pos = ident_blocks.begin (); pos != ident_blocks.end (); ++pos) {
-		 // Ѿ diff_blocks УЩͷ
-		 // Щû˳
-		if ((*pos)->deleted == TRUE) {
-			xit_t * p = (xit_t *)((*pos)->data);
+	std::vector<uint32_t> order;
+	order.reserve (nodes.size ());
+	resolve_inplace_order (nodes, order, policy);
+
+	// ѭɾĿΪݣڲͷЩû˳
+	for (size_t i = 0; i < nodes.size (); ++i) {
+		if (nodes[i].state == NODE_DELETED) {
+			xit_t * p = nodes[i].item;
 			p->type = DT_DIFF;
 			p->next = diffhead;
 			diffhead = p;
@@ -569,18 +1606,65 @@ void xdelta_resolve_inplace (xit_t ** head)
 	// ͷҪĿ飬ȥҪӺ洦𣬴ͷ
 	// ʱպҪͬĿ顣Щϸ˳
 	//
-	typedef std::list<equal_node*>::reverse_iterator rit_t;
-	for (rit_t pos = result_ident_blocks.rbegin (); pos != result_ident_blocks.rend (); ++pos) {
-		xit_t * p = (xit_t *)((*pos)->data);
+	for (size_t i = order.size (); i > 0; --i) {
+		xit_t * p = nodes[order[i - 1]].item;
 		p->next = diffhead;
 		diffhead = p;
 	}
 	
 	*head = diffhead;
-	std::for_each (ident_blocks.begin (), ident_blocks.end (), delete_obj<equal_node>);
 	return;
 }
 
+int xdelta_apply (const xit_t * head, const char * tgtfile, const char * srcfile
+				, const char * outfile, unsigned long long filesize)
+{
+	return xdelta_apply_ex (head, tgtfile, srcfile, outfile, filesize, 0, 0);
+}
+
+int xdelta_apply_ex (const xit_t * head, const char * tgtfile, const char * srcfile
+				, const char * outfile, unsigned long long filesize, int flags, xast_t * stat)
+{
+	if (tgtfile == 0) {
+		errno = 22;
+		return -1;
+	}
+
+	xast_t local_stat;
+	if (stat == 0)
+		stat = &local_stat;
+	memset (stat, 0, sizeof (xast_t));
+
+	try {
+		const bool inplace = outfile == 0;
+		std::vector<apply_run> runs;
+		collect_runs (head, !inplace, runs);
+
+		f_local_freader tgt (tgtfile);
+		((file_reader &)tgt).open_file ();
+
+		f_local_freader src (srcfile != 0 ? srcfile : tgtfile);
+		file_reader * psrc = 0;
+		if (srcfile != 0) {
+			psrc = &src;
+			psrc->open_file ();
+		}
+
+		f_local_fwriter out (inplace ? tgtfile : outfile);
+		file_writer * pout = &out;
+		pout->open_file ();
+
+		const bool kernel = !inplace && (flags & XDELTA_APPLY_KERNEL_COPY) != 0;
+		apply_runs (runs, tgt, psrc, out, inplace, kernel, *stat);
+		pout->set_file_size (filesize);
+	}
+	catch (xdelta_exception &e) {
+		errno = e.get_errno () != 0 ? e.get_errno () : 22;
+		return -1;
+	}
+	return 0;
+}
+
 unsigned xdelta_calc_block_len (unsigned long long filesize)
 {
 	return get_xdelta_block_size (filesize);
@@ -76,14 +76,19 @@ extern "C"
 
 	#define DT_DIFF		((unsigned short)0x0)
 	#define DT_IDENT	((unsigned short)0xffff)
+	#define DT_ZERO		((unsigned short)0x1)
 	/**
-	 *		ΪDT_DIFF,DT_IDENT
+	 *		ΪDT_DIFF,DT_IDENT,DT_ZERO
 	 *			DT_DIFFʾӦݿǲģΪݵĳȡڹļʱ
 	 *					 ӦôԴļ**Դʼλ**ʼȡָȵݣд
 	 *					 ʱļ **Դʼλ** 
 	 *			DT_IDENTʾӦݿͬģʼλü¼ͳһΪʱʹõĿ鳤ȡ
 	 *					 ڹļʱӦôӼԭʼϣֵļĿļ**ʼλ** жȡ,
 	 *					 дʱļ **Դʼλ**
+	 *			DT_ZEROʾԴļӦȫ 0ϡļûзռĲ֣Ϊݵĳȡ
+	 *					 ڹļʱҪȡݣʱļ **Դʼλ** 
+	 *					 fallocate  FALLOC_FL_PUNCH_HOLEչļftruncateɣļȻϡġ
+	 *					 ֻмݿԱնʱŻ֣ӹܵʱ֡
 	 */
 	typedef struct xdelta_item
 	{
@@ -98,7 +103,63 @@ extern "C"
 
 	inline unsigned long long get_target_offset (xit_t * head)
 	{
-		return head->t_offset + head->blklen * head->index;
+		return head->t_offset + (unsigned long long)head->blklen * head->index;
+	}
+
+	/**
+	 * ŵĽÿһҪ估ͷţܶࣨʱ䡢ͷŶ
+	 * ʱӿڣһη顣ÿȻУм估ĩβûֽڣ
+	 * ƽ̨ϵĲͬͬһֽĻֱ֮дļ磺
+	 *
+	 *	hrec_t40 ֽڣ
+	 *		0	check_hash	8 ֽ
+	 *		8	t_offset	8 ֽ
+	 *		16	fast_hash	4 ֽ
+	 *		20	t_index		4 ֽ
+	 *		24	slow_hash	16 ֽ
+	 *
+	 *	xrec_t32 ֽڣ
+	 *		0	s_offset	8 ֽ
+	 *		8	t_offset	8 ֽ
+	 *		16	index		4 ֽ
+	 *		20	blklen		4 ֽ
+	 *		24	type		2 ֽ
+	 *		26	reserved	6 ֽڣΪ 0
+	 *
+	 * ֶε hit_t  xit_t ֶͬͬcheck_hash  hit_t ûе 64 λУ Hash
+	 * xdelta_start_xdelta_array ʱ Hash кȱȽͬʱż Hashӿû
+	 * ֶΣxdelta_start_xdelta(_ex) ȽУ Hash
+	 */
+	typedef struct hash_record {
+		unsigned long long check_hash;
+		unsigned long long t_offset;
+		unsigned fast_hash;
+		unsigned t_index;
+		unsigned char slow_hash[DIGEST_BYTES];
+	}hrec_t;
+
+	typedef struct xdelta_record {
+		unsigned long long s_offset;
+		unsigned long long t_offset;
+		unsigned index;
+		unsigned blklen;
+		unsigned short type;
+		unsigned short reserved[3];
+	}xrec_t;
+
+	typedef struct hash_array {
+		hrec_t * items;			// ˳ŵĽcount Ϊ 0 ʱΪָ롣
+		unsigned long long count;
+	}harr_t;
+
+	typedef struct xdelta_array {
+		xrec_t * items;			// ԴļеλôŵĽcount Ϊ 0 ʱΪָ롣
+		unsigned long long count;
+	}xarr_t;
+
+	inline unsigned long long get_record_target_offset (const xrec_t * rec)
+	{
+		return rec->t_offset + (unsigned long long)rec->blklen * rec->index;
 	}
 	
 	/**
@@ -118,6 +179,20 @@ extern "C"
 	 *				СֵΧʱ᷵һָ롣ʹӦü鷵ִֵС
 	 */
 	DLL_EXPORT void * xdelta_start_hash (unsigned blklen);
+
+	/**
+	 * ϣ㷨ϣ˱ʹͬһ㷨
+	 *	XDELTA_HASH_MD4MD4xdelta_start_hash  xdelta_start_xdelta ʹõ㷨
+	 *	XDELTA_HASH_MURMUR3MurmurHash3 x64 128 λǼܹϣ MD4 
+	 */
+	#define XDELTA_HASH_MD4		0
+	#define XDELTA_HASH_MURMUR3	1
+
+	/**
+	 *  xdelta_start_hash ͬ hash_type ָϣ㷨
+	 * @hash_type	XDELTA_HASH_MD4  XDELTA_HASH_MURMUR3Ч㷨᷵ؿָ롣
+	 */
+	DLL_EXPORT void * xdelta_start_hash_ex (unsigned blklen, int hash_type);
 	/**
 	 * ʹ½ӿڼָĿ HASH ֵ
 	 *
@@ -127,6 +202,27 @@ extern "C"
 	 *				ö뱣֤붴һһӦϵݴ󣬻δΪ
 	 */
 	DLL_EXPORT PIPE_HANDLE xdelta_run_hash (fh_t * ptgthole, void * inner_data);
+
+	/**
+	 *  xdelta_run_hash ͬụ̀ܵ߳ʼһĹϣ֮ɵԼ߳
+	 *  xdelta_hash_feed δݡһ xdelta_hash_beginxdelta_run_hash 
+	 * xdelta_get_hashes_free_inner 
+	 * @ptgthole	 ĹϣĸĿļ
+	 * @inner_data	 ڲݣ xdelta_start_hash(_ex) 
+	 * @return		ɹ 0ʧܷ -1 errno
+	 */
+	DLL_EXPORT int xdelta_hash_begin (fh_t * ptgthole, void * inner_data);
+
+	/**
+	 *  xdelta_hash_begin ʼĶݣֱڵ߳мڴеݣֻ
+	 * ԽεõĿ顣ݿԷδ룬ܳȱڶĳȣʱʧܣ
+	 * ʱԺ xdelta_get_hashes_free_inner ȡĽӿڷؿָ롣
+	 * @inner_data	 ڲݣ xdelta_start_hash(_ex) 
+	 * @data		һδݡ
+	 * @datalen		ݳȡ
+	 * @return		ɹ 0ʧܣ糬ĳȣ -1 errno
+	 */
+	DLL_EXPORT int xdelta_hash_feed (void * inner_data, const char * data, unsigned datalen);
 	
 	/**
 	 * ȡһ xdelta_calc_hash ִѭִн
@@ -142,6 +238,25 @@ extern "C"
 	 *					 Ӧͷ
 	 */
 	DLL_EXPORT void xdelta_free_hashes (hit_t * head);
+
+	/**
+	 *  xdelta_get_hashes_free_inner ͬĽڵǷֿģмʱ估ͷŵ
+	 * ֻȡճ𿪻ţڵ㲻 xdelta_free_hashes 
+	 * delete ͷţ xdelta_free_nodes (*owner) һͷеĽڵ㡣
+	 * @owner			ڵߣؿָʱҲΪա
+	 */
+	DLL_EXPORT hit_t * xdelta_get_hashes_in_chunks_free_inner (void * inner_data, void ** owner);
+
+	/**
+	 *  xdelta_get_hashes_free_inner ͬһ顣
+	 * @inner_data	 	ڲݣڽӿڷغȫͷš
+	 * @return			ϣ飬 xdelta_free_hash_array ͷšڴ治ʱؿָ롣
+	 */
+	DLL_EXPORT harr_t * xdelta_get_hash_array_free_inner (void * inner_data);
+	/**
+	 * ͷ xdelta_get_hash_array_free_inner صĹϣ顣
+	 */
+	DLL_EXPORT void xdelta_free_hash_array (harr_t * hashes);
 	
 	/**
 	 * ĺڷʱͨصķʽݡʹ֮ǰϸ
@@ -217,6 +332,58 @@ extern "C"
 										, unsigned blklen
 										, diff_func_t diffcb
 										, void * cbpriv);
+
+	/**
+	 *  xdelta_start_xdelta ͬ hash_type ָϣ㷨 head ʱ
+	 *  xdelta_start_hash_ex ĲͬЧ㷨᷵ؿָ롣
+	 */
+	DLL_EXPORT void * xdelta_start_xdelta_ex (hit_t * head
+										, unsigned blklen
+										, diff_func_t diffcb
+										, void * cbpriv
+										, int hash_type);
+
+	/**
+	 *  xdelta_start_xdelta_ex ͬϣ xdelta_get_hash_array_free_inner ص飨Ҳ
+	 * Ǵļ飩֪ϣһηװ룬ȱ
+	 * @hashes		ϣ飬ӿڷغ߿ͷš
+	 */
+	DLL_EXPORT void * xdelta_start_xdelta_array (const harr_t * hashes
+										, unsigned blklen
+										, diff_func_t diffcb
+										, void * cbpriv
+										, int hash_type);
+
+	/**
+	 * ļС鳤ÿҪϣֽ rsync ͬ 4  16 ֮䡣
+	 * ضϣԼٹϣʱϣռõڴ棬ײĻ
+	 * ӣԼɺȽļժҪ xdelta_get_digestͬʱȵϣ¼㡣
+	 * @filesize	ĿļĴС
+	 * @blklen		鳤ȡ
+	 */
+	DLL_EXPORT unsigned xdelta_calc_hash_len (unsigned long long filesize, unsigned blklen);
+
+	/**
+	 * ϣֽ˱ֵͬinner_data  xdelta_start_hash(_ex) ʱ
+	 *  hit_t::slow_hash ֻǰ hash_len ֽЧΪ 0 xdelta_start_xdelta(_ex)
+	 * ʱϣֻ沢Ƚǰ hash_len ֽڡhash_len С 16 ʱ㴫ݵժҪ
+	 *  xdelta_get_digestҪڴ֮ǰá
+	 * @inner_data	xdelta_start_hash(_ex)  xdelta_start_xdelta(_ex) صڲݡ
+	 * @hash_len	1  16 ֮䣬16 ض̡
+	 * @return		ɹ 0Чʱ -1 errno
+	 */
+	DLL_EXPORT int xdelta_set_hash_len (void * inner_data, unsigned hash_len);
+
+	/**
+	 * ȡýضϣ󣨼 xdelta_set_hash_lenݰ˳ MD4׼ MD4
+	 *  rsync ּͬʱļժҪһժҪļժҪ
+	 * ļһɵļ MD4 Ƚϣͬʱȵϣ¼㡣
+	 * Ҫ xdelta_get_*_free_inner ֮ǰãڼĶ֮Ȼȡ
+	 * @inner_data	xdelta_start_hash(_ex)  xdelta_start_xdelta(_ex) صڲݡ
+	 * @digest		 16 ֽڵժҪ
+	 * @return		ɹ 0ûнضϣжݲ߲Чʱ -1 errno
+	 */
+	DLL_EXPORT int xdelta_get_digest (void * inner_data, unsigned char digest[DIGEST_BYTES]);
 	
 	/**
 	 * ȷִ xdelta_start_xdelta 󣬵ñӿڡӿִвݼ㡣
@@ -229,6 +396,29 @@ extern "C"
 	 */
 	DLL_EXPORT PIPE_HANDLE xdelta_run_xdelta (fh_t * srchole, void * inner_data);
 
+	/**
+	 *  xdelta_run_xdelta ͬụ̀ܵ߳ʼһĲݣ֮ɵԼ
+	 * ߳е xdelta_delta_feed δݣdiffcb Ҳ߳еãһ
+	 * xdelta_delta_beginxdelta_run_xdelta  xdelta_get_xdeltas_free_inner 
+	 * ʣµĲݡ
+	 * @srchole		ԴļĶ
+	 * @inner_data	ڲݣ xdelta_start_xdelta(_ex) 
+	 * @return		ɹ 0ʧܷ -1 errno
+	 */
+	DLL_EXPORT int xdelta_delta_begin (fh_t * srchole, void * inner_data);
+
+	/**
+	 *  xdelta_delta_begin ʼĶݣֱڵߵڴм㣬ֻƿԽεõ
+	 * ڡݿԷδ룬ܳȱڶĳȣʱʧܣʱ
+	 * Ժ xdelta_get_xdeltas_free_inner ȡĽӿڷؿָ롣ÿδݺʱݻ
+	 * ȺϲԲзֿ xdelta_run_xdelta ͬͬȫͬ
+	 * @inner_data	ڲݣ xdelta_start_xdelta(_ex) 
+	 * @data		һδݡ
+	 * @datalen		ݳȡ
+	 * @return		ɹ 0ʧܣ糬ĳȣ -1 errno
+	 */
+	DLL_EXPORT int xdelta_delta_feed (void * inner_data, const char * data, unsigned datalen);
+
 	/**
 	 * ȡһ xdelta_run_xdelta ִѭִн
 	 * @inner_data	 	ڲݣʱ calc_hash ڽӿڷغȫͷţ߲ʹ
@@ -243,6 +433,28 @@ extern "C"
 	 *					 Ӧͷ
 	 */
 	DLL_EXPORT void xdelta_free_xdeltas (xit_t * head);
+
+	/**
+	 *  xdelta_get_xdeltas_free_inner ͬڵǷֿģ xdelta_get_hashes_in_chunks_free_inner
+	 *  xdelta_free_nodes (*owner) ͷš
+	 */
+	DLL_EXPORT xit_t * xdelta_get_xdeltas_in_chunks_free_inner (void * inner_data, void ** owner);
+	/**
+	 * ͷ xdelta_get_hashes_in_chunks_free_inner  xdelta_get_xdeltas_in_chunks_free_inner
+	 *  owner енڵ㣬֮Щʹá
+	 */
+	DLL_EXPORT void xdelta_free_nodes (void * owner);
+
+	/**
+	 *  xdelta_get_xdeltas_free_inner ͬһ顣
+	 * @inner_data	 	ڲݣڽӿڷغȫͷš
+	 * @return			飬 xdelta_free_xdelta_array ͷšڴ治ʱؿָ롣
+	 */
+	DLL_EXPORT xarr_t * xdelta_get_xdelta_array_free_inner (void * inner_data);
+	/**
+	 * ͷ xdelta_get_xdelta_array_free_inner صĲ顣
+	 */
+	DLL_EXPORT void xdelta_free_xdelta_array (xarr_t * xdeltas);
 	
 	
 	/********************************************* API ָ *********************************************************/
@@ -326,6 +538,65 @@ extern "C"
 	 * @head ͷ
 	 */
 	DLL_EXPORT void xdelta_free_hole (fh_t * head);
+
+	/**
+	 * ϡxdelta_divide_hole ÿָһ鶼Ҫͷʼңּжͬ鶼ܶʱ
+	 *  O(  )ƽ涴ָһ O(log n)һֵĲλź
+	 * ָʱֻҪ˳żһ顣ʱ xdelta_holes_export  fh_t 
+	 * αе xdelta_divide_hole ѭԻɣ
+	 *
+	 *			srcholes = xdelta_holes_create (srchole);
+	 *			tgtholes = xdelta_holes_create (tgthole);
+	 *			...
+	 *			xdelta_holes_divide_xdeltas (tgtholes, xdelta_result, XDELTA_TARGET_HOLES);
+	 *			xdelta_holes_divide_xdeltas (srcholes, xdelta_result, XDELTA_SOURCE_HOLES);
+	 *			srchole = xdelta_holes_export (srcholes); // һֱã xdelta_free_hole ͷš
+	 */
+	#define XDELTA_SOURCE_HOLES	0	// ͬԴļеλãs_offsetָ
+	#define XDELTA_TARGET_HOLES	1	// ͬĿļеλãget_target_offsetָ
+
+	/**
+	 *  fh_t ɶϡ
+	 * @head		Ϊգռϣ֮䲻صᱻ޸ģȻҪԼͷš
+	 * @return		ϣ xdelta_holes_free ͷšصʱؿָ룬 errno
+	 */
+	DLL_EXPORT void * xdelta_holes_create (const fh_t * head);
+
+	/**
+	 *  xdelta_divide_hole ͬӼзָ (pos, pos + len) Ŀ顣
+	 * @return		ɹ 0鲻κһʱ -1 errno
+	 */
+	DLL_EXPORT int xdelta_holes_divide (void * holes, unsigned long long pos, unsigned len);
+
+	/**
+	 * е DT_IDENT ָϣDT_DIFF  DT_ZERO Ŀԡ
+	 * XDELTA_TARGET_HOLES ʱĿļͬһ飨ǰĿصָֻһΡ
+	 * @head		xdelta_get_xdeltas_free_inner صĽ
+	 * @which		XDELTA_SOURCE_HOLES  XDELTA_TARGET_HOLES
+	 * @return		ɹ 0ʧܷ -1 errnoʧʱеĶѾָһ֡
+	 */
+	DLL_EXPORT int xdelta_holes_divide_xdeltas (void * holes, const xit_t * head, int which);
+
+	/**
+	 *  xdelta_holes_divide_xdeltas ͬ xdelta_get_xdelta_array_free_inner ص顣
+	 */
+	DLL_EXPORT int xdelta_holes_divide_array (void * holes, const xarr_t * xdeltas, int which);
+
+	/**
+	 * ؼжĸ
+	 */
+	DLL_EXPORT unsigned long long xdelta_holes_count (void * holes);
+
+	/**
+	 * λ˳򵼳еĶ
+	 * @return		malloc 䣩 xdelta_free_hole ͷšΪջڴ治ʱؿָ롣
+	 */
+	DLL_EXPORT fh_t * xdelta_holes_export (void * holes);
+
+	/**
+	 * ͷŶϡ
+	 */
+	DLL_EXPORT void xdelta_holes_free (void * holes);
 	 
 	/********************************************* API ָ *********************************************************/
 	/**
@@ -343,12 +614,74 @@ extern "C"
 	 *				for (item in head list) {
 	 *					if (link.item.type == DT_IDENT)
 	 *						continue;
+	 *					if (link.item.type == DT_ZERO) {
+	 *						punch_hole (tmpfile, link.item.s_offset, link.item.len);
+	 *						continue;
+	 *					}
 	 *					data = copy_from (srcfile);
 	 *					seek (tmpfile, link.item.s_offset);
 	 *					write (tmpfile, data, link.item.len);
 	 *				}
 	 */
 	DLL_EXPORT void xdelta_resolve_inplace (xit_t ** head);
+
+	/**
+	 * ѭʱΪݵĿѡԣ
+	 *	XDELTA_INPLACE_FASTѭʱɾʱʵĿ飬ĳȣ xdelta_resolve_inplace ͬ
+	 *	XDELTA_INPLACE_MIN_COSTɾѭ̵Ŀ飬ͬʱɾĿ飨ͬʱڶѭУ
+	 *		 Rasch/Burns е locally-minimum ԣư鳤ȨС㼯ĳȲͬ
+	 *		ֵĽͬ齻صƽƣʱҪĲͨһЩҪ
+	 *		δͬһ顣
+	 */
+	#define XDELTA_INPLACE_FAST		0
+	#define XDELTA_INPLACE_MIN_COST	1
+
+	/**
+	 *  xdelta_resolve_inplace ͬ policy ָѭĲԡ
+	 * @head			xdelta ıͷ
+	 * @policy			XDELTA_INPLACE_FAST  XDELTA_INPLACE_MIN_COSTֵ XDELTA_INPLACE_FAST ͬ
+	 */
+	DLL_EXPORT void xdelta_resolve_inplace_ex (xit_t ** head, int policy);
+
+	/********************************************* API ָ *********************************************************/
+	/**
+	 *  xdelta ļ seekreadwrite Ĺ̡ļʱȰдλ
+	 * дλڣͬĶȡλҲڣϲһΣһζȡдλڵܵ 4MB
+	 * Ļһд룬λöдpread/pwriteƶļָ롣͵ʱ˳ִУ
+	 * ֻϲǰڵDT_ZERO ɵļд򶴣ִ֧ʱд 0
+	 *
+	 * @head		xdelta ͵ʱ xdelta_resolve_inplace Ľ
+	 * @tgtfile		Ŀļϣļȡ DT_IDENT ݡ
+	 * @srcfile		ļ s_offset ȡ DT_DIFF ݣԴļҲǰλôյ
+	 *				Ĳݵļû DT_DIFF ʱΪա
+	 * @outfile		ɵļʱΪʱ͵޸ tgtfile
+	 * @filesize	ɵļĴСԴļĴСضϻչļ
+	 * @return		ɹ 0ʧܷ -1 errnoʱɵļݲȷ
+	 */
+	DLL_EXPORT int xdelta_apply (const xit_t * head, const char * tgtfile, const char * srcfile
+								, const char * outfile, unsigned long long filesize);
+
+	/**
+	 * xdelta_apply_ex ѡ
+	 *	XDELTA_APPLY_KERNEL_COPYļʱͬĶΣϲںиƣûռ䡣λö
+	 *		ļϵͳʱ FICLONERANGEbtrfsXFS Ϲݿ飬ݣ copy_file_range
+	 *		ֻ Linux ֧֣֧֣ļϵͳϵںˣʱ xdelta_apply ķʽд͵ʱá
+	 */
+	#define XDELTA_APPLY_KERNEL_COPY	0x1
+
+	typedef struct xdelta_apply_stat {
+		unsigned long long clone_bytes;		//  FICLONERANGE ݿֽ
+		unsigned long long kernel_bytes;	//  copy_file_range ںиƵֽ
+		unsigned long long user_bytes;		// ûռдֽDT_DIFF ûںиƵ DT_IDENT
+	}xast_t;
+
+	/**
+	 *  xdelta_apply ָͬѡͳơ
+	 * @flags		0  XDELTA_APPLY_KERNEL_COPY
+	 * @stat		ظַʽƵֽΪա
+	 */
+	DLL_EXPORT int xdelta_apply_ex (const xit_t * head, const char * tgtfile, const char * srcfile
+								, const char * outfile, unsigned long long filesize, int flags, xast_t * stat);
 	
 #ifdef __cplusplus
 }
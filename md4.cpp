@@ -43,6 +43,7 @@
 
 #include <string>
 #include <set>
+#include <vector>
 #include <algorithm>
 
 #ifdef _WIN32
@@ -71,6 +72,20 @@
 #include "buffer.h"
 #include "xdeltalib.h"
 
+#ifdef XDELTA_X86
+/* GCC 12's avx512fintrin.h self-initialises its "undefined" vectors and
+ * warns about them in every AVX-512 kernel that gets inlined. */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
 namespace xdelta {
 
 #define F(X,Y,Z) (((X)&(Y)) | ((~(X))&(Z)))
@@ -407,5 +422,378 @@ rs_mdfour(uchar_t *out, void const *in, size_t n)
     rs_mdfour_result(&md, out);
 }
 
+
+/*
+ * Multi-buffer MD4.
+ *
+ * Signature blocks are independent and all of the same length, so we can
+ * run one block per 32-bit lane of a SIMD register: 4 with SSE2, 8 with
+ * AVX2 and 16 with AVX-512.  Each lane does exactly what rs_mdfour does,
+ * including the padding, so the digests are byte-identical.  The message
+ * words of the lanes are brought into the lanes with 4x4 transposes of
+ * 16-byte loads.
+ */
+#define MD4_STEPS(R1, R2, R3)                                           \
+    R1(A, B, C, D, 0, 3);   R1(D, A, B, C, 1, 7);                       \
+    R1(C, D, A, B, 2, 11);  R1(B, C, D, A, 3, 19);                      \
+    R1(A, B, C, D, 4, 3);   R1(D, A, B, C, 5, 7);                       \
+    R1(C, D, A, B, 6, 11);  R1(B, C, D, A, 7, 19);                      \
+    R1(A, B, C, D, 8, 3);   R1(D, A, B, C, 9, 7);                       \
+    R1(C, D, A, B, 10, 11); R1(B, C, D, A, 11, 19);                     \
+    R1(A, B, C, D, 12, 3);  R1(D, A, B, C, 13, 7);                      \
+    R1(C, D, A, B, 14, 11); R1(B, C, D, A, 15, 19);                     \
+    R2(A, B, C, D, 0, 3);   R2(D, A, B, C, 4, 5);                       \
+    R2(C, D, A, B, 8, 9);   R2(B, C, D, A, 12, 13);                     \
+    R2(A, B, C, D, 1, 3);   R2(D, A, B, C, 5, 5);                       \
+    R2(C, D, A, B, 9, 9);   R2(B, C, D, A, 13, 13);                     \
+    R2(A, B, C, D, 2, 3);   R2(D, A, B, C, 6, 5);                       \
+    R2(C, D, A, B, 10, 9);  R2(B, C, D, A, 14, 13);                     \
+    R2(A, B, C, D, 3, 3);   R2(D, A, B, C, 7, 5);                       \
+    R2(C, D, A, B, 11, 9);  R2(B, C, D, A, 15, 13);                     \
+    R3(A, B, C, D, 0, 3);   R3(D, A, B, C, 8, 9);                       \
+    R3(C, D, A, B, 4, 11);  R3(B, C, D, A, 12, 15);                     \
+    R3(A, B, C, D, 2, 3);   R3(D, A, B, C, 10, 9);                      \
+    R3(C, D, A, B, 6, 11);  R3(B, C, D, A, 14, 15);                     \
+    R3(A, B, C, D, 1, 3);   R3(D, A, B, C, 9, 9);                       \
+    R3(C, D, A, B, 5, 11);  R3(B, C, D, A, 13, 15);                     \
+    R3(A, B, C, D, 3, 3);   R3(D, A, B, C, 11, 9);                      \
+    R3(C, D, A, B, 7, 11);  R3(B, C, D, A, 15, 15);
+
+/**
+ * Build the padded last chunk(s) of a message of \p bytes bytes, the same
+ * padding rs_mdfour_tail adds.  \p tail must hold 128 bytes.
+ *
+ * \return the number of 64-byte chunks in \p tail, 1 or 2.
+ */
+static int
+md4_pad_tail(uchar_t *tail, const uchar_t *in, size_t bytes)
+{
+    size_t          full = bytes & ~(size_t) 63;
+    size_t          rest = bytes - full;
+    int             chunks = rest < 56 ? 1 : 2;
+    uint64_t        bits = (uint64_t) bytes << 3;
+
+    memcpy(tail, in + full, rest);
+    tail[rest] = 0x80;
+    memset(tail + rest + 1, 0, chunks * 64 - 8 - rest - 1);
+    copy4(tail + chunks * 64 - 8, (uint32_t) bits);
+    copy4(tail + chunks * 64 - 4, (uint32_t) (bits >> 32));
+    return chunks;
+}
+
+#ifdef XDELTA_X86
+
+#define V4_F(b,c,d) _mm_xor_si128(d, _mm_and_si128(b, _mm_xor_si128(c, d)))
+#define V4_G(b,c,d) _mm_or_si128(_mm_and_si128(b, c), _mm_and_si128(d, _mm_or_si128(b, c)))
+#define V4_H(b,c,d) _mm_xor_si128(_mm_xor_si128(b, c), d)
+#define V4_ROT(x,s) _mm_or_si128(_mm_slli_epi32(x, s), _mm_srli_epi32(x, 32 - (s)))
+#define V4_R1(a,b,c,d,k,s) a = V4_ROT(_mm_add_epi32(_mm_add_epi32(a, V4_F(b,c,d)), X[k]), s)
+#define V4_R2(a,b,c,d,k,s) a = V4_ROT(_mm_add_epi32(_mm_add_epi32(a, V4_G(b,c,d)), _mm_add_epi32(X[k], K2)), s)
+#define V4_R3(a,b,c,d,k,s) a = V4_ROT(_mm_add_epi32(_mm_add_epi32(a, V4_H(b,c,d)), _mm_add_epi32(X[k], K3)), s)
+
+XDELTA_TARGET("sse2")
+static inline void
+md4_x4_chunk(__m128i *st, const uchar_t * const *p, size_t off)
+{
+    const __m128i   K2 = _mm_set1_epi32(0x5A827999);
+    const __m128i   K3 = _mm_set1_epi32(0x6ED9EBA1);
+    __m128i         X[16];
+
+    for (int q = 0; q < 4; ++q) {
+        __m128i r0 = _mm_loadu_si128((const __m128i *) (p[0] + off + q * 16));
+        __m128i r1 = _mm_loadu_si128((const __m128i *) (p[1] + off + q * 16));
+        __m128i r2 = _mm_loadu_si128((const __m128i *) (p[2] + off + q * 16));
+        __m128i r3 = _mm_loadu_si128((const __m128i *) (p[3] + off + q * 16));
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+        __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+        __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+        __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+        X[q * 4 + 0] = _mm_unpacklo_epi64(t0, t1);
+        X[q * 4 + 1] = _mm_unpackhi_epi64(t0, t1);
+        X[q * 4 + 2] = _mm_unpacklo_epi64(t2, t3);
+        X[q * 4 + 3] = _mm_unpackhi_epi64(t2, t3);
+    }
+
+    __m128i A = st[0], B = st[1], C = st[2], D = st[3];
+    MD4_STEPS(V4_R1, V4_R2, V4_R3)
+    st[0] = _mm_add_epi32(st[0], A);
+    st[1] = _mm_add_epi32(st[1], B);
+    st[2] = _mm_add_epi32(st[2], C);
+    st[3] = _mm_add_epi32(st[3], D);
+}
+
+XDELTA_TARGET("sse2")
+void
+rs_mdfour_x4(uchar_t *out, const uchar_t * const *in, size_t bytes)
+{
+    __m128i         st[4];
+    uchar_t         tail[4][128];
+    const uchar_t  *tp[4];
+    uint32_t        words[4][4];
+    size_t          full = bytes & ~(size_t) 63;
+    int             chunks = 0;
+
+    st[0] = _mm_set1_epi32(0x67452301);
+    st[1] = _mm_set1_epi32((int) 0xefcdab89);
+    st[2] = _mm_set1_epi32((int) 0x98badcfe);
+    st[3] = _mm_set1_epi32(0x10325476);
+    for (int j = 0; j < 4; ++j) {
+        chunks = md4_pad_tail(tail[j], in[j], bytes);
+        tp[j] = tail[j];
+    }
+
+    for (size_t off = 0; off < full; off += 64)
+        md4_x4_chunk(st, in, off);
+    for (int c = 0; c < chunks; ++c)
+        md4_x4_chunk(st, tp, c * 64);
+
+    for (int w = 0; w < 4; ++w)
+        _mm_storeu_si128((__m128i *) words[w], st[w]);
+    for (int j = 0; j < 4; ++j)
+        for (int w = 0; w < 4; ++w)
+            copy4(out + j * MD4_DIGEST_LENGTH + w * 4, words[w][j]);
+}
+
+#define V8_F(b,c,d) _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)))
+#define V8_G(b,c,d) _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)))
+#define V8_H(b,c,d) _mm256_xor_si256(_mm256_xor_si256(b, c), d)
+#define V8_ROT(x,s) _mm256_or_si256(_mm256_slli_epi32(x, s), _mm256_srli_epi32(x, 32 - (s)))
+#define V8_R1(a,b,c,d,k,s) a = V8_ROT(_mm256_add_epi32(_mm256_add_epi32(a, V8_F(b,c,d)), X[k]), s)
+#define V8_R2(a,b,c,d,k,s) a = V8_ROT(_mm256_add_epi32(_mm256_add_epi32(a, V8_G(b,c,d)), _mm256_add_epi32(X[k], K2)), s)
+#define V8_R3(a,b,c,d,k,s) a = V8_ROT(_mm256_add_epi32(_mm256_add_epi32(a, V8_H(b,c,d)), _mm256_add_epi32(X[k], K3)), s)
+
+/* Lane j and j + 4 share one 256-bit load, so after the in-lane transpose
+ * the low half holds blocks 0-3 and the high half blocks 4-7. */
+XDELTA_TARGET("avx2")
+static inline __m256i
+md4_load_x8(const uchar_t * const *p, int j, size_t off)
+{
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (p[j] + off))),
+        _mm_loadu_si128((const __m128i *) (p[j + 4] + off)), 1);
+}
+
+XDELTA_TARGET("avx2")
+static inline void
+md4_x8_chunk(__m256i *st, const uchar_t * const *p, size_t off)
+{
+    const __m256i   K2 = _mm256_set1_epi32(0x5A827999);
+    const __m256i   K3 = _mm256_set1_epi32(0x6ED9EBA1);
+    __m256i         X[16];
+
+    for (int q = 0; q < 4; ++q) {
+        __m256i r0 = md4_load_x8(p, 0, off + q * 16);
+        __m256i r1 = md4_load_x8(p, 1, off + q * 16);
+        __m256i r2 = md4_load_x8(p, 2, off + q * 16);
+        __m256i r3 = md4_load_x8(p, 3, off + q * 16);
+        __m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+        __m256i t1 = _mm256_unpacklo_epi32(r2, r3);
+        __m256i t2 = _mm256_unpackhi_epi32(r0, r1);
+        __m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+        X[q * 4 + 0] = _mm256_unpacklo_epi64(t0, t1);
+        X[q * 4 + 1] = _mm256_unpackhi_epi64(t0, t1);
+        X[q * 4 + 2] = _mm256_unpacklo_epi64(t2, t3);
+        X[q * 4 + 3] = _mm256_unpackhi_epi64(t2, t3);
+    }
+
+    __m256i A = st[0], B = st[1], C = st[2], D = st[3];
+    MD4_STEPS(V8_R1, V8_R2, V8_R3)
+    st[0] = _mm256_add_epi32(st[0], A);
+    st[1] = _mm256_add_epi32(st[1], B);
+    st[2] = _mm256_add_epi32(st[2], C);
+    st[3] = _mm256_add_epi32(st[3], D);
+}
+
+XDELTA_TARGET("avx2")
+void
+rs_mdfour_x8(uchar_t *out, const uchar_t * const *in, size_t bytes)
+{
+    __m256i         st[4];
+    uchar_t         tail[8][128];
+    const uchar_t  *tp[8];
+    uint32_t        words[4][8];
+    size_t          full = bytes & ~(size_t) 63;
+    int             chunks = 0;
+
+    st[0] = _mm256_set1_epi32(0x67452301);
+    st[1] = _mm256_set1_epi32((int) 0xefcdab89);
+    st[2] = _mm256_set1_epi32((int) 0x98badcfe);
+    st[3] = _mm256_set1_epi32(0x10325476);
+    for (int j = 0; j < 8; ++j) {
+        chunks = md4_pad_tail(tail[j], in[j], bytes);
+        tp[j] = tail[j];
+    }
+
+    for (size_t off = 0; off < full; off += 64)
+        md4_x8_chunk(st, in, off);
+    for (int c = 0; c < chunks; ++c)
+        md4_x8_chunk(st, tp, c * 64);
+
+    for (int w = 0; w < 4; ++w)
+        _mm256_storeu_si256((__m256i *) words[w], st[w]);
+    for (int j = 0; j < 8; ++j)
+        for (int w = 0; w < 4; ++w)
+            copy4(out + j * MD4_DIGEST_LENGTH + w * 4, words[w][j]);
+}
+
+/* AVX-512 has a rotate and a three-input logic instruction; 0xca is
+ * "b ? c : d" (F), 0xe8 the majority (G) and 0x96 the xor (H). */
+#define V16_R1(a,b,c,d,k,s) a = _mm512_rol_epi32(_mm512_add_epi32(_mm512_add_epi32(a, _mm512_ternarylogic_epi32(b, c, d, 0xca)), X[k]), s)
+#define V16_R2(a,b,c,d,k,s) a = _mm512_rol_epi32(_mm512_add_epi32(_mm512_add_epi32(a, _mm512_ternarylogic_epi32(b, c, d, 0xe8)), _mm512_add_epi32(X[k], K2)), s)
+#define V16_R3(a,b,c,d,k,s) a = _mm512_rol_epi32(_mm512_add_epi32(_mm512_add_epi32(a, _mm512_ternarylogic_epi32(b, c, d, 0x96)), _mm512_add_epi32(X[k], K3)), s)
+
+XDELTA_TARGET("avx512f")
+static inline __m512i
+md4_load_x16(const uchar_t * const *p, int j, size_t off)
+{
+    __m512i v = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *) (p[j] + off)));
+    v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i *) (p[j + 4] + off)), 1);
+    v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i *) (p[j + 8] + off)), 2);
+    return _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i *) (p[j + 12] + off)), 3);
+}
+
+XDELTA_TARGET("avx512f")
+static inline void
+md4_x16_chunk(__m512i *st, const uchar_t * const *p, size_t off)
+{
+    const __m512i   K2 = _mm512_set1_epi32(0x5A827999);
+    const __m512i   K3 = _mm512_set1_epi32(0x6ED9EBA1);
+    __m512i         X[16];
+
+    for (int q = 0; q < 4; ++q) {
+        __m512i r0 = md4_load_x16(p, 0, off + q * 16);
+        __m512i r1 = md4_load_x16(p, 1, off + q * 16);
+        __m512i r2 = md4_load_x16(p, 2, off + q * 16);
+        __m512i r3 = md4_load_x16(p, 3, off + q * 16);
+        __m512i t0 = _mm512_unpacklo_epi32(r0, r1);
+        __m512i t1 = _mm512_unpacklo_epi32(r2, r3);
+        __m512i t2 = _mm512_unpackhi_epi32(r0, r1);
+        __m512i t3 = _mm512_unpackhi_epi32(r2, r3);
+        X[q * 4 + 0] = _mm512_unpacklo_epi64(t0, t1);
+        X[q * 4 + 1] = _mm512_unpackhi_epi64(t0, t1);
+        X[q * 4 + 2] = _mm512_unpacklo_epi64(t2, t3);
+        X[q * 4 + 3] = _mm512_unpackhi_epi64(t2, t3);
+    }
+
+    __m512i A = st[0], B = st[1], C = st[2], D = st[3];
+    MD4_STEPS(V16_R1, V16_R2, V16_R3)
+    st[0] = _mm512_add_epi32(st[0], A);
+    st[1] = _mm512_add_epi32(st[1], B);
+    st[2] = _mm512_add_epi32(st[2], C);
+    st[3] = _mm512_add_epi32(st[3], D);
+}
+
+XDELTA_TARGET("avx512f")
+void
+rs_mdfour_x16(uchar_t *out, const uchar_t * const *in, size_t bytes)
+{
+    __m512i         st[4];
+    uchar_t         tail[16][128];
+    const uchar_t  *tp[16];
+    uint32_t        words[4][16];
+    size_t          full = bytes & ~(size_t) 63;
+    int             chunks = 0;
+
+    st[0] = _mm512_set1_epi32(0x67452301);
+    st[1] = _mm512_set1_epi32((int) 0xefcdab89);
+    st[2] = _mm512_set1_epi32((int) 0x98badcfe);
+    st[3] = _mm512_set1_epi32(0x10325476);
+    for (int j = 0; j < 16; ++j) {
+        chunks = md4_pad_tail(tail[j], in[j], bytes);
+        tp[j] = tail[j];
+    }
+
+    for (size_t off = 0; off < full; off += 64)
+        md4_x16_chunk(st, in, off);
+    for (int c = 0; c < chunks; ++c)
+        md4_x16_chunk(st, tp, c * 64);
+
+    for (int w = 0; w < 4; ++w)
+        _mm512_storeu_si512((void *) words[w], st[w]);
+    for (int j = 0; j < 16; ++j)
+        for (int w = 0; w < 4; ++w)
+            copy4(out + j * MD4_DIGEST_LENGTH + w * 4, words[w][j]);
+}
+
+#else /* XDELTA_X86 */
+
+static void
+md4_one_by_one(uchar_t *out, const uchar_t * const *in, size_t bytes, int n)
+{
+    for (int j = 0; j < n; ++j)
+        rs_mdfour(out + j * MD4_DIGEST_LENGTH, in[j], bytes);
+}
+
+void
+rs_mdfour_x4(uchar_t *out, const uchar_t * const *in, size_t bytes)
+{
+    md4_one_by_one(out, in, bytes, 4);
+}
+
+void
+rs_mdfour_x8(uchar_t *out, const uchar_t * const *in, size_t bytes)
+{
+    md4_one_by_one(out, in, bytes, 8);
+}
+
+void
+rs_mdfour_x16(uchar_t *out, const uchar_t * const *in, size_t bytes)
+{
+    md4_one_by_one(out, in, bytes, 16);
+}
+
+#endif /* XDELTA_X86 */
+
+/* 0 until the first call, then the number of lanes of the widest kernel
+ * the CPU supports.  One word, so a race only detects the CPU twice. */
+static unsigned int md4_lanes = 0;
+
+unsigned int
+rs_mdfour_lanes()
+{
+    if (md4_lanes == 0) {
+        unsigned int lanes = 1;
+        if (cpu_has_avx512())
+            lanes = 16;
+        else if (cpu_has_avx2())
+            lanes = 8;
+        else if (cpu_has_sse2())
+            lanes = 4;
+        md4_lanes = lanes;
+    }
+    return md4_lanes;
+}
+
+void
+rs_mdfour_multi(uchar_t *out, const uchar_t * const *in, size_t bytes, unsigned int n)
+{
+    unsigned int    lanes = rs_mdfour_lanes();
+    unsigned int    i = 0;
+
+    if (lanes >= 16)
+        for (; i + 16 <= n; i += 16)
+            rs_mdfour_x16(out + i * MD4_DIGEST_LENGTH, in + i, bytes);
+    if (lanes >= 8)
+        for (; i + 8 <= n; i += 8)
+            rs_mdfour_x8(out + i * MD4_DIGEST_LENGTH, in + i, bytes);
+    if (lanes >= 4)
+        for (; i + 4 <= n; i += 4)
+            rs_mdfour_x4(out + i * MD4_DIGEST_LENGTH, in + i, bytes);
+    for (; i < n; ++i)
+        rs_mdfour(out + i * MD4_DIGEST_LENGTH, in[i], bytes);
+}
+
+void
+get_strong_hash_multi(strong_hash_type type, uchar_t *out
+                      , const uchar_t * const *in, size_t bytes, unsigned int n)
+{
+    if (type == STRONG_HASH_MURMUR3) {
+        for (unsigned int i = 0; i < n; ++i)
+            murmur3_128(out + i * MD4_DIGEST_LENGTH, in[i], (uint32_t) bytes);
+    }
+    else
+        rs_mdfour_multi(out, in, bytes, n);
+}
+
 } // namespace xdelta
 
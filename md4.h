@@ -72,6 +72,66 @@ void DLL_EXPORT rs_mdfour_update(rs_mdfour_t * md, void const * buf,size_t n);
 /// \return ޷
 void DLL_EXPORT rs_mdfour_result(rs_mdfour_t * md, uchar_t *out);
 
+/// \def MD4_MAX_LANES
+/// · MD4 һݿAVX-512 ͨ
+#define MD4_MAX_LANES			16
+
+/// \fn unsigned int DLL_EXPORT rs_mdfour_lanes ();
+/// \brief صǰ CPU ϶· MD4 һμĿ1684  1߰Ŀ
+/// ύݿЧ
+/// \return ÿĿ
+unsigned int DLL_EXPORT rs_mdfour_lanes ();
+
+/// \fn void DLL_EXPORT rs_mdfour_multi (uchar_t * out, const uchar_t * const * in, size_t bytes, unsigned int n);
+/// \brief ͬʱȳݿ MD4 ֵ rs_mdfour ȫͬݿ֮
+/// أԿԷ SIMD ĴĲͬͨвм㣬ʱ CPU ѡ AVX-512
+/// AVX2SSE2 ͨʵ֡
+/// \param[out] out  壬 i  MD4 ֵ out + i * DIGEST_BYTES
+/// \param[in] in  ݿָ顣
+/// \param[in] bytes  ÿݿĳȡ
+/// \param[in] n  ݿֵ
+/// \return ޷
+void DLL_EXPORT rs_mdfour_multi (uchar_t * out, const uchar_t * const * in, size_t bytes, unsigned int n);
+
+/// \fn void DLL_EXPORT rs_mdfour_x4 (uchar_t * out, const uchar_t * const * in, size_t bytes);
+/// \brief  SSE2 ͬʱ 4 ȳݿ MD4 ֵֻ cpu_has_sse2 () Ϊʱá
+/// rs_mdfour_x8 (AVX2)  rs_mdfour_x16 (AVX-512) ƣ x86 ƽ̨˻㡣
+void DLL_EXPORT rs_mdfour_x4 (uchar_t * out, const uchar_t * const * in, size_t bytes);
+void DLL_EXPORT rs_mdfour_x8 (uchar_t * out, const uchar_t * const * in, size_t bytes);
+void DLL_EXPORT rs_mdfour_x16 (uchar_t * out, const uchar_t * const * in, size_t bytes);
+
+/// \enum strong_hash_type
+/// ǿHash 㷨slow_hash ֻ DIGEST_BYTES ֽڵ Hash ֵ㷨 Hash 
+/// ǩһͬԼͨʱ¼ handshake_header  reserved СֻҪ
+/// ײҪѧǿȣԿѡ MD4 öķǼ Hash
+enum strong_hash_type {
+	STRONG_HASH_MD4 = 0,		///< MD4ɰ汾ݣĬϵ㷨
+	STRONG_HASH_MURMUR3 = 1,	///< MurmurHash3 x64 128 λ
+	STRONG_HASH_MAX
+};
+
+/// \fn void DLL_EXPORT murmur3_128 (uchar_t * out, const uchar_t * data, uint32_t len);
+/// \brief ݿ MurmurHash3 x64 128 λ Hash ֵΪ 0С
+/// \param[out] out 壬16 ֽڡ
+/// \param[in] data ݿָ롣
+/// \param[in] len ݿ鳤ȡ
+/// \return ޷
+void DLL_EXPORT murmur3_128 (uchar_t * out, const uchar_t * data, uint32_t len);
+
+/// \fn bool is_valid_hash_type (int type)
+/// \brief  Hash 㷨ֵǷЧӶԶյֵ
+/// \param[in] type 㷨ֵ
+/// \return Ч򷵻棬򷵻ؼ١
+inline bool is_valid_hash_type (const int type)
+{
+	return type >= STRONG_HASH_MD4 && type < STRONG_HASH_MAX;
+}
+
+/// \fn void DLL_EXPORT get_strong_hash_multi (strong_hash_type type, uchar_t * out, const uchar_t * const * in, size_t bytes, unsigned int n);
+/// \brief ָ㷨ͬʱȳݿ Hash ֵ rs_mdfour_multi ͬ
+void DLL_EXPORT get_strong_hash_multi (strong_hash_type type, uchar_t * out
+						, const uchar_t * const * in, size_t bytes, unsigned int n);
+
 /// \fn void get_slow_hash (const uchar_t *buf1, uint32_t len, uchar_t hash[DIGEST_BYTES])
 /// \brief ݿ Hash ֵ
 /// \param[in] buf1 ݿָ롣
@@ -83,6 +143,22 @@ inline void get_slow_hash (const uchar_t *buf1, uint32_t len, uchar_t hash[DIGES
 	rs_mdfour (hash, buf1, len);
 }
 
+/// \fn void get_slow_hash (const uchar_t *buf1, uint32_t len, uchar_t hash[DIGEST_BYTES], strong_hash_type type)
+/// \brief ָ㷨ݿ Hash ֵ
+/// \param[in] buf1 ݿָ롣
+/// \param[in] len  鳤ȡ
+/// \param[out] hash  Hash 
+/// \param[in] type  Hash 㷨
+/// \return ޷
+inline void get_slow_hash (const uchar_t *buf1, uint32_t len, uchar_t hash[DIGEST_BYTES]
+						, const strong_hash_type type)
+{
+	if (type == STRONG_HASH_MURMUR3)
+		murmur3_128 (hash, buf1, len);
+	else
+		rs_mdfour (hash, buf1, len);
+}
+
 } // namespace xdelta
 
 #endif //__DIGEST_H__
@@ -0,0 +1,114 @@
+/*
+* Copyright (C) 2016- yeyouqun@163.com
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, visit the http://fsf.org website.
+*/
+
+/// @file
+/// MurmurHash3 x64 128 λʵ֡㷨 Austin Appleby Ʋ빫
+/// ﰴСȡ֤ͬƽ̨ϵĽͬ
+#include <string>
+
+#include "mytypes.h"
+#include "platform.h"
+#include "md4.h"
+
+namespace xdelta {
+
+static inline uint64_t rotl64 (uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t load_le64 (const uchar_t * p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16)
+		| ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+		| ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline void store_le64 (uchar_t * p, uint64_t x)
+{
+	for (int i = 0; i < 8; ++i)
+		p[i] = (uchar_t)(x >> (i * 8));
+}
+
+static inline uint64_t fmix64 (uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+void murmur3_128 (uchar_t * out, const uchar_t * data, uint32_t len)
+{
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	const uint32_t nblocks = len / 16;
+	uint64_t h1 = 0; // seed
+	uint64_t h2 = 0;
+
+	for (uint32_t i = 0; i < nblocks; ++i) {
+		uint64_t k1 = load_le64 (data + i * 16);
+		uint64_t k2 = load_le64 (data + i * 16 + 8);
+
+		k1 *= c1; k1 = rotl64 (k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl64 (h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2; k2 = rotl64 (k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl64 (h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	const uchar_t * tail = data + nblocks * 16;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+
+	switch (len & 15) {
+	case 15: k2 ^= (uint64_t)tail[14] << 48;
+	case 14: k2 ^= (uint64_t)tail[13] << 40;
+	case 13: k2 ^= (uint64_t)tail[12] << 32;
+	case 12: k2 ^= (uint64_t)tail[11] << 24;
+	case 11: k2 ^= (uint64_t)tail[10] << 16;
+	case 10: k2 ^= (uint64_t)tail[ 9] << 8;
+	case  9: k2 ^= (uint64_t)tail[ 8] << 0;
+		k2 *= c2; k2 = rotl64 (k2, 33); k2 *= c1; h2 ^= k2;
+
+	case  8: k1 ^= (uint64_t)tail[ 7] << 56;
+	case  7: k1 ^= (uint64_t)tail[ 6] << 48;
+	case  6: k1 ^= (uint64_t)tail[ 5] << 40;
+	case  5: k1 ^= (uint64_t)tail[ 4] << 32;
+	case  4: k1 ^= (uint64_t)tail[ 3] << 24;
+	case  3: k1 ^= (uint64_t)tail[ 2] << 16;
+	case  2: k1 ^= (uint64_t)tail[ 1] << 8;
+	case  1: k1 ^= (uint64_t)tail[ 0] << 0;
+		k1 *= c1; k1 = rotl64 (k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64 (h1);
+	h2 = fmix64 (h2);
+	h1 += h2;
+	h2 += h1;
+
+	store_le64 (out, h1);
+	store_le64 (out + 8, h2);
+}
+
+} // namespace xdelta
@@ -160,7 +160,7 @@ public:
 			#define BYTE_ORDER BIG_ENDIAN
 		#endif
 	#elif defined (__GNUG__) || defined (__GNUC__)
-		#if defined (__ORDER_LITTLE_ENDIAN__) && defined (__BYTE_ORDER__) &&
+		#if defined (__ORDER_LITTLE_ENDIAN__) && defined (__BYTE_ORDER__) && \
 		    (__ORDER_LITTLE_ENDIAN__ == __BYTE_ORDER__)
 			#define BYTE_ORDER LITTLE_ENDIAN
 		#elif defined(__i386__) || defined (__amd64__)
@@ -29,6 +29,8 @@
 	#include <time.h>
 #else
 	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
 	#include <memory>
 	#include <ext/functional>
     #if !defined (__CXX_11__)
@@ -43,6 +45,17 @@
 
 #include "mytypes.h"
 #include "platform.h"
+#include "ringbuf.h"
+#include "buffer.h"
+
+#ifdef XDELTA_X86
+	#ifdef _WIN32
+		#include <intrin.h>
+		#include <immintrin.h>
+	#else
+		#include <cpuid.h>
+	#endif
+#endif
 
 namespace xdelta {
 
@@ -105,5 +118,188 @@ std::string get_tmp_fname (const std::string & fname)
 #endif
 }
 
+#ifdef _WIN32
+static uchar_t * map_mirrored (const uint32_t size, void ** handle)
+{
+	SYSTEM_INFO si;
+	GetSystemInfo (&si);
+	if (size == 0 || size % si.dwAllocationGranularity != 0)
+		return 0;
+
+	HANDLE mapping = CreateFileMapping (INVALID_HANDLE_VALUE, 0, PAGE_READWRITE, 0, size, 0);
+	if (mapping == 0)
+		return 0;
+
+	// ȱһСĵַͷţȻεַӳΡͷӳ֮
+	// ַܱ߳ռãԶԼΡ
+	for (int i = 0; i < 8; ++i) {
+		uchar_t * addr = (uchar_t *)VirtualAlloc (0, (SIZE_T)size * 2, MEM_RESERVE, PAGE_NOACCESS);
+		if (addr == 0)
+			break;
+		VirtualFree (addr, 0, MEM_RELEASE);
+
+		void * lo = MapViewOfFileEx (mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, addr);
+		void * hi = MapViewOfFileEx (mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, addr + size);
+		if (lo == addr && hi == addr + size) {
+			*handle = mapping;
+			return addr;
+		}
+		if (lo != 0)
+			UnmapViewOfFile (lo);
+		if (hi != 0)
+			UnmapViewOfFile (hi);
+	}
+
+	CloseHandle (mapping);
+	return 0;
+}
+
+static void unmap_mirrored (uchar_t * addr, const uint32_t size, void * handle)
+{
+	UnmapViewOfFile (addr);
+	UnmapViewOfFile (addr + size);
+	CloseHandle ((HANDLE)handle);
+}
+#else
+static uchar_t * map_mirrored (const uint32_t size, void ** handle)
+{
+#if defined (__linux__) && defined (SYS_memfd_create)
+	long pagesize = sysconf (_SC_PAGESIZE);
+	if (size == 0 || pagesize <= 0 || size % pagesize != 0)
+		return 0;
+
+	// ڴļṩҳ̣رպӳһͷš
+	int fd = (int)syscall (SYS_memfd_create, "xdelta-ring", 0);
+	if (fd < 0)
+		return 0;
+
+	uchar_t * addr = 0;
+	if (ftruncate (fd, size) == 0) {
+		void * area = mmap (0, (size_t)size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (area != MAP_FAILED) {
+			addr = (uchar_t *)area;
+			if (mmap (addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+				|| mmap (addr + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+					== MAP_FAILED) {
+				munmap (area, (size_t)size * 2);
+				addr = 0;
+			}
+		}
+	}
+
+	close (fd);
+	*handle = 0;
+	return addr;
+#else
+	return 0;
+#endif
+}
+
+static void unmap_mirrored (uchar_t * addr, const uint32_t size, void * handle)
+{
+	munmap (addr, (size_t)size * 2);
+}
+#endif
+
+ring_buffer::ring_buffer (const uint32_t size)
+	: ptr_ (0)
+	, size_ (size)
+	, mirrored_ (false)
+	, handle_ (0)
+{
+	ptr_ = map_mirrored (size, &handle_);
+	if (ptr_ != 0) {
+		mirrored_ = true;
+		return;
+	}
+
+	ptr_ = (uchar_t *)malloc (size);
+	if (ptr_ == 0)
+		THROW_XDELTA_EXCEPTION ("Can't allocate read buffer.");
+}
+
+ring_buffer::~ring_buffer ()
+{
+	if (mirrored_)
+		unmap_mirrored (ptr_, size_, handle_);
+	else
+		free (ptr_);
+}
+
+#ifdef XDELTA_X86
+static void get_cpuid (uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _WIN32
+	int info[4];
+	__cpuidex (info, (int)leaf, (int)subleaf);
+	for (int i = 0; i < 4; ++i)
+		regs[i] = (uint32_t)info[i];
+#else
+	regs[0] = regs[1] = regs[2] = regs[3] = 0;
+	__cpuid_count (leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t get_xcr0 ()
+{
+#ifdef _WIN32
+	return _xgetbv (0);
+#else
+	uint32_t eax, edx;
+	__asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+#endif
+
+bool cpu_has_sse2 ()
+{
+#ifdef XDELTA_X86
+	uint32_t regs[4];
+	get_cpuid (1, 0, regs);
+	return (regs[3] & (1 << 26)) != 0;
+#else
+	return false;
+#endif
+}
+
+bool cpu_has_avx2 ()
+{
+#ifdef XDELTA_X86
+	uint32_t regs[4];
+	get_cpuid (0, 0, regs);
+	if (regs[0] < 7)
+		return false;
+
+	get_cpuid (1, 0, regs);
+	const uint32_t osxsave = 1 << 27, avx = 1 << 28;
+	if ((regs[2] & (osxsave | avx)) != (osxsave | avx))
+		return false;
+	if ((get_xcr0 () & 6) != 6) // ϵͳ XMM  YMM Ĵ
+		return false;
+
+	get_cpuid (7, 0, regs);
+	return (regs[1] & (1 << 5)) != 0;
+#else
+	return false;
+#endif
+}
+
+bool cpu_has_avx512 ()
+{
+#ifdef XDELTA_X86
+	if (!cpu_has_avx2 ())
+		return false;
+	if ((get_xcr0 () & 0xe6) != 0xe6) // ϵͳ ZMM Ĵ
+		return false;
+
+	uint32_t regs[4];
+	get_cpuid (7, 0, regs);
+	return (regs[1] & (1 << 16)) != 0;
+#else
+	return false;
+#endif
+}
+
 } // namespace xdelta
 
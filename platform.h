@@ -172,6 +172,38 @@ std::string DLL_EXPORT get_tmp_fname (const std::string & fname);
   #define FPRINTF  fprintf
 #endif
 
+/*---------------------------------------------------------------------------*/
+/*                                                                           */
+/* CPU Features                                                              */
+/*                                                                           */
+/*---------------------------------------------------------------------------*/
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  #define XDELTA_X86
+#endif
+
+///  GCC Ϊָʹ SIMD 벻Ҫļ -mavx2 룬
+/// ʱٸ CPU ֧ѡVC Ҫԡ
+#if defined(__GNUC__)
+  #define XDELTA_TARGET(x) __attribute__ ((target (x)))
+#else
+  #define XDELTA_TARGET(x)
+#endif
+
+/// \fn bool DLL_EXPORT cpu_has_sse2 ()
+/// \brief  CPU Ƿ֧ SSE2 ָ
+/// \return ֧򷵻棬򷵻ؼ٣ x86 ƽ̨Ƿؼ١
+bool DLL_EXPORT cpu_has_sse2 ();
+
+/// \fn bool DLL_EXPORT cpu_has_avx2 ()
+/// \brief  CPU ϵͳǷ֧ AVX2 ָϵͳҪ YMM Ĵ
+/// \return ֧򷵻棬򷵻ؼ٣ x86 ƽ̨Ƿؼ١
+bool DLL_EXPORT cpu_has_avx2 ();
+
+/// \fn bool DLL_EXPORT cpu_has_avx512 ()
+/// \brief  CPU ϵͳǷ֧ AVX-512F ָϵͳҪ ZMM Ĵ
+/// \return ֧򷵻棬򷵻ؼ٣ x86 ƽ̨Ƿؼ١
+bool DLL_EXPORT cpu_has_avx512 ();
+
 } // namespace xdelta
 #endif //__PLATFORM_H__
 
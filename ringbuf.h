@@ -0,0 +1,108 @@
+/*
+* Copyright (C) 2013- yeyouqun@163.com
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, visit the http://fsf.org website.
+*/
+
+#ifndef __RINGBUF_H__
+#define __RINGBUF_H__
+/// \file
+/// \brief
+/// ʹõĻ泤ȣԼļõĻλ
+
+namespace xdelta {
+
+/// һЩڴϵͳУĲúܶ࣬пܵڴù࣬ʹϵͳ
+/// ܵӰ죬崻ԣҪĿϵͳڴԺԼӦ
+/// ĴС MULTIROUND_MAX_BLOCK_SIZE ҪС 512 KBXDELTA_BUFFER_LEN 
+/// MULTIROUND_MAX_BLOCK_SIZEΪ 2  N η 8  ȡ
+/// ϵͳдڴڴʱϴڴŻʵ֡ʹÿͬʱϵͳռڴ
+/// ĴΪ
+///		Դˣͻˣ
+///			߳ * XDELTA_BUFFER_LEN * 3ϵͳڴޣԲ̵߳ķʽдʽ
+///			޷ʹö̵߳ơ
+///		Ŀˣˣ
+///			߳ * XDELTA_BUFFER_LEN * 2߳ܵĿͻ˵ĿԼÿͻͬʱ
+///			õ߳
+/// ͬʱļС߿Сûдﵽ XDELTA_BUFFER_LEN ȣδʹõĵַϵͳ
+/// ڴ棬ʱֻռý̵ĵַռ䣬ȴռϵͳڴ档
+#ifndef BIT32_PLATFORM
+#error "Define BIT32_PLATFORM first, maybe you have to include mytypes.h first!"
+#endif
+#if BIT32_PLATFORM
+	/// ڶ Hash е鳤
+	#define MULTIROUND_MAX_BLOCK_SIZE (1 << 22)
+
+	/// ʹû泤
+	#define XDELTA_BUFFER_LEN ((int32_t)1 << 25) // 32MB
+#else
+	/// ڶ Hash е鳤
+	#define MULTIROUND_MAX_BLOCK_SIZE (1 << 20)
+
+	/// ʹû泤
+	#define XDELTA_BUFFER_LEN ((int32_t)1 << 23) // 8MB
+#endif
+
+/// \class
+/// \brief ļõĻλ
+///
+/// ͬһҳַϽӳΣԴǰһκλÿʼ size ֽ
+/// ڵַ϶ġߵĩβʱֻҪָۻǰһ룬δ
+/// ݲҪƶֱӶеĲ֡ϵͳ֧˫ӳʱ size 
+/// ҳС˻Ϊͨڴ棬 rewind δƵʼ
+class DLL_EXPORT ring_buffer
+{
+public:
+	/// \brief
+	/// һСΪ size Ļλ
+	/// \param size[in]	С
+	ring_buffer (const uint32_t size);
+	~ring_buffer ();
+	/// \brief
+	/// ػĴС
+	uint32_t size () const { return size_; }
+	/// \brief
+	/// ػײ
+	uchar_t * begin () { return ptr_; }
+	/// \brief
+	/// Ƿ˫ӳĻ
+	bool mirrored () const { return mirrored_; }
+	/// \brief
+	/// ׼һζݡ data ʼ len ֽǻҪݡ
+	/// \param[in] data	Ҫݣ [begin (), begin () + 2 * size ()) У˫ӳʱΪ
+	///					[begin (), begin () + size ())
+	/// \param[in] len		ݵֽܳ size ()
+	/// \return ݵλ p[p + len, p + size ()) ǿֱдĿпռ䡣
+	uchar_t * rewind (const uchar_t * data, const uint32_t len)
+	{
+		const uint32_t pos = (uint32_t)(data - ptr_);
+		if (mirrored_)
+			return ptr_ + (pos >= size_ ? pos - size_ : pos);
+		if (len > 0 && pos != 0)
+			memmove (ptr_, data, len);
+		return ptr_;
+	}
+private:
+	ring_buffer ();
+	ring_buffer (const ring_buffer &);
+	ring_buffer & operator = (const ring_buffer &);
+
+	uchar_t *	ptr_;
+	uint32_t	size_;
+	bool		mirrored_;
+	void *		handle_;	///< ˫ӳʱ Windows ļӳ
+};
+
+} // namespace xdelta
+#endif //__RINGBUF_H__
@@ -25,6 +25,11 @@
 #include "platform.h"
 #include "rollsum.h"
 
+#ifdef XDELTA_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
 namespace xdelta {
 
 #define DO1(buf,i)  {s1 += buf[i]; s2 += s1;}
@@ -34,7 +39,7 @@ namespace xdelta {
 #define DO16(buf)   DO8(buf,0); DO8(buf,8);
 #define OF16(off)  {s1 += 16*off; s2 += 136*off;}
 
-void RollsumUpdate(Rollsum *sum,const unsigned char *buf,unsigned int len) {
+void RollsumUpdateScalar(Rollsum *sum,const unsigned char *buf,unsigned int len) {
     /* ANSI C says no overflow for unsigned. 
      zlib's adler 32 goes to extra effort to avoid overflow*/
     unsigned long s1 = sum->s1;
@@ -56,5 +61,142 @@ void RollsumUpdate(Rollsum *sum,const unsigned char *buf,unsigned int len) {
     sum->s2=s2;
 }
 
+/*
+ * SIMD kernels, the same idea as the vectorized adler32 in zlib-ng.  For n
+ * bytes c[0..n-1] (c = byte + ROLLSUM_CHAR_OFFSET):
+ *     s1' = s1 + sum(c[i])
+ *     s2' = s2 + n*s1 + sum((n-i)*c[i])
+ * The bytes are eaten in chunks of W (16 or 32) bytes.  For the byte i of
+ * chunk j (of k chunks) the weight n-i splits into W*(k-1-j) + (W-i%W), so
+ * we keep three vector sums: the plain byte sum, the sum of all previous
+ * chunk sums (the prefix, times W), and the in-chunk weighted sum.  The
+ * weighted sum is kept in 32-bit lanes, so at most ROLLSUM_MAX_CHUNKS are
+ * eaten before folding into s1/s2.  All arithmetic wraps like the scalar
+ * code, so the result is bit-for-bit identical.
+ */
+#define ROLLSUM_MAX_CHUNKS 8192
+
+static void RollsumFold(Rollsum *sum, unsigned long n, unsigned long long bytes,
+                        unsigned long long prefix, unsigned long long weighted, unsigned long width) {
+    unsigned long s1 = sum->s1;
+    unsigned long s2 = sum->s2;
+    unsigned long offset = (unsigned long)((unsigned long long)n * (n + 1) / 2);
+
+    s2 += n * s1 + width * (unsigned long)prefix + (unsigned long)weighted
+        + offset * ROLLSUM_CHAR_OFFSET;
+    s1 += (unsigned long)bytes + n * ROLLSUM_CHAR_OFFSET;
+    sum->s1 = s1;
+    sum->s2 = s2;
+}
+
+#ifdef XDELTA_X86
+XDELTA_TARGET("sse2")
+void RollsumUpdateSSE2(Rollsum *sum,const unsigned char *buf,unsigned int len) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wlo = _mm_set_epi16(9, 10, 11, 12, 13, 14, 15, 16);
+    const __m128i whi = _mm_set_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+    unsigned long long lanes[2];
+    unsigned int wlanes[4];
+
+    while (len >= 16) {
+        unsigned int chunks = len / 16;
+        if (chunks > ROLLSUM_MAX_CHUNKS)
+            chunks = ROLLSUM_MAX_CHUNKS;
+
+        __m128i vs = zero, vp = zero, vw = zero;
+        for (unsigned int k = 0; k < chunks; ++k) {
+            __m128i b = _mm_loadu_si128((const __m128i *)buf);
+            vp = _mm_add_epi64(vp, vs);
+            vs = _mm_add_epi64(vs, _mm_sad_epu8(b, zero));
+            vw = _mm_add_epi32(vw, _mm_madd_epi16(_mm_unpacklo_epi8(b, zero), wlo));
+            vw = _mm_add_epi32(vw, _mm_madd_epi16(_mm_unpackhi_epi8(b, zero), whi));
+            buf += 16;
+        }
+
+        _mm_storeu_si128((__m128i *)lanes, vs);
+        unsigned long long bytes = lanes[0] + lanes[1];
+        _mm_storeu_si128((__m128i *)lanes, vp);
+        unsigned long long prefix = lanes[0] + lanes[1];
+        _mm_storeu_si128((__m128i *)wlanes, vw);
+        unsigned long long weighted = (unsigned long long)wlanes[0] + wlanes[1] + wlanes[2] + wlanes[3];
+
+        sum->count += chunks * 16;
+        RollsumFold(sum, chunks * 16, bytes, prefix, weighted, 16);
+        len -= chunks * 16;
+    }
+    if (len != 0)
+        RollsumUpdateScalar(sum, buf, len);
+}
+
+XDELTA_TARGET("avx2")
+void RollsumUpdateAVX2(Rollsum *sum,const unsigned char *buf,unsigned int len) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i weight = _mm256_set_epi8(1, 2, 3, 4, 5, 6, 7, 8,
+                                           9, 10, 11, 12, 13, 14, 15, 16,
+                                           17, 18, 19, 20, 21, 22, 23, 24,
+                                           25, 26, 27, 28, 29, 30, 31, 32);
+    unsigned long long lanes[4];
+    unsigned int wlanes[8];
+
+    while (len >= 32) {
+        unsigned int chunks = len / 32;
+        if (chunks > ROLLSUM_MAX_CHUNKS)
+            chunks = ROLLSUM_MAX_CHUNKS;
+
+        __m256i vs = zero, vp = zero, vw = zero;
+        for (unsigned int k = 0; k < chunks; ++k) {
+            __m256i b = _mm256_loadu_si256((const __m256i *)buf);
+            vp = _mm256_add_epi64(vp, vs);
+            vs = _mm256_add_epi64(vs, _mm256_sad_epu8(b, zero));
+            vw = _mm256_add_epi32(vw, _mm256_madd_epi16(_mm256_maddubs_epi16(b, weight), ones));
+            buf += 32;
+        }
+
+        _mm256_storeu_si256((__m256i *)lanes, vs);
+        unsigned long long bytes = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm256_storeu_si256((__m256i *)lanes, vp);
+        unsigned long long prefix = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm256_storeu_si256((__m256i *)wlanes, vw);
+        unsigned long long weighted = 0;
+        for (int i = 0; i < 8; ++i)
+            weighted += wlanes[i];
+
+        sum->count += chunks * 32;
+        RollsumFold(sum, chunks * 32, bytes, prefix, weighted, 32);
+        len -= chunks * 32;
+    }
+    if (len != 0)
+        RollsumUpdateScalar(sum, buf, len);
+}
+#else
+void RollsumUpdateSSE2(Rollsum *sum,const unsigned char *buf,unsigned int len) {
+    RollsumUpdateScalar(sum, buf, len);
+}
+
+void RollsumUpdateAVX2(Rollsum *sum,const unsigned char *buf,unsigned int len) {
+    RollsumUpdateScalar(sum, buf, len);
+}
+#endif
+
+typedef void (*RollsumUpdateFn)(Rollsum *sum,const unsigned char *buf,unsigned int len);
+static void RollsumUpdateFirst(Rollsum *sum,const unsigned char *buf,unsigned int len);
+static RollsumUpdateFn rollsum_update = RollsumUpdateFirst;
+
+/* Choose the kernel on first use; a race here only picks the same one twice. */
+static void RollsumUpdateFirst(Rollsum *sum,const unsigned char *buf,unsigned int len) {
+    RollsumUpdateFn fn = RollsumUpdateScalar;
+    if (cpu_has_avx2())
+        fn = RollsumUpdateAVX2;
+    else if (cpu_has_sse2())
+        fn = RollsumUpdateSSE2;
+    rollsum_update = fn;
+    fn(sum, buf, len);
+}
+
+void RollsumUpdate(Rollsum *sum,const unsigned char *buf,unsigned int len) {
+    rollsum_update(sum, buf, len);
+}
+
 } //namespace xdelta
 
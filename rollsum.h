@@ -22,7 +22,7 @@
  */
 #ifndef _ROLLSUM_H_
 #define _ROLLSUM_H_
-/// @file
+/// @file
 /// Rolling Hash ӿļ
 
 namespace xdelta {
@@ -37,7 +37,14 @@ typedef struct _Rollsum {
     unsigned long s2;                  /* s2 part of sum */
 } Rollsum;
 
+/* RollsumUpdate picks the fastest kernel the CPU supports on first use.
+ * All kernels give exactly the same s1/s2 as the scalar one; the SSE2
+ * and AVX2 kernels must only be called when cpu_has_sse2()/cpu_has_avx2()
+ * say so, and fall back to the scalar one on non-x86 builds. */
 void DLL_EXPORT RollsumUpdate(Rollsum *sum,const unsigned char *buf,unsigned int len);
+void DLL_EXPORT RollsumUpdateScalar(Rollsum *sum,const unsigned char *buf,unsigned int len);
+void DLL_EXPORT RollsumUpdateSSE2(Rollsum *sum,const unsigned char *buf,unsigned int len);
+void DLL_EXPORT RollsumUpdateAVX2(Rollsum *sum,const unsigned char *buf,unsigned int len);
 /* The following are implemented as macros.
 void RollsumInit(Rollsum *sum);
 void RollsumRotate(Rollsum *sum,unsigned char out, unsigned char in);
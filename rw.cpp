@@ -15,6 +15,9 @@
 * with this program; if not, visit the http://fsf.org website.
 */
 #include <string>
+#include <vector>
+#include <deque>
+#include <set>
 
 #ifdef _WIN32
 	#include <windows.h>
@@ -27,12 +30,28 @@
 	#include <fcntl.h>
 	#include <stdio.h>
 	#include <dirent.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#ifdef __linux__
+		#include <linux/falloc.h>
+		#include <linux/fs.h>
+		#include <linux/version.h>
+		#include <sys/ioctl.h>
+		#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0) && defined (__NR_io_uring_setup)
+			#include <linux/io_uring.h>
+			#define XDELTA_IO_URING
+		#endif
+	#endif
 #endif
 #include <errno.h>
+#include <string.h>
+#include <stdlib.h>
 
 #include "mytypes.h"
+#include "tinythread.h"
 #include "platform.h"
 #include "rw.h"
+#include "ringbuf.h"
 
 namespace xdelta {
 static uint64_t seek_file (HANDLE handle,
@@ -154,6 +173,219 @@ int f_local_freader::read_file (uchar_t * data, const uint32_t len)
 	return local_read (f_handle_, data, len);
 }
 
+int file_reader::read_at (const uint64_t offset, uchar_t * data, const uint32_t len)
+{
+	if (seek_file (offset, FILE_BEGIN) != offset) {
+		std::string errmsg = fmt_string ("Can't seek file %s(%s)."
+			, get_fname ().c_str (), error_msg ().c_str ());
+		THROW_XDELTA_EXCEPTION (errmsg);
+	}
+	return read_file (data, len);
+}
+
+/// \fn local_pread()
+/// \brief
+/// ļ offset ݣʹҲıļĶָ룬ڶ߳ͬʱá
+/// \return ֽʱ -1
+int local_pread (HANDLE handle, uchar_t * data, const uint32_t len, const uint64_t offset)
+{
+#ifdef _WIN32
+	OVERLAPPED ov;
+	memset (&ov, 0, sizeof (ov));
+	ov.Offset = (DWORD)(offset & 0xFFFFFFFF);
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD bytes = 0;
+	if (!::ReadFile (handle, data, len, &bytes, &ov))
+		return ::GetLastError () == ERROR_HANDLE_EOF ? 0 : -1;
+	return (int)bytes;
+#else
+	return (int)pread (handle, data, len, (off_t)offset);
+#endif
+}
+
+/// \fn local_pwrite()
+/// \brief
+/// дļ offset ʹҲıļдָ루Windows ϻƶļָ룩
+/// дȫݲŷء
+/// \return дֽʱ -1
+int local_pwrite (HANDLE handle, const uchar_t * data, const uint32_t len, const uint64_t offset)
+{
+	uint32_t done = 0;
+	while (done < len) {
+#ifdef _WIN32
+		OVERLAPPED ov;
+		memset (&ov, 0, sizeof (ov));
+		ov.Offset = (DWORD)((offset + done) & 0xFFFFFFFF);
+		ov.OffsetHigh = (DWORD)((offset + done) >> 32);
+		DWORD bytes = 0;
+		if (!::WriteFile (handle, data + done, len - done, &bytes, &ov))
+			return -1;
+		const int size = (int)bytes;
+#else
+		const int size = (int)pwrite (handle, data + done, len - done, (off_t)(offset + done));
+		if (size < 0 && errno == EINTR)
+			continue;
+#endif
+		if (size <= 0)
+			return -1;
+		done += size;
+	}
+	return (int)done;
+}
+
+/// \fn local_copy_range()
+/// \brief
+/// ںа from_handle  from  len ֽڸƵ to_handle  offset ߵλö
+/// ļϵͳʱĲ FICLONERANGEbtrfsXFS Ϲݿ飬ݣ
+///  copy_file_rangeͬһļϵͳں˸ƣNFS ȿڷ˸ƣ
+/// ֻ Linux ʵ֣ƽ̨Ϸ 0
+/// \param[in,out] try_clone	Ƿ FICLONERANGEļϵͳ֧ʱΪ false
+/// \param[out] cloned			йݿֽ
+/// \return Ƶֽ֧֣ļϵͳϵںˣ߳ʱС len
+uint64_t local_copy_range (HANDLE from_handle, const uint64_t from, HANDLE to_handle, const uint64_t offset
+						, const uint64_t len, bool & try_clone, uint64_t & cloned)
+{
+	cloned = 0;
+	uint64_t done = 0;
+#if defined (__linux__) && defined (FICLONERANGE)
+	struct stat st;
+	if (try_clone && fstat (to_handle, &st) == 0 && st.st_blksize > 0) {
+		const uint64_t bs = (uint64_t)st.st_blksize;
+		if (from % bs == 0 && offset % bs == 0 && len >= bs) {
+			struct file_clone_range range;
+			range.src_fd = from_handle;
+			range.src_offset = from;
+			range.src_length = len - len % bs;
+			range.dest_offset = offset;
+			if (ioctl (to_handle, FICLONERANGE, &range) == 0)
+				cloned = done = range.src_length;
+			else if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV || errno == ENOSYS)
+				try_clone = false;
+		}
+	}
+#endif
+#if defined (__linux__) && defined (__NR_copy_file_range)
+	while (done < len) {
+		loff_t in = (loff_t)(from + done), out = (loff_t)(offset + done);
+		const size_t size = (size_t)(len - done > XDELTA_BUFFER_LEN ? XDELTA_BUFFER_LEN : len - done);
+		const long copied = syscall (__NR_copy_file_range, from_handle, &in, to_handle, &out, size, 0);
+		if (copied < 0 && errno == EINTR)
+			continue;
+		if (copied <= 0)
+			break;
+		done += (uint64_t)copied;
+	}
+#endif
+	return done;
+}
+
+/// \fn local_extent()
+/// \brief
+/// ȡļ offset ʼһݻ߿ն file_reader::get_extentfilsize ΪļС
+/// Linux  lseek  SEEK_DATA/SEEK_HOLEWindows  FSCTL_QUERY_ALLOCATED_RANGES
+/// ֧ʱļݡõָ룬ǰָ
+/// \return һǿնʱ true
+bool local_extent (HANDLE handle, const uint64_t offset, const uint64_t filsize, uint64_t & len)
+{
+	len = offset < filsize ? filsize - offset : 0;
+	if (len == 0)
+		return false;
+#ifdef _WIN32
+	FILE_ALLOCATED_RANGE_BUFFER query, range;
+	query.FileOffset.QuadPart = (LONGLONG)offset;
+	query.Length.QuadPart = (LONGLONG)len;
+	DWORD bytes = 0;
+	// ֻȡһΣ滹ʱ ERROR_MORE_DATA
+	if (!::DeviceIoControl (handle, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof (query)
+			, &range, sizeof (range), &bytes, 0) && ::GetLastError () != ERROR_MORE_DATA)
+		return false;
+	if (bytes < sizeof (range))
+		return true;	// 涼ûз䡣
+
+	const uint64_t start = (uint64_t)range.FileOffset.QuadPart;
+	if (start > offset) {
+		len = start - offset;
+		return true;
+	}
+	const uint64_t end = start + (uint64_t)range.Length.QuadPart;
+	if (end < filsize)
+		len = end - offset;
+	return false;
+#elif defined (SEEK_DATA) && defined (SEEK_HOLE)
+	const off_t cur = lseek (handle, 0, SEEK_CUR);
+	bool hole = false;
+	off_t pos = lseek (handle, (off_t)offset, SEEK_DATA);
+	if (pos < 0)
+		hole = (errno == ENXIO);	// ûݣʱݡ
+	else if ((uint64_t)pos > offset) {
+		len = (uint64_t)pos - offset;
+		hole = true;
+	}
+	else {
+		pos = lseek (handle, (off_t)offset, SEEK_HOLE);
+		if (pos > 0 && (uint64_t)pos < filsize)
+			len = (uint64_t)pos - offset;
+	}
+	if (cur >= 0)
+		lseek (handle, cur, SEEK_SET);
+	if (hole && offset + len > filsize)
+		len = filsize - offset;
+	return hole;
+#else
+	return false;
+#endif
+}
+
+/// \fn local_sparse()
+/// \brief
+/// ļǷпնLinux ϿĿռǷСļСWindows Ͽϡļԣ
+/// ûпնʱ local_extent ѯÿʡȥ lseek
+bool local_sparse (HANDLE handle)
+{
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+#ifdef _WIN32
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!::GetFileInformationByHandle (handle, &info))
+		return false;
+	return (info.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0;
+#elif defined (SEEK_DATA) && defined (SEEK_HOLE)
+	struct stat st;
+	if (fstat (handle, &st) != 0)
+		return false;
+	return (uint64_t)st.st_blocks * 512 < (uint64_t)st.st_size;
+#else
+	return false;
+#endif
+}
+
+bool f_local_freader::has_extents () const
+{
+	return local_sparse (f_handle_);
+}
+
+bool f_local_freader::get_extent (const uint64_t offset, uint64_t & len)
+{
+	if (f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	return local_extent (f_handle_, offset, get_file_size (), len);
+}
+
+int f_local_freader::read_at (const uint64_t offset, uchar_t * data, const uint32_t len)
+{
+	if (data == 0 || len == 0) {
+		std::string errmsg ("Parameter(s) not correct");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	if (f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	return local_pread (f_handle_, data, len, offset);
+}
+
 #ifdef _WIN32
 static uint64_t get_file_size (HANDLE handle)
 #else
@@ -236,6 +468,815 @@ uint64_t f_local_freader::seek_file (const uint64_t offset, const int whence)
 	return xdelta::seek_file (f_handle_, offset, whence, f_name_);
 }
 
+//////////// f_mmap_freader
+
+f_mmap_freader::f_mmap_freader (const std::string & path, const std::string & fname) :
+					f_handle_ (INVALID_HANDLE_VALUE),
+					f_mapping_ (0),
+					f_view_ (0),
+					f_view_offset_ (0),
+					f_view_len_ (0),
+					f_size_ (0),
+					f_pos_ (0),
+					f_name_ (path + SEPERATOR + fname),
+					f_path_ (path),
+					f_filename_ (fname)
+{
+}
+
+f_mmap_freader::f_mmap_freader (const std::string & fullname) :
+					f_handle_ (INVALID_HANDLE_VALUE),
+					f_mapping_ (0),
+					f_view_ (0),
+					f_view_offset_ (0),
+					f_view_len_ (0),
+					f_size_ (0),
+					f_pos_ (0),
+					f_name_ (fullname) ,
+					f_path_ (fullname.substr (0, get_sep_pos(fullname))) ,
+					f_filename_ (fullname.substr (get_sep_pos(fullname) + 1))
+{
+}
+
+f_mmap_freader::~f_mmap_freader ()
+{
+	close_file ();
+}
+
+bool f_mmap_freader::exist_file () const
+{
+	return xdelta::exist_file (f_name_);
+}
+
+void f_mmap_freader::open_file ()
+{
+	if (f_handle_ != INVALID_HANDLE_VALUE)
+		return;
+
+#ifdef _WIN32
+	f_handle_ = ::CreateFileA (f_name_.c_str (),
+							   GENERIC_READ, 
+							   FILE_SHARE_READ | FILE_SHARE_WRITE,
+							   0,
+							   OPEN_EXISTING,
+							   FILE_FLAG_SEQUENTIAL_SCAN,
+							   0);
+	if(f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg = fmt_string ("Can't not open file %s.", f_name_.c_str ());
+		THROW_XDELTA_EXCEPTION (errmsg);
+	}
+	f_size_ = xdelta::get_file_size (f_handle_);
+	if (f_size_ > 0) {
+		f_mapping_ = ::CreateFileMappingA (f_handle_, 0, PAGE_READONLY, 0, 0, 0);
+		if (f_mapping_ == 0) {
+			std::string errmsg = fmt_string ("Can't not map file %s.", f_name_.c_str ());
+			close_file ();
+			THROW_XDELTA_EXCEPTION (errmsg);
+		}
+	}
+#else
+	f_handle_ = open (f_name_.c_str (), O_RDONLY | O_BINARY);
+	if (f_handle_ < 0) {
+		f_handle_ = INVALID_HANDLE_VALUE;
+		std::string errmsg = fmt_string ("Can't not open file %s.", f_name_.c_str ());
+		THROW_XDELTA_EXCEPTION (errmsg);
+	}
+	f_size_ = xdelta::get_file_size (f_name_);
+#endif
+	f_pos_ = 0;
+}
+
+void f_mmap_freader::unmap_view ()
+{
+	if (f_view_ == 0)
+		return;
+#ifdef _WIN32
+	::UnmapViewOfFile (f_view_);
+#else
+	munmap (f_view_, (size_t)f_view_len_);
+#endif
+	f_view_ = 0;
+	f_view_offset_ = 0;
+	f_view_len_ = 0;
+}
+
+void f_mmap_freader::close_file ()
+{
+	unmap_view ();
+#ifdef _WIN32
+	if (f_mapping_ != 0) {
+		::CloseHandle ((HANDLE)f_mapping_);
+		f_mapping_ = 0;
+	}
+	if (f_handle_ != INVALID_HANDLE_VALUE) {
+		::CloseHandle (f_handle_);
+		f_handle_ = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (f_handle_ != -1) {
+		close (f_handle_);
+		f_handle_ = -1;
+	}
+#endif
+	f_size_ = 0;
+	f_pos_ = 0;
+}
+
+const uchar_t * f_mmap_freader::map_file (const uint64_t offset, const uint32_t len)
+{
+	if (f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	if (offset + len > f_size_ || len > MMAP_WINDOW_LEN) {
+		std::string errmsg = fmt_string ("Map out of range of file %s.", f_name_.c_str ());
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	if (len == 0)
+		return f_view_;
+
+	if (f_view_ == 0 || offset < f_view_offset_ || offset + len > f_view_offset_ + f_view_len_) {
+		unmap_view ();
+
+		// 64 λƽ̨ӳļ32 λƽ̨ϴ offset ڵĶλӳһڡ
+		uint64_t start = 0;
+		uint64_t length = f_size_;
+#if BIT32_PLATFORM
+	#ifdef _WIN32
+		SYSTEM_INFO si;
+		GetSystemInfo (&si);
+		const uint64_t granularity = si.dwAllocationGranularity;
+	#else
+		const uint64_t granularity = (uint64_t)sysconf (_SC_PAGESIZE);
+	#endif
+		start = offset - offset % granularity;
+		if (length - start > MMAP_WINDOW_LEN + granularity)
+			length = MMAP_WINDOW_LEN + granularity;
+		else
+			length -= start;
+#endif
+
+#ifdef _WIN32
+		void * view = ::MapViewOfFile ((HANDLE)f_mapping_, FILE_MAP_READ, (DWORD)(start >> 32)
+									, (DWORD)(start & 0xFFFFFFFF), (SIZE_T)length);
+		if (view == 0) {
+			std::string errmsg = fmt_string ("Can't not map file %s.", f_name_.c_str ());
+			THROW_XDELTA_EXCEPTION (errmsg);
+		}
+#else
+		void * view = mmap (0, (size_t)length, PROT_READ, MAP_SHARED, f_handle_, (off_t)start);
+		if (view == MAP_FAILED) {
+			std::string errmsg = fmt_string ("Can't not map file %s.", f_name_.c_str ());
+			THROW_XDELTA_EXCEPTION (errmsg);
+		}
+	#ifdef MADV_SEQUENTIAL
+		madvise (view, (size_t)length, MADV_SEQUENTIAL);
+	#endif
+#endif
+		f_view_ = (uchar_t *)view;
+		f_view_offset_ = start;
+		f_view_len_ = length;
+	}
+
+	uchar_t * data = f_view_ + (offset - f_view_offset_);
+#if !defined (_WIN32) && defined (MADV_WILLNEED)
+	// ǰҪõݣmadvise Ҫʼַҳ롣
+	const uint64_t pagesize = (uint64_t)sysconf (_SC_PAGESIZE);
+	uchar_t * page = f_view_ + (offset - f_view_offset_) / pagesize * pagesize;
+	madvise (page, (size_t)(data + len - page), MADV_WILLNEED);
+#endif
+	return data;
+}
+
+int f_mmap_freader::read_file (uchar_t * data, const uint32_t len)
+{
+	int size = read_at (f_pos_, data, len);
+	if (size > 0)
+		f_pos_ += size;
+	return size;
+}
+
+int f_mmap_freader::read_at (const uint64_t offset, uchar_t * data, const uint32_t len)
+{
+	if (data == 0 || len == 0) {
+		std::string errmsg ("Parameter(s) not correct");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	if (offset >= f_size_)
+		return 0;
+
+	uint32_t size = len > MMAP_WINDOW_LEN ? MMAP_WINDOW_LEN : len;
+	if (offset + size > f_size_)
+		size = (uint32_t)(f_size_ - offset);
+	memcpy (data, map_file (offset, size), size);
+	return (int)size;
+}
+
+bool f_mmap_freader::has_extents () const
+{
+	return local_sparse (f_handle_);
+}
+
+bool f_mmap_freader::get_extent (const uint64_t offset, uint64_t & len)
+{
+	if (f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	return local_extent (f_handle_, offset, f_size_, len);
+}
+
+uint64_t f_mmap_freader::seek_file (const uint64_t offset, const int whence)
+{
+	if (f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	if (whence == FILE_BEGIN)
+		f_pos_ = offset;
+	else if (whence == FILE_CURRENT)
+		f_pos_ += offset;
+	else
+		f_pos_ = f_size_ + offset;
+	return f_pos_;
+}
+
+//////////// f_async_freader
+
+/// \class
+/// \brief f_async_freader ύķʽ
+class async_engine
+{
+public:
+	virtual ~async_engine () {}
+	/// \brief
+	/// ύһtag ʱԭء
+	virtual void submit (const uint64_t tag, const uint64_t offset, uchar_t * buf, const uint32_t len) = 0;
+	/// \brief
+	/// ȴһɣ׳쳣close_file ʱȴ
+	/// \param[out] tag	 tag
+	/// \param[out] res	ֽʱΪĴ롣
+	/// \return ٵȴʱ io_uring_enter ʧܣؼ٣errno Ϊ롣
+	virtual bool try_wait (uint64_t & tag, int & res) = 0;
+	/// \brief
+	///  try_wait ͬܵȴʱ׳쳣
+	void wait (uint64_t & tag, int & res)
+	{
+		if (!try_wait (tag, res)) {
+			std::string errmsg ("Can't wait for read request.");
+			THROW_XDELTA_EXCEPTION (errmsg);
+		}
+	}
+	virtual bool is_uring () const { return false; }
+};
+
+/// \class
+/// \brief һ߳ pread ɶ󣬲֧ io_uring ϵͳʹá
+class pread_engine : public async_engine
+{
+	struct request
+	{
+		uint64_t	tag;
+		uint64_t	offset;
+		uchar_t *	buf;
+		uint32_t	len;
+	};
+	struct result
+	{
+		uint64_t	tag;
+		int			res;
+	};
+
+	HANDLE					handle_;
+	mutex					lock_;
+	condition_variable		cond_;
+	std::deque<request>		requests_;
+	std::deque<result>		results_;
+	bool					stop_;
+	std::vector<thread *>	threads_;
+
+	static void worker (void * data)
+	{
+		pread_engine * pe = (pread_engine *)data;
+		while (true) {
+			request req;
+			{
+				lock_guard<mutex> guard (pe->lock_);
+				while (pe->requests_.empty () && !pe->stop_)
+					pe->cond_.wait (pe->lock_);
+				if (pe->stop_)
+					return;
+				req = pe->requests_.front ();
+				pe->requests_.pop_front ();
+			}
+
+			int size = local_pread (pe->handle_, req.buf, req.len, req.offset);
+#ifdef _WIN32
+			result res = { req.tag, size < 0 ? -(int)::GetLastError () : size };
+#else
+			result res = { req.tag, size < 0 ? -errno : size };
+#endif
+			lock_guard<mutex> guard (pe->lock_);
+			pe->results_.push_back (res);
+			pe->cond_.notify_all ();
+		}
+	}
+public:
+	pread_engine (HANDLE handle, const uint32_t threads) : handle_ (handle), stop_ (false)
+	{
+		for (uint32_t i = 0; i < threads; ++i)
+			threads_.push_back (new thread (worker, this));
+	}
+	~pread_engine ()
+	{
+		{
+			lock_guard<mutex> guard (lock_);
+			stop_ = true;
+			cond_.notify_all ();
+		}
+		for (size_t i = 0; i < threads_.size (); ++i) {
+			threads_[i]->join ();
+			delete threads_[i];
+		}
+	}
+	virtual void submit (const uint64_t tag, const uint64_t offset, uchar_t * buf, const uint32_t len)
+	{
+		request req = { tag, offset, buf, len };
+		lock_guard<mutex> guard (lock_);
+		requests_.push_back (req);
+		cond_.notify_all ();
+	}
+	virtual bool try_wait (uint64_t & tag, int & res)
+	{
+		lock_guard<mutex> guard (lock_);
+		while (results_.empty ())
+			cond_.wait (lock_);
+		tag = results_.front ().tag;
+		res = results_.front ().res;
+		results_.pop_front ();
+		return true;
+	}
+};
+
+#ifdef XDELTA_IO_URING
+/// \class
+/// \brief  io_uring ύֱʹϵͳã liburing
+class uring_engine : public async_engine
+{
+	int				fd_;
+	HANDLE			handle_;
+	void *			sq_ptr_;
+	size_t			sq_len_;
+	void *			cq_ptr_;
+	size_t			cq_len_;
+	io_uring_sqe *	sqes_;
+	size_t			sqes_len_;
+	unsigned *		sq_tail_;
+	unsigned *		sq_mask_;
+	unsigned *		sq_array_;
+	unsigned *		cq_head_;
+	unsigned *		cq_tail_;
+	unsigned *		cq_mask_;
+	io_uring_cqe *	cqes_;
+
+	int enter (const unsigned to_submit, const unsigned min_complete, const unsigned flags)
+	{
+		return (int)syscall (__NR_io_uring_enter, fd_, to_submit, min_complete, flags, 0, 0);
+	}
+	void release ()
+	{
+		if (sqes_ != 0)
+			munmap (sqes_, sqes_len_);
+		if (cq_ptr_ != 0 && cq_ptr_ != sq_ptr_)
+			munmap (cq_ptr_, cq_len_);
+		if (sq_ptr_ != 0)
+			munmap (sq_ptr_, sq_len_);
+		if (fd_ >= 0)
+			close (fd_);
+		fd_ = -1;
+		sq_ptr_ = cq_ptr_ = 0;
+		sqes_ = 0;
+	}
+public:
+	uring_engine (HANDLE handle, const uint32_t entries) : fd_ (-1), handle_ (handle)
+		, sq_ptr_ (0), sq_len_ (0), cq_ptr_ (0), cq_len_ (0), sqes_ (0), sqes_len_ (0)
+	{
+		io_uring_params p;
+		memset (&p, 0, sizeof (p));
+		fd_ = (int)syscall (__NR_io_uring_setup, entries, &p);
+		// IORING_OP_READ  5.6 ʼ֧֣汾ͬʱ IORING_FEAT_RW_CUR_POS
+		if (fd_ < 0 || (p.features & IORING_FEAT_RW_CUR_POS) == 0) {
+			release ();
+			return;
+		}
+
+		sq_len_ = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+		cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof (io_uring_cqe);
+		const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single && cq_len_ > sq_len_)
+			sq_len_ = cq_len_;
+
+		sq_ptr_ = mmap (0, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, IORING_OFF_SQ_RING);
+		if (sq_ptr_ == MAP_FAILED) {
+			sq_ptr_ = 0;
+			release ();
+			return;
+		}
+		cq_ptr_ = single ? sq_ptr_ : mmap (0, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED
+											, fd_, IORING_OFF_CQ_RING);
+		if (cq_ptr_ == MAP_FAILED) {
+			cq_ptr_ = 0;
+			release ();
+			return;
+		}
+		sqes_len_ = p.sq_entries * sizeof (io_uring_sqe);
+		void * sqes = mmap (0, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) {
+			release ();
+			return;
+		}
+
+		sqes_ = (io_uring_sqe *)sqes;
+		sq_tail_ = (unsigned *)((char *)sq_ptr_ + p.sq_off.tail);
+		sq_mask_ = (unsigned *)((char *)sq_ptr_ + p.sq_off.ring_mask);
+		sq_array_ = (unsigned *)((char *)sq_ptr_ + p.sq_off.array);
+		cq_head_ = (unsigned *)((char *)cq_ptr_ + p.cq_off.head);
+		cq_tail_ = (unsigned *)((char *)cq_ptr_ + p.cq_off.tail);
+		cq_mask_ = (unsigned *)((char *)cq_ptr_ + p.cq_off.ring_mask);
+		cqes_ = (io_uring_cqe *)((char *)cq_ptr_ + p.cq_off.cqes);
+	}
+	~uring_engine () { release (); }
+	bool ok () const { return fd_ >= 0; }
+	virtual bool is_uring () const { return true; }
+	/// \brief
+	/// ͬʱύʱ entriesύв
+	virtual void submit (const uint64_t tag, const uint64_t offset, uchar_t * buf, const uint32_t len)
+	{
+		const unsigned tail = *sq_tail_;
+		const unsigned index = tail & *sq_mask_;
+		io_uring_sqe * sqe = &sqes_[index];
+		memset (sqe, 0, sizeof (*sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = handle_;
+		sqe->addr = (unsigned long)buf;
+		sqe->len = len;
+		sqe->off = offset;
+		sqe->user_data = tag;
+		sq_array_[index] = index;
+		__atomic_store_n (sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+		int ret;
+		while ((ret = enter (1, 0, 0)) < 0 && errno == EINTR)
+			;
+		if (ret < 0) {
+			std::string errmsg ("Can't submit read request.");
+			THROW_XDELTA_EXCEPTION (errmsg);
+		}
+	}
+	virtual bool try_wait (uint64_t & tag, int & res)
+	{
+		while (true) {
+			const unsigned head = *cq_head_;
+			if (head != __atomic_load_n (cq_tail_, __ATOMIC_ACQUIRE)) {
+				const io_uring_cqe & cqe = cqes_[head & *cq_mask_];
+				tag = cqe.user_data;
+				res = cqe.res;
+				__atomic_store_n (cq_head_, head + 1, __ATOMIC_RELEASE);
+				return true;
+			}
+			if (enter (0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+				return false;
+		}
+	}
+};
+#endif
+
+f_async_freader::f_async_freader (const std::string & path, const std::string & fname, const bool use_uring) :
+					f_handle_ (INVALID_HANDLE_VALUE),
+					f_use_uring_ (use_uring),
+					f_engine_ (0),
+					f_ring_ (0),
+					f_slots_ (0),
+					f_base_ (0),
+					f_keep_ (0),
+					f_next_ (0),
+					f_inflight_ (0),
+					f_size_ (0),
+					f_pos_ (0),
+					f_name_ (path + SEPERATOR + fname),
+					f_path_ (path),
+					f_filename_ (fname)
+{
+}
+
+f_async_freader::f_async_freader (const std::string & fullname, const bool use_uring) :
+					f_handle_ (INVALID_HANDLE_VALUE),
+					f_use_uring_ (use_uring),
+					f_engine_ (0),
+					f_ring_ (0),
+					f_slots_ (0),
+					f_base_ (0),
+					f_keep_ (0),
+					f_next_ (0),
+					f_inflight_ (0),
+					f_size_ (0),
+					f_pos_ (0),
+					f_name_ (fullname) ,
+					f_path_ (fullname.substr (0, get_sep_pos(fullname))) ,
+					f_filename_ (fullname.substr (get_sep_pos(fullname) + 1))
+{
+}
+
+f_async_freader::~f_async_freader ()
+{
+	try {
+		close_file ();
+	}
+	catch (...) {
+	}
+}
+
+bool f_async_freader::exist_file () const
+{
+	return xdelta::exist_file (f_name_);
+}
+
+bool f_async_freader::can_map () const
+{
+	return f_ring_ != 0 && f_ring_->mirrored ();
+}
+
+bool f_async_freader::using_uring () const
+{
+	return f_engine_ != 0 && f_engine_->is_uring ();
+}
+
+void f_async_freader::open_file ()
+{
+	if (f_handle_ != INVALID_HANDLE_VALUE)
+		return;
+
+#ifdef _WIN32
+	f_handle_ = ::CreateFileA (f_name_.c_str (),
+							   GENERIC_READ,
+							   FILE_SHARE_READ | FILE_SHARE_WRITE,
+							   0,
+							   OPEN_EXISTING,
+							   FILE_ATTRIBUTE_NORMAL,
+							   0);
+	if(f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg = fmt_string ("Can't not open file %s.", f_name_.c_str ());
+		THROW_XDELTA_EXCEPTION (errmsg);
+	}
+	f_size_ = xdelta::get_file_size (f_handle_);
+#else
+	f_handle_ = open (f_name_.c_str (), O_RDONLY | O_BINARY);
+	if (f_handle_ < 0) {
+		f_handle_ = INVALID_HANDLE_VALUE;
+		std::string errmsg = fmt_string ("Can't not open file %s.", f_name_.c_str ());
+		THROW_XDELTA_EXCEPTION (errmsg);
+	}
+	f_size_ = xdelta::get_file_size (f_name_);
+#endif
+
+	try {
+		// Ҫܷ map_file һȡݣ XDELTA_BUFFER_LENܲĿʼ
+		// ȡټǰ
+		f_slots_ = XDELTA_BUFFER_LEN / ASYNC_READ_LEN + ASYNC_READ_DEPTH;
+		f_ring_ = new ring_buffer (f_slots_ * ASYNC_READ_LEN);
+		f_chunk_.assign (f_slots_, 0);
+		f_got_.assign (f_slots_, 0);
+		f_busy_.assign (f_slots_, 0);
+
+#ifdef XDELTA_IO_URING
+		if (f_use_uring_) {
+			uring_engine * engine = new uring_engine (f_handle_, ASYNC_READ_DEPTH);
+			if (engine->ok ())
+				f_engine_ = engine;
+			else
+				delete engine;
+		}
+#endif
+		if (f_engine_ == 0)
+			f_engine_ = new pread_engine (f_handle_, ASYNC_READ_DEPTH);
+	}
+	catch (...) {
+		close_file ();
+		throw;
+	}
+
+	f_pos_ = 0;
+	restart (0);
+}
+
+void f_async_freader::close_file ()
+{
+	// ȴѾύɣдѾͷŵĻȲʱȷں
+	// д룬ֻòͷŻ
+	bool drained = true;
+	while (f_engine_ != 0 && f_inflight_ > 0) {
+		uint64_t tag;
+		int res;
+		if (!f_engine_->try_wait (tag, res)) {
+			drained = false;
+			break;
+		}
+		--f_inflight_;
+	}
+	f_inflight_ = 0;
+	delete f_engine_;
+	f_engine_ = 0;
+	if (drained)
+		delete f_ring_;
+	f_ring_ = 0;
+
+#ifdef _WIN32
+	if (f_handle_ != INVALID_HANDLE_VALUE) {
+		::CloseHandle (f_handle_);
+		f_handle_ = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (f_handle_ != -1) {
+		close (f_handle_);
+		f_handle_ = -1;
+	}
+#endif
+	f_size_ = 0;
+	f_pos_ = 0;
+}
+
+/// \brief
+/// ȴѾύɣȻ offset ʼύ
+void f_async_freader::restart (const uint64_t offset)
+{
+	while (f_inflight_ > 0)
+		complete_read ();
+	f_base_ = offset;
+	f_keep_ = 0;
+	f_next_ = 0;
+	f_busy_.assign (f_slots_, 0);
+	submit_reads ();
+}
+
+/// \brief
+/// ڲ ASYNC_READ_DEPTH 󡢲ǻҪݵǰ£ύ
+void f_async_freader::submit_reads ()
+{
+	while (f_inflight_ < ASYNC_READ_DEPTH && f_next_ < f_keep_ + f_slots_) {
+		const uint64_t offset = f_base_ + f_next_ * ASYNC_READ_LEN;
+		if (offset >= f_size_)
+			break;
+		const uint32_t slot = (uint32_t)(f_next_ % f_slots_);
+		if (f_busy_[slot])	// ûɡ
+			break;
+
+		const uint64_t left = f_size_ - offset;
+		const uint32_t len = left > ASYNC_READ_LEN ? ASYNC_READ_LEN : (uint32_t)left;
+		f_chunk_[slot] = f_next_;
+		f_got_[slot] = 0;
+		f_busy_[slot] = 1;
+		f_engine_->submit (f_next_, offset, f_ring_->begin () + slot * ASYNC_READ_LEN, len);
+		++f_inflight_;
+		++f_next_;
+	}
+}
+
+/// \brief
+/// ȴһɣûжʱύʣµĲ֡
+void f_async_freader::complete_read ()
+{
+	uint64_t tag;
+	int res;
+	f_engine_->wait (tag, res);
+	--f_inflight_;
+
+	const uint32_t slot = (uint32_t)(tag % f_slots_);
+	if (res <= 0) {
+		f_busy_[slot] = 0;
+		f_chunk_[slot] = (uint64_t)-1;
+		errno = -res;
+		std::string errmsg = fmt_string ("Can't not read file %s.", f_name_.c_str ());
+		if (res == 0)
+			THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+		THROW_XDELTA_EXCEPTION (errmsg);
+	}
+
+	f_got_[slot] += res;
+	const uint64_t offset = f_base_ + tag * ASYNC_READ_LEN;
+	const uint64_t left = f_size_ - offset;
+	const uint32_t len = left > ASYNC_READ_LEN ? ASYNC_READ_LEN : (uint32_t)left;
+	if (f_got_[slot] < len) {
+		f_engine_->submit (tag, offset + f_got_[slot]
+			, f_ring_->begin () + slot * ASYNC_READ_LEN + f_got_[slot], len - f_got_[slot]);
+		++f_inflight_;
+		return;
+	}
+	f_busy_[slot] = 0;
+}
+
+bool f_async_freader::chunk_ready (const uint64_t chunk) const
+{
+	const uint32_t slot = (uint32_t)(chunk % f_slots_);
+	return chunk < f_next_ && f_chunk_[slot] == chunk && !f_busy_[slot];
+}
+
+/// \brief
+/// ֤ offset ʼ len ֽѾ룬ڻλеλá
+uint32_t f_async_freader::fetch (const uint64_t offset, const uint32_t len)
+{
+	if (f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	if (offset + len > f_size_ || len > (f_slots_ - 1) * ASYNC_READ_LEN) {
+		std::string errmsg = fmt_string ("Read out of range of file %s.", f_name_.c_str ());
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+
+	if (offset < f_base_ + f_keep_ * ASYNC_READ_LEN
+		|| (offset - f_base_) / ASYNC_READ_LEN > f_next_)
+		restart (offset);
+
+	f_keep_ = (offset - f_base_) / ASYNC_READ_LEN;
+	const uint64_t last = (offset + len - f_base_ + ASYNC_READ_LEN - 1) / ASYNC_READ_LEN;
+	for (uint64_t chunk = f_keep_; chunk < last; ++chunk) {
+		submit_reads ();
+		while (!chunk_ready (chunk)) {
+			complete_read ();
+			submit_reads ();
+		}
+	}
+	submit_reads ();
+	return (uint32_t)((offset - f_base_) % ((uint64_t)f_slots_ * ASYNC_READ_LEN));
+}
+
+const uchar_t * f_async_freader::map_file (const uint64_t offset, const uint32_t len)
+{
+	if (!can_map ()) {
+		std::string errmsg ("Can't map file without a mirrored buffer.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	return f_ring_->begin () + fetch (offset, len);
+}
+
+int f_async_freader::read_at (const uint64_t offset, uchar_t * data, const uint32_t len)
+{
+	if (data == 0 || len == 0) {
+		std::string errmsg ("Parameter(s) not correct");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	if (offset >= f_size_)
+		return 0;
+
+	uint32_t size = len > ASYNC_READ_LEN ? ASYNC_READ_LEN : len;
+	if (offset + size > f_size_)
+		size = (uint32_t)(f_size_ - offset);
+	const uint32_t pos = fetch (offset, size);
+	// ˫ӳʱԽĽβٶһЩ
+	const uint32_t ring_len = f_slots_ * ASYNC_READ_LEN;
+	if (!f_ring_->mirrored () && pos + size > ring_len)
+		size = ring_len - pos;
+	memcpy (data, f_ring_->begin () + pos, size);
+	return (int)size;
+}
+
+int f_async_freader::read_file (uchar_t * data, const uint32_t len)
+{
+	int size = read_at (f_pos_, data, len);
+	if (size > 0)
+		f_pos_ += size;
+	return size;
+}
+
+bool f_async_freader::has_extents () const
+{
+	return local_sparse (f_handle_);
+}
+
+bool f_async_freader::get_extent (const uint64_t offset, uint64_t & len)
+{
+	if (f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	return local_extent (f_handle_, offset, f_size_, len);
+}
+
+uint64_t f_async_freader::seek_file (const uint64_t offset, const int whence)
+{
+	if (f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	if (whence == FILE_BEGIN)
+		f_pos_ = offset;
+	else if (whence == FILE_CURRENT)
+		f_pos_ += offset;
+	else
+		f_pos_ = f_size_ + offset;
+	return f_pos_;
+}
+
 //////////// f_local_fwriter
 
 
@@ -453,5 +1494,106 @@ void f_local_fwriter::set_file_size (uint64_t filsize)
 	}	
 }
 
+int file_writer::write_at (const uint64_t offset, const uchar_t * data, const uint32_t len)
+{
+	if (seek_file (offset, FILE_BEGIN) != offset) {
+		std::string errmsg = fmt_string ("Can't seek file %s(%s)."
+			, get_fname ().c_str (), error_msg ().c_str ());
+		THROW_XDELTA_EXCEPTION (errmsg);
+	}
+	return write_file (data, len);
+}
+
+int f_local_fwriter::write_at (const uint64_t offset, const uchar_t * data, const uint32_t len)
+{
+	if (data == 0) {
+		std::string errmsg ("Parameter(s) not correct");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	if (f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	const int size = local_pwrite (f_handle_, data, len, offset);
+	if (size < 0) {
+		std::string errmsg = fmt_string ("Can't not write file %s.", f_name_.c_str ());
+		THROW_XDELTA_EXCEPTION (errmsg);
+	}
+	return size;
+}
+
+uint64_t f_local_fwriter::copy_range (const f_local_freader & reader, const uint64_t from, const uint64_t offset
+									, const uint64_t len, bool & try_clone, uint64_t & cloned)
+{
+	if (f_handle_ == INVALID_HANDLE_VALUE || reader.f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+	return local_copy_range (reader.f_handle_, from, f_handle_, offset, len, try_clone, cloned);
+}
+
+void file_writer::write_zero (const uint64_t offset, const uint64_t len)
+{
+	const uint32_t buflen = (uint32_t)(len > XDELTA_BUFFER_LEN ? XDELTA_BUFFER_LEN : len);
+	if (buflen == 0)
+		return;
+
+	std::vector<uchar_t> zeros (buflen, 0);
+	seek_file (offset, FILE_BEGIN);
+	for (uint64_t pos = 0; pos < len;) {
+		const uint32_t size = (uint32_t)(len - pos > buflen ? buflen : len - pos);
+		write_file (&zeros[0], size);
+		pos += size;
+	}
+}
+
+/// \fn punch_hole()
+/// \brief
+/// ͷļһռõĿռ䣬 0ļС䡣Linux  fallocate 
+/// FALLOC_FL_PUNCH_HOLEWindows ȱΪϡļ FSCTL_SET_ZERO_DATA
+/// \return ļϵͳ֧ʱ false
+static bool punch_hole (HANDLE handle, const uint64_t offset, const uint64_t len)
+{
+#ifdef _WIN32
+	DWORD bytes = 0;
+	if (!::DeviceIoControl (handle, FSCTL_SET_SPARSE, 0, 0, 0, 0, &bytes, 0))
+		return false;
+	FILE_ZERO_DATA_INFORMATION zero;
+	zero.FileOffset.QuadPart = (LONGLONG)offset;
+	zero.BeyondFinalZero.QuadPart = (LONGLONG)(offset + len);
+	return ::DeviceIoControl (handle, FSCTL_SET_ZERO_DATA, &zero, sizeof (zero), 0, 0, &bytes, 0) != FALSE;
+#elif defined (FALLOC_FL_PUNCH_HOLE)
+	return fallocate (handle, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)len) == 0;
+#else
+	return false;
+#endif
+}
+
+void f_local_fwriter::write_zero (const uint64_t offset, const uint64_t len)
+{
+	if (len == 0)
+		return;
+	if (f_handle_ == INVALID_HANDLE_VALUE) {
+		std::string errmsg ("File not open.");
+		THROW_XDELTA_EXCEPTION_NO_ERRNO (errmsg);
+	}
+
+	// ļеĲִ򶴣֧ʱд 0ĲչļµĲֱǿն
+	const uint64_t size = get_file_size ();
+	const uint64_t end = offset + len;
+	if (offset < size) {
+		const uint64_t inner = end > size ? size - offset : len;
+		if (!punch_hole (f_handle_, offset, inner))
+			file_writer::write_zero (offset, inner);
+	}
+	if (end > size) {
+#ifdef _WIN32
+		DWORD bytes = 0;	// ϡļչĲֲŲռ䡣
+		::DeviceIoControl (f_handle_, FSCTL_SET_SPARSE, 0, 0, 0, 0, &bytes, 0);
+#endif
+		set_file_size (end);
+	}
+}
+
 } //namespace xdelta
 
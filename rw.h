@@ -38,6 +38,18 @@ public:
 	virtual int read_file (uchar_t * data, const uint32_t len) 
 	{ THROW_XDELTA_EXCEPTION ("Not implemented.!"); return -1 ;}
 	/// \brief
+	/// ļ offset ݡĬ seek_file  read_fileıָ룻԰λ
+	/// дʹҲıָ룬ʡȥһζλ
+	/// \param[in] offset	ļеƫơ
+	/// \param[out] data	ݻ
+	/// \param[in] len		ļĳȡ
+	/// \return ضȡֽ
+	virtual int read_at (const uint64_t offset, uchar_t * data, const uint32_t len);
+	/// \brief
+	/// ߳Ƿͬʱ read_at
+	/// \return ĬΪ false
+	virtual bool concurrent_read () const { return false; }
+	/// \brief
 	/// رļ
 	/// \return ûз
 	virtual void close_file () { THROW_XDELTA_EXCEPTION ("Not implemented.!"); }
@@ -58,6 +70,31 @@ public:
 	/// жļǷڡ
 	/// \return ڣ򷵻 trueڣ޷򿪣򷵻 false
 	virtual bool exist_file () const { THROW_XDELTA_EXCEPTION ("Not implemented.!"); return false; }
+	/// \brief
+	/// Ƿ map_file ֱӷļݣʱֻ read_file ȡ
+	/// \return ĬΪ false
+	virtual bool can_map () const { return false; }
+	/// \brief
+	/// ȡļһݵָ룬ݣҲıָ롣ָһε map_file
+	/// read_file رļ֮ǰЧ
+	/// \param[in] offset	ļеƫơ
+	/// \param[in] len		ݵĳȣܳļҲܴ XDELTA_BUFFER_LEN
+	/// \return ݵָ롣
+	virtual const uchar_t * map_file (const uint64_t offset, const uint32_t len)
+	{ THROW_XDELTA_EXCEPTION ("Not implemented.!"); return 0; }
+	/// \brief
+	/// Ƿ get_extent ȡļնķֲʱܵļݡ
+	/// ÿ read_and_hashread_and_delta һΣļûпնʱҲӦ falseʡȥѯ
+	/// \return ĬΪ false
+	virtual bool has_extents () const { return false; }
+	/// \brief
+	/// ȡô offset ʼһݻ߿ննϡļûзռĲ֣
+	/// ȫ 0Բıָ롣
+	/// \param[in] offset	ļеƫơ
+	/// \param[out] len		һεĳȣļĽβ
+	/// \return һǿնʱ true
+	virtual bool get_extent (const uint64_t offset, uint64_t & len)
+	{ THROW_XDELTA_EXCEPTION ("Not implemented.!"); return false; }
 };
 /// \class
 /// \brief ļд࣬ҪдԼƽ̨ļдࡣ
@@ -76,6 +113,14 @@ public:
 	/// \return дֽ
 	virtual int write_file (const uchar_t * data, const uint32_t len) { THROW_XDELTA_EXCEPTION ("Not implemented.!"); }
 	/// \brief
+	/// дļ offset Ĭ seek_file  write_fileıдָ룻԰λ
+	/// ддʹҲıдָ룬ʡȥһζλ
+	/// \param[in] offset	ļеƫơ
+	/// \param[in] data		ݻ
+	/// \param[in] len		дļĳȡ
+	/// \return дֽ
+	virtual int write_at (const uint64_t offset, const uchar_t * data, const uint32_t len);
+	/// \brief
 	/// رļ
 	/// \return ûз
 	virtual void close_file () { THROW_XDELTA_EXCEPTION ("Not implemented.!"); }
@@ -99,6 +144,12 @@ public:
 	/// ļССļԭСضϣдʱдܵļƽ̨
 	/// \return ޷ء
 	virtual void set_file_size (uint64_t filszie) { THROW_XDELTA_EXCEPTION ("Not implemented.!"); }
+	/// \brief
+	/// ļ offset ʼ len ֽдΪ 0 xdelta_stream::add_zeroļʱչļ
+	/// Ĭ϶λд 0֧ϡļдֱ¿ն֮дָλòȷ
+	/// д֮ǰҪ seek_file
+	/// \return ޷ء
+	virtual void write_zero (const uint64_t offset, const uint64_t len);
 };
 
 /// \class
@@ -106,11 +157,15 @@ public:
 class DLL_EXPORT f_local_freader : public file_reader {
 	virtual void open_file ();
 	virtual int read_file (uchar_t * data, const uint32_t len);
+	virtual int read_at (const uint64_t offset, uchar_t * data, const uint32_t len);
+	virtual bool concurrent_read () const { return true; }
 	virtual void close_file ();
 	virtual std::string get_fname () const { return f_filename_; }
 	virtual uint64_t get_file_size () const;
 	virtual uint64_t seek_file (const uint64_t offset, const int whence);
 	virtual bool exist_file () const;
+	virtual bool has_extents () const;
+	virtual bool get_extent (const uint64_t offset, uint64_t & len);
 private:
 	HANDLE f_handle_;
 	const std::string f_name_;
@@ -120,21 +175,130 @@ public:
 	f_local_freader (const std::string & path, const std::string & fname);
 	f_local_freader (const std::string & fullname);
 	~f_local_freader();
+	friend class f_local_fwriter; // copy_range Ҫļ
 };
 
 int local_read (HANDLE handle, uchar_t * data, const uint32_t len);
+int local_pread (HANDLE handle, uchar_t * data, const uint32_t len, const uint64_t offset);
+int local_pwrite (HANDLE handle, const uchar_t * data, const uint32_t len, const uint64_t offset);
+uint64_t local_copy_range (HANDLE from_handle, const uint64_t from, HANDLE to_handle, const uint64_t offset
+						, const uint64_t len, bool & try_clone, uint64_t & cloned);
+bool local_extent (HANDLE handle, const uint64_t offset, const uint64_t filsize, uint64_t & len);
+bool local_sparse (HANDLE handle);
+
+/// 32 λƽ̨ f_mmap_freader ÿӳĴڳȣmap_file һȡôݣ
+/// С XDELTA_BUFFER_LEN
+#define MMAP_WINDOW_LEN ((uint32_t)1 << 26) // 64MB
+
+/// \class
+/// ڴӳȡļmap_file ֱӷӳеָ룬ʡȥҳ渴ݡ
+/// 64 λƽ̨һӳļ32 λƽ̨ϵַռޣֻӳ MMAP_WINDOW_LEN 
+/// ڣʴʱӳ䡣ӳʱʾϵͳ˳ʲǰҪõݡ
+class DLL_EXPORT f_mmap_freader : public file_reader {
+	virtual void open_file ();
+	virtual int read_file (uchar_t * data, const uint32_t len);
+	virtual int read_at (const uint64_t offset, uchar_t * data, const uint32_t len);
+	virtual void close_file ();
+	virtual std::string get_fname () const { return f_filename_; }
+	virtual uint64_t get_file_size () const { return f_size_; }
+	virtual uint64_t seek_file (const uint64_t offset, const int whence);
+	virtual bool exist_file () const;
+	virtual bool has_extents () const;
+	virtual bool get_extent (const uint64_t offset, uint64_t & len);
+	virtual bool can_map () const { return true; }
+	virtual const uchar_t * map_file (const uint64_t offset, const uint32_t len);
+private:
+	void unmap_view ();
+	HANDLE f_handle_;
+	void * f_mapping_;			///< Windows ϵӳ
+	uchar_t * f_view_;			///< ǰӳĴڡ
+	uint64_t f_view_offset_;	///< ļеƫơ
+	uint64_t f_view_len_;
+	uint64_t f_size_;
+	uint64_t f_pos_;			///< read_file Ķָ롣
+	const std::string f_name_;
+	const std::string f_path_;
+	const std::string f_filename_;
+public:
+	f_mmap_freader (const std::string & path, const std::string & fname);
+	f_mmap_freader (const std::string & fullname);
+	~f_mmap_freader();
+};
+
+/// f_async_freader ÿĳȡ
+#define ASYNC_READ_LEN ((uint32_t)1 << 20) // 1MB
+
+/// f_async_freader ͬʱύĶ
+#define ASYNC_READ_DEPTH 8
+
+class async_engine;
+class ring_buffer;
+
+/// \class
+/// 첽ȡļڶָ루 map_file ȡݣ֮ʼձ ASYNC_READ_DEPTH 
+/// ASYNC_READ_LEN Ķ󣬶һ˫ӳĻλmap_file ֱӷеָ롣
+/// Linux  io_uring ύ󣻲֧ io_uringʱҪãʱͬ߳
+///  pread ȡѾݻûжʱȴѾύ
+/// ɺµλÿʼ
+class DLL_EXPORT f_async_freader : public file_reader {
+	virtual void open_file ();
+	virtual int read_file (uchar_t * data, const uint32_t len);
+	virtual int read_at (const uint64_t offset, uchar_t * data, const uint32_t len);
+	virtual void close_file ();
+	virtual std::string get_fname () const { return f_filename_; }
+	virtual uint64_t get_file_size () const { return f_size_; }
+	virtual uint64_t seek_file (const uint64_t offset, const int whence);
+	virtual bool exist_file () const;
+	virtual bool has_extents () const;
+	virtual bool get_extent (const uint64_t offset, uint64_t & len);
+	virtual bool can_map () const;
+	virtual const uchar_t * map_file (const uint64_t offset, const uint32_t len);
+private:
+	uint32_t fetch (const uint64_t offset, const uint32_t len);
+	void restart (const uint64_t offset);
+	void submit_reads ();
+	void complete_read ();
+	bool chunk_ready (const uint64_t chunk) const;
+
+	HANDLE f_handle_;
+	bool f_use_uring_;
+	async_engine * f_engine_;
+	ring_buffer * f_ring_;
+	uint32_t f_slots_;					///< λ ASYNC_READ_LEN ĸ
+	std::vector<uint64_t> f_chunk_;		///< ÿλϵš
+	std::vector<uint32_t> f_got_;		///< ÿλѾֽ
+	std::vector<char> f_busy_;			///< ÿλǷδɵ
+	uint64_t f_base_;					///<  0 ļеƫơ
+	uint64_t f_keep_;					///< Ҫĵһ
+	uint64_t f_next_;					///< һҪύ
+	uint32_t f_inflight_;
+	uint64_t f_size_;
+	uint64_t f_pos_;
+	const std::string f_name_;
+	const std::string f_path_;
+	const std::string f_filename_;
+public:
+	f_async_freader (const std::string & path, const std::string & fname, const bool use_uring = true);
+	f_async_freader (const std::string & fullname, const bool use_uring = true);
+	~f_async_freader();
+	/// \brief
+	/// Ƿ io_uringļЧ
+	bool using_uring () const;
+};
 
 /// \class
 /// ļ͡
 class DLL_EXPORT f_local_fwriter : public file_writer {
 	virtual void open_file ();
 	virtual int write_file (const uchar_t * data, const uint32_t len);
+	virtual int write_at (const uint64_t offset, const uchar_t * data, const uint32_t len);
 	virtual void close_file ();
 	virtual std::string get_fname () const { return f_filename_; }
 	virtual uint64_t get_file_size () const;
 	virtual uint64_t seek_file (uint64_t offset, int whence);
 	virtual bool exist_file () const;
 	virtual void set_file_size (uint64_t filszie);
+	virtual void write_zero (const uint64_t offset, const uint64_t len);
 private:
 	HANDLE f_handle_;
 	const std::string f_name_;
@@ -144,6 +308,14 @@ public:
 	f_local_fwriter (const std::string & path, const std::string & fname);
 	f_local_fwriter (const std::string & fullname);
 	~f_local_fwriter();
+	/// \brief
+	/// ںа reader  from  len ֽڸƵļ offset ûռ䣨 local_copy_range
+	/// ļҪѾ򿪡
+	/// \param[in,out] try_clone	Ƿ FICLONERANGEļϵͳ֧ʱΪ falseԺԡ
+	/// \param[out] cloned			йݿ飨reflinkֽ
+	/// \return Ƶֽ֧ʱС lenʣµɵԼд
+	uint64_t copy_range (const f_local_freader & reader, const uint64_t from, const uint64_t offset
+						, const uint64_t len, bool & try_clone, uint64_t & cloned);
 };
 
 /// \class
@@ -4,6 +4,7 @@
 #include <sys/stat.h>
 #include <assert.h>
 #include <set>
+#include <vector>
 #include <list>
 
 #ifdef _WIN32
@@ -36,6 +37,7 @@
 
 #include "mytypes.h"
 #include "tinythread.h"
+#include "ringbuf.h"
 #include "buffer.h"
 #include "platform.h"
 #include "md4.h"
@@ -133,6 +135,17 @@ unsigned write_pipe_handle (PIPE_HANDLE handle, uchar_t * buff, unsigned len)
 }
 #define BUFSIZE (1024*1024)
 
+// ϣ㷨еĵĸָ
+static int hash_type = XDELTA_HASH_MD4;
+// ǷļСضϣĸ -short ׺ʱ򿪡
+static bool short_hash = false;
+
+static void set_hash_len (void * inner_data, unsigned long long filesize, unsigned blklen)
+{
+	if (short_hash && inner_data != 0)
+		xdelta_set_hash_len (inner_data, xdelta_calc_hash_len (filesize, blklen));
+}
+
 int handle_this_node (const fh_t * head, file_reader * preader, PIPE_HANDLE wr)
 {
 	char_buffer<uchar_t> databuf (BUFSIZE);
@@ -151,6 +164,31 @@ int handle_this_node (const fh_t * head, file_reader * preader, PIPE_HANDLE wr)
 	return 0;
 }
 
+// Ƿ xdelta_hash_feed/xdelta_delta_feed ֱӴݣģʽ fдܵ
+static bool use_feed = false;
+
+// ÿδĳȲǿ鳤鼰ڻԽδ롣
+#define FEEDSIZE (BUFSIZE / 4 + 3)
+
+int feed_this_node (const fh_t * head, file_reader * preader, void * inner_data, bool hash)
+{
+	char_buffer<uchar_t> databuf (FEEDSIZE);
+	
+	unsigned long long b2r = head->len;
+	while (b2r > 0) {
+		unsigned readlen = b2r > FEEDSIZE ? FEEDSIZE : (unsigned)b2r;
+		int size = preader->read_file (databuf.begin (), readlen);
+		if (size <= 0)
+			return -1;
+		int ret = hash ? xdelta_hash_feed (inner_data, (char *)databuf.begin (), size)
+			: xdelta_delta_feed (inner_data, (char *)databuf.begin (), size);
+		if (ret != 0)
+			return -1;
+		b2r -= size;
+	}
+	return 0;
+}
+
 int read_and_write (file_reader * preader, file_writer * pwriter, unsigned blklen)
 {
 	char_buffer<uchar_t> databuf (BUFSIZE);
@@ -189,6 +227,48 @@ struct sync_stat
 					printf ("Radio(ident/(ident+diff)):%.6f\n", ((float)(s.identical_bytes))/(s.identical_bytes + s.different_bytes)); \
 
 
+// Ƿ xdelta_get_*_array_free_inner ȡĽģʽ a
+static bool use_array = false;
+// Ƿ xdelta_apply ļģʽ pk  jд
+static bool use_apply = false;
+// xdelta_apply_ex ѡģʽ k ʱںиͬĿ顣
+static int apply_flags = 0;
+
+// ֻͳƣ xdelta_apply ɡ
+static void count_items (const xit_t * head, sync_stat & s)
+{
+	for (const xit_t * p = head; p != 0; p = p->next) {
+		if (p->type == DT_IDENT) {
+			SYNC_IDENT(p);
+		}
+		else {
+			SYNC_DIFF(p);
+		}
+	}
+}
+
+static unsigned long long target_offset_of (const xit_t * p) { return get_target_offset ((xit_t *)p); }
+static unsigned long long target_offset_of (const xrec_t * p) { return get_record_target_offset (p); }
+
+// һļݣֶͬ
+template <class item_t>
+int construct_item (const item_t * p, file_reader * ptgtreader, file_reader * psrcreader
+					, file_writer * p_cstor_writer, sync_stat & s)
+{
+	if (p->type == DT_IDENT) {
+		SYNC_IDENT(p);
+		ptgtreader->seek_file (target_offset_of (p), FILE_BEGIN);
+		p_cstor_writer->seek_file (p->s_offset, FILE_BEGIN);
+		return read_and_write (ptgtreader, p_cstor_writer, p->blklen);
+	}
+	else { // (head->type == DT_DIFF)
+		SYNC_DIFF(p);
+		psrcreader->seek_file (p->s_offset, FILE_BEGIN);
+		p_cstor_writer->seek_file (p->s_offset, FILE_BEGIN);
+		return read_and_write (psrcreader, p_cstor_writer, p->blklen);
+	}
+}
+
 ///////////////////////////////////////////////////////////////
 void test_single_round (const std::string & srcfile, const std::string & tgtfile)
 {
@@ -233,11 +313,21 @@ void test_single_round (const std::string & srcfile, const std::string & tgtfile
 	hit_t * hash_result = 0;
 	
 	SYNC_START();
-	void *inner_data = xdelta_start_hash (blklen);
+	void *inner_data = xdelta_start_hash_ex (blklen, hash_type);
 	if (inner_data == 0)
 		return;
+	set_hash_len (inner_data, ptgtreader->get_file_size (), blklen);
 
-	if (head.len > 0) {
+	if (head.len > 0 && use_feed) {
+		ptgtreader->seek_file (head.pos, FILE_BEGIN);
+		if (xdelta_hash_begin (&head, inner_data) != 0
+			|| feed_this_node (&head, ptgtreader, inner_data, true) != 0) {
+			hit_t * hash_result = xdelta_get_hashes_free_inner (inner_data);
+			xdelta_free_hashes (hash_result);
+			goto over;
+		}
+	}
+	else if (head.len > 0) {
 		PIPE_HANDLE wh = xdelta_run_hash (&head, inner_data);
 		ptgtreader->seek_file (head.pos, FILE_BEGIN);
 		if (handle_this_node (&head, ptgtreader, wh) != 0) {
@@ -247,14 +337,31 @@ void test_single_round (const std::string & srcfile, const std::string & tgtfile
 		}
 	}
 		
-	hash_result = xdelta_get_hashes_free_inner (inner_data);
-	inner_data = xdelta_start_xdelta (hash_result, blklen, 0, 0);
-	xdelta_free_hashes (hash_result);
+	if (use_array) {
+		harr_t * hashes = xdelta_get_hash_array_free_inner (inner_data);
+		inner_data = xdelta_start_xdelta_array (hashes, blklen, 0, 0, hash_type);
+		xdelta_free_hash_array (hashes);
+	}
+	else {
+		hash_result = xdelta_get_hashes_free_inner (inner_data);
+		inner_data = xdelta_start_xdelta_ex (hash_result, blklen, 0, 0, hash_type);
+		xdelta_free_hashes (hash_result);
+	}
+	set_hash_len (inner_data, ptgtreader->get_file_size (), blklen);
 
 	head.pos = 0;
 	head.len = psrcreader->get_file_size ();
 		
-	if (head.len > 0) {
+	if (head.len > 0 && use_feed) {
+		psrcreader->seek_file (head.pos, FILE_BEGIN);
+		if (xdelta_delta_begin (&head, inner_data) != 0
+			|| feed_this_node (&head, psrcreader, inner_data, false) != 0) {
+			xit_t * result = xdelta_get_xdeltas_free_inner (inner_data);
+			xdelta_free_xdeltas (result);
+			goto over;
+		}
+	}
+	else if (head.len > 0) {
 		PIPE_HANDLE wh = xdelta_run_xdelta (&head, inner_data);
 		psrcreader->seek_file (head.pos, FILE_BEGIN);
 
@@ -265,30 +372,41 @@ void test_single_round (const std::string & srcfile, const std::string & tgtfile
 		}
 	}
 		
+	if (use_array) {
+		xarr_t * xdeltas = xdelta_get_xdelta_array_free_inner (inner_data);
+		if (xdeltas == 0)
+			return;
+		for (unsigned long long i = 0; i < xdeltas->count; ++i) {
+			if (construct_item (&xdeltas->items[i], ptgtreader, psrcreader, p_cstor_writer, s) != 0) {
+				xdelta_free_xdelta_array (xdeltas);
+				goto over;
+			}
+		}
+		xdelta_free_xdelta_array (xdeltas);
+		SYNC_END()
+		goto over;
+	}
+
 	xdelta_result = xdelta_get_xdeltas_free_inner (inner_data);
 	if (xdelta_result == 0)
 		return;
-		
-	for (xit_t * p = xdelta_result; p != 0; p = p->next) {
-		if (p->type == DT_IDENT) {
-			SYNC_IDENT(p);
-			ptgtreader->seek_file (get_target_offset(p), FILE_BEGIN);
-			p_cstor_writer->seek_file (p->s_offset, FILE_BEGIN);
-				
-			if (read_and_write (ptgtreader, p_cstor_writer, p->blklen) != 0) {
-				xdelta_free_xdeltas (xdelta_result);
-				goto over;
-			}
+
+	if (use_apply) {
+		count_items (xdelta_result, s);
+		xast_t stat;
+		if (xdelta_apply_ex (xdelta_result, tgtfile.c_str (), srcfile.c_str (), tmptgt.c_str ()
+				, psrcreader->get_file_size (), apply_flags, &stat) != 0) {
+			xdelta_free_xdeltas (xdelta_result);
+			goto over;
 		}
-		else { // (head->type == DT_DIFF)
-			SYNC_DIFF(p);
-			psrcreader->seek_file (p->s_offset, FILE_BEGIN);
-			p_cstor_writer->seek_file (p->s_offset, FILE_BEGIN);
-					
-			if (read_and_write (psrcreader, p_cstor_writer, p->blklen) != 0) {
-				xdelta_free_xdeltas (xdelta_result);
-				goto over;
-			}
+		printf ("Cloned:%20llu\tkernel copied:%20llu\tuser copied:%20llu\n"
+			, stat.clone_bytes, stat.kernel_bytes, stat.user_bytes);
+	}
+		
+	for (xit_t * p = xdelta_result; p != 0 && !use_apply; p = p->next) {
+		if (construct_item (p, ptgtreader, psrcreader, p_cstor_writer, s) != 0) {
+			xdelta_free_xdeltas (xdelta_result);
+			goto over;
 		}
 	}
 	
@@ -305,7 +423,32 @@ over:
 
 	c.rename (tmptgt.substr (pos + 1), tgtfile.substr (pos2 + 1));
 }
+// ʱǷöϣģʽ hָ xdelta_divide_hole
+static bool use_hole_set = false;
+
 ////////////////////////////////////////////////////////////////////
+/// ԴļĿļеͬһʱĿļָָֻһΡ
+static bool check_duplicate_divide ()
+{
+	fh_t hole = {0, 4096, 0};
+	xit_t items[2];
+	memset (items, 0, sizeof (items));
+	for (int i = 0; i < 2; ++i) {
+		items[i].type = DT_IDENT;
+		items[i].s_offset = i * 512;
+		items[i].blklen = 512;
+	}
+	items[0].next = &items[1];
+
+	void * holes = xdelta_holes_create (&hole);
+	bool ok = holes != 0 && xdelta_holes_divide_xdeltas (holes, items, XDELTA_TARGET_HOLES) == 0;
+	fh_t * left = ok ? xdelta_holes_export (holes) : 0;
+	ok = ok && left != 0 && left->pos == 512 && left->len == 4096 - 512 && left->next == 0;
+	xdelta_free_hole (left);
+	xdelta_holes_free (holes);
+	return ok;
+}
+
 void test_multiple_round (const std::string & srcfile, const std::string & tgtfile)
 {
 	if (!xdelta::exist_file (srcfile))
@@ -353,13 +496,16 @@ void test_multiple_round (const std::string & srcfile, const std::string & tgtfi
 	tgthole->next = 0;
 	xit_t * xdelta_result = 0;
 	hit_t * hash_result = 0;
+	void * srcholes = use_hole_set ? xdelta_holes_create (srchole) : 0;
+	void * tgtholes = use_hole_set ? xdelta_holes_create (tgthole) : 0;
 
 	unsigned minimal_blklen = XDELTA_BLOCK_SIZE;
 	SYNC_START();
 	for (;;) {
-		void *inner_data = xdelta_start_hash (blklen);
+		void *inner_data = xdelta_start_hash_ex (blklen, hash_type);
 		if (inner_data == 0)
 			return;
+		set_hash_len (inner_data, ptgtreader->get_file_size (), blklen);
 
 		for (fh_t * head = tgthole; head != 0; head = head->next) {
 			if (head->len > 0) {
@@ -374,7 +520,8 @@ void test_multiple_round (const std::string & srcfile, const std::string & tgtfi
 		}
 		
 		hash_result = xdelta_get_hashes_free_inner (inner_data);
-		inner_data = xdelta_start_xdelta (hash_result, blklen, 0, 0);
+		inner_data = xdelta_start_xdelta_ex (hash_result, blklen, 0, 0, hash_type);
+		set_hash_len (inner_data, ptgtreader->get_file_size (), blklen);
 		xdelta_free_hashes (hash_result);
 		
 		for (fh_t * head = srchole; head != 0; head = head->next) {
@@ -408,7 +555,18 @@ void test_multiple_round (const std::string & srcfile, const std::string & tgtfi
 		}
 		
 		blklen /= 2; // һִһֱ֣СС
-		if (blklen >= minimal_blklen) {
+		if (blklen >= minimal_blklen && use_hole_set) {
+			if (xdelta_holes_divide_xdeltas (tgtholes, xdelta_result, XDELTA_TARGET_HOLES) != 0
+				|| xdelta_holes_divide_xdeltas (srcholes, xdelta_result, XDELTA_SOURCE_HOLES) != 0)
+				printf ("Divide holes failed.\n");
+			xdelta_free_hole (srchole);
+			xdelta_free_hole (tgthole);
+			srchole = xdelta_holes_export (srcholes);
+			tgthole = xdelta_holes_export (tgtholes);
+			xdelta_free_xdeltas (xdelta_result);
+			continue;
+		}
+		else if (blklen >= minimal_blklen) {
 			for (xit_t * head = xdelta_result; head != 0; head = head->next) {
 				if (head->type == DT_IDENT) {
 					xdelta_divide_hole (&tgthole, get_target_offset(head), head->blklen);
@@ -441,6 +599,8 @@ void test_multiple_round (const std::string & srcfile, const std::string & tgtfi
 over:	
 	xdelta_free_hole (srchole);
 	xdelta_free_hole (tgthole);
+	xdelta_holes_free (srcholes);
+	xdelta_holes_free (tgtholes);
 	
 	ptgtreader->close_file ();
 	psrcreader->close_file ();
@@ -493,9 +653,10 @@ void test_single_round_inplace (const std::string & srcfile, const std::string &
 	hit_t * hash_result = 0;
 	
 	SYNC_START();
-	void *inner_data = xdelta_start_hash (blklen);
+	void *inner_data = xdelta_start_hash_ex (blklen, hash_type);
 	if (inner_data == 0)
 		return;
+	set_hash_len (inner_data, ptgtreader->get_file_size (), blklen);
 
 	if (head.len > 0) {
 		PIPE_HANDLE wh = xdelta_run_hash (&head, inner_data);
@@ -507,9 +668,17 @@ void test_single_round_inplace (const std::string & srcfile, const std::string &
 		}
 	}
 		
-	hash_result = xdelta_get_hashes_free_inner (inner_data);
-	inner_data = xdelta_start_xdelta (hash_result, blklen, 0, 0);
-	xdelta_free_hashes (hash_result);
+	if (use_array) {
+		harr_t * hashes = xdelta_get_hash_array_free_inner (inner_data);
+		inner_data = xdelta_start_xdelta_array (hashes, blklen, 0, 0, hash_type);
+		xdelta_free_hash_array (hashes);
+	}
+	else {
+		hash_result = xdelta_get_hashes_free_inner (inner_data);
+		inner_data = xdelta_start_xdelta_ex (hash_result, blklen, 0, 0, hash_type);
+		xdelta_free_hashes (hash_result);
+	}
+	set_hash_len (inner_data, ptgtreader->get_file_size (), blklen);
 
 	head.pos = 0;
 	head.len = psrcreader->get_file_size ();
@@ -524,14 +693,32 @@ void test_single_round_inplace (const std::string & srcfile, const std::string &
 			goto over;
 		}
 	}
+
+	if (short_hash) {
+		// ضϣʱһժҪԴļժҪͬ
+		unsigned char digest[DIGEST_BYTES], file_digest[DIGEST_BYTES];
+		psrcreader->seek_file (0, FILE_BEGIN);
+		get_file_digest (*psrcreader, file_digest);
+		if (xdelta_get_digest (inner_data, digest) != 0 || memcmp (digest, file_digest, DIGEST_BYTES) != 0)
+			printf ("Digest mismatch.\n");
+	}
 		
 	xdelta_result = xdelta_get_xdeltas_free_inner (inner_data);
 	if (xdelta_result == 0)
 		return;
 
 	xdelta_resolve_inplace (&xdelta_result);
+
+	if (use_apply) {
+		count_items (xdelta_result, s);
+		if (xdelta_apply (xdelta_result, tgtfile.c_str (), srcfile.c_str (), 0
+				, psrcreader->get_file_size ()) != 0) {
+			xdelta_free_xdeltas (xdelta_result);
+			goto over;
+		}
+	}
 		
-	for (xit_t * p = xdelta_result; p != 0; p = p->next) {
+	for (xit_t * p = xdelta_result; p != 0 && !use_apply; p = p->next) {
 		if (p->type == DT_IDENT) {
 			SYNC_IDENT(p);
 			ptgtreader->seek_file (get_target_offset(p), FILE_BEGIN);
@@ -589,28 +776,52 @@ int check_file_sum (const std::string & srcfile, const std::string & tgtfile)
 
 int main (int argn, char ** argc)
 {
-	if (argn != 4) {
+	if (argn != 4 && argn != 5) {
 		return -1;
 	}
 
+	if (argn == 5) { // ϣ㷨md4  murmur3 -short ׺ʱضϣ
+		std::string type (argc[4]);
+		const std::string suffix ("-short");
+		if (type.size () > suffix.size ()
+			&& type.compare (type.size () - suffix.size (), suffix.size (), suffix) == 0) {
+			short_hash = true;
+			type.erase (type.size () - suffix.size ());
+		}
+		if (type == "murmur3")
+			hash_type = XDELTA_HASH_MURMUR3;
+		else if (type != "md4")
+			return -1;
+	}
+
 	std::string srcfile (argc[1]); // Ŀļ
 	std::string tgtfile (argc[2]);
 	
-	if (strcmp (argc[3], "m") == 0)  { // 
+	if (strcmp (argc[3], "m") == 0 || strcmp (argc[3], "h") == 0)  { // ֣h ʱöϷָ
+		use_hole_set = strcmp (argc[3], "h") == 0;
+		if (use_hole_set && !check_duplicate_divide ())
+			printf ("Duplicate divide failed.\n");
 		test_multiple_round (srcfile, tgtfile);
 		if (check_file_sum (srcfile, tgtfile))
 			printf ("file %s is different with %s.\n", srcfile.c_str (), tgtfile.c_str ());
 		else
 			printf ("file %s is same with %s.\n", srcfile.c_str (), tgtfile.c_str ());
 	}
-	else if (strcmp (argc[3], "s") == 0) { // 
+	else if (strcmp (argc[3], "s") == 0 || strcmp (argc[3], "f") == 0
+		|| strcmp (argc[3], "a") == 0 || strcmp (argc[3], "p") == 0
+		|| strcmp (argc[3], "k") == 0) { // ֣f ʱֱӴݣa ʱȡpk ʱ xdelta_apply
+		use_feed = strcmp (argc[3], "f") == 0;
+		use_array = strcmp (argc[3], "a") == 0;
+		use_apply = strcmp (argc[3], "p") == 0 || strcmp (argc[3], "k") == 0;
+		apply_flags = strcmp (argc[3], "k") == 0 ? XDELTA_APPLY_KERNEL_COPY : 0;
 		test_single_round (srcfile, tgtfile);
 		if (check_file_sum (srcfile, tgtfile))
 			printf ("file %s is different with %s.\n", srcfile.c_str (), tgtfile.c_str ());
 		else
 			printf ("file %s is same with %s.\n", srcfile.c_str (), tgtfile.c_str ());
 	}
-	else if (strcmp (argc[3], "i") == 0) { // ͵ɣ֡
+	else if (strcmp (argc[3], "i") == 0 || strcmp (argc[3], "j") == 0) { // ͵ɣ֣j ʱ xdelta_apply
+		use_apply = strcmp (argc[3], "j") == 0;
 		test_single_round_inplace (srcfile, tgtfile);
 		if (check_file_sum (srcfile, tgtfile))
 			printf ("file %s is different with %s.\n", srcfile.c_str (), tgtfile.c_str ());
@@ -0,0 +1,2335 @@
+/*
+* Copyright (C) 2016- yeyouqun@163.com
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, visit the http://fsf.org website.
+*/
+#include <time.h>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <set>
+#include <list>
+#include <vector>
+
+#ifdef _WIN32
+	#include <windows.h>
+	#include <psapi.h>
+	#include <functional>
+	#define _SILENCE_STDEXT_HASH_DEPRECATION_WARNINGS
+	#include <hash_map>
+	#include <errno.h>
+	#include <io.h>
+	#include <direct.h>
+	#pragma comment(lib, "psapi.lib")
+#else
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <sys/time.h>
+	#include <memory>
+	#include <ext/functional>
+    #if !defined (__CXX_11__)
+    	#include <ext/hash_map>
+    #else
+    	#include <unordered_map>
+    #endif
+    #include <memory.h>
+    #include <stdio.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <iterator>
+
+#include "mytypes.h"
+#include "tinythread.h"
+#include "ringbuf.h"
+#include "buffer.h"
+#include "platform.h"
+#include "md4.h"
+#include "rw.h"
+#include "rollsum.h"
+#include "xdeltalib.h"
+
+#include "capi.h"
+
+/**
+ * ܲԳ÷
+ *		testperf <> [...]
+ *
+ * 
+ *		table []		ϣڴռãRSSÿҴ
+ *		filter []		ƶϣ򿪡رλʱ·Ĳٶȡ
+ *		tier [MB]			 Hash кܶϣУ Hash ʡȥ MD4 
+ *		rollsum				 RollsumUpdate ʵֵĽǷһ£Լֿ鳤µGB/s
+ *		eat [鳤]			ƥ֮³ʼ Hasheat_hashֽڵľʵֱȽϡ
+ *		md4					· MD4 ĽǷ rs_mdfour һ£ʵֵǩٶȡ
+ *		shash				 Hash 㷨
+ */
+
+using namespace xdelta;
+
+static double now_sec ()
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency (&freq);
+	QueryPerformanceCounter (&count);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+// ̵ǰʹõڴ棨KB
+static unsigned long long rss_kb ()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo (GetCurrentProcess (), &pmc, sizeof (pmc)))
+		return pmc.WorkingSetSize / 1024;
+	return 0;
+#else
+	unsigned long long rss = 0;
+	FILE * fp = fopen ("/proc/self/status", "r");
+	if (fp == 0)
+		return 0;
+
+	char line[256];
+	while (fgets (line, sizeof (line), fp) != 0) {
+		if (strncmp (line, "VmRSS:", 6) == 0) {
+			rss = STRTOULL (line + 6);
+			break;
+		}
+	}
+	fclose (fp);
+	return rss;
+#endif
+}
+
+// 򵥵α֤ÿβԵһ
+static uint32_t rand_state = 2463534242u;
+static uint32_t next_rand ()
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static void fill_random (uchar_t * buf, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; ++i)
+		buf[i] = (uchar_t)next_rand ();
+}
+
+///////////////////////////////////////////////////////////////
+// tableϣڴ漰ܡ
+//
+// м nr ĿϣһʵݣʹòУ
+// Ȼһ read_and_delta һڲҡڶΪ Hash
+// ֽΪ 0 ʱ get_strong_hash_len 㣨ļСȡ nr 飩
+static int perf_table (int argn, char ** argc)
+{
+	uint32_t nr = argn > 2 ? (uint32_t)atoi (argc[2]) : 4000000;
+	uint32_t hlen = argn > 3 ? (uint32_t)atoi (argc[3]) : DIGEST_BYTES;
+	const uint32_t blk_len = XDELTA_BLOCK_SIZE;
+	const uint32_t data_len = 32 * 1024 * 1024;
+
+	std::vector<uchar_t> data (data_len);
+	fill_random (&data[0], data_len);
+
+	unsigned long long rss_before = rss_kb ();
+	double t0 = now_sec ();
+	hash_table * table = new hash_table ();
+	if (hlen == 0)
+		hlen = get_strong_hash_len ((unsigned long long)nr * blk_len, blk_len);
+	table->set_hash_len (hlen);
+	table->reserve (nr);
+
+	uint32_t real_nr = data_len / blk_len / 2;
+	for (uint32_t i = 0; i < nr; ++i) {
+		slow_hash bsh;
+		uint32_t fhash;
+		bsh.tpos.t_offset = 0;
+		bsh.tpos.index = i;
+		if (i < real_nr) {
+			// ǰһеĿ飬ʱС
+			const uchar_t * p = &data[0] + (unsigned long long)i * blk_len;
+			fhash = rolling_hasher::hash (p, blk_len);
+			get_slow_hash (p, blk_len, bsh.hash);
+			bsh.check = get_check_hash (p, blk_len);
+		}
+		else {
+			fhash = next_rand ();
+			for (int j = 0; j < DIGEST_BYTES; j += 4) {
+				uint32_t r = next_rand ();
+				memcpy (bsh.hash + j, &r, 4);
+			}
+			bsh.check = ((unsigned long long)next_rand () << 32) | next_rand ();
+		}
+		table->add_block (fhash, bsh);
+	}
+	double t1 = now_sec ();
+	unsigned long long rss_after = rss_kb ();
+
+	// ڲңǰÿ鶼УλȫС
+	unsigned long long lookups = 0, hits = 0;
+	rolling_hasher hasher;
+	const uchar_t * p = &data[0];
+	const uchar_t * end = &data[0] + data_len - blk_len;
+	bool newhash = true;
+	uchar_t outchar = 0;
+	double t2 = now_sec ();
+	while (p < end) {
+		if (newhash) {
+			hasher.eat_hash (p, blk_len);
+			newhash = false;
+		}
+		else
+			hasher.update (outchar, p[blk_len - 1]);
+
+		++lookups;
+		target_pos tpos;
+		if (table->find_block (hasher.hash_value (), p, blk_len, tpos)) {
+			++hits;
+			p += blk_len;
+			newhash = true;
+		}
+		else
+			outchar = *p++;
+	}
+	double t3 = now_sec ();
+
+	printf ("blocks:%20u\thash bytes:%14u\n", nr, hlen);
+	printf ("build time(s):%14.3f\tblocks/s:%20.0f\n", t1 - t0, nr / (t1 - t0));
+	printf ("table RSS(KB):%14llu\tbytes/block:%16.1f\n", rss_after - rss_before
+				, (rss_after - rss_before) * 1024.0 / nr);
+	printf ("lookups:%20llu\thits:%20llu\n", lookups, hits);
+	printf ("lookup time(s):%13.3f\tlookups/s:%19.0f\n", t3 - t2, lookups / (t3 - t2));
+
+	delete table;
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////
+// filter·
+//
+// ȫĿϣһ֮޹صֽڻң
+// ģƶȺܵ͵ļֱرաλ˼ʱ
+static double scan_miss (const hash_table & table
+						, const std::vector<uchar_t> & data
+						, uint32_t blk_len
+						, unsigned long long & hits)
+{
+	rolling_hasher hasher;
+	const uchar_t * p = &data[0];
+	const uchar_t * end = &data[0] + data.size () - blk_len;
+
+	hits = 0;
+	hasher.eat_hash (p, blk_len);
+	target_pos tpos;
+	double t0 = now_sec ();
+	while (p < end) {
+		if (table.find_block (hasher.hash_value (), p, blk_len, tpos))
+			++hits;
+		hasher.update (*p, p[blk_len]);
+		++p;
+	}
+	return now_sec () - t0;
+}
+
+static int perf_filter (int argn, char ** argc)
+{
+	uint32_t nr = argn > 2 ? (uint32_t)atoi (argc[2]) : 50000;
+	const uint32_t blk_len = XDELTA_BLOCK_SIZE;
+	const uint32_t data_len = 64 * 1024 * 1024;
+
+	hash_table table;
+	for (uint32_t i = 0; i < nr; ++i) {
+		slow_hash bsh;
+		bsh.tpos.t_offset = 0;
+		bsh.tpos.index = i;
+		for (int j = 0; j < DIGEST_BYTES; j += 4) {
+			uint32_t r = next_rand ();
+			memcpy (bsh.hash + j, &r, 4);
+		}
+		bsh.check = ((unsigned long long)next_rand () << 32) | next_rand ();
+		table.add_block (next_rand (), bsh);
+	}
+
+	std::vector<uchar_t> data (data_len);
+	fill_random (&data[0], data_len);
+
+	unsigned long long hits_off, hits_on;
+	table.set_filter (false);
+	double off = scan_miss (table, data, blk_len, hits_off);
+	table.set_filter (true);
+	double on = scan_miss (table, data, blk_len, hits_on);
+
+	printf ("blocks:%20u\tpositions:%20u\n", nr, data_len - blk_len);
+	printf ("filter off(s):%13.3f\tlookups/s:%19.0f\thits:%llu\n"
+				, off, (data_len - blk_len) / off, hits_off);
+	printf ("filter on(s):%14.3f\tlookups/s:%19.0f\thits:%llu\n"
+				, on, (data_len - blk_len) / on, hits_on);
+	printf ("speedup:%19.2f\n", off / on);
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////
+// tierּƥ䡣
+//
+// ַСݣ DNA л־еĳЩֶΣϣ32 λ Hash
+// ֵںСķΧڣзǳࡣĿԴ޹أͳƿ Hash С
+// У Hash ʵʼ MD4 Ĵÿο Hash ж MD4 ĺʱȽϡ
+static int perf_tier (int argn, char ** argc)
+{
+	uint32_t mb = argn > 2 ? (uint32_t)atoi (argc[2]) : 16;
+	const uint32_t blk_len = XDELTA_BLOCK_SIZE;
+	const uint32_t data_len = mb * 1024 * 1024;
+
+	std::vector<uchar_t> target (data_len), source (data_len);
+	for (uint32_t i = 0; i < data_len; ++i) {
+		target[i] = "ACGT"[next_rand () & 3];
+		source[i] = "ACGT"[next_rand () & 3];
+	}
+
+	hash_table table;
+	table.reserve (data_len / blk_len);
+	for (uint32_t i = 0; i + blk_len <= data_len; i += blk_len) {
+		slow_hash bsh;
+		bsh.tpos.t_offset = 0;
+		bsh.tpos.index = i / blk_len;
+		get_slow_hash (&target[i], blk_len, bsh.hash);
+		bsh.check = get_check_hash (&target[i], blk_len);
+		table.add_block (rolling_hasher::hash (&target[i], blk_len), bsh);
+	}
+
+	hash_stat stat;
+	rolling_hasher hasher;
+	const uchar_t * p = &source[0];
+	const uchar_t * end = &source[0] + data_len - blk_len;
+	hasher.eat_hash (p, blk_len);
+	target_pos tpos;
+	double t0 = now_sec ();
+	while (p < end) {
+		table.find_block (hasher.hash_value (), p, blk_len, tpos, &stat);
+		hasher.update (*p, p[blk_len]);
+		++p;
+	}
+	double t1 = now_sec ();
+
+	// ԭÿο Hash жҪһ MD4
+	uchar_t hash[DIGEST_BYTES];
+	double t2 = now_sec ();
+	for (unsigned long long i = 0; i < stat.fast_hits; ++i)
+		get_slow_hash (&source[(uint32_t)(i % (data_len - blk_len))], blk_len, hash);
+	double t3 = now_sec ();
+
+	printf ("lookups:%20llu\tfast hits:%20llu\n", (unsigned long long)stat.lookups
+				, (unsigned long long)stat.fast_hits);
+	printf ("check hits:%17llu\tstrong hashes:%16llu\tmatches:%llu\n"
+				, (unsigned long long)stat.check_hits
+				, (unsigned long long)stat.strong_hashes
+				, (unsigned long long)stat.matches);
+	printf ("strong hashes avoided:%20llu\n", (unsigned long long)stat.strong_avoided ());
+	printf ("scan time(s):%15.3f\tMD4 on every fast hit would add(s):%10.3f\n"
+				, t1 - t0, t3 - t2);
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////
+// rollsumSIMD  Hash
+//
+// ĳȡʼַ룩ͳʼ״̬£Ƚϸʵֵ s1/s2/count
+// Ȼ󰴲ͬ鳤 read_and_hash һ㣩
+typedef void (*rollsum_fn) (Rollsum *, const unsigned char *, unsigned int);
+
+static double rollsum_speed (rollsum_fn fn, const std::vector<uchar_t> & data, uint32_t blk_len)
+{
+	const uint32_t rounds = 8;
+	const uint32_t nblk = (uint32_t)data.size () / blk_len;
+	uint32_t digest = 0;
+	double t0 = now_sec ();
+	for (uint32_t r = 0; r < rounds; ++r) {
+		for (uint32_t i = 0; i < nblk; ++i) {
+			Rollsum sum;
+			RollsumInit ((&sum));
+			fn (&sum, &data[0] + (unsigned long long)i * blk_len, blk_len);
+			digest ^= RollsumDigest ((&sum));
+		}
+	}
+	double t = now_sec () - t0;
+	if (digest == 0x12345678) // ֹŻ
+		printf (" ");
+	return (double)rounds * nblk * blk_len / t / (1024.0 * 1024 * 1024);
+}
+
+static int perf_rollsum (int argn, char ** argc)
+{
+	const char * names[] = { "scalar", "sse2", "avx2" };
+	rollsum_fn fns[] = { RollsumUpdateScalar, RollsumUpdateSSE2, RollsumUpdateAVX2 };
+	bool usable[] = { true, cpu_has_sse2 (), cpu_has_avx2 () };
+
+	std::vector<uchar_t> data (64 * 1024 * 1024);
+	fill_random (&data[0], (uint32_t)data.size ());
+
+	int failed = 0;
+	for (int t = 0; t < 100000; ++t) {
+		uint32_t len = t < 70000 ? next_rand () % 1200 : next_rand () % (1024 * 1024);
+		uint32_t off = next_rand () % 64;
+		Rollsum init;
+		init.count = next_rand () % 100000;
+		init.s1 = next_rand ();
+		init.s2 = next_rand ();
+		if (t % 3 == 0)
+			memset (&data[off], 0xff, len); // ֵֽм
+
+		Rollsum expect = init;
+		RollsumUpdateScalar (&expect, &data[off], len);
+		for (int k = 0; k < 3; ++k) {
+			if (!usable[k])
+				continue;
+			Rollsum sum = init;
+			if (k == 0)
+				RollsumUpdate (&sum, &data[off], len);
+			else
+				fns[k] (&sum, &data[off], len);
+			if (sum.s1 != expect.s1 || sum.s2 != expect.s2 || sum.count != expect.count) {
+				if (failed++ < 10)
+					printf ("%s mismatch: len %u, offset %u\n", k == 0 ? "dispatch" : names[k], len, off);
+			}
+		}
+		if (t % 3 == 0)
+			fill_random (&data[off], len);
+	}
+	printf ("identity: %s\n", failed == 0 ? "OK" : "FAILED");
+
+	const uint32_t blk_lens[] = { 400, 4096, 65536, 1024 * 1024 };
+	printf ("%-8s", "kernel");
+	for (int b = 0; b < 4; ++b)
+		printf ("\t%10u", blk_lens[b]);
+	printf ("\t(block bytes, GB/s)\n");
+	for (int k = 0; k < 3; ++k) {
+		if (!usable[k])
+			continue;
+		printf ("%-8s", names[k]);
+		for (int b = 0; b < 4; ++b)
+			printf ("\t%10.2f", rollsum_speed (fns[k], data, blk_lens[b]));
+		printf ("\n");
+	}
+	return failed == 0 ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// eatƥ
+//
+// ļȫͬʱread_and_delta ÿƥһ鶼Ҫ eat_hash ³ʼ
+//  Hashold_eater ԭʵ֣std::for_each  bind1st ֽڵóԱ
+class old_eater
+{
+public:
+	old_eater () { RollsumInit ((&sum_)); }
+	void eat_hash (const uchar_t *buf1, uint32_t len)
+	{
+		RollsumInit ((&sum_));
+#ifdef _WIN32
+		std::for_each (buf1, buf1 + len, std::bind1st (std::mem_fun (&old_eater::_eat), this));
+#else
+		std::for_each (buf1, buf1 + len
+			, std::bind1st (__gnu_cxx::mem_fun1 (&old_eater::_eat), this));
+#endif
+	}
+	uint32_t hash_value () const { return RollsumDigest ((&sum_)); }
+	const Rollsum & state () const { return sum_; }
+private:
+	Rollsum sum_;
+	void _eat (uchar_t inchar) { RollsumRollin ((&sum_), inchar); }
+};
+
+static int perf_eat (int argn, char ** argc)
+{
+	const uint32_t blk_len = argn > 2 ? (uint32_t)atoi (argc[2]) : XDELTA_BLOCK_SIZE;
+	const uint32_t data_len = 64 * 1024 * 1024;
+	const uint32_t nblk = data_len / blk_len;
+	const uint32_t rounds = 4;
+
+	std::vector<uchar_t> data (data_len);
+	fill_random (&data[0], data_len);
+
+	// ȫͬ update ڲ״ֻ̬ժҪֵ
+	int failed = 0;
+	for (uint32_t i = 0; i < 1000; ++i) {
+		uint32_t len = next_rand () % (blk_len + 1);
+		const uchar_t * p = &data[0] + next_rand () % (data_len - len);
+		old_eater oe;
+		rolling_hasher ne;
+		oe.eat_hash (p, len);
+		ne.eat_hash (p, len);
+		uchar_t out = p[0], in = p[len];
+		Rollsum st = oe.state ();
+		RollsumRotate ((&st), out, in);
+		if (oe.hash_value () != ne.hash_value ()
+			|| ne.update (out, in) != (uint32_t)RollsumDigest ((&st)))
+			++failed;
+	}
+	printf ("identity: %s\n", failed == 0 ? "OK" : "FAILED");
+
+	uint32_t digest = 0;
+	old_eater oe;
+	double t0 = now_sec ();
+	for (uint32_t r = 0; r < rounds; ++r)
+		for (uint32_t i = 0; i < nblk; ++i) {
+			oe.eat_hash (&data[0] + (unsigned long long)i * blk_len, blk_len);
+			digest ^= oe.hash_value ();
+		}
+	double t1 = now_sec ();
+
+	rolling_hasher ne;
+	for (uint32_t r = 0; r < rounds; ++r)
+		for (uint32_t i = 0; i < nblk; ++i) {
+			ne.eat_hash (&data[0] + (unsigned long long)i * blk_len, blk_len);
+			digest ^= ne.hash_value ();
+		}
+	double t2 = now_sec ();
+
+	const double gb = (double)rounds * nblk * blk_len / (1024.0 * 1024 * 1024);
+	printf ("block length:%15u\t(digest %08x)\n", blk_len, digest);
+	printf ("before(GB/s):%15.2f\tblocks/s:%20.0f\n", gb / (t1 - t0), rounds * nblk / (t1 - t0));
+	printf ("after(GB/s):%16.2f\tblocks/s:%20.0f\n", gb / (t2 - t1), rounds * nblk / (t2 - t1));
+	printf ("speedup:%19.2f\n", (t1 - t0) / (t2 - t1));
+	return failed == 0 ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// md4· MD4
+typedef void (*md4_fn) (uchar_t *, const uchar_t * const *, size_t);
+
+static double md4_speed (md4_fn fn, uint32_t lanes, const std::vector<uchar_t> & data, uint32_t blk_len)
+{
+	const uint32_t nblk = (uint32_t)data.size () / blk_len / lanes * lanes;
+	std::vector<uchar_t> out (lanes * DIGEST_BYTES);
+	const uchar_t * blocks[MD4_MAX_LANES];
+	double t0 = now_sec ();
+	for (uint32_t i = 0; i < nblk; i += lanes) {
+		for (uint32_t j = 0; j < lanes; ++j)
+			blocks[j] = &data[0] + (unsigned long long)(i + j) * blk_len;
+		if (fn == 0)
+			rs_mdfour (&out[0], blocks[0], blk_len);
+		else
+			fn (&out[0], blocks, blk_len);
+	}
+	return (double)nblk * blk_len / (now_sec () - t0) / (1024.0 * 1024);
+}
+
+//  read_and_hash һ HashУ Hash  MD4multi Ϊʱ MD4 㡣
+static double sign_speed (const std::vector<uchar_t> & data, uint32_t blk_len, bool multi)
+{
+	const uint32_t nblk = (uint32_t)data.size () / blk_len;
+	uchar_t digests[MD4_MAX_LANES * DIGEST_BYTES];
+	const uchar_t * blocks[MD4_MAX_LANES];
+	uint32_t sink = 0;
+	double t0 = now_sec ();
+	for (uint32_t i = 0; i < nblk; ) {
+		uint32_t nr = 0;
+		while (nr < MD4_MAX_LANES && i + nr < nblk) {
+			blocks[nr] = &data[0] + (unsigned long long)(i + nr) * blk_len;
+			++nr;
+		}
+		if (multi)
+			rs_mdfour_multi (digests, blocks, blk_len, nr);
+		for (uint32_t j = 0; j < nr; ++j) {
+			if (!multi)
+				get_slow_hash (blocks[j], blk_len, digests + j * DIGEST_BYTES);
+			sink += rolling_hasher::hash (blocks[j], blk_len);
+			sink += (uint32_t)get_check_hash (blocks[j], blk_len);
+			sink += digests[j * DIGEST_BYTES];
+		}
+		i += nr;
+	}
+	double t = now_sec () - t0;
+	if (sink == 0x12345678) // ֹŻ
+		printf (" ");
+	return (double)nblk * blk_len / t / (1024.0 * 1024);
+}
+
+static int perf_md4 (int argn, char ** argc)
+{
+	const char * names[] = { "scalar", "x4 sse2", "x8 avx2", "x16 avx512" };
+	md4_fn fns[] = { 0, rs_mdfour_x4, rs_mdfour_x8, rs_mdfour_x16 };
+	uint32_t lanes[] = { 1, 4, 8, 16 };
+	bool usable[] = { true, cpu_has_sse2 (), cpu_has_avx2 (), cpu_has_avx512 () };
+
+	std::vector<uchar_t> data (64 * 1024 * 1024);
+	fill_random (&data[0], (uint32_t)data.size ());
+
+	// гȵ0  300 ֽڣԼĳȡʼַ
+	int failed = 0;
+	for (uint32_t t = 0; t < 3000; ++t) {
+		uint32_t len = t <= 300 ? t : next_rand () % 70000;
+		uchar_t expect[MD4_MAX_LANES * DIGEST_BYTES], got[MD4_MAX_LANES * DIGEST_BYTES];
+		const uchar_t * blocks[MD4_MAX_LANES];
+		for (int j = 0; j < MD4_MAX_LANES; ++j) {
+			blocks[j] = &data[0] + next_rand () % (data.size () - len);
+			rs_mdfour (expect + j * DIGEST_BYTES, blocks[j], len);
+		}
+		for (int k = 1; k < 4; ++k) {
+			if (!usable[k])
+				continue;
+			fns[k] (got, blocks, len);
+			if (memcmp (got, expect, lanes[k] * DIGEST_BYTES) != 0 && failed++ < 10)
+				printf ("%s mismatch: len %u\n", names[k], len);
+		}
+		uint32_t n = next_rand () % (MD4_MAX_LANES + 1);
+		rs_mdfour_multi (got, blocks, len, n);
+		if (memcmp (got, expect, n * DIGEST_BYTES) != 0 && failed++ < 10)
+			printf ("multi mismatch: len %u, n %u\n", len, n);
+	}
+	printf ("identity: %s\tlanes: %u\n", failed == 0 ? "OK" : "FAILED", rs_mdfour_lanes ());
+
+	const uint32_t blk_lens[] = { 400, 4096, 65536 };
+	printf ("%-12s", "kernel");
+	for (int b = 0; b < 3; ++b)
+		printf ("\t%10u", blk_lens[b]);
+	printf ("\t(block bytes, MB/s)\n");
+	for (int k = 0; k < 4; ++k) {
+		if (!usable[k])
+			continue;
+		printf ("%-12s", names[k]);
+		for (int b = 0; b < 3; ++b)
+			printf ("\t%10.0f", md4_speed (fns[k], lanes[k], data, blk_lens[b]));
+		printf ("\n");
+	}
+
+	printf ("%-12s", "signature");
+	for (int b = 0; b < 3; ++b)
+		printf ("\t%4.0f->%4.0f", sign_speed (data, blk_lens[b], false), sign_speed (data, blk_lens[b], true));
+	printf ("\t(rollsum + check + MD4, MB/s)\n");
+	return failed == 0 ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// shash Hash 㷨
+//
+// ùĲ MurmurHash3Ȼ󰴿鳤ÿ㷨鼰
+static int perf_shash (int argn, char ** argc)
+{
+	const char * fox = "The quick brown fox jumps over the lazy dog";
+	const uchar_t fox_hash[DIGEST_BYTES] = {
+		0x6c, 0x1b, 0x07, 0xbc, 0x7b, 0xbc, 0x4b, 0xe3,
+		0x47, 0x93, 0x9a, 0xc4, 0xa9, 0x3c, 0x43, 0x7a
+	};
+	uchar_t out[MD4_MAX_LANES * DIGEST_BYTES];
+	murmur3_128 (out, (const uchar_t *)fox, (uint32_t)strlen (fox));
+	bool ok = memcmp (out, fox_hash, DIGEST_BYTES) == 0;
+	printf ("murmur3 test vector: %s\n", ok ? "OK" : "FAILED");
+
+	std::vector<uchar_t> data (64 * 1024 * 1024);
+	fill_random (&data[0], (uint32_t)data.size ());
+
+	const char * names[] = { "md4", "murmur3" };
+	const uint32_t blk_lens[] = { 400, 4096, 65536 };
+	printf ("%-16s", "algorithm");
+	for (int b = 0; b < 3; ++b)
+		printf ("\t%10u", blk_lens[b]);
+	printf ("\t(block bytes, MB/s)\n");
+
+	for (int t = 0; t < STRONG_HASH_MAX; ++t) {
+		for (int multi = 0; multi < 2; ++multi) {
+			printf ("%-8s%-8s", names[t], multi ? "batch" : "single");
+			for (int b = 0; b < 3; ++b) {
+				const uint32_t blk_len = blk_lens[b];
+				const uint32_t nblk = (uint32_t)data.size () / blk_len / MD4_MAX_LANES * MD4_MAX_LANES;
+				const uchar_t * blocks[MD4_MAX_LANES];
+				double t0 = now_sec ();
+				for (uint32_t i = 0; i < nblk; i += MD4_MAX_LANES) {
+					for (uint32_t j = 0; j < MD4_MAX_LANES; ++j)
+						blocks[j] = &data[0] + (unsigned long long)(i + j) * blk_len;
+					if (multi)
+						get_strong_hash_multi ((strong_hash_type)t, out, blocks, blk_len, MD4_MAX_LANES);
+					else
+						for (uint32_t j = 0; j < MD4_MAX_LANES; ++j)
+							get_slow_hash (blocks[j], blk_len, out + j * DIGEST_BYTES, (strong_hash_type)t);
+				}
+				printf ("\t%10.0f", (double)nblk * blk_len / (now_sec () - t0) / (1024.0 * 1024));
+			}
+			printf ("\n");
+		}
+	}
+	return ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// ringλ
+//
+// ˫ӳǷͬһڴ棬Ȼÿ鳤Ŀ飬
+// ÿֻܶһֵķʽģܵ read_and_hash  read_and_delta
+// ԽβĴĽ
+class mem_reader : public file_reader
+{
+	const std::vector<uchar_t> & data_;
+	uint32_t chunk_;
+	xdelta::uint64_t pos_;
+public:
+	mem_reader (const std::vector<uchar_t> & data, uint32_t chunk)
+		: data_ (data), chunk_ (chunk), pos_ (0) {}
+	virtual int read_file (uchar_t * data, const uint32_t len)
+	{
+		uint32_t size = len > chunk_ ? chunk_ : len;
+		if (pos_ + size > data_.size ())
+			size = (uint32_t)(data_.size () - pos_);
+		memcpy (data, &data_[0] + pos_, size);
+		pos_ += size;
+		return (int)size;
+	}
+	virtual xdelta::uint64_t seek_file (const xdelta::uint64_t offset, const int whence)
+	{
+		pos_ = offset;
+		return pos_;
+	}
+	virtual std::string get_fname () const { return "memory"; }
+};
+
+class collect_hasher : public hasher_stream
+{
+public:
+	std::vector<uint32_t> fhashes;
+	std::vector<slow_hash> shashes;
+	virtual void add_block (const uint32_t fhash, const slow_hash & shash)
+	{
+		fhashes.push_back (fhash);
+		shashes.push_back (shash);
+	}
+};
+
+class check_xdelta : public xdelta_stream
+{
+	const std::vector<uchar_t> & source_;
+	const std::vector<uchar_t> & target_;
+public:
+	xdelta::uint64_t next;			// һӦÿʼԴļλá
+	unsigned long long idents;
+	bool ok;
+	check_xdelta (const std::vector<uchar_t> & source, const std::vector<uchar_t> & target)
+		: source_ (source), target_ (target), next (0), idents (0), ok (true) {}
+	virtual void add_block (const target_pos & tpos
+							, const uint32_t blk_len
+							, const xdelta::uint64_t s_offset)
+	{
+		ok = ok && s_offset == next && memcmp (&source_[0] + s_offset
+			, &target_[0] + (unsigned long long)tpos.index * blk_len, blk_len) == 0;
+		next = s_offset + blk_len;
+		++idents;
+	}
+	virtual void add_block (const uchar_t * data
+							, const uint32_t blk_len
+							, const xdelta::uint64_t s_offset)
+	{
+		ok = ok && s_offset == next && memcmp (&source_[0] + s_offset, data, blk_len) == 0;
+		next = s_offset + blk_len;
+	}
+};
+
+static int perf_ring (int argn, char ** argc)
+{
+	bool ok = true;
+	{
+		ring_buffer buf (XDELTA_BUFFER_LEN);
+		printf ("ring buffer:%20u bytes\tmirrored:%4s\n", buf.size (), buf.mirrored () ? "yes" : "no");
+		if (buf.mirrored ()) {
+			buf.begin ()[0] = 0x5a;
+			buf.begin ()[buf.size () - 1] = 0xa5;
+			ok = buf.begin ()[buf.size ()] == 0x5a && buf.begin ()[buf.size () * 2 - 1] == 0xa5;
+			ok = ok && buf.rewind (buf.begin () + buf.size () + 10, 100) == buf.begin () + 10;
+		}
+		else
+			ok = buf.rewind (buf.begin () + 10, 100) == buf.begin ();
+		printf ("mirror check:%20s\n", ok ? "ok" : "FAILED");
+	}
+
+	const uint32_t blk_len = 1000;	// Сÿζвһݡ
+	const uint32_t data_len = XDELTA_BUFFER_LEN * 3 + 12345;
+	std::vector<uchar_t> target (data_len);
+	fill_random (&target[0], data_len);
+
+	//  Hashÿ 1MB һ㣬ȽϽ
+	mem_reader treader (target, 1024 * 1024 + 7);
+	collect_hasher hasher;
+	rs_mdfour_t ctx;
+	rs_mdfour_begin (&ctx);
+	double t0 = now_sec ();
+	read_and_hash (treader, hasher, data_len, blk_len, 0, &ctx);
+	double t1 = now_sec ();
+
+	bool hash_ok = hasher.shashes.size () == data_len / blk_len;
+	for (size_t i = 0; hash_ok && i < hasher.shashes.size (); ++i) {
+		const uchar_t * p = &target[0] + (unsigned long long)i * blk_len;
+		uchar_t hash[DIGEST_BYTES];
+		get_slow_hash (p, blk_len, hash);
+		hash_ok = hasher.shashes[i].tpos.index == i
+			&& hasher.fhashes[i] == rolling_hasher::hash (p, blk_len)
+			&& memcmp (hasher.shashes[i].hash, hash, DIGEST_BYTES) == 0;
+	}
+	uchar_t whole[DIGEST_BYTES], expect[DIGEST_BYTES];
+	rs_mdfour_result (&ctx, whole);
+	rs_mdfour (expect, &target[0], data_len);
+	hash_ok = hash_ok && memcmp (whole, expect, DIGEST_BYTES) == 0;
+	printf ("read_and_hash:%19.0f MB/s\t%s\n", data_len / (t1 - t0) / (1024.0 * 1024), hash_ok ? "ok" : "FAILED");
+
+	// ԴļĿļǰ뼸ֽڣÿ鶼ҪڻĴҵ
+	std::vector<uchar_t> source (data_len + 3);
+	fill_random (&source[0], 3);
+	memcpy (&source[3], &target[0], data_len);
+
+	hash_table table;
+	table.reserve ((uint32_t)hasher.shashes.size ());
+	for (size_t i = 0; i < hasher.shashes.size (); ++i)
+		table.add_block (hasher.fhashes[i], hasher.shashes[i]);
+
+	std::set<hole_t> holes;
+	hole_t hole;
+	hole.offset = 0;
+	hole.length = source.size ();
+	holes.insert (hole);
+
+	mem_reader sreader (source, 1024 * 1024 + 7);
+	check_xdelta checker (source, target);
+	t0 = now_sec ();
+	read_and_delta (sreader, checker, table, holes, blk_len, false);
+	t1 = now_sec ();
+
+	bool delta_ok = checker.ok && checker.next == source.size ()
+		&& checker.idents == data_len / blk_len;
+	printf ("read_and_delta:%18.0f MB/s\t%s\n", source.size () / (t1 - t0) / (1024.0 * 1024)
+		, delta_ok ? "ok" : "FAILED");
+
+	return ok && hash_ok && delta_ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// pdelta̼߳Ĳ졣
+//
+// ԴļĿļÿ 64KB ļֽڣгɺܶපģֱ֣
+// read_and_delta  read_and_delta_parallel 㣬ֺĶȫͬ
+// һ 3/4 ļһ󶴣 XDELTA_PARALLEL_DATA_LEN ʱɵֱ߳
+class op_recorder : public xdelta_stream
+{
+public:
+	struct op {
+		bool		ident;
+		uint32_t	index;
+		uint32_t	blk_len;
+		xdelta::uint64_t	s_offset;
+		bool operator == (const op & o) const
+		{
+			return ident == o.ident && index == o.index && blk_len == o.blk_len && s_offset == o.s_offset;
+		}
+	};
+	std::vector<op> ops;
+	std::vector<uchar_t> data;
+	virtual void add_block (const target_pos & tpos
+							, const uint32_t blk_len
+							, const xdelta::uint64_t s_offset)
+	{
+		op o = { true, tpos.index, blk_len, s_offset };
+		ops.push_back (o);
+	}
+	virtual void add_block (const uchar_t * d
+							, const uint32_t blk_len
+							, const xdelta::uint64_t s_offset)
+	{
+		op o = { false, 0, blk_len, s_offset };
+		ops.push_back (o);
+		data.insert (data.end (), d, d + blk_len);
+	}
+};
+
+static bool same_holes (const std::set<hole_t> & a, const std::set<hole_t> & b)
+{
+	if (a.size () != b.size ())
+		return false;
+	std::set<hole_t>::const_iterator i = a.begin (), j = b.begin ();
+	for (; i != a.end (); ++i, ++j)
+		if (i->offset != j->offset || i->length != j->length)
+			return false;
+	return true;
+}
+
+static int perf_pdelta (int argn, char ** argc)
+{
+	uint32_t threads = argn > 2 ? (uint32_t)atoi (argc[2]) : 0;
+	const uint32_t blk_len = 2048;
+	const uint32_t hole_len = 256 * 1024;
+	const uint32_t data_len = 128 * 1024 * 1024;
+
+	std::vector<uchar_t> target (data_len);
+	fill_random (&target[0], data_len);
+	std::vector<uchar_t> source (target);
+	for (uint32_t i = 1000; i < data_len; i += 64 * 1024)
+		source[i] ^= 0xff;
+
+	hash_table table;
+	table.reserve (data_len / blk_len);
+	for (uint32_t i = 0; i + blk_len <= data_len; i += blk_len) {
+		slow_hash bsh;
+		bsh.tpos.t_offset = 0;
+		bsh.tpos.index = i / blk_len;
+		get_slow_hash (&target[i], blk_len, bsh.hash);
+		bsh.check = get_check_hash (&target[i], blk_len);
+		table.add_block (rolling_hasher::hash (&target[i], blk_len), bsh);
+	}
+
+	// std::set<hole_t> ڵĶصÿһֽڡ
+	std::set<hole_t> holes, big_holes;
+	for (uint32_t i = 0; i < data_len; i += hole_len) {
+		hole_t hole;
+		hole.offset = i;
+		hole.length = hole_len - 1;
+		holes.insert (hole);
+		if (i < data_len / 4)
+			big_holes.insert (hole);
+	}
+	hole_t big;
+	big.offset = data_len / 4;
+	big.length = data_len - data_len / 4;
+	big_holes.insert (big);
+
+	bool ok = true;
+	printf ("holes:%10u\tthreads:%4u\n", (uint32_t)holes.size ()
+		, threads != 0 ? threads : thread::hardware_concurrency ());
+	const char * names[] = { "with diff", "split holes", "big hole" };
+	for (int run = 0; run < 3; ++run) {
+		const int split = run == 1;
+		const std::set<hole_t> & start = run == 2 ? big_holes : holes;
+		std::set<hole_t> serial_holes (start), parallel_holes (start);
+		op_recorder serial, parallel;
+		mem_reader sreader (source, 0xffffffff), preader (source, 0xffffffff);
+
+		double t0 = now_sec ();
+		read_and_delta (sreader, serial, table, serial_holes, blk_len, split != 0);
+		double t1 = now_sec ();
+		read_and_delta_parallel (preader, parallel, table, parallel_holes, blk_len, split != 0, threads);
+		double t2 = now_sec ();
+
+		bool same = serial.ops == parallel.ops && serial.data == parallel.data
+			&& same_holes (serial_holes, parallel_holes);
+		ok = ok && same;
+		printf ("%-12s serial:%8.0f MB/s\tparallel:%8.0f MB/s\t%5.2fx\t%s\n"
+			, names[run]
+			, data_len / (t1 - t0) / (1024.0 * 1024), data_len / (t2 - t1) / (1024.0 * 1024)
+			, (t1 - t0) / (t2 - t1), same ? "ok" : "FAILED");
+	}
+	return ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// segmentһ󶴷ֶζ߳ɨ衣
+//
+// ݣĿļĶֽڣֽʹλظݣÿλö
+// ƥ䣬ֶɨλ봮ɨ費ͬͬγȡúܶҲ룬
+//  read_and_delta ȫͬ
+static int perf_segment (int argn, char ** argc)
+{
+	uint32_t threads = argn > 2 ? (uint32_t)atoi (argc[2]) : 4;
+	xdelta::uint64_t seg_len = argn > 3 ? (xdelta::uint64_t)atoi (argc[3]) : 1024 * 1024 + 333;
+	const uint32_t blk_len = 2048;
+	const uint32_t data_len = 64 * 1024 * 1024;
+	const char * names[] = { "edit", "shift", "periodic" };
+
+	bool ok = true;
+	printf ("threads:%4u\tsegment:%12llu\n", threads, (unsigned long long)seg_len);
+	for (int kind = 0; kind < 3; ++kind) {
+		std::vector<uchar_t> target (data_len);
+		std::vector<uchar_t> source;
+		if (kind == 2) {
+			for (uint32_t i = 0; i < data_len; ++i)
+				target[i] = (uchar_t)("0123456"[i % 7]);
+			source.assign (target.begin () + 3, target.end ());
+		}
+		else {
+			fill_random (&target[0], data_len);
+			source = target;
+			for (uint32_t i = 1000; i < data_len; i += 64 * 1024) {
+				if (kind == 0)
+					source[i] ^= 0xff;
+				else
+					source.insert (source.begin () + i, (uchar_t)next_rand ());
+			}
+		}
+
+		hash_table table;
+		table.reserve (data_len / blk_len);
+		for (uint32_t i = 0; i + blk_len <= data_len; i += blk_len) {
+			slow_hash bsh;
+			bsh.tpos.t_offset = 0;
+			bsh.tpos.index = i / blk_len;
+			get_slow_hash (&target[i], blk_len, bsh.hash);
+			bsh.check = get_check_hash (&target[i], blk_len);
+			table.add_block (rolling_hasher::hash (&target[i], blk_len), bsh);
+		}
+
+		std::set<hole_t> holes;
+		hole_t hole;
+		hole.offset = 0;
+		hole.length = source.size ();
+		holes.insert (hole);
+
+		for (int split = 0; split < 2; ++split) {
+			std::set<hole_t> serial_holes (holes), seg_holes (holes);
+			op_recorder serial, segmented;
+			mem_reader sreader (source, 0xffffffff), preader (source, 0xffffffff);
+
+			double t0 = now_sec ();
+			read_and_delta (sreader, serial, table, serial_holes, blk_len, split != 0);
+			double t1 = now_sec ();
+			read_and_delta_segmented (preader, segmented, table, seg_holes, blk_len, split != 0
+				, threads, seg_len);
+			double t2 = now_sec ();
+
+			bool same = serial.ops == segmented.ops && serial.data == segmented.data
+				&& same_holes (serial_holes, seg_holes);
+			ok = ok && same;
+			printf ("%-9s%-6s ops:%8u serial:%6.0f MB/s\tsegmented:%6.0f MB/s\t%5.2fx\t%s\n"
+				, names[kind], split ? "split" : "diff", (uint32_t)serial.ops.size ()
+				, source.size () / (t1 - t0) / (1024.0 * 1024), source.size () / (t2 - t1) / (1024.0 * 1024)
+				, (t1 - t0) / (t2 - t1), same ? "ok" : "FAILED");
+		}
+	}
+	return ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// hashpipe Hash ص
+//
+// ڵǰĿ¼һļÿμʱǰҳֻ Linux Ч
+// ȽȶĴԭ read_and_hash ͬˮߵ read_and_hash
+class count_hasher : public hasher_stream
+{
+public:
+	unsigned long long blocks;
+	count_hasher () : blocks (0) {}
+	virtual void add_block (const uint32_t fhash, const slow_hash & shash) { ++blocks; }
+};
+
+static void drop_cache (const std::string & fname)
+{
+#if !defined (_WIN32) && defined (POSIX_FADV_DONTNEED)
+	int fd = open (fname.c_str (), O_RDONLY);
+	if (fd >= 0) {
+		fdatasync (fd);
+		posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+		close (fd);
+	}
+#endif
+}
+
+static void serial_hash (file_reader & reader, hasher_stream & stream
+						, unsigned long long len, uint32_t blk_len)
+{
+	const uint32_t chunk = XDELTA_BUFFER_LEN / blk_len * blk_len;
+	std::vector<uchar_t> buf (chunk);
+	rs_mdfour_t ctx;
+	rs_mdfour_begin (&ctx);
+	uint32_t index = 0;
+	while (len > 0) {
+		uint32_t want = (uint32_t)(len > chunk ? chunk : len);
+		for (uint32_t got = 0; got < want; ) {
+			int size = reader.read_file (&buf[got], want - got);
+			if (size <= 0)
+				return;
+			rs_mdfour_update (&ctx, &buf[got], size);
+			got += size;
+		}
+		len -= want;
+
+		for (uint32_t off = 0; off + blk_len <= want; off += blk_len * MD4_MAX_LANES) {
+			const uchar_t * blocks[MD4_MAX_LANES];
+			uchar_t digests[MD4_MAX_LANES * DIGEST_BYTES];
+			uint32_t nr = 0;
+			while (nr < MD4_MAX_LANES && off + (nr + 1) * blk_len <= want) {
+				blocks[nr] = &buf[off + nr * blk_len];
+				++nr;
+			}
+			get_strong_hash_multi (STRONG_HASH_MD4, digests, blocks, blk_len, nr);
+			for (uint32_t i = 0; i < nr; ++i) {
+				slow_hash bsh;
+				bsh.tpos.index = index++;
+				bsh.tpos.t_offset = 0;
+				memcpy (bsh.hash, digests + i * DIGEST_BYTES, DIGEST_BYTES);
+				bsh.check = get_check_hash (blocks[i], blk_len);
+				stream.add_block (rolling_hasher::hash (blocks[i], blk_len), bsh);
+			}
+		}
+	}
+}
+
+static int perf_hashpipe (int argn, char ** argc)
+{
+	const uint32_t mb = argn > 2 ? (uint32_t)atoi (argc[2]) : 512;
+	const uint32_t blk_len = argn > 3 ? (uint32_t)atoi (argc[3]) : 4096;
+	const std::string fname ("xdelta-hashpipe.tmp");
+	const unsigned long long len = (unsigned long long)mb * 1024 * 1024;
+
+	{
+		std::vector<uchar_t> data (1024 * 1024);
+		FILE * fp = fopen (fname.c_str (), "wb");
+		if (fp == 0)
+			return -1;
+		for (uint32_t i = 0; i < mb; ++i) {
+			fill_random (&data[0], (uint32_t)data.size ());
+			fwrite (&data[0], 1, data.size (), fp);
+		}
+		fclose (fp);
+	}
+
+	bool ok = true;
+	printf ("file:%8u MB\tblock:%8u\n", mb, blk_len);
+	for (int cold = 1; cold >= 0; --cold) {
+		double secs[2];
+		unsigned long long blocks[2];
+		for (int piped = 0; piped < 2; ++piped) {
+			if (cold)
+				drop_cache (fname);
+			f_local_freader freader (fname);
+			file_reader & reader = freader;
+			reader.open_file ();
+			count_hasher stream;
+			rs_mdfour_t ctx;
+			rs_mdfour_begin (&ctx);
+			double t0 = now_sec ();
+			if (piped)
+				read_and_hash (reader, stream, len, blk_len, 0, &ctx);
+			else
+				serial_hash (reader, stream, len, blk_len);
+			secs[piped] = now_sec () - t0;
+			blocks[piped] = stream.blocks;
+			reader.close_file ();
+		}
+		ok = ok && blocks[0] == blocks[1] && blocks[0] == len / blk_len;
+		printf ("%-6s serial:%8.0f MB/s\tpipelined:%8.0f MB/s\t%5.2fx\n", cold ? "cold" : "warm"
+			, mb / secs[0], mb / secs[1], secs[0] / secs[1]);
+	}
+	remove (fname.c_str ());
+	return ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// phash̼߳ Hash
+//
+// ÿֻܶһֵķʽ룬鳤ȡֵȽ read_and_hash 
+// read_and_hash_parallel ÿһ飨˳򣩼ļ MD4
+static bool same_hashes (const collect_hasher & a, const collect_hasher & b)
+{
+	if (a.fhashes != b.fhashes || a.shashes.size () != b.shashes.size ())
+		return false;
+	for (size_t i = 0; i < a.shashes.size (); ++i) {
+		const slow_hash & x = a.shashes[i], & y = b.shashes[i];
+		if (x.tpos.index != y.tpos.index || x.tpos.t_offset != y.tpos.t_offset
+			|| x.check != y.check || memcmp (x.hash, y.hash, DIGEST_BYTES) != 0)
+			return false;
+	}
+	return true;
+}
+
+static int perf_phash (int argn, char ** argc)
+{
+	uint32_t threads = argn > 2 ? (uint32_t)atoi (argc[2]) : 4;
+	const uint32_t data_len = XDELTA_BUFFER_LEN * 12 + 12345;
+	std::vector<uchar_t> target (data_len);
+	fill_random (&target[0], data_len);
+
+	bool ok = true;
+	printf ("data:%10u MB	threads:%4u\n", data_len >> 20, threads);
+	const uint32_t blk_lens[] = { 1000, 4096, 65536 + 3 };
+	for (size_t b = 0; b < sizeof (blk_lens) / sizeof (blk_lens[0]); ++b) {
+		const uint32_t blk_len = blk_lens[b];
+		collect_hasher serial, parallel;
+		serial.fhashes.reserve (data_len / blk_len);
+		serial.shashes.reserve (data_len / blk_len);
+		parallel.fhashes.reserve (data_len / blk_len);
+		parallel.shashes.reserve (data_len / blk_len);
+		mem_reader sreader (target, 1024 * 1024 + 7), preader (target, 1024 * 1024 + 7);
+		rs_mdfour_t sctx, pctx;
+		rs_mdfour_begin (&sctx);
+		rs_mdfour_begin (&pctx);
+
+		double t0 = now_sec ();
+		read_and_hash (sreader, serial, data_len, blk_len, 7, &sctx);
+		double t1 = now_sec ();
+		read_and_hash_parallel (preader, parallel, data_len, blk_len, 7, &pctx, STRONG_HASH_MD4, threads);
+		double t2 = now_sec ();
+
+		uchar_t sdigest[DIGEST_BYTES], pdigest[DIGEST_BYTES];
+		rs_mdfour_result (&sctx, sdigest);
+		rs_mdfour_result (&pctx, pdigest);
+		bool same = serial.shashes.size () == data_len / blk_len && same_hashes (serial, parallel)
+			&& memcmp (sdigest, pdigest, DIGEST_BYTES) == 0;
+		ok = ok && same;
+		printf ("block:%8u serial:%8.0f MB/s\tparallel:%8.0f MB/s\t%5.2fx\t%s\n", blk_len
+			, data_len / (t1 - t0) / (1024.0 * 1024), data_len / (t2 - t1) / (1024.0 * 1024)
+			, (t1 - t0) / (t2 - t1), same ? "ok" : "FAILED");
+	}
+	return ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// mmapڴӳļ
+//
+// ڵǰĿ¼Ŀļ롢޸һЩֽڵԴļֱ f_local_freader 
+// f_mmap_freader  read_and_hashread_and_hash_parallel  read_and_delta
+// ȫͬзֺּĶ
+static void write_file (const std::string & fname, const std::vector<uchar_t> & data)
+{
+	FILE * fp = fopen (fname.c_str (), "wb");
+	if (fp == 0)
+		return;
+	fwrite (&data[0], 1, data.size (), fp);
+	fclose (fp);
+}
+
+/// ɲõĿļԴļĿļĳȡ
+static uint32_t make_reader_files (const std::string & tname, const std::string & sname
+									, std::vector<uchar_t> & target, std::vector<uchar_t> & source)
+{
+	const uint32_t data_len = XDELTA_BUFFER_LEN * 6 + 12345;
+	target.resize (data_len);
+	fill_random (&target[0], data_len);
+	source.assign (target.begin (), target.begin () + data_len / 3);
+	source.push_back (0x5a);
+	source.insert (source.end (), target.begin () + data_len / 3, target.end ());
+	for (uint32_t i = 1000; i < source.size (); i += 3 * 1024 * 1024 + 17)
+		source[i] ^= 0xff;
+	write_file (tname, target);
+	write_file (sname, source);
+	return data_len;
+}
+
+typedef file_reader * (*reader_maker) (const std::string & fname);
+
+///  make ɵ reader  f_local_freader ֱ㣬ȽϽ
+static bool check_reader (const char * kind, reader_maker make)
+{
+	const uint32_t blk_len = 2000;
+	const std::string tname ("xdelta-reader-target.tmp"), sname ("xdelta-reader-source.tmp");
+	std::vector<uchar_t> target, source;
+	const uint32_t data_len = make_reader_files (tname, sname, target, source);
+
+	bool ok = true;
+	collect_hasher hashers[3];
+	uchar_t digests[3][DIGEST_BYTES];
+	double hsecs[3];
+	for (int m = 0; m < 3; ++m) {
+		file_reader * reader = m == 0 ? new f_local_freader (tname) : make (tname);
+		reader->open_file ();
+		reader->seek_file (0, FILE_BEGIN);
+		rs_mdfour_t ctx;
+		rs_mdfour_begin (&ctx);
+		double t0 = now_sec ();
+		if (m < 2)
+			read_and_hash (*reader, hashers[m], data_len, blk_len, 0, &ctx);
+		else
+			read_and_hash_parallel (*reader, hashers[m], data_len, blk_len, 0, &ctx, STRONG_HASH_MD4, 3);
+		hsecs[m] = now_sec () - t0;
+		rs_mdfour_result (&ctx, digests[m]);
+		ok = ok && reader->seek_file (0, FILE_CURRENT) == data_len;
+		reader->close_file ();
+		delete reader;
+	}
+	bool same = hashers[0].shashes.size () == data_len / blk_len
+		&& same_hashes (hashers[0], hashers[1]) && same_hashes (hashers[0], hashers[2])
+		&& memcmp (digests[0], digests[1], DIGEST_BYTES) == 0
+		&& memcmp (digests[0], digests[2], DIGEST_BYTES) == 0;
+	ok = ok && same;
+	printf ("%-14s read:%8.0f MB/s\t%s:%8.0f MB/s\tparallel:%8.0f MB/s\t%s\n", "read_and_hash"
+		, data_len / hsecs[0] / (1024.0 * 1024), kind, data_len / hsecs[1] / (1024.0 * 1024)
+		, data_len / hsecs[2] / (1024.0 * 1024), same ? "ok" : "FAILED");
+
+	hash_table table;
+	table.reserve ((uint32_t)hashers[0].shashes.size ());
+	for (size_t i = 0; i < hashers[0].shashes.size (); ++i)
+		table.add_block (hashers[0].fhashes[i], hashers[0].shashes[i]);
+
+	// std::set<hole_t> ڵĶصÿһֽڡ
+	std::set<hole_t> holes;
+	for (xdelta::uint64_t off = 0; off < source.size (); off += 10 * 1024 * 1024 + 3) {
+		hole_t hole;
+		hole.offset = off;
+		hole.length = source.size () - off < 10 * 1024 * 1024 + 2 ? source.size () - off : 10 * 1024 * 1024 + 2;
+		holes.insert (hole);
+	}
+
+	for (int split = 0; split < 2; ++split) {
+		std::set<hole_t> lholes (holes), mholes (holes);
+		op_recorder lstream, mstream;
+		f_local_freader lreader (sname);
+		file_reader & lr = lreader, * mr = make (sname);
+		lr.open_file ();
+		mr->open_file ();
+
+		double t0 = now_sec ();
+		read_and_delta (lr, lstream, table, lholes, blk_len, split != 0);
+		double t1 = now_sec ();
+		read_and_delta (*mr, mstream, table, mholes, blk_len, split != 0);
+		double t2 = now_sec ();
+
+		same = lstream.ops == mstream.ops && lstream.data == mstream.data
+			&& same_holes (lholes, mholes) && lstream.ops.size () > holes.size ();
+		ok = ok && same;
+		printf ("%-14s read:%8.0f MB/s\t%s:%8.0f MB/s\t%s\n", split ? "split holes" : "read_and_delta"
+			, source.size () / (t1 - t0) / (1024.0 * 1024), kind
+			, source.size () / (t2 - t1) / (1024.0 * 1024), same ? "ok" : "FAILED");
+		lr.close_file ();
+		mr->close_file ();
+		delete mr;
+	}
+
+	// ̹߳һ readerf_local_freader λöһ reader 
+	for (int m = 0; m < 2; ++m) {
+		std::set<hole_t> sholes (holes), pholes (holes), gholes (holes);
+		op_recorder serial, parallel, segmented;
+		file_reader * reader = m == 0 ? new f_local_freader (sname) : make (sname);
+		reader->open_file ();
+		read_and_delta (*reader, serial, table, sholes, blk_len, false);
+		read_and_delta_parallel (*reader, parallel, table, pholes, blk_len, false, 3);
+		read_and_delta_segmented (*reader, segmented, table, gholes, blk_len, false, 3, 1024 * 1024 + 5);
+		same = serial.ops == parallel.ops && serial.data == parallel.data
+			&& serial.ops == segmented.ops && serial.data == segmented.data;
+		ok = ok && same;
+		printf ("%-14s %-6s %s\n", "shared reader", m == 0 ? "read" : kind, same ? "ok" : "FAILED");
+		reader->close_file ();
+		delete reader;
+	}
+
+	// λ read_file ǰļβ
+	{
+		file_reader * reader = make (sname);
+		reader->open_file ();
+		std::vector<uchar_t> buf (3 * 1024 * 1024);
+		bool read_ok = true;
+		for (int i = 0; read_ok && i < 200; ++i) {
+			const uint32_t off = i % 10 == 9 ? (uint32_t)source.size () - 100 : next_rand () % (uint32_t)source.size ();
+			const uint32_t len = 1 + next_rand () % (uint32_t)buf.size ();
+			uint32_t got = 0;
+			reader->seek_file (off, FILE_BEGIN);
+			while (got < len && off + got < source.size ()) {
+				int size = reader->read_file (&buf[got], len - got);
+				if (size <= 0)
+					break;
+				got += size;
+			}
+			const uint32_t expect = source.size () - off < len ? (uint32_t)source.size () - off : len;
+			read_ok = got == expect && memcmp (&buf[0], &source[off], got) == 0;
+		}
+		ok = ok && read_ok;
+		printf ("%-14s %s\n", "random reads", read_ok ? "ok" : "FAILED");
+		reader->close_file ();
+		delete reader;
+	}
+
+	remove (tname.c_str ());
+	remove (sname.c_str ());
+	return ok;
+}
+
+static file_reader * make_mmap_reader (const std::string & fname) { return new f_mmap_freader (fname); }
+
+static int perf_mmap (int argn, char ** argc)
+{
+	return check_reader ("mmap", make_mmap_reader) ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// aread첽ļ
+//
+//  mmap ֱͬ io_uring  pread ̵߳ f_async_freader 㣬
+// f_local_freader ȫͬ
+static file_reader * make_uring_reader (const std::string & fname) { return new f_async_freader (fname, true); }
+static file_reader * make_pread_reader (const std::string & fname) { return new f_async_freader (fname, false); }
+
+static int perf_aread (int argn, char ** argc)
+{
+	{
+		f_async_freader probe (argc[0]);
+		file_reader & reader = probe;
+		reader.open_file ();
+		printf ("io_uring:%10s\n", probe.using_uring () ? "yes" : "no");
+		reader.close_file ();
+	}
+	bool ok = check_reader ("uring", make_uring_reader);
+	ok = check_reader ("pread", make_pread_reader) && ok;
+	if (argn < 3)
+		return ok ? 0 : 1;
+
+	// ļСMBʱٱȽҳ reader  read_and_hash ٶȡ
+	const uint32_t mb = (uint32_t)atoi (argc[2]);
+	const std::string fname ("xdelta-aread.tmp");
+	{
+		std::vector<uchar_t> data (1024 * 1024);
+		FILE * fp = fopen (fname.c_str (), "wb");
+		if (fp == 0)
+			return -1;
+		for (uint32_t i = 0; i < mb; ++i) {
+			fill_random (&data[0], (uint32_t)data.size ());
+			fwrite (&data[0], 1, data.size (), fp);
+		}
+		fclose (fp);
+	}
+	const char * kinds[] = { "read", "mmap", "uring", "pread" };
+	for (int k = 0; k < 4; ++k) {
+		drop_cache (fname);
+		file_reader * reader = k == 0 ? new f_local_freader (fname) : k == 1 ? make_mmap_reader (fname)
+			: k == 2 ? make_uring_reader (fname) : make_pread_reader (fname);
+		reader->open_file ();
+		count_hasher stream;
+		rs_mdfour_t ctx;
+		rs_mdfour_begin (&ctx);
+		double t0 = now_sec ();
+		read_and_hash (*reader, stream, (unsigned long long)mb * 1024 * 1024, 4096, 0, &ctx);
+		printf ("cold %-6s%8.0f MB/s\n", kinds[k], mb / (now_sec () - t0));
+		reader->close_file ();
+		delete reader;
+	}
+	remove (fname.c_str ());
+	return ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// sparseϡļ
+//
+// ڵǰĿ¼ɴ󲿷ǿնĿļԴļɾһݡڿնмһݲ
+// ļֽڡն read_and_hash ÿһ벻ʱͬһͬļ
+// MD4 Ҳͬ read_and_delta ĽնֱӴ򶴣ؽԴļԴļͬ
+// ӡؽļʵռõĿռ䡣 add_zero õͬ顢ݱ벻ʱһ
+class dense_reader : public file_reader
+{
+	file_reader & reader_;
+public:
+	dense_reader (file_reader & reader) : reader_ (reader) {}
+	virtual int read_file (uchar_t * data, const uint32_t len) { return reader_.read_file (data, len); }
+	virtual int read_at (const xdelta::uint64_t offset, uchar_t * data, const uint32_t len)
+	{
+		return reader_.read_at (offset, data, len);
+	}
+	virtual xdelta::uint64_t seek_file (const xdelta::uint64_t offset, const int whence)
+	{
+		return reader_.seek_file (offset, whence);
+	}
+};
+
+class sparse_builder : public xdelta_stream
+{
+	file_writer & writer_;
+	const std::vector<uchar_t> & target_;
+public:
+	unsigned long long zeros;
+	sparse_builder (file_writer & writer, const std::vector<uchar_t> & target)
+		: writer_ (writer), target_ (target), zeros (0) {}
+	virtual void add_block (const target_pos & tpos
+							, const uint32_t blk_len
+							, const xdelta::uint64_t s_offset)
+	{
+		writer_.seek_file (s_offset, FILE_BEGIN);
+		writer_.write_file (&target_[0] + (unsigned long long)tpos.index * blk_len, blk_len);
+	}
+	virtual void add_block (const uchar_t * data
+							, const uint32_t blk_len
+							, const xdelta::uint64_t s_offset)
+	{
+		writer_.seek_file (s_offset, FILE_BEGIN);
+		writer_.write_file (data, blk_len);
+	}
+	virtual bool wants_zero () const { return true; }
+	virtual void add_zero (const xdelta::uint64_t length, const xdelta::uint64_t s_offset)
+	{
+		writer_.write_zero (s_offset, length);
+		zeros += length;
+	}
+};
+
+class sparse_counter : public xdelta_stream
+{
+public:
+	unsigned long long ident, diff;
+	sparse_counter () : ident (0), diff (0) {}
+	virtual void add_block (const target_pos & tpos
+							, const uint32_t blk_len
+							, const xdelta::uint64_t s_offset) { ident += blk_len; }
+	virtual void add_block (const uchar_t * data
+							, const uint32_t blk_len
+							, const xdelta::uint64_t s_offset) { diff += blk_len; }
+};
+
+///  extentsƫơȶԣϡļdata Ϊļݡ
+static void write_sparse (const std::string & fname, const std::vector<uchar_t> & data
+						, const std::vector<std::pair<uint32_t, uint32_t> > & extents)
+{
+	remove (fname.c_str ());
+	f_local_fwriter w (fname);
+	file_writer & writer = w;
+	writer.open_file ();
+	writer.set_file_size (data.size ());
+	for (size_t i = 0; i < extents.size (); ++i) {
+		writer.seek_file (extents[i].first, FILE_BEGIN);
+		writer.write_file (&data[extents[i].first], extents[i].second);
+	}
+	writer.close_file ();
+}
+
+static double allocated_mb (const std::string & fname)
+{
+#ifdef _WIN32
+	return -1;
+#else
+	struct stat st;
+	if (stat (fname.c_str (), &st) != 0)
+		return -1;
+	return st.st_blocks * 512.0 / (1024 * 1024);
+#endif
+}
+
+static int perf_sparse (int argn, char ** argc)
+{
+	const uint32_t mb = argn > 2 ? (uint32_t)atoi (argc[2]) : 64;
+	const uint32_t size = mb * 1024 * 1024;
+	const uint32_t blk_len = 2000;
+	const std::string tname ("xdelta-sparse-target.tmp"), sname ("xdelta-sparse-source.tmp")
+		, oname ("xdelta-sparse-out.tmp");
+
+	// ÿ 8MB һ 1MB ҵݣ롣
+	std::vector<std::pair<uint32_t, uint32_t> > textents, sextents;
+	for (uint32_t off = 100; off + 2 * 1024 * 1024 < size; off += 8 * 1024 * 1024 + 4097)
+		textents.push_back (std::make_pair (off, (uint32_t)1024 * 1024 + 3333));
+	std::vector<uchar_t> target (size), source;
+	for (size_t i = 0; i < textents.size (); ++i)
+		fill_random (&target[textents[i].first], textents[i].second);
+
+	source = target;
+	for (size_t i = 0; i < textents.size (); ++i) {
+		if (i == 1) {
+			memset (&source[textents[i].first], 0, textents[i].second);
+			continue;
+		}
+		source[textents[i].first + 5000] ^= 0xff;
+		sextents.push_back (textents[i]);
+	}
+	sextents.push_back (std::make_pair (size / 2 - 12345, (uint32_t)500 * 1024));
+	fill_random (&source[sextents.back ().first], sextents.back ().second);
+	write_sparse (tname, target, textents);
+	write_sparse (sname, source, sextents);
+	printf ("file:%10u MB\ttarget allocated:%8.1f MB\tsource allocated:%8.1f MB\n", mb
+		, allocated_mb (tname), allocated_mb (sname));
+
+	bool ok = true;
+	collect_hasher hashers[2];
+	uchar_t digests[2][DIGEST_BYTES];
+	double hsecs[2];
+	for (int m = 0; m < 2; ++m) {
+		f_local_freader lreader (tname);
+		file_reader & local = lreader;
+		dense_reader dreader (local);
+		file_reader & reader = m == 0 ? (file_reader &)dreader : local;
+		local.open_file ();
+		rs_mdfour_t ctx;
+		rs_mdfour_begin (&ctx);
+		double t0 = now_sec ();
+		read_and_hash (reader, hashers[m], size, blk_len, 0, &ctx);
+		hsecs[m] = now_sec () - t0;
+		rs_mdfour_result (&ctx, digests[m]);
+		ok = ok && local.seek_file (0, FILE_CURRENT) == size;
+		local.close_file ();
+	}
+	bool same = hashers[1].shashes.size () < hashers[0].shashes.size ()
+		&& memcmp (digests[0], digests[1], DIGEST_BYTES) == 0;
+	for (size_t i = 0; same && i < hashers[1].shashes.size (); ++i) {
+		const slow_hash & s = hashers[1].shashes[i], & d = hashers[0].shashes[s.tpos.index];
+		same = hashers[1].fhashes[i] == hashers[0].fhashes[s.tpos.index]
+			&& s.check == d.check && memcmp (s.hash, d.hash, DIGEST_BYTES) == 0;
+	}
+	ok = ok && same;
+	printf ("%-14s dense:%8.0f MB/s\tsparse:%8.0f MB/s\tblocks:%8u/%-8u\t%s\n", "read_and_hash"
+		, size / hsecs[0] / (1024.0 * 1024), size / hsecs[1] / (1024.0 * 1024)
+		, (uint32_t)hashers[1].shashes.size (), (uint32_t)hashers[0].shashes.size (), same ? "ok" : "FAILED");
+
+	hash_table table;
+	for (size_t i = 0; i < hashers[1].shashes.size (); ++i)
+		table.add_block (hashers[1].fhashes[i], hashers[1].shashes[i]);
+
+	double dsecs[2];
+	unsigned long long zeros = 0;
+	for (int m = 0; m < 2; ++m) {
+		f_local_freader lreader (sname);
+		file_reader & local = lreader;
+		dense_reader dreader (local);
+		file_reader & reader = m == 0 ? (file_reader &)dreader : local;
+		local.open_file ();
+		remove (oname.c_str ());
+		f_local_fwriter w (oname);
+		file_writer & writer = w;
+		writer.open_file ();
+		sparse_builder stream (writer, target);
+		std::set<hole_t> holes;
+		hole_t hole;
+		hole.offset = 0;
+		hole.length = size;
+		holes.insert (hole);
+		double t0 = now_sec ();
+		read_and_delta (reader, stream, table, holes, blk_len, false);
+		dsecs[m] = now_sec () - t0;
+		zeros = stream.zeros;
+		writer.close_file ();
+		local.close_file ();
+	}
+
+	std::vector<uchar_t> out (size + 1);
+	FILE * fp = fopen (oname.c_str (), "rb");
+	same = fp != 0 && fread (&out[0], 1, out.size (), fp) == size && memcmp (&out[0], &source[0], size) == 0;
+	if (fp != 0)
+		fclose (fp);
+	same = same && zeros > 0;
+	ok = ok && same;
+	printf ("%-14s dense:%8.0f MB/s\tsparse:%8.0f MB/s\tzeros:%8.1f MB\t%s\n", "read_and_delta"
+		, size / dsecs[0] / (1024.0 * 1024), size / dsecs[1] / (1024.0 * 1024)
+		, zeros / (1024.0 * 1024), same ? "ok" : "FAILED");
+	printf ("rebuilt allocated:%8.1f MB\n", allocated_mb (oname));
+
+	sparse_counter counters[2];
+	for (int m = 0; m < 2; ++m) {
+		f_local_freader lreader (sname);
+		file_reader & local = lreader;
+		dense_reader dreader (local);
+		file_reader & reader = m == 0 ? (file_reader &)dreader : local;
+		local.open_file ();
+		std::set<hole_t> holes;
+		hole_t hole;
+		hole.offset = 0;
+		hole.length = size;
+		holes.insert (hole);
+		read_and_delta (reader, counters[m], table, holes, blk_len, false);
+		local.close_file ();
+	}
+	same = counters[0].ident == counters[1].ident && counters[0].diff == counters[1].diff
+		&& counters[1].ident + counters[1].diff == size;
+	ok = ok && same;
+	printf ("%-14s ident:%8.1f MB\tdiff:%8.1f MB\t%s\n", "no add_zero"
+		, counters[1].ident / (1024.0 * 1024), counters[1].diff / (1024.0 * 1024), same ? "ok" : "FAILED");
+
+	remove (tname.c_str ());
+	remove (sname.c_str ());
+	remove (oname.c_str ());
+	return ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// feedC ӿдֱܵӴݡ
+//
+// Ŀ 64MB ظɣԴÿ 1MB һֽڣ 1MB ɣȫ
+// ڴУԲ⼸ GB ݡֱ xdelta_run_hash/xdelta_run_xdeltaдܵһ
+// ̶߳ xdelta_hash_feed/xdelta_delta_feedֱ߳Ӽ㣩㣬ϣͬ
+// ȫͬеĿθԴݡ
+static void write_pipe (PIPE_HANDLE handle, const uchar_t * data, uint32_t len)
+{
+	while (len > 0) {
+#ifdef _WIN32
+		DWORD size = 0;
+		if (!::WriteFile (handle, data, len, &size, 0))
+			return;
+#else
+		int size = (int)write (handle, data, len);
+		if (size <= 0)
+			return;
+#endif
+		data += size;
+		len -= size;
+	}
+}
+
+/// дܵpipe Ϊ trueֱӴķʽ mb  1MB ݽ inner
+static bool push_data (void * inner, bool hash, bool pipe, uint32_t mb, const std::vector<uchar_t> & pool)
+{
+	const uint32_t chunk = 1024 * 1024, pool_mb = (uint32_t)(pool.size () / chunk);
+	fh_t hole;
+	hole.pos = 0;
+	hole.len = (unsigned long long)mb * chunk;
+	hole.next = 0;
+
+	PIPE_HANDLE wh = INVALID_HANDLE_VALUE;
+	if (pipe) {
+		wh = hash ? xdelta_run_hash (&hole, inner) : xdelta_run_xdelta (&hole, inner);
+		if (wh == INVALID_HANDLE_VALUE)
+			return false;
+	}
+	else if ((hash ? xdelta_hash_begin (&hole, inner) : xdelta_delta_begin (&hole, inner)) != 0)
+		return false;
+
+	std::vector<uchar_t> buf (chunk);
+	for (uint32_t i = 0; i < mb; ++i) {
+		const uchar_t * data = &pool[(i % pool_mb) * chunk];
+		if (!hash) {
+			memcpy (&buf[0], data, chunk);
+			buf[(i * 7777) % chunk] ^= 0xff;
+			data = &buf[0];
+		}
+		if (pipe)
+			write_pipe (wh, data, chunk);
+		else if ((hash ? xdelta_hash_feed (inner, (const char *)data, chunk)
+				: xdelta_delta_feed (inner, (const char *)data, chunk)) != 0)
+			return false;
+	}
+	return true;
+}
+
+static int perf_feed (int argn, char ** argc)
+{
+	const uint32_t mb = argn > 2 ? (uint32_t)atoi (argc[2]) : 256;
+	const unsigned long long size = (unsigned long long)mb * 1024 * 1024;
+	const unsigned blklen = xdelta_calc_block_len (size);
+	std::vector<uchar_t> pool ((size_t)(mb < 64 ? mb : 64) * 1024 * 1024);
+	fill_random (&pool[0], (uint32_t)pool.size ());
+	printf ("data:%10u MB\tblock:%8u\n", mb, blklen);
+
+	hit_t * hashes[2];
+	double hsecs[2];
+	for (int m = 0; m < 2; ++m) {
+		double t0 = now_sec ();
+		void * inner = xdelta_start_hash_ex (blklen, XDELTA_HASH_MD4);
+		bool pushed = push_data (inner, true, m == 0, mb, pool);
+		hashes[m] = xdelta_get_hashes_free_inner (inner);
+		hsecs[m] = now_sec () - t0;
+		if (!pushed)
+			return 1;
+	}
+	bool same = hashes[0] != 0;
+	unsigned long long nr = 0;
+	for (hit_t * p = hashes[0], * q = hashes[1]; same && (p != 0 || q != 0); p = p->next, q = q->next, ++nr)
+		same = p != 0 && q != 0 && p->fast_hash == q->fast_hash
+			&& p->t_offset == q->t_offset && p->t_index == q->t_index
+			&& memcmp (p->slow_hash, q->slow_hash, DIGEST_BYTES) == 0;
+	same = same && nr == size / blklen;
+	bool ok = same;
+	printf ("%-8s pipe:%8.0f MB/s\tfeed:%8.0f MB/s\t%5.2fx\t%s\n", "hash", mb / hsecs[0], mb / hsecs[1]
+		, hsecs[0] / hsecs[1], same ? "ok" : "FAILED");
+
+	xit_t * xdeltas[2];
+	double dsecs[2];
+	for (int m = 0; m < 2; ++m) {
+		double t0 = now_sec ();
+		void * inner = xdelta_start_xdelta_ex (hashes[1], blklen, 0, 0, XDELTA_HASH_MD4);
+		bool pushed = push_data (inner, false, m == 0, mb, pool);
+		xdeltas[m] = xdelta_get_xdeltas_free_inner (inner);
+		dsecs[m] = now_sec () - t0;
+		if (!pushed)
+			return 1;
+	}
+	xdelta_free_hashes (hashes[0]);
+	xdelta_free_hashes (hashes[1]);
+
+	// ͬȫͬеĿθԴݡ
+	std::vector<xit_t> idents[2];
+	for (int m = 0; m < 2; ++m) {
+		unsigned long long next = 0;
+		for (xit_t * p = xdeltas[m]; p != 0; p = p->next) {
+			same = same && p->s_offset == next;
+			next += p->blklen;
+			if (p->type == DT_IDENT)
+				idents[m].push_back (*p);
+		}
+		same = same && next == size;
+		xdelta_free_xdeltas (xdeltas[m]);
+	}
+	same = same && idents[0].size () == idents[1].size () && !idents[0].empty ();
+	for (size_t i = 0; same && i < idents[0].size (); ++i)
+		same = idents[0][i].s_offset == idents[1][i].s_offset && idents[0][i].index == idents[1][i].index
+			&& idents[0][i].t_offset == idents[1][i].t_offset;
+	ok = ok && same;
+	printf ("%-8s pipe:%8.0f MB/s\tfeed:%8.0f MB/s\t%5.2fx\t%s\n", "xdelta", mb / dsecs[0], mb / dsecs[1]
+		, dsecs[0] / dsecs[1], same ? "ok" : "FAILED");
+
+	// ݲ㶴ĳʱȡʧܡ
+	fh_t hole;
+	hole.pos = 0;
+	hole.len = blklen * 4;
+	hole.next = 0;
+	void * inner = xdelta_start_hash_ex (blklen, XDELTA_HASH_MD4);
+	bool rejected = xdelta_hash_begin (&hole, inner) == 0
+		&& xdelta_hash_feed (inner, (const char *)&pool[0], blklen * 3) == 0;
+	hit_t * partial = xdelta_get_hashes_free_inner (inner);
+	rejected = rejected && partial == 0;
+	xdelta_free_hashes (partial);
+	inner = xdelta_start_xdelta_ex (0, blklen, 0, 0, XDELTA_HASH_MD4);
+	rejected = rejected && xdelta_delta_begin (&hole, inner) == 0
+		&& xdelta_delta_feed (inner, (const char *)&pool[0], blklen * 3) == 0;
+	xarr_t * parray = xdelta_get_xdelta_array_free_inner (inner);
+	rejected = rejected && parray == 0;
+	xdelta_free_xdelta_array (parray);
+	ok = ok && rejected;
+	printf ("short feed: %s\n", rejected ? "ok" : "FAILED");
+
+	// ضϣʱֱӴݵժҪݵ MD4 ͬ
+	const uint32_t digest_mb = 4;
+	rs_mdfour_t ctx;
+	rs_mdfour_begin (&ctx);
+	for (uint32_t i = 0; i < digest_mb; ++i)
+		rs_mdfour_update (&ctx, &pool[(i % (pool.size () >> 20)) << 20], 1024 * 1024);
+	uchar_t expect[DIGEST_BYTES], digest[DIGEST_BYTES];
+	rs_mdfour_result (&ctx, expect);
+	inner = xdelta_start_hash_ex (blklen, XDELTA_HASH_MD4);
+	bool digested = xdelta_set_hash_len (inner, 8) == 0 && push_data (inner, true, false, digest_mb, pool)
+		&& xdelta_get_digest (inner, digest) == 0 && memcmp (digest, expect, DIGEST_BYTES) == 0;
+	hit_t * digested_hashes = xdelta_get_hashes_free_inner (inner);
+	digested = digested && digested_hashes != 0;
+	xdelta_free_hashes (digested_hashes);
+	ok = ok && digested;
+	printf ("digest: %s\n", digested ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// arrayC ӿڵ
+//
+// СĿ鳤 mb MB ݵĹϣ죨 feed ͬݣõʮ򵽼
+// ֱӿȡýװϣͷţֻ⼸ʱ䡣ֽ
+// ȫͬ
+struct result_sum
+{
+	unsigned long long nr;
+	unsigned long long sum;
+	result_sum () : nr (0), sum (0) {}
+	template <class T> void add_hash (const T * p)
+	{
+		++nr;
+		sum = sum * 31 + p->fast_hash + p->t_offset + p->t_index + p->slow_hash[0];
+	}
+	template <class T> void add_xdelta (const T * p)
+	{
+		++nr;
+		sum = sum * 31 + p->type + p->s_offset + p->t_offset + p->index + p->blklen;
+	}
+	bool operator == (const result_sum & r) const { return nr == r.nr && sum == r.sum; }
+};
+
+static int perf_array (int argn, char ** argc)
+{
+	const uint32_t mb = argn > 2 ? (uint32_t)atoi (argc[2]) : 256;
+	const unsigned blklen = XDELTA_BLOCK_SIZE;
+	std::vector<uchar_t> pool ((size_t)(mb < 64 ? mb : 64) * 1024 * 1024);
+	fill_random (&pool[0], (uint32_t)pool.size ());
+	printf ("data:%10u MB	block:%8u	item bytes list:%u/%u array:%u/%u\n", mb, blklen
+		, (unsigned)sizeof (hit_t), (unsigned)sizeof (xit_t), (unsigned)sizeof (hrec_t), (unsigned)sizeof (xrec_t));
+
+	// 0 Ϊֿ1 Ϊ飺ȡùϣװϣͷŹϣȡòͷš
+	const char * steps[] = {"hash get", "hash walk", "hash load", "hash free", "xdelta get", "xdelta walk", "xdelta free"};
+	double secs[2][7];
+	result_sum hsum[2], xsum[2];
+	for (int m = 0; m < 2; ++m) {
+		void * inner = xdelta_start_hash_ex (blklen, XDELTA_HASH_MD4);
+		if (!push_data (inner, true, false, mb, pool))
+			return 1;
+
+		double t[8];
+		t[0] = now_sec ();
+		hit_t * hlist = 0;
+		harr_t * harr = 0;
+		void * owner = 0;
+		if (m == 0)
+			hlist = xdelta_get_hashes_in_chunks_free_inner (inner, &owner);
+		else
+			harr = xdelta_get_hash_array_free_inner (inner);
+		t[1] = now_sec ();
+		if (m == 0)
+			for (hit_t * p = hlist; p != 0; p = p->next)
+				hsum[m].add_hash (p);
+		else
+			for (unsigned long long i = 0; i < harr->count; ++i)
+				hsum[m].add_hash (&harr->items[i]);
+		t[2] = now_sec ();
+		inner = m == 0 ? xdelta_start_xdelta_ex (hlist, blklen, 0, 0, XDELTA_HASH_MD4)
+			: xdelta_start_xdelta_array (harr, blklen, 0, 0, XDELTA_HASH_MD4);
+		t[3] = now_sec ();
+		if (m == 0)
+			xdelta_free_nodes (owner);
+		else
+			xdelta_free_hash_array (harr);
+		t[4] = now_sec ();
+
+		if (!push_data (inner, false, false, mb, pool))
+			return 1;
+		const double t4 = now_sec (); // ʱ䲻㡣
+		xit_t * xlist = 0;
+		xarr_t * xarr = 0;
+		if (m == 0)
+			xlist = xdelta_get_xdeltas_in_chunks_free_inner (inner, &owner);
+		else
+			xarr = xdelta_get_xdelta_array_free_inner (inner);
+		t[5] = now_sec ();
+		if (m == 0)
+			for (xit_t * p = xlist; p != 0; p = p->next)
+				xsum[m].add_xdelta (p);
+		else
+			for (unsigned long long i = 0; i < xarr->count; ++i)
+				xsum[m].add_xdelta (&xarr->items[i]);
+		t[6] = now_sec ();
+		if (m == 0)
+			xdelta_free_nodes (owner);
+		else
+			xdelta_free_xdelta_array (xarr);
+		t[7] = now_sec ();
+
+		for (int i = 0; i < 7; ++i)
+			secs[m][i] = t[i + 1] - t[i];
+		secs[m][4] = t[5] - t4;
+	}
+
+	const bool same = hsum[0] == hsum[1] && xsum[0] == xsum[1] && hsum[0].nr > 0 && xsum[0].nr > 0;
+	printf ("hashes:%12llu\txdeltas:%12llu\t%s\n", hsum[0].nr, xsum[0].nr, same ? "ok" : "FAILED");
+	double total[2] = {0, 0};
+	for (int i = 0; i < 7; ++i) {
+		printf ("%-12s list:%10.2f ms\tarray:%10.2f ms\n", steps[i], secs[0][i] * 1000, secs[1][i] * 1000);
+		total[0] += secs[0][i];
+		total[1] += secs[1][i];
+	}
+	printf ("%-12s list:%10.2f ms\tarray:%10.2f ms\t%5.2fx\n", "total", total[0] * 1000, total[1] * 1000
+		, total[0] / total[1]);
+	return same ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// holesּ xdelta_divide_hole ָöָ
+//
+// һÿһһͬ飬Դļͬ鰴λУĿļд˳ַ
+// õĶȫͬ
+static bool same_hole_list (const fh_t * a, const fh_t * b)
+{
+	for (; a != 0 && b != 0; a = a->next, b = b->next)
+		if (a->pos != b->pos || a->len != b->len)
+			return false;
+	return a == 0 && b == 0;
+}
+
+static int perf_holes (int argn, char ** argc)
+{
+	const uint32_t nr = argn > 2 ? (uint32_t)atoi (argc[2]) : 20000;
+	const unsigned blklen = 1024;
+	std::vector<xit_t> items (nr);
+	std::vector<uint32_t> order (nr);
+	for (uint32_t i = 0; i < nr; ++i)
+		order[i] = i;
+	for (uint32_t i = nr; i > 1; --i)
+		std::swap (order[i - 1], order[next_rand () % i]);
+	for (uint32_t i = 0; i < nr; ++i) {
+		items[i].type = DT_IDENT;
+		items[i].s_offset = (unsigned long long)i * 2 * blklen + blklen;
+		items[i].t_offset = blklen;
+		items[i].index = order[i] * 2;
+		items[i].blklen = blklen;
+		items[i].next = i + 1 < nr ? &items[i + 1] : 0;
+	}
+	printf ("blocks:%10u\tblock:%8u\n", nr, blklen);
+
+	bool ok = true;
+	for (int which = XDELTA_SOURCE_HOLES; which <= XDELTA_TARGET_HOLES; ++which) {
+		fh_t * list = (fh_t *)malloc (sizeof (fh_t));
+		list->pos = 0;
+		list->len = (unsigned long long)nr * 2 * blklen + blklen;
+		list->next = 0;
+		void * holes = xdelta_holes_create (list);
+
+		double t0 = now_sec ();
+		for (uint32_t i = 0; i < nr; ++i)
+			xdelta_divide_hole (&list, which == XDELTA_SOURCE_HOLES ? items[i].s_offset
+				: get_target_offset (&items[i]), blklen);
+		double t1 = now_sec ();
+		const int ret = xdelta_holes_divide_xdeltas (holes, &items[0], which);
+		double t2 = now_sec ();
+		fh_t * exported = xdelta_holes_export (holes);
+
+		const bool same = ret == 0 && xdelta_holes_count (holes) == nr + 1 && same_hole_list (list, exported);
+		ok = ok && same;
+		printf ("%-8s list:%10.2f ms\tset:%10.2f ms\t%8.1fx\t%s\n", which == XDELTA_SOURCE_HOLES ? "source" : "target"
+			, (t1 - t0) * 1000, (t2 - t1) * 1000, (t1 - t0) / (t2 - t1 > 0 ? t2 - t1 : 1e-6), same ? "ok" : "FAILED");
+		xdelta_free_hole (list);
+		xdelta_free_hole (exported);
+		xdelta_holes_free (holes);
+	}
+	return ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// inplacexdelta_resolve_inplace ȷԼģ
+//
+// Сڴа˳͵ɣͬӵǰĻƣ
+// ƣͬĿݵĿ飨ظ򣩼ƴɣ
+// һӴҽ˳
+// ٶִѭĲԱȽϸΪݵֽƽƵͬĳΪ LL/2
+// L/4Ŀļеλò룬ȡеλø֮佻صѭܶࡣ
+// мʱƽư飨һһݹʵֻջ
+// ÿԶѭУԼƽƺһΪ 64MB鳤ܴʱص
+// Ŀ鲻ܰĿ鳤ɨһζ̿飩
+static bool rebuild_inplace (std::vector<xit_t> & items, bool shuffle, int policy
+	, const std::vector<uchar_t> & target, const std::vector<uchar_t> & source
+	, unsigned long long & resent)
+{
+	// ˳ʱ鲻ٰԴļеλС
+	std::vector<size_t> order (items.size ());
+	for (size_t i = 0; i < order.size (); ++i)
+		order[i] = i;
+	if (shuffle)
+		for (size_t i = order.size (); i > 1; --i)
+			std::swap (order[i - 1], order[next_rand () % i]);
+	unsigned long long diff_bytes = 0;
+	for (size_t i = 0; i < order.size (); ++i) {
+		items[order[i]].next = i + 1 < order.size () ? &items[order[i + 1]] : 0;
+		if (items[i].type == DT_DIFF)
+			diff_bytes += items[i].blklen;
+	}
+
+	xit_t * head = &items[order[0]];
+	xdelta_resolve_inplace_ex (&head, policy);
+
+	std::vector<uchar_t> buf (target);
+	if (buf.size () < source.size ())
+		buf.resize (source.size ());
+	size_t count = 0;
+	resent = 0;
+	for (xit_t * p = head; p != 0; p = p->next, ++count) {
+		if (p->type == DT_IDENT)
+			memmove (&buf[(size_t)p->s_offset], &buf[(size_t)get_target_offset (p)], p->blklen);
+		else {
+			memcpy (&buf[(size_t)p->s_offset], &source[(size_t)p->s_offset], p->blklen);
+			resent += p->blklen;
+		}
+	}
+	resent -= diff_bytes; // ֻͬĳɵĲݡ
+	return count == items.size () && memcmp (&buf[0], &source[0], source.size ()) == 0;
+}
+
+static void make_inplace (uint32_t nr, uint32_t blklen, bool shifted
+	, std::vector<uchar_t> & target, std::vector<uchar_t> & source, std::vector<xit_t> & items)
+{
+	target.resize ((size_t)nr * blklen);
+	fill_random (&target[0], (uint32_t)target.size ());
+	source.clear ();
+	items.clear ();
+	while (items.size () < nr) {
+		xit_t item;
+		item.s_offset = source.size ();
+		item.t_offset = 0;
+		item.index = 0;
+		if (next_rand () % 8 == 0) {
+			item.type = DT_DIFF;
+			item.blklen = next_rand () % (blklen * 2) + 1;
+			for (uint32_t i = 0; i < item.blklen; ++i)
+				source.push_back ((uchar_t)next_rand ());
+			items.push_back (item);
+			continue;
+		}
+
+		item.type = DT_IDENT;
+		if (shifted) {
+			item.blklen = blklen >> (next_rand () % 3);
+			const long long max_off = (long long)target.size () - item.blklen;
+			long long off = (long long)source.size () + (long long)(next_rand () % (blklen * 4)) - blklen * 2;
+			item.t_offset = off < 0 ? 0 : (off > max_off ? max_off : off);
+		}
+		else {
+			item.blklen = blklen;
+			item.index = next_rand () % nr;
+		}
+		const uchar_t * data = &target[(size_t)get_target_offset (&item)];
+		source.insert (source.end (), data, data + item.blklen);
+		items.push_back (item);
+	}
+}
+
+static bool check_inplace (uint32_t nr, uint32_t blklen, bool shuffle, int policy)
+{
+	std::vector<uchar_t> target, source;
+	std::vector<xit_t> items;
+	unsigned long long resent;
+	make_inplace (nr, blklen, false, target, source, items);
+	return rebuild_inplace (items, shuffle, policy, target, source, resent);
+}
+
+static bool compare_inplace_cost (uint32_t nr, uint32_t blklen)
+{
+	std::vector<uchar_t> target, source;
+	std::vector<xit_t> items;
+	make_inplace (nr, blklen, true, target, source, items);
+
+	unsigned long long ident_bytes = 0, resent[2];
+	for (size_t i = 0; i < items.size (); ++i)
+		if (items[i].type == DT_IDENT)
+			ident_bytes += items[i].blklen;
+	bool ok = true;
+	double secs[2];
+	for (int policy = XDELTA_INPLACE_FAST; policy <= XDELTA_INPLACE_MIN_COST; ++policy) {
+		std::vector<xit_t> copy (items);
+		double t0 = now_sec ();
+		ok = rebuild_inplace (copy, false, policy, target, source, resent[policy]) && ok;
+		secs[policy] = now_sec () - t0;
+	}
+	const double base = resent[XDELTA_INPLACE_FAST] ? (double)resent[XDELTA_INPLACE_FAST] : 1.0;
+	printf ("shifted  blocks:%10u\tidentical bytes:%12llu\tresent fast:%11llu (%5.1f ms)\tmin-cost:%11llu (%5.1f ms)\tsaved:%5.1f%%\t%s\n"
+		, nr, ident_bytes, resent[XDELTA_INPLACE_FAST], secs[XDELTA_INPLACE_FAST] * 1000
+		, resent[XDELTA_INPLACE_MIN_COST], secs[XDELTA_INPLACE_MIN_COST] * 1000
+		, ((double)resent[XDELTA_INPLACE_FAST] - (double)resent[XDELTA_INPLACE_MIN_COST]) * 100 / base
+		, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+static int perf_inplace (int argn, char ** argc)
+{
+	const unsigned long long max_nr = argn > 2 ? STRTOULL (argc[2]) : 10000000;
+	bool ok = true;
+	for (int i = 0; i < 400 && ok; ++i)
+		ok = check_inplace (next_rand () % 200 + 1, 16, i % 2 == 1, i % 4 < 2 ? XDELTA_INPLACE_FAST : XDELTA_INPLACE_MIN_COST);
+	printf ("random rebuild: %s\n", ok ? "ok" : "FAILED");
+
+	for (unsigned long long nr = 1000; nr <= max_nr && nr <= 1000000 && ok; nr *= 10)
+		ok = compare_inplace_cost ((uint32_t)nr, 64);
+
+	const uint32_t blklen = 1024;
+	const char * kinds[] = {"shift", "swap", "random", "mixed"};
+	const char * policies[] = {"fast", "min-cost"};
+	for (unsigned long long nr = 1000; nr <= max_nr && ok; nr *= 10) {
+		for (int k = 0; k < 4; ++k) {
+			for (int policy = XDELTA_INPLACE_FAST; policy <= XDELTA_INPLACE_MIN_COST; ++policy) {
+				std::vector<xit_t> items ((size_t)nr);
+				std::vector<uint32_t> perm ((size_t)nr);
+				for (uint32_t i = 0; i < nr; ++i)
+					perm[i] = i;
+				if (k == 2)
+					for (uint32_t i = (uint32_t)nr; i > 1; --i)
+						std::swap (perm[i - 1], perm[next_rand () % i]);
+				for (uint32_t i = 0; i < nr; ++i) {
+					xit_t & item = items[i];
+					item.type = DT_IDENT;
+					item.blklen = k == 3 && i + 1 == nr ? 1 << 26 : blklen;
+					item.t_offset = 0;
+					item.s_offset = (unsigned long long)i * blklen + (k == 0 || k == 3 ? blklen / 2 : 0);
+					item.index = k == 1 ? (i ^ 1) % (uint32_t)nr : perm[i];
+					if (item.blklen != blklen) { // index Կ鳤Ϊλ
+						item.t_offset = (unsigned long long)i * blklen;
+						item.index = 0;
+					}
+					item.next = i + 1 < nr ? &items[i + 1] : 0;
+				}
+
+				xit_t * head = &items[0];
+				double t0 = now_sec ();
+				xdelta_resolve_inplace_ex (&head, policy);
+				double secs = now_sec () - t0;
+
+				unsigned long long idents = 0, count = 0;
+				for (xit_t * p = head; p != 0; p = p->next, ++count)
+					if (p->type == DT_IDENT)
+						++idents;
+				ok = ok && count == nr;
+				printf ("%-8s %-8s blocks:%12llu\t%10.1f ms\t%7.1f ns/block\tidentical:%12llu\t%s\n", kinds[k]
+					, policies[policy], nr, secs * 1000, secs * 1e9 / nr, idents, count == nr ? "ok" : "FAILED");
+			}
+		}
+	}
+	return ok ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////
+// applyxdelta_apply  testcapi  seekreadwrite ɹ̱Ƚϡ
+//
+// ԴĿݵĿ飨 XDELTA_BLOCK_SIZEఴ˳ż߲ݣƴɣ
+// 鹹졣ֱļ͵ɣ xdelta_resolve_inplace 򣩣
+// ļʱٱȽ XDELTA_APPLY_KERNEL_COPYɵļԴͬ
+static bool same_file (const std::string & fname, const std::vector<uchar_t> & data)
+{
+	std::vector<uchar_t> out (data.size () + 1);
+	FILE * fp = fopen (fname.c_str (), "rb");
+	bool same = fp != 0 && fread (&out[0], 1, out.size (), fp) == data.size ()
+		&& memcmp (&out[0], &data[0], data.size ()) == 0;
+	if (fp != 0)
+		fclose (fp);
+	return same;
+}
+
+/// ɣͬ testcapi  construct_item
+static void apply_by_item (const xit_t * head, const std::string & tname, const std::string & sname
+	, const std::string & oname, unsigned long long filesize)
+{
+	f_local_freader treader (tname), sreader (sname);
+	f_local_fwriter writer (oname);
+	file_reader & tgt = treader, & src = sreader;
+	file_writer & out = writer;
+	tgt.open_file ();
+	src.open_file ();
+	out.open_file ();
+	std::vector<uchar_t> buf (MAX_XDELTA_BLOCK_BYTES);
+	for (const xit_t * p = head; p != 0; p = p->next) {
+		file_reader & reader = p->type == DT_IDENT ? tgt : src;
+		reader.seek_file (p->type == DT_IDENT ? get_target_offset ((xit_t *)p) : p->s_offset, FILE_BEGIN);
+		out.seek_file (p->s_offset, FILE_BEGIN);
+		for (unsigned done = 0; done < p->blklen;) {
+			const unsigned len = p->blklen - done > buf.size () ? (unsigned)buf.size () : p->blklen - done;
+			int size = reader.read_file (&buf[0], len);
+			if (size <= 0)
+				return;
+			out.write_file (&buf[0], size);
+			done += size;
+		}
+	}
+	out.set_file_size (filesize);
+}
+
+static int perf_apply (int argn, char ** argc)
+{
+	const uint32_t mb = argn > 2 ? (uint32_t)atoi (argc[2]) : 64;
+	const uint32_t blklen = XDELTA_BLOCK_SIZE;
+	const uint32_t nr = mb * 1024 * 1024 / blklen;
+	const std::string tname ("xdelta-apply-target.tmp"), sname ("xdelta-apply-source.tmp")
+		, oname ("xdelta-apply-out.tmp");
+
+	std::vector<uchar_t> target ((size_t)nr * blklen), source;
+	fill_random (&target[0], (uint32_t)target.size ());
+	std::vector<xit_t> items;
+	items.reserve (nr + nr / 8);
+	for (uint32_t i = 0; i < nr; ++i) {
+		const uint32_t r = next_rand () % 64;
+		if (r == 0)
+			continue; // ɾĿ顣
+		xit_t item;
+		item.s_offset = source.size ();
+		item.t_offset = 0;
+		if (r < 4) {
+			item.type = DT_DIFF;
+			item.index = 0;
+			item.blklen = next_rand () % blklen + 1;
+			for (uint32_t k = 0; k < item.blklen; ++k)
+				source.push_back ((uchar_t)next_rand ());
+			items.push_back (item);
+			item.s_offset = source.size ();
+		}
+		item.type = DT_IDENT;
+		item.index = i;
+		item.blklen = blklen;
+		source.insert (source.end (), &target[(size_t)i * blklen], &target[(size_t)i * blklen] + blklen);
+		items.push_back (item);
+	}
+	for (size_t i = 0; i < items.size (); ++i)
+		items[i].next = i + 1 < items.size () ? &items[i + 1] : 0;
+	write_file (sname, source);
+	printf ("target:%10u MB\titems:%10u\tblock:%6u\n", mb, (uint32_t)items.size (), blklen);
+
+	bool ok = true;
+	const char * kinds[] = {"new file", "in-place"};
+	for (int inplace = 0; inplace < 2 && ok; ++inplace) {
+		double secs[2];
+		for (int m = 0; m < 2; ++m) {
+			std::vector<xit_t> copy (items);
+			for (size_t i = 0; i < copy.size (); ++i)
+				copy[i].next = i + 1 < copy.size () ? &copy[i + 1] : 0;
+			xit_t * head = &copy[0];
+			write_file (tname, target);
+			remove (oname.c_str ());
+			const std::string out = inplace ? tname : oname;
+			double t0 = now_sec ();
+			if (inplace)
+				xdelta_resolve_inplace (&head);
+			if (m == 0)
+				apply_by_item (head, tname, sname, out, source.size ());
+			else
+				ok = xdelta_apply (head, tname.c_str (), sname.c_str (), inplace ? 0 : oname.c_str ()
+					, source.size ()) == 0 && ok;
+			secs[m] = now_sec () - t0;
+			ok = same_file (out, source) && ok;
+		}
+		printf ("%-10s per item:%8.1f ms\txdelta_apply:%8.1f ms\tspeedup:%6.1fx\t%s\n", kinds[inplace]
+			, secs[0] * 1000, secs[1] * 1000, secs[0] / secs[1], ok ? "ok" : "FAILED");
+	}
+
+	// ļʱںиͬĶΣֵ֧ļϵͳ˻ûռд
+	for (int k = 0; k < 2 && ok; ++k) {
+		std::vector<xit_t> copy (items);
+		for (size_t i = 0; i < copy.size (); ++i)
+			copy[i].next = i + 1 < copy.size () ? &copy[i + 1] : 0;
+		write_file (tname, target);
+		remove (oname.c_str ());
+		xast_t stat;
+		double t0 = now_sec ();
+		ok = xdelta_apply_ex (&copy[0], tname.c_str (), sname.c_str (), oname.c_str (), source.size ()
+			, k == 0 ? 0 : XDELTA_APPLY_KERNEL_COPY, &stat) == 0 && ok;
+		double secs = now_sec () - t0;
+		ok = same_file (oname, source) && ok;
+		printf ("%-11s xdelta_apply_ex:%8.1f ms\tcloned:%8.1f MB\tkernel:%8.1f MB\tuser:%8.1f MB\t%s\n"
+			, k == 0 ? "user copy" : "kernel copy", secs * 1000, stat.clone_bytes / (1024.0 * 1024)
+			, stat.kernel_bytes / (1024.0 * 1024), stat.user_bytes / (1024.0 * 1024), ok ? "ok" : "FAILED");
+	}
+
+	remove (tname.c_str ());
+	remove (sname.c_str ());
+	remove (oname.c_str ());
+	return ok ? 0 : 1;
+}
+
+int main (int argn, char ** argc)
+{
+	if (argn < 2) {
+		printf ("usage: %s table [blocks] [hash_len] | filter [blocks] | tier [MB] | rollsum | eat [blk_len] | md4 | shash | ring | pdelta [threads] | segment [threads] [seg_len] | hashpipe [MB] [blk_len] | phash [threads] | mmap | aread [MB] | sparse [MB] | feed [MB] | array [MB] | holes [blocks] | inplace [max_blocks] | apply [MB]\n", argc[0]);
+		return -1;
+	}
+
+	std::string item (argc[1]);
+	if (item == "table")
+		return perf_table (argn, argc);
+	else if (item == "filter")
+		return perf_filter (argn, argc);
+	else if (item == "tier")
+		return perf_tier (argn, argc);
+	else if (item == "rollsum")
+		return perf_rollsum (argn, argc);
+	else if (item == "eat")
+		return perf_eat (argn, argc);
+	else if (item == "md4")
+		return perf_md4 (argn, argc);
+	else if (item == "shash")
+		return perf_shash (argn, argc);
+	else if (item == "ring")
+		return perf_ring (argn, argc);
+	else if (item == "pdelta")
+		return perf_pdelta (argn, argc);
+	else if (item == "segment")
+		return perf_segment (argn, argc);
+	else if (item == "hashpipe")
+		return perf_hashpipe (argn, argc);
+	else if (item == "phash")
+		return perf_phash (argn, argc);
+	else if (item == "mmap")
+		return perf_mmap (argn, argc);
+	else if (item == "aread")
+		return perf_aread (argn, argc);
+	else if (item == "sparse")
+		return perf_sparse (argn, argc);
+	else if (item == "feed")
+		return perf_feed (argn, argc);
+	else if (item == "array")
+		return perf_array (argn, argc);
+	else if (item == "holes")
+		return perf_holes (argn, argc);
+	else if (item == "inplace")
+		return perf_inplace (argn, argc);
+	else if (item == "apply")
+		return perf_apply (argn, argc);
+
+	printf ("unknown item %s.\n", item.c_str ());
+	return -1;
+}
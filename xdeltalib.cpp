@@ -45,15 +45,18 @@
 #include <string>
 #include <iterator>
 #include <list>
+#include <deque>
 #include <algorithm>
 #include <vector>
 #include <math.h>
 #include <assert.h>
 
 #include "mytypes.h"
+#include "tinythread.h"
 #include "md4.h"
 #include "rw.h"
 #include "rollsum.h"
+#include "ringbuf.h"
 #include "buffer.h"
 #include "xdeltalib.h"
 #include "platform.h"
@@ -64,10 +67,10 @@ namespace xdelta {
 // Our implementations.
 //
 
-static void free_hash_set (const std::pair<uint32_t, std::set<slow_hash> *> & p)
-{
-	delete p.second;
-}
+/// ۵С
+#define MIN_HASH_SLOTS 16
+/// λ2MBٶʱʻԱֱӷʲ졣
+#define MAX_FILTER_BITS ((uint32_t)1 << 24)
 
 hash_table::~hash_table ()
 {
@@ -76,100 +79,887 @@ hash_table::~hash_table ()
 
 void hash_table::clear ()
 {
-	std::for_each (hash_table_.begin (), hash_table_.end (), free_hash_set);
-	hash_table_.clear ();
+	// ýķʽͷڴ棬clear ͷ vector 
+	std::vector<hash_slot> ().swap (slots_);
+	std::vector<hash_entry> ().swap (entries_);
+	std::vector<uchar_t> ().swap (strong_);
+	std::vector<uint64_t> ().swap (filter_);
+	mask_ = 0;
+	shift_ = 32;
+	used_ = 0;
+	fshift_ = 32;
+}
+
+void hash_table::set_filter (const bool on)
+{
+	use_filter_ = on;
+	build_filter ();
+}
+
+void hash_table::build_filter ()
+{
+	std::vector<uint64_t> ().swap (filter_);
+	fshift_ = 32;
+	if (!use_filter_ || slots_.empty ())
+		return;
+
+	// ÿ 4 λӲ 1/2ÿ Hash  8 λλĿʽ Bloom
+	//  5% ҡǩ飩ֻа KBԷ L2 С
+	uint32_t bits = (mask_ + 1) * 4;
+	if (bits > MAX_FILTER_BITS)
+		bits = MAX_FILTER_BITS;
+
+	uint32_t wbits = 1; // λ 32
+	while (((uint32_t)64 << wbits) < bits)
+		++wbits;
+	filter_.assign ((size_t)1 << wbits, 0);
+	fshift_ = 32 - wbits;
+
+	typedef std::vector<hash_slot>::const_iterator it_t;
+	for (it_t it = slots_.begin (); it != slots_.end (); ++it)
+		if (it->head != 0)
+			filter_add (it->fhash);
+}
+
+void hash_table::set_hash_len (const uint32_t hlen)
+{
+	if (hlen == 0 || hlen > DIGEST_BYTES)
+		THROW_XDELTA_EXCEPTION ("Invalid strong hash length.");
+	if (hlen == hlen_)
+		return;
+
+	// еĿ鰴µĳУӳʱֽѾʧֻܲ 0
+	std::vector<uchar_t> strong (entries_.size () * hlen, 0);
+	const uint32_t keep = hlen < hlen_ ? hlen : hlen_;
+	for (size_t i = 0; i < entries_.size (); ++i)
+		memcpy (&strong[i * hlen], &strong_[i * hlen_], keep);
+	strong_.swap (strong);
+	hlen_ = hlen;
 }
 
-const slow_hash * hash_table::find_block (const uint32_t fhash
-										, const uchar_t * buf
-										, const uint32_t len) const
+void hash_table::rehash (uint32_t slots)
 {
-	chit_t pos;
-	if ((pos = hash_table_.find (fhash)) == hash_table_.end ())
-		return 0;
+	uint32_t bits = 0;
+	while (((uint32_t)1 << bits) < slots)
+		++bits;
+
+	std::vector<hash_slot> old;
+	old.swap (slots_);
+
+	hash_slot empty_slot;
+	empty_slot.fhash = 0;
+	empty_slot.head = 0;
+	slots_.assign ((size_t)1 << bits, empty_slot);
+	mask_ = ((uint32_t)1 << bits) - 1;
+	shift_ = 32 - bits;
+
+	typedef std::vector<hash_slot>::const_iterator it_t;
+	for (it_t it = old.begin (); it != old.end (); ++it) {
+		if (it->head == 0)
+			continue;
+		uint32_t pos = slot_of (it->fhash);
+		while (slots_[pos].head != 0)
+			pos = (pos + 1) & mask_;
+		slots_[pos] = *it;
+	}
+
+	build_filter ();
+}
+
+void hash_table::reserve (const uint32_t nr)
+{
+	entries_.reserve (nr);
+	strong_.reserve ((size_t)nr * hlen_);
+	// Ӳ 1/2֤ʱ̽ⳤ㹻̡
+	uint32_t slots = nr * 2;
+	if (slots < MIN_HASH_SLOTS)
+		slots = MIN_HASH_SLOTS;
+	if (slots > mask_ + 1 || slots_.empty ())
+		rehash (slots);
+}
+
+bool hash_table::find_block (const uint32_t fhash
+							, const uchar_t * buf
+							, const uint32_t len
+							, target_pos & tpos
+							, hash_stat * stat) const
+{
+	if (stat != 0)
+		++stat->lookups;
+	if (used_ == 0)
+		return false;
+	if (!filter_.empty () && !filter_test (fhash))
+		return false;
+
+	uint32_t pos = slot_of (fhash);
+	while (true) {
+		const hash_slot & slot = slots_[pos];
+		if (slot.head == 0)
+			return false;
+		if (slot.fhash == fhash)
+			break;
+		pos = (pos + 1) & mask_;
+	}
+
+	if (stat != 0)
+		++stat->fast_hits;
 
-	slow_hash bsh;
-	get_slow_hash (buf, len, bsh.hash);
-	bsh.tpos.index = -1; // not used.
+	// ּƥ䣺У Hash  MD4 ÿλһΣҶҪʱż㡣
+	// 32 λ Hash ڴļкܶ࣬У Hash ͬʱͲټ MD4 ˡ
+	const uint64_t check = use_check_ ? get_check_hash (buf, len) : 0;
+	uchar_t hash[DIGEST_BYTES];
+	bool hashed = false;
 
-	std::set<slow_hash>::const_iterator hashpos;
-	if ((hashpos = pos->second->find (bsh)) == pos->second->end ())
-		return 0;
+	for (uint32_t idx = slots_[pos].head; idx != 0; ) {
+		const hash_entry & entry = entries_[idx - 1];
+		idx = entry.next;
+		if (use_check_ && entry.check != check)
+			continue;
+
+		if (!hashed) {
+			get_slow_hash (buf, len, hash, hash_type_);
+			hashed = true;
+			if (stat != 0) {
+				++stat->check_hits;
+				++stat->strong_hashes;
+			}
+		}
+		if (memcmp (&strong_[(size_t)(&entry - &entries_[0]) * hlen_], hash, hlen_) == 0) {
+			if (stat != 0)
+				++stat->matches;
+			tpos.index = entry.index;
+			tpos.t_offset = entry.t_offset;
+			return true;
+		}
+	}
 
-	return &*hashpos;
+	return false;
 }
 
 void hash_table::add_block (const uint32_t fhash, const slow_hash & shash)
 {
-	hash_iter pos;
-	if ((pos = hash_table_.find (fhash)) == hash_table_.end ()) {
-		pos = hash_table_.insert (std::make_pair (fhash, new std::set<slow_hash> ())).first;
+	if ((used_ + 1) * 2 > mask_ + 1 || slots_.empty ())
+		rehash (slots_.empty () ? MIN_HASH_SLOTS : (mask_ + 1) * 2);
+
+	uint32_t pos = slot_of (fhash);
+	while (slots_[pos].head != 0 && slots_[pos].fhash != fhash)
+		pos = (pos + 1) & mask_;
+
+	hash_slot & slot = slots_[pos];
+	uint32_t tail = 0; // β± 1push_back ܻƶԲָܱ롣
+	if (slot.head != 0) {
+		// ԭ std::set ͬ Hash ѾʱȼĿ顣 Hash ض̺
+		// ҪȽУ Hashѽض̺ײĲͬ鶪
+		for (uint32_t idx = slot.head; idx != 0; idx = entries_[idx - 1].next) {
+			if ((!use_check_ || entries_[idx - 1].check == shash.check)
+				&& memcmp (&strong_[(size_t)(idx - 1) * hlen_], shash.hash, hlen_) == 0)
+				return;
+			tail = idx;
+		}
+	}
+	else {
+		slot.fhash = fhash;
+		++used_;
+		if (!filter_.empty ())
+			filter_add (fhash);
+	}
+
+	hash_entry entry;
+	entry.check = shash.check;
+	entry.t_offset = shash.tpos.t_offset;
+	entry.index = shash.tpos.index;
+	entry.next = 0;
+	entries_.push_back (entry);
+	strong_.insert (strong_.end (), shash.hash, shash.hash + hlen_);
+	if (tail == 0)
+		slot.head = (uint32_t)entries_.size ();
+	else
+		entries_[tail - 1].next = (uint32_t)entries_.size ();
+}
+
+void xdelta_stream::add_zero (const uint64_t length, const uint64_t s_offset)
+{
+	const uint32_t buflen = (uint32_t)(length > XDELTA_BUFFER_LEN ? XDELTA_BUFFER_LEN : length);
+	char_buffer<uchar_t> zeros (buflen);
+	memset (zeros.begin (), 0, buflen);
+	for (uint64_t pos = 0; pos < length; pos += buflen) {
+		const uint32_t len = (uint32_t)(length - pos > buflen ? buflen : length - pos);
+		add_block (zeros.begin (), len, s_offset + pos);
+	}
+}
+
+/// \fn read_chunk()
+/// \brief
+///  reader  len ֽڣͬʱļ MD4
+static void read_chunk (file_reader & reader, uchar_t * buf, uint32_t len, rs_mdfour_t * pctx)
+{
+	//
+	// to_read_bytes Ӧ˻Զȡݣһ ȡ buflen Сݡܹ
+	// пܵѭڵȴ Bug »ᷢ
+	//
+	while (len > 0) {
+		int size = reader.read_file (buf, len);
+		if (size <= 0) {
+			std::string errmsg = "Can't not read file or pipe.";
+			THROW_XDELTA_EXCEPTION (errmsg);
+		}
+
+		if (pctx != 0)
+			rs_mdfour_update(pctx, buf, size);
+
+		buf += size;
+		len -= size;
+	}
+}
+
+/// \fn calc_blocks()
+/// \brief
+///  data ʼ nr Ŀ졢 Hash У Hash˳ fhashes
+///  shashes tpos֮以أ HashMD4 ʱ·У
+static void calc_blocks (const uchar_t * data
+						, uint32_t nr
+						, const int32_t blk_len
+						, strong_hash_type hash_type
+						, uint32_t * fhashes
+						, slow_hash * shashes)
+{
+	while (nr > 0) {
+		const uchar_t * blocks[MD4_MAX_LANES];
+		uchar_t digests[MD4_MAX_LANES * DIGEST_BYTES];
+		const uint32_t n = nr < MD4_MAX_LANES ? nr : MD4_MAX_LANES;
+		for (uint32_t i = 0; i < n; ++i)
+			blocks[i] = data + i * blk_len;
+		get_strong_hash_multi (hash_type, digests, blocks, blk_len, n);
+
+		for (uint32_t i = 0; i < n; ++i) {
+			fhashes[i] = rolling_hasher::hash (blocks[i], blk_len);
+			memcpy (shashes[i].hash, digests + i * DIGEST_BYTES, DIGEST_BYTES);
+			shashes[i].check = get_check_hash (blocks[i], blk_len);
+		}
+
+		data += n * blk_len;
+		fhashes += n;
+		shashes += n;
+		nr -= n;
+	}
+}
+
+/// \fn emit_blocks()
+/// \brief
+/// ˳ calc_blocks Ľ streamindex ΪһţʱΪһš
+static void emit_blocks (hasher_stream & stream
+						, const uint32_t * fhashes
+						, slow_hash * shashes
+						, const uint32_t nr
+						, const uint64_t t_offset
+						, uint64_t & index)
+{
+	for (uint32_t i = 0; i < nr; ++i) {
+		shashes[i].tpos.index = (uint32_t)index;
+		shashes[i].tpos.t_offset = t_offset;
+		stream.add_block (fhashes[i], shashes[i]);
+		++index;
+	}
+}
+
+/// \fn hash_blocks()
+/// \brief
+///  data ÿĿ졢 Hash ˳һβ㡣
+static void hash_blocks (hasher_stream & stream
+						, const uchar_t * data
+						, const uint32_t len
+						, const int32_t blk_len
+						, const uint64_t t_offset
+						, uint64_t & index
+						, strong_hash_type hash_type)
+{
+	uint32_t nr = len / blk_len;
+	while (nr > 0) {
+		uint32_t fhashes[MD4_MAX_LANES];
+		slow_hash shashes[MD4_MAX_LANES];
+		const uint32_t n = nr < MD4_MAX_LANES ? nr : MD4_MAX_LANES;
+		calc_blocks (data, n, blk_len, hash_type, fhashes, shashes);
+		emit_blocks (stream, fhashes, shashes, n, t_offset, index);
+		data += n * blk_len;
+		nr -= n;
+	}
+}
+
+/// read_and_hash ˮлĸ
+#define HASH_PIPELINE_DEPTH 2
+
+/// \struct
+/// \brief read_and_hash Ķ̹߳߳ݡreaderpctx  to_read ֻɶ߳
+/// ʹãԱ lock 
+struct hash_pipeline
+{
+	file_reader *		reader;
+	rs_mdfour_t *		pctx;
+	uint64_t			to_read;
+	uint32_t			chunk;
+	std::vector<char_buffer<uchar_t> *> mem;
+	uchar_t *			bufs[HASH_PIPELINE_DEPTH];
+	uint32_t			lens[HASH_PIPELINE_DEPTH];
+	bool				full[HASH_PIPELINE_DEPTH];
+
+	mutex				lock;
+	condition_variable	cond;
+	bool				stop;
+	bool				failed;		///< ̳߳error Ϊ 0 ʱ xdelta_exception
+	xdelta_exception *	error;
+	thread *			reader_thread;
+
+	hash_pipeline () : reader (0), pctx (0), to_read (0), chunk (0), stop (false), failed (false)
+		, error (0), reader_thread (0)
+	{
+		for (int i = 0; i < HASH_PIPELINE_DEPTH; ++i) {
+			bufs[i] = 0;
+			lens[i] = 0;
+			full[i] = false;
+		}
+	}
+	~hash_pipeline ()
+	{
+		stop_reader ();
+		for (size_t i = 0; i < mem.size (); ++i)
+			delete mem[i];
+		delete error;
+	}
+	void fail (const xdelta_exception * e)
+	{
+		lock_guard<mutex> guard (lock);
+		if (e != 0)
+			error = new xdelta_exception (*e);
+		failed = true;
+		cond.notify_all ();
+	}
+	void start_reader (file_reader & r, rs_mdfour_t * ctx, const uint64_t bytes, const uint32_t len);
+	void stop_reader ();
+	/// \brief
+	/// ȴ i ζĻ棬̳߳ʱ 0
+	uchar_t * wait_slot (const uint32_t i)
+	{
+		const uint32_t slot = i % HASH_PIPELINE_DEPTH;
+		lock_guard<mutex> guard (lock);
+		while (!full[slot] && !failed)
+			cond.wait (lock);
+		return full[slot] ? bufs[slot] : 0;
+	}
+	/// \brief
+	///  i ζĻǷѾȴ
+	bool slot_ready (const uint32_t i)
+	{
+		lock_guard<mutex> guard (lock);
+		return full[i % HASH_PIPELINE_DEPTH];
+	}
+	/// \brief
+	///  i ζĻѾ̼꣬߳
+	void release_slot (const uint32_t i)
+	{
+		lock_guard<mutex> guard (lock);
+		full[i % HASH_PIPELINE_DEPTH] = false;
+		cond.notify_all ();
+	}
+	/// \brief
+	/// ߳̽󣬰Ĵ׸ߡ
+	void check_error ()
+	{
+		if (error != 0) {
+			xdelta_exception e (*error);
+			throw e;
+		}
+		if (failed)
+			THROW_XDELTA_EXCEPTION_NO_ERRNO ("Read thread failed.");
+	}
+};
+
+/// \fn hash_reader_thread()
+/// \brief
+/// ̣߳ΰݶеĻ棬߳ȡ֮ǰḲǡ
+static void hash_reader_thread (void * data)
+{
+	hash_pipeline * hp = (hash_pipeline *)data;
+	try {
+		for (uint32_t i = 0; hp->to_read > 0; ++i) {
+			const uint32_t slot = i % HASH_PIPELINE_DEPTH;
+			{
+				lock_guard<mutex> guard (hp->lock);
+				while (hp->full[slot] && !hp->stop)
+					hp->cond.wait (hp->lock);
+				if (hp->stop)
+					return;
+			}
+
+			const uint32_t len = (uint32_t)(hp->to_read > hp->chunk ? hp->chunk : hp->to_read);
+			read_chunk (*hp->reader, hp->bufs[slot], len, hp->pctx);
+			hp->to_read -= len;
+
+			lock_guard<mutex> guard (hp->lock);
+			hp->lens[slot] = len;
+			hp->full[slot] = true;
+			hp->cond.notify_all ();
+		}
+	}
+	catch (xdelta_exception & e) {
+		hp->fail (&e);
+	}
+	catch (...) {
+		hp->fail (0);
+	}
+}
+
+void hash_pipeline::start_reader (file_reader & r, rs_mdfour_t * ctx, const uint64_t bytes, const uint32_t len)
+{
+	reader = &r;
+	pctx = ctx;
+	to_read = bytes;
+	chunk = len;
+	for (int i = 0; i < HASH_PIPELINE_DEPTH; ++i) {
+		mem.push_back (new char_buffer<uchar_t> (chunk));
+		bufs[i] = mem.back ()->begin ();
+	}
+	reader_thread = new thread (hash_reader_thread, this);
+}
+
+void hash_pipeline::stop_reader ()
+{
+	if (reader_thread == 0)
+		return;
+	{
+		lock_guard<mutex> guard (lock);
+		stop = true;
+		cond.notify_all ();
+	}
+	reader_thread->join ();
+	delete reader_thread;
+	reader_thread = 0;
+}
+
+/// \fn hash_range()
+/// \brief
+/// Ӷָ뿪ʼ to_read_bytes ֽڵĿ졢ϣindex ΪһţʱΪһ
+/// š
+///
+/// ÿζ鳤ݣпԽζĿ顣ݶһζʱһ߳
+/// ݶ HASH_PIPELINE_DEPTH еĿߣͬʱļ MD4߳
+/// ѾĻ棬 Hash صС
+static void hash_range (file_reader & reader
+							, hasher_stream & stream
+							, uint64_t to_read_bytes
+							, const int32_t blk_len
+							, uint64_t t_offset
+							, uint64_t & index
+							, rs_mdfour_t * pctx
+							, strong_hash_type hash_type)
+{
+	const uint32_t chunk = XDELTA_BUFFER_LEN / blk_len * blk_len;
+	if (reader.can_map ()) {
+		// ֱӳϼ㣬Ҫ漰̣߳ϵͳǰݡ
+		uint64_t pos = reader.seek_file (0, FILE_CURRENT);
+		while (to_read_bytes > 0) {
+			const uint32_t len = (uint32_t)(to_read_bytes > chunk ? chunk : to_read_bytes);
+			const uchar_t * data = reader.map_file (pos, len);
+			if (pctx != 0)
+				rs_mdfour_update (pctx, data, len);
+			hash_blocks (stream, data, len, blk_len, t_offset, index, hash_type);
+			pos += len;
+			to_read_bytes -= len;
+		}
+		reader.seek_file (pos, FILE_BEGIN);
+		return;
+	}
+
+	if (to_read_bytes <= chunk) {
+		// һξͿԶ꣬Ҫ̡߳
+		char_buffer<uchar_t> buf ((std::size_t)to_read_bytes);
+		read_chunk (reader, buf.begin (), (uint32_t)to_read_bytes, pctx);
+		hash_blocks (stream, buf.begin (), (uint32_t)to_read_bytes, blk_len, t_offset, index, hash_type);
+		return;
 	}
-	
-	pos->second->insert (shash);
+
+	hash_pipeline hp;
+	hp.start_reader (reader, pctx, to_read_bytes, chunk);
+	for (uint32_t i = 0; to_read_bytes > 0; ++i) {
+		const uchar_t * data = hp.wait_slot (i);
+		if (data == 0)
+			break;
+
+		const uint32_t len = hp.lens[i % HASH_PIPELINE_DEPTH];
+		hash_blocks (stream, data, len, blk_len, t_offset, index, hash_type);
+		to_read_bytes -= len;
+		hp.release_slot (i);
+	}
+
+	hp.stop_reader ();
+	hp.check_error ();
+}
+
+/// \fn hash_zeros()
+/// \brief
+///  nr ڿնеĿ飬ȫ 0ֻ zero_sent Ϊ false ʱһ Hash
+/// Զȫ 0 Ŀ鶼ƥ䵽һ顣ļ MD4 ȻЩ 0
+static void hash_zeros (hasher_stream & stream
+						, const uint64_t nr
+						, const int32_t blk_len
+						, const uint64_t t_offset
+						, uint64_t & index
+						, bool & zero_sent
+						, rs_mdfour_t * pctx
+						, strong_hash_type hash_type)
+{
+	char_buffer<uchar_t> zeros (blk_len);
+	memset (zeros.begin (), 0, blk_len);
+	if (!zero_sent) {
+		uint32_t fhash;
+		slow_hash shash;
+		uint64_t first = index;
+		calc_blocks (zeros.begin (), 1, blk_len, hash_type, &fhash, &shash);
+		emit_blocks (stream, &fhash, &shash, 1, t_offset, first);
+		zero_sent = true;
+	}
+
+	if (pctx != 0)
+		for (uint64_t i = 0; i < nr; ++i)
+			rs_mdfour_update (pctx, zeros.begin (), blk_len);
+	index += nr;
 }
 
 /// \fn read_and_hash()
 /// \brief
 /// ӿʵּ졢ϣ
+///
+/// reader Ան file_reader::get_extentʱȫڿնеĿ鲻Ҳ㣬
+///  hash_zeros ݰԭķʽ hash_range 㣬ż˳򲻱䡣
 void read_and_hash (file_reader & reader
 							, hasher_stream & stream
 							, uint64_t to_read_bytes
 							, const int32_t blk_len
 							, uint64_t t_offset
-							, rs_mdfour_t * pctx)
+							, rs_mdfour_t * pctx
+							, strong_hash_type hash_type)
 {
-	//
-	// read huge block one time and calc hash block after block length of f_blk_len;
-	//
-	uint32_t buflen;
-	char_buffer<uchar_t> buf (XDELTA_BUFFER_LEN);
-
 	uint64_t index = 0;
-	uchar_t * rdbuf = buf.begin ();
-	buflen = (uint32_t)(to_read_bytes > XDELTA_BUFFER_LEN ? XDELTA_BUFFER_LEN : to_read_bytes);
-
-	while (to_read_bytes > 0) {
-		//
-		// to_read_bytes Ӧ˻Զȡݣһ ȡ buflen Сݡܹ
-		// пܵѭڵȴ Bug »ᷢ
-		//
-		uchar_t * endbuf = rdbuf;
-		while (buflen > 0) {
-			int size = reader.read_file (endbuf, buflen);
-			if (size <= 0) {
-				std::string errmsg = "Can't not read file or pipe.";
-				THROW_XDELTA_EXCEPTION (errmsg);
+	if (!reader.has_extents () || to_read_bytes < (uint64_t)blk_len * 2) {
+		hash_range (reader, stream, to_read_bytes, blk_len, t_offset, index, pctx, hash_type);
+		return;
+	}
+
+	const uint64_t start = reader.seek_file (0, FILE_CURRENT);
+	const uint64_t end = start + to_read_bytes;
+	uint64_t pos = start;
+	uint64_t data = start;	// ûмݵĿʼڿı߽ϡ
+	bool zero_sent = false;
+	while (pos < end) {
+		uint64_t len = 0;
+		const bool hole = reader.get_extent (pos, len);
+		if (len == 0 || len > end - pos)
+			len = end - pos;
+
+		if (hole) {
+			const uint64_t first = start + (pos - start + blk_len - 1) / blk_len * blk_len;
+			const uint64_t last = start + (pos + len - start) / blk_len * blk_len;
+			if (first < last) {
+				if (first > data) {
+					reader.seek_file (data, FILE_BEGIN);
+					hash_range (reader, stream, first - data, blk_len, t_offset, index, pctx, hash_type);
+				}
+				hash_zeros (stream, (last - first) / blk_len, blk_len, t_offset, index, zero_sent
+					, pctx, hash_type);
+				data = last;
+			}
+		}
+		pos += len;
+	}
+
+	reader.seek_file (data, FILE_BEGIN);
+	if (end > data)
+		hash_range (reader, stream, end - data, blk_len, t_offset, index, pctx, hash_type);
+}
+
+hash_feeder::hash_feeder (hasher_stream & stream
+						, const int32_t blk_len
+						, const uint64_t t_offset
+						, rs_mdfour_t * pctx
+						, strong_hash_type hash_type)
+	: stream_ (stream), blk_len_ (blk_len), t_offset_ (t_offset), pctx_ (pctx)
+	, hash_type_ (hash_type), index_ (0)
+{
+	carry_.reserve (blk_len);
+}
+
+void hash_feeder::feed (const uchar_t * data, const uint32_t len)
+{
+	if (pctx_ != 0)
+		rs_mdfour_update (pctx_, data, len);
+
+	uint32_t pos = 0;
+	if (!carry_.empty ()) {
+		const uint32_t need = blk_len_ - (uint32_t)carry_.size ();
+		pos = len < need ? len : need;
+		carry_.insert (carry_.end (), data, data + pos);
+		if (carry_.size () < (size_t)blk_len_)
+			return;
+		hash_blocks (stream_, &carry_[0], blk_len_, blk_len_, t_offset_, index_, hash_type_);
+		carry_.clear ();
+	}
+
+	const uint32_t whole = (len - pos) / blk_len_ * blk_len_;
+	hash_blocks (stream_, data + pos, whole, blk_len_, t_offset_, index_, hash_type_);
+	carry_.assign (data + pos + whole, data + len);
+}
+
+/// \struct
+/// \brief read_and_hash_parallel һһ nr 顣
+struct hash_task
+{
+	const uchar_t *		data;
+	uint32_t			nr;
+	uint32_t *			fhashes;	///< ŵλãָ hash_workers Ľ
+	slow_hash *			shashes;
+	bool				done;
+};
+
+/// \struct
+/// \brief read_and_hash_parallel ļ̹߳ݣqueue  lock 
+struct hash_workers
+{
+	int32_t						blk_len;
+	strong_hash_type			hash_type;
+	std::vector<uint32_t>		fhashes[HASH_PIPELINE_DEPTH];	///< ÿиĽ
+	std::vector<slow_hash>		shashes[HASH_PIPELINE_DEPTH];
+	std::vector<hash_task>		tasks[HASH_PIPELINE_DEPTH];		///< ÿзֳɵ
+
+	mutex						lock;
+	condition_variable			cond;
+	std::deque<hash_task *>		queue;
+	bool						stop;
+	bool						failed;	///< ̳߳error Ϊ 0 ʱ xdelta_exception
+	xdelta_exception *			error;
+	std::vector<thread *>		workers;
+
+	hash_workers () : blk_len (0), hash_type (STRONG_HASH_MD4), stop (false), failed (false), error (0) {}
+	~hash_workers ()
+	{
+		stop_workers ();
+		delete error;
+	}
+	void fail (const xdelta_exception * e)
+	{
+		lock_guard<mutex> guard (lock);
+		if (!failed && e != 0)
+			error = new xdelta_exception (*e);
+		failed = true;
+		stop = true;
+		cond.notify_all ();
+	}
+	void start_workers (const uint32_t threads);
+	void stop_workers ();
+	void post (const uint32_t slot, const uchar_t * data, const uint32_t len);
+	/// \brief
+	/// ȴɣ̳߳ʱ false
+	bool wait_task (const hash_task & task)
+	{
+		lock_guard<mutex> guard (lock);
+		while (!task.done && !stop)
+			cond.wait (lock);
+		return task.done;
+	}
+	void check_error ()
+	{
+		if (error != 0) {
+			xdelta_exception e (*error);
+			throw e;
+		}
+		if (failed)
+			THROW_XDELTA_EXCEPTION_NO_ERRNO ("Hash thread failed.");
+	}
+};
+
+/// \fn hash_worker()
+/// \brief
+/// ̣߳ȡ񣬼
+static void hash_worker (void * data)
+{
+	hash_workers * hw = (hash_workers *)data;
+	try {
+		while (true) {
+			hash_task * task;
+			{
+				lock_guard<mutex> guard (hw->lock);
+				while (hw->queue.empty () && !hw->stop)
+					hw->cond.wait (hw->lock);
+				if (hw->stop)
+					return;
+				task = hw->queue.front ();
+				hw->queue.pop_front ();
 			}
 
+			calc_blocks (task->data, task->nr, hw->blk_len, hw->hash_type, task->fhashes, task->shashes);
+
+			lock_guard<mutex> guard (hw->lock);
+			task->done = true;
+			hw->cond.notify_all ();
+		}
+	}
+	catch (xdelta_exception & e) {
+		hw->fail (&e);
+	}
+	catch (...) {
+		hw->fail (0);
+	}
+}
+
+void hash_workers::start_workers (const uint32_t threads)
+{
+	for (uint32_t i = 0; i < threads; ++i)
+		workers.push_back (new thread (hash_worker, this));
+}
+
+void hash_workers::stop_workers ()
+{
+	{
+		lock_guard<mutex> guard (lock);
+		stop = true;
+		cond.notify_all ();
+	}
+	for (size_t i = 0; i < workers.size (); ++i) {
+		workers[i]->join ();
+		delete workers[i];
+	}
+	workers.clear ();
+}
+
+/// \brief
+/// һĻ水зֳ񽻸̡߳ÿ߳һ񣬵ÿ
+/// MD4_MAX_LANES 飬ʹ MD4 Ӱ졣
+void hash_workers::post (const uint32_t slot, const uchar_t * data, const uint32_t len)
+{
+	const uint32_t nr = len / blk_len;
+	uint32_t ntasks = (uint32_t)workers.size ();
+	if (ntasks > nr / MD4_MAX_LANES)
+		ntasks = nr / MD4_MAX_LANES;
+	if (ntasks == 0)
+		ntasks = 1;
+
+	if (fhashes[slot].size () < nr) {
+		fhashes[slot].resize (nr);
+		shashes[slot].resize (nr);
+	}
+
+	std::vector<hash_task> & ts = tasks[slot];
+	ts.resize (ntasks);
+	uint32_t first = 0;
+	for (uint32_t i = 0; i < ntasks; ++i) {
+		const uint32_t n = nr / ntasks + (i < nr % ntasks ? 1 : 0);
+		ts[i].data = data + (uint64_t)first * blk_len;
+		ts[i].nr = n;
+		ts[i].fhashes = nr == 0 ? 0 : &fhashes[slot][first];
+		ts[i].shashes = nr == 0 ? 0 : &shashes[slot][first];
+		ts[i].done = false;
+		first += n;
+	}
+
+	lock_guard<mutex> guard (lock);
+	for (uint32_t i = 0; i < ntasks; ++i)
+		queue.push_back (&ts[i]);
+	cond.notify_all ();
+}
+
+/// \fn read_and_hash_parallel()
+/// \brief
+/// ߳ read_and_hash ͬÿһͰзֽ̣̰߳߳
+/// ˳ȡؽһ֮ǰȰѾһ潻ȥ̲߳صȴ
+/// 
+void read_and_hash_parallel (file_reader & reader
+							, hasher_stream & stream
+							, uint64_t to_read_bytes
+							, const int32_t blk_len
+							, uint64_t t_offset
+							, rs_mdfour_t * pctx
+							, strong_hash_type hash_type
+							, uint32_t threads)
+{
+	if (threads == 0)
+		threads = thread::hardware_concurrency ();
+
+	const uint32_t chunk = XDELTA_BUFFER_LEN / blk_len * blk_len;
+	if (threads <= 1 || to_read_bytes < (uint64_t)blk_len * MD4_MAX_LANES * 2) {
+		read_and_hash (reader, stream, to_read_bytes, blk_len, t_offset, pctx, hash_type);
+		return;
+	}
+
+	// hw  hp ߳̽ǰ治ͷš
+	hash_pipeline hp;
+	hash_workers hw;
+	hw.blk_len = blk_len;
+	hw.hash_type = hash_type;
+	hw.start_workers (threads);
+
+	uint64_t index = 0;
+	if (reader.can_map ()) {
+		// ֱ߳ӳϼ㣬߳ͬʱļ MD4Ҫ̡߳
+		uint64_t pos = reader.seek_file (0, FILE_CURRENT);
+		while (to_read_bytes > 0) {
+			const uint32_t len = (uint32_t)(to_read_bytes > chunk ? chunk : to_read_bytes);
+			const uchar_t * data = reader.map_file (pos, len);
+			hw.post (0, data, len);
 			if (pctx != 0)
-				rs_mdfour_update(pctx, rdbuf, size);
-
-			to_read_bytes -= size;
-			endbuf += size;
-			buflen -= size;
-		}
-
-		rdbuf = buf.begin ();
-		while ((int32_t)(endbuf - rdbuf) >= blk_len) {
-			uint32_t fhash = rolling_hasher::hash (rdbuf, blk_len);
-			struct slow_hash bsh;
-			bsh.tpos.index = index;
-			bsh.tpos.t_offset = t_offset;
-			get_slow_hash (rdbuf, blk_len, bsh.hash);
-			stream.add_block (fhash, bsh);
-			++index;
-			rdbuf += blk_len;
+				rs_mdfour_update (pctx, data, len);
+
+			const std::vector<hash_task> & ts = hw.tasks[0];
+			for (size_t t = 0; t < ts.size (); ++t) {
+				if (!hw.wait_task (ts[t])) {
+					hw.stop_workers ();
+					hw.check_error ();
+				}
+				emit_blocks (stream, ts[t].fhashes, ts[t].shashes, ts[t].nr, t_offset, index);
+			}
+			pos += len;
+			to_read_bytes -= len;
+		}
+		hw.stop_workers ();
+		reader.seek_file (pos, FILE_BEGIN);
+		return;
+	}
+
+	hp.start_reader (reader, pctx, to_read_bytes, chunk);
+	uint32_t posted = 0;	// Ѿ̵߳Ļ
+	bool ok = true;
+	for (uint32_t i = 0; ok && to_read_bytes > 0; ++i) {
+		const uint32_t slot = i % HASH_PIPELINE_DEPTH;
+		if (posted == i) {
+			const uchar_t * data = hp.wait_slot (i);
+			if (data == 0)
+				break;
+			hw.post (slot, data, hp.lens[slot]);
+			++posted;
+		}
+		// ߳ѾһҲȽȥ
+		if (posted == i + 1 && (uint64_t)hp.lens[slot] < to_read_bytes && hp.slot_ready (posted)) {
+			const uint32_t next = posted % HASH_PIPELINE_DEPTH;
+			hw.post (next, hp.bufs[next], hp.lens[next]);
+			++posted;
 		}
 
-		uint32_t remain = (int32_t)(endbuf - rdbuf);
-		if (remain > 0)
-			memmove (buf.begin (), rdbuf, remain);
+		const std::vector<hash_task> & ts = hw.tasks[slot];
+		for (size_t t = 0; t < ts.size (); ++t) {
+			if (!hw.wait_task (ts[t])) {
+				ok = false;
+				break;
+			}
+			emit_blocks (stream, ts[t].fhashes, ts[t].shashes, ts[t].nr, t_offset, index);
+		}
+		if (!ok)
+			break;
 
-		rdbuf = buf.begin () + remain;
-		buflen = XDELTA_BUFFER_LEN - remain;
-		buflen = (uint32_t)(to_read_bytes > buflen ? buflen : to_read_bytes);
+		to_read_bytes -= hp.lens[slot];
+		hp.release_slot (i);
 	}
+
+	hp.stop_reader ();
+	hw.stop_workers ();
+	hp.check_error ();
+	hw.check_error ();
 }
 
 //
@@ -188,11 +978,12 @@ void hash_table::hash_it (file_reader & reader, hasher_stream & stream) const
 	reader.open_file (); // sometimes this will throw.
 	filsize = reader.get_file_size ();
 	f_blk_len = get_xdelta_block_size (filsize);
-	read_and_hash (reader, stream, filsize, f_blk_len, 0, &ctx);
+	read_and_hash (reader, stream, filsize, f_blk_len, 0, &ctx, hash_type_);
 
 	uchar_t file_hash[DIGEST_BYTES];
 	memset (file_hash, 0, sizeof (file_hash));
 	rs_mdfour_result (&ctx, file_hash);
+	stream.end_hash (file_hash);
 
 	reader.close_file ();
 	return;
@@ -202,172 +993,1060 @@ void hash_table::hash_it (file_reader & reader, hasher_stream & stream) const
 
 void split_hole (std::set<hole_t> & holeset, const hole_t & hole)
 {
+	if (hole.length == 0)
+		return;
+
 	typedef std::set<hole_t>::iterator it_t;
 	hole_t findhole;
 	findhole.offset = hole.offset;
 	findhole.length = 0;
 
 	it_t pos = holeset.find (findhole);
-	if (pos != holeset.end ()) {
-		const hole_t bighole = *pos;
-		if (bighole.offset <= hole.offset && 
-			(bighole.offset + bighole.length) >= (hole.offset + hole.length)) {
-				// split to one or more hole, like this
-				// |--------------------------------------|
-				// |---------| added block |--------------|
-				holeset.erase (pos);
-				if (bighole.offset < hole.offset) {
-					hole_t newhole;
-					newhole.offset = bighole.offset;
-					newhole.length = hole.offset - bighole.offset;
-					holeset.insert (newhole);
+	if (pos == holeset.end () || pos->offset > hole.offset
+		|| pos->offset + pos->length < hole.offset + hole.length)
+		BUG("hole must be exists");
+
+	const hole_t bighole = *pos;
+
+	// split to one or more hole, like this
+	// |--------------------------------------|
+	// |---------| added block |--------------|
+	holeset.erase (pos);
+	if (bighole.offset < hole.offset) {
+		hole_t newhole;
+		newhole.offset = bighole.offset;
+		newhole.length = hole.offset - bighole.offset;
+		holeset.insert (newhole);
+	}
+
+	uint64_t bigend = bighole.offset + bighole.length,
+			 holeend = hole.offset + hole.length;
+	if (bigend > holeend) {
+		hole_t newhole;
+		newhole.offset = holeend;
+		newhole.length = bigend - holeend;
+		holeset.insert (newhole);
+	}
+}
+
+void split_holes (std::set<hole_t> & holeset, const std::vector<hole_t> & holes)
+{
+	for (size_t i = 0; i < holes.size (); ++i)
+		split_hole (holeset, holes[i]);
+}
+
+/// \fn delta_hole()
+/// \brief
+/// һĲݣbuf ΪõĻ棬reader.can_map () ʱãΪա
+/// ƥĿ holes2remove
+static void delta_hole (file_reader & reader
+					, xdelta_stream & stream
+					, const hash_table & hashes
+					, const hole_t & hole
+					, const int blk_len
+					, bool need_split_hole
+					, ring_buffer * buf
+					, std::list<hole_t> & holes2remove
+					, hash_stat * stat)
+{
+	bool adddiff = !need_split_hole;
+	uint64_t offset = hole.offset;
+	uint64_t read_pos = hole.offset;	// λöҪȶλ
+	const bool mapped = reader.can_map();
+	const uint32_t window = mapped ? XDELTA_BUFFER_LEN : buf->size();
+	uint64_t to_read_bytes = hole.length;
+	const uchar_t * rdbuf = mapped ? 0 : buf->begin();
+	const uchar_t * endbuf = rdbuf, *sentrybuf = rdbuf;
+
+	rolling_hasher hasher;
+	bool newhash = true;
+	int32_t remain = 0;
+	uchar_t outchar = 0;
+	while (true) {
+		if (remain < blk_len) {
+			if (to_read_bytes == 0) {
+				uint32_t slipsize = (uint32_t)(endbuf - sentrybuf);
+				if (slipsize > 0 && adddiff)
+					stream.add_block(sentrybuf, slipsize, offset);
+				break;
+			}
+			else {
+				uint32_t slipsize = (uint32_t)(rdbuf - sentrybuf);
+				if (slipsize > 0) {
+					if (adddiff)
+						stream.add_block(sentrybuf, slipsize, offset);
+					offset += slipsize;
 				}
 
-				uint64_t bigend = bighole.offset + bighole.length,
-					     holeend = hole.offset + hole.length;
-				if (bigend > holeend) {
-					hole_t newhole;
-					newhole.offset = hole.offset + hole.length;
-					newhole.length = bigend - holeend;
-					holeset.insert (newhole);
+				uint32_t buflen = window - remain;
+				buflen = (uint32_t)(to_read_bytes > buflen ? buflen : to_read_bytes);
+				if (mapped) {
+					// ļѾӳ䣬еݱģֱȡôӴ
+					// ʼݣơÿȡĳʱͬҲȫͬ
+					sentrybuf = reader.map_file(offset, remain + buflen);
+					rdbuf = sentrybuf;
+					endbuf = sentrybuf + remain + buflen;
+					remain += buflen;
+					to_read_bytes -= buflen;
+					continue;
 				}
 
-				return;
+				// вһݱ˫ӳʱڿֱԽĽβ
+				// Ҫƶݡ
+				uchar_t * wrbuf = buf->rewind(rdbuf, remain);
+				sentrybuf = rdbuf = wrbuf;
+				endbuf = wrbuf + remain;
+				//
+				// ȡļʱ reader ļһξͿɶ꣬ǹܵҪβܽȡɣ
+				//  hole ĴСӳݵĴС to_read_bytes Ӧ˻Զȡݣһ
+				// ȡ buflen Сݡܹпܵѭڵȴ Bug 
+				// »ᷢ
+				//
+				while (buflen > 0) {
+					int size = reader.read_at(read_pos, wrbuf + remain, buflen);
+					if (size <= 0) {
+						std::string errmsg = "Can't not read file or pipe.";
+						THROW_XDELTA_EXCEPTION (errmsg);
+					}
+					read_pos += size;
+					to_read_bytes -= size;
+					buflen -= size;
+					endbuf += size;
+					remain += size;
+				}
+				continue;
+			}
+		}
+		else {
+			if (newhash) {
+				hasher.eat_hash(rdbuf, blk_len);
+				newhash = false;
+			}
+			else
+				hasher.update(outchar, *(rdbuf + blk_len - 1));
+		}
+
+		target_pos tpos;
+		if (hashes.find_block(hasher.hash_value(), rdbuf, blk_len, tpos, stat)) {
+			// a match was found.
+			uint32_t slipsize = (uint32_t)(rdbuf - sentrybuf);
+			if (slipsize > 0) {
+				if (adddiff)
+					stream.add_block(sentrybuf, slipsize, offset);
+
+				offset += slipsize;
+			}
+
+			stream.add_block(tpos, blk_len, offset);
+			if (need_split_hole) {
+				hole_t newhole;
+				newhole.offset = offset;
+				newhole.length = blk_len;
+				holes2remove.push_back(newhole);
+			}
+
+			rdbuf += blk_len;
+			offset += blk_len;
+			remain -= blk_len;
+			sentrybuf = rdbuf;
+			newhash = true;
+		}
+		else {
+			// slip the window by one bytes which size is blk_len.
+			outchar = *rdbuf++;
+			--remain;
 		}
 	}
+}
 
-	BUG("hole must be exists");
+/// \fn delta_extents()
+/// \brief
+/// stream  add_zero ʱ xdelta_stream::wants_zeroŵá
+///  reader ĿնзһһĿնΪȫ 0 Ҳ㣬
+/// ಿ delta_hole 㡣ҪֶʱնͬһӶȥ
+static void delta_extents (file_reader & reader
+					, xdelta_stream & stream
+					, const hash_table & hashes
+					, const hole_t & hole
+					, const int blk_len
+					, bool need_split_hole
+					, ring_buffer * buf
+					, std::list<hole_t> & holes2remove
+					, hash_stat * stat)
+{
+	const uint64_t end = hole.offset + hole.length;
+	uint64_t pos = hole.offset;
+	hole_t part;
+	part.offset = hole.offset;
+	while (pos < end) {
+		uint64_t len = 0;
+		const bool zero = reader.get_extent (pos, len);
+		if (len == 0 || len > end - pos)
+			len = end - pos;
+
+		if (zero && len >= (uint64_t)blk_len) {
+			if (pos > part.offset) {
+				part.length = pos - part.offset;
+				delta_hole (reader, stream, hashes, part, blk_len, need_split_hole, buf, holes2remove, stat);
+			}
+			stream.add_zero (len, pos);
+			if (need_split_hole) {
+				hole_t zerohole;
+				zerohole.offset = pos;
+				zerohole.length = len;
+				holes2remove.push_back (zerohole);
+			}
+			part.offset = pos + len;
+		}
+		pos += len;
+	}
+
+	if (end > part.offset) {
+		part.length = end - part.offset;
+		delta_hole (reader, stream, hashes, part, blk_len, need_split_hole, buf, holes2remove, stat);
+	}
 }
 
 /// \fn read_and_delta()
 /// \brief
 /// ӿʵֲݵȡط㷨ĺģ
 /// ־ܱ֡ӦþִЧʣ֪ɷ
-/// Ĳ㷽
+/// Ĳ㷽 read_and_delta_parallel
 void read_and_delta (file_reader & reader
 					, xdelta_stream & stream
 					, const hash_table & hashes
 					, std::set<hole_t> & hole_set
 					, const int blk_len
-					, bool need_split_hole)
+					, bool need_split_hole
+					, hash_stat * stat)
 {
-	bool adddiff = !need_split_hole;
-	char_buffer<uchar_t> buf (XDELTA_BUFFER_LEN);
 	typedef std::set<hole_t>::iterator it_t;
 	std::list<hole_t> holes2remove;
 
-	for (it_t begin = hole_set.begin (); begin != hole_set.end (); ++begin) {
-		const hole_t & hole = *begin;
-		uint64_t offset = reader.seek_file(hole.offset, FILE_BEGIN);
-		if (offset != hole.offset) {
-			std::string errmsg = fmt_string("Can't seek file %s(%s)."
-				, reader.get_fname().c_str(), error_msg().c_str());
-			THROW_XDELTA_EXCEPTION(errmsg);
+	// ļѾӳʱֱӳϼ㣬Ҫ档
+	ring_buffer * buf = reader.can_map () ? 0 : new ring_buffer (XDELTA_BUFFER_LEN);
+	const bool extents = stream.wants_zero () && reader.has_extents ();
+	try {
+		for (it_t begin = hole_set.begin (); begin != hole_set.end (); ++begin) {
+			if (extents)
+				delta_extents (reader, stream, hashes, *begin, blk_len, need_split_hole, buf, holes2remove, stat);
+			else
+				delta_hole (reader, stream, hashes, *begin, blk_len, need_split_hole, buf, holes2remove, stat);
 		}
+	}
+	catch (...) {
+		delete buf;
+		throw;
+	}
+	delete buf;
 
-		uint32_t to_read_bytes = (uint32_t)hole.length;
-		uchar_t * rdbuf = buf.begin();
-		uchar_t * endbuf = rdbuf, *sentrybuf = rdbuf;
+	if (need_split_hole) {
+		split_holes (hole_set, std::vector<hole_t> (holes2remove.begin (), holes2remove.end ()));
+	}
+	return;
+}
 
-		rolling_hasher hasher;
-		bool newhash = true;
-		int32_t remain = 0;
-		uchar_t outchar = 0;
-		while (true) {
-			if (remain < blk_len) {
-				if (to_read_bytes == 0) {
-					uint32_t slipsize = (uint32_t)(endbuf - sentrybuf);
-					if (slipsize > 0 && adddiff)
-						stream.add_block(sentrybuf, slipsize, offset);
-					break;
-				}
-				else {
-					uint32_t slipsize = (uint32_t)(rdbuf - sentrybuf);
-					if (slipsize > 0) {
-						if (adddiff)
-							stream.add_block(sentrybuf, slipsize, offset);
-						offset += slipsize;
-					}
+delta_feeder::delta_feeder (xdelta_stream & stream
+						, const hash_table & hashes
+						, const int32_t blk_len
+						, const uint64_t s_offset
+						, hash_stat * stat)
+	: stream_ (stream), hashes_ (hashes), blk_len_ (blk_len), stat_ (stat), offset_ (s_offset)
+	, newhash_ (true), outchar_ (0)
+{
+	tail_.reserve (2 * blk_len);
+}
 
-					if (remain > 0)
-						memmove(buf.begin(), rdbuf, remain);
+void delta_feeder::flush ()
+{
+	if (pending_.empty ())
+		return;
+	stream_.add_block (&pending_[0], (uint32_t)pending_.size (), offset_);
+	offset_ += pending_.size ();
+	pending_.clear ();
+}
 
-					sentrybuf = buf.begin();
-					uint32_t buflen = XDELTA_BUFFER_LEN - remain;
-					buflen = to_read_bytes > buflen ? buflen : to_read_bytes;
-					rdbuf = sentrybuf;
-					endbuf = sentrybuf + remain;
-					//
-					// ȡļʱ reader ļһξͿɶ꣬ǹܵҪβܽȡɣ
-					//  hole ĴСӳݵĴС to_read_bytes Ӧ˻Զȡݣһ
-					// ȡ buflen Сݡܹпܵѭڵȴ Bug 
-					// »ᷢ
-					//
-					while (buflen > 0) {
-						int size = reader.read_file(sentrybuf + remain, buflen);
-						if (size <= 0) {
-							std::string errmsg = "Can't not read file or pipe.";
-							THROW_XDELTA_EXCEPTION (errmsg);
-						}
-						to_read_bytes -= size;
-						buflen -= size;
-						endbuf += size;
-						remain += size;
+/// \brief
+///  len ֽڵĲݡkeep Ϊ true ʱܻûнһ feed ܺϲʱ
+/// ȸƵ pending_ С
+void delta_feeder::add_diff (const uchar_t * data, const uint32_t len, const bool keep)
+{
+	if ((keep || !pending_.empty ()) && pending_.size () + len <= XDELTA_BUFFER_LEN) {
+		pending_.insert (pending_.end (), data, data + len);
+		if (!keep)
+			flush ();
+		return;
+	}
+	flush ();
+	stream_.add_block (data, len, offset_);
+	offset_ += len;
+}
+
+/// \brief
+///  pos ʼڣֱڵĿʼС limitdata Ҫ limit + blk_len - 1 ֽڣ
+/// sentry Ϊ data лûĲݵĿʼƥʱ¡شֹͣλãƥĿ
+/// Խ limit
+uint32_t delta_feeder::scan (const uchar_t * data, uint32_t pos, const uint32_t limit, uint32_t & sentry)
+{
+	while (pos < limit) {
+		if (newhash_) {
+			hasher_.eat_hash (data + pos, blk_len_);
+			newhash_ = false;
+		}
+		else
+			hasher_.update (outchar_, data[pos + blk_len_ - 1]);
+
+		target_pos tpos;
+		if (hashes_.find_block (hasher_.hash_value (), data + pos, blk_len_, tpos, stat_)) {
+			if (pos > sentry)
+				add_diff (data + sentry, pos - sentry, false);
+			else
+				flush ();
+			stream_.add_block (tpos, blk_len_, offset_);
+			offset_ += blk_len_;
+			pos += blk_len_;
+			sentry = pos;
+			newhash_ = true;
+		}
+		else
+			outchar_ = data[pos++];
+	}
+	return pos;
+}
+
+void delta_feeder::feed (const uchar_t * data, const uint32_t len)
+{
+	uint32_t pos = 0, sentry = 0;
+	if (!tail_.empty ()) {
+		// ʼ tail_ Ĵ໹Ҫ blk_len - 1 ֽڣȰǽӵ tail_ ɨ衣
+		const uint32_t t = (uint32_t)tail_.size ();
+		const uint32_t n = len < (uint32_t)blk_len_ - 1 ? len : blk_len_ - 1;
+		tail_.insert (tail_.end (), data, data + n);
+		const uint32_t size = t + n;
+		uint32_t limit = size >= (uint32_t)blk_len_ ? size - blk_len_ + 1 : 0;
+		if (limit > t)
+			limit = t;
+
+		uint32_t tsentry = 0;
+		const uint32_t tpos = scan (&tail_[0], 0, limit, tsentry);
+		if (tpos < t) {
+			// ̫٣ڻû뿪 tail_
+			if (tpos > tsentry)
+				add_diff (&tail_[tsentry], tpos - tsentry, true);
+			tail_.erase (tail_.begin (), tail_.begin () + tpos);
+			return;
+		}
+
+		if (t > tsentry)
+			add_diff (&tail_[tsentry], t - tsentry, true);
+		else
+			sentry = tsentry - t;
+		pos = tpos - t;
+		tail_.clear ();
+	}
+
+	if (len >= pos + blk_len_)
+		pos = scan (data, pos, len - blk_len_ + 1, sentry);
+	if (pos > sentry)
+		add_diff (data + sentry, pos - sentry, true);
+	tail_.assign (data + pos, data + len);
+}
+
+void delta_feeder::finish ()
+{
+	if (!tail_.empty ())
+		add_diff (&tail_[0], (uint32_t)tail_.size (), false);
+	else
+		flush ();
+	tail_.clear ();
+	newhash_ = true;
+}
+
+/// \class
+/// \brief ̹߳һ readerÿΰ̼߳¼λõ read_atreader ֶ֧߳
+/// ͬʱλöʱ
+class shared_reader : public file_reader
+{
+	file_reader &	reader_;
+	mutex &			lock_;
+	uint64_t		pos_;
+public:
+	shared_reader (file_reader & reader, mutex & lock) : reader_ (reader), lock_ (lock), pos_ (0) {}
+	virtual int read_file (uchar_t * data, const uint32_t len)
+	{
+		int size = read_at (pos_, data, len);
+		if (size > 0)
+			pos_ += size;
+		return size;
+	}
+	/// \brief
+	/// reader Զ߳ͬʱλöʱ f_local_freader  preadҪ
+	virtual int read_at (const uint64_t offset, uchar_t * data, const uint32_t len)
+	{
+		if (reader_.concurrent_read ())
+			return reader_.read_at (offset, data, len);
+		lock_guard<mutex> guard (lock_);
+		return reader_.read_at (offset, data, len);
+	}
+	virtual uint64_t seek_file (const uint64_t offset, const int whence)
+	{
+		pos_ = offset;
+		return pos_;
+	}
+	virtual std::string get_fname () const { return reader_.get_fname (); }
+};
+
+/// \class
+/// \brief ֻƥĻڣ delta_hole ɨͬƥ飬ǰһֽڣ
+/// ݡڷֶɨ輰ֶ֮ͬ
+class block_scanner
+{
+	file_reader &		reader_;
+	const hash_table &	hashes_;
+	const int			blk_len_;
+	ring_buffer &		buf_;
+	hash_stat *			stat_;
+	uint64_t			pos_;		///< ڿʼλá
+	uint64_t			read_;		///< Ѿλá
+	uint64_t			end_;		///< ԶݵĽβ
+	uchar_t *			rdbuf_;		///< pos_ ݡ
+	rolling_hasher		hasher_;
+	bool				newhash_;
+	uchar_t				outchar_;
+public:
+	block_scanner (file_reader & reader, const hash_table & hashes, const int blk_len
+				, ring_buffer & buf, hash_stat * stat)
+		: reader_ (reader), hashes_ (hashes), blk_len_ (blk_len), buf_ (buf), stat_ (stat)
+		, pos_ (0), read_ (0), end_ (0), rdbuf_ (buf.begin ()), newhash_ (true), outchar_ (0) {}
+	/// \brief
+	///  pos ʼɨ裬ֻ end Ϊֹ
+	void start (const uint64_t pos, const uint64_t end)
+	{
+		pos_ = read_ = pos;
+		end_ = end;
+		rdbuf_ = buf_.begin ();
+		newhash_ = true;
+	}
+	uint64_t position () const { return pos_; }
+	/// \brief
+	/// ҴڿʼλС stop һƥ顣
+	/// \return ҵʱ trueǰλƵ֮󣻷ǰλͣ stopʣµݲһ顣
+	bool next (const uint64_t stop, uint64_t & mpos, target_pos & tpos)
+	{
+		while (pos_ < stop) {
+			uint32_t remain = (uint32_t)(read_ - pos_);
+			if (remain < (uint32_t)blk_len_) {
+				if (read_ == end_)
+					return false;
+				rdbuf_ = buf_.rewind (rdbuf_, remain);
+				uint32_t buflen = buf_.size () - remain;
+				buflen = (uint32_t)(end_ - read_ > buflen ? buflen : end_ - read_);
+				uchar_t * endbuf = rdbuf_ + remain;
+				while (buflen > 0) {
+					int size = reader_.read_at (read_, endbuf, buflen);
+					if (size <= 0) {
+						std::string errmsg = "Can't not read file or pipe.";
+						THROW_XDELTA_EXCEPTION (errmsg);
 					}
-					continue;
+					read_ += size;
+					endbuf += size;
+					buflen -= size;
 				}
+				continue;
+			}
+
+			if (newhash_) {
+				hasher_.eat_hash (rdbuf_, blk_len_);
+				newhash_ = false;
 			}
+			else
+				hasher_.update (outchar_, *(rdbuf_ + blk_len_ - 1));
+
+			if (hashes_.find_block (hasher_.hash_value (), rdbuf_, blk_len_, tpos, stat_)) {
+				mpos = pos_;
+				pos_ += blk_len_;
+				rdbuf_ += blk_len_;
+				newhash_ = true;
+				return true;
+			}
+			outchar_ = *rdbuf_++;
+			++pos_;
+		}
+		return false;
+	}
+};
+
+/// \struct
+/// ֶɨҵƥ顣
+struct seg_match
+{
+	uint64_t	pos;
+	target_pos	tpos;
+	bool operator < (const seg_match & other) const { return pos < other.pos; }
+};
+
+/// \struct
+/// \brief һһΣļ˳¼ɵ̻߳طŵ stream
+struct delta_job
+{
+	struct op {
+		target_pos	tpos;
+		uint64_t	s_offset;
+		uint32_t	blk_len;
+		uint64_t	data_pos;	///<  data еλãͬΪ (uint64_t)-1
+	};
+	std::vector<op>			ops;
+	std::vector<uchar_t>	data;
+	std::list<hole_t>		holes2remove;
+	std::vector<seg_match>	matches;	///< ֶɨʱӶοʼɨҵƥ顣
+	uint64_t				exit;		///< ֶɨʱɨ뿪κĵһλá
+	bool					done;
+	bool					direct;		///< ̫ûм㣬ɵֱ߳
+	delta_job () : exit (0), done (false), direct (false) {}
+};
+
+class record_stream : public xdelta_stream
+{
+	delta_job &		job_;
+	const uint64_t	limit_;		///< ΪԤĲݳȡ
+public:
+	record_stream (delta_job & job, const uint64_t limit) : job_ (job), limit_ (limit) {}
+	virtual void add_block (const target_pos & tpos
+							, const uint32_t blk_len
+							, const uint64_t s_offset)
+	{
+		delta_job::op o;
+		o.tpos = tpos;
+		o.s_offset = s_offset;
+		o.blk_len = blk_len;
+		o.data_pos = (uint64_t)-1;
+		job_.ops.push_back (o);
+	}
+	virtual void add_block (const uchar_t * data
+							, const uint32_t blk_len
+							, const uint64_t s_offset)
+	{
+		delta_job::op o;
+		o.s_offset = s_offset;
+		o.blk_len = blk_len;
+		if (job_.data.size () + blk_len > limit_)
+			THROW_XDELTA_EXCEPTION_NO_ERRNO ("Too much delta data buffered.");
+		o.data_pos = (uint64_t)job_.data.size ();
+		job_.ops.push_back (o);
+		job_.data.insert (job_.data.end (), data, data + blk_len);
+	}
+};
+
+/// \struct
+/// \brief мʱ̼߳乲ݣֻĳԱ lock 
+/// ˳ȡ˳holes ΪֶɨʱΪͬһĸ
+/// offset ΪεĿʼlength Ϊڴڿʼλõĸ
+struct parallel_delta
+{
+	file_reader *				reader;
+	const hash_table *			hashes;
+	int							blk_len;
+	bool						need_split_hole;
+	bool						segmented;
+	uint64_t					seg_end;	///< ֶɨʱĽβ
+	std::vector<hole_t>			holes;
+	std::vector<delta_job *>	jobs;
+
+	mutex						io_lock;	///<  reader
+	mutex						lock;
+	condition_variable			cond;
+	size_t						next;		///< һҪ
+	size_t						emitted;	///< Ѿ
+	size_t						window;		///< 
+	uint64_t					buffered;	///< ѾȡûԤĲݡ
+	bool						stop;
+	bool						failed;		///< ̳߳error Ϊ 0 ʱ xdelta_exception
+	xdelta_exception *			error;
+	hash_stat *					stat;
+	std::vector<thread *>		workers;
+
+	parallel_delta () : reader (0), hashes (0), blk_len (0), need_split_hole (false)
+		, segmented (false), seg_end (0), next (0), emitted (0), window (0), buffered (0), stop (false)
+		, failed (false), error (0), stat (0) {}
+	~parallel_delta ()
+	{
+		stop_workers ();
+		for (size_t i = 0; i < jobs.size (); ++i)
+			delete jobs[i];
+		delete error;
+	}
+	void fail (const xdelta_exception * e)
+	{
+		lock_guard<mutex> guard (lock);
+		if (!failed && e != 0)
+			error = new xdelta_exception (*e);
+		failed = true;
+		stop = true;
+		cond.notify_all ();
+	}
+	void start_workers (const uint32_t threads);
+	void stop_workers ();
+	/// \brief
+	///  i Ƿ̫ɵֱ߳
+	bool is_direct (const size_t i) const
+	{
+		return !segmented && !need_split_hole && holes[i].length > XDELTA_PARALLEL_DATA_LEN;
+	}
+	/// \brief
+	///  i ҪԤĲݳȣݲȶݻֱʱΪ 0
+	uint64_t data_limit (const size_t i) const
+	{
+		return segmented || need_split_hole || is_direct (i) ? 0 : holes[i].length;
+	}
+	/// \brief
+	/// ȴ i ɣ̳߳ʱ 0
+	delta_job * wait_job (const size_t i)
+	{
+		lock_guard<mutex> guard (lock);
+		while (!jobs[i]->done && !stop)
+			cond.wait (lock);
+		return jobs[i]->done ? jobs[i] : 0;
+	}
+	/// \brief
+	///  i ѾͷĽ̼߳ȼ㡣
+	void release_job (const size_t i)
+	{
+		delete jobs[i];
+		jobs[i] = 0;
+		lock_guard<mutex> guard (lock);
+		++emitted;
+		buffered -= data_limit (i);
+		cond.notify_all ();
+	}
+	/// \brief
+	/// ̶߳Ѿ󣬰߳еĴ׸ߡ
+	void check_error ()
+	{
+		if (error != 0) {
+			xdelta_exception e (*error);
+			throw e;
+		}
+		if (failed)
+			THROW_XDELTA_EXCEPTION_NO_ERRNO ("Delta thread failed.");
+	}
+};
+
+/// \fn scan_segment()
+/// \brief
+/// ӶεĿʼɨһΣ¼ƥ飬Լɨ뿪κĵһλá
+/// ݱȶζ blk_len - 1 ֽڣĩβĴҲġ
+static void scan_segment (block_scanner & scanner, const hole_t & seg, const uint64_t end
+						, const int blk_len, delta_job & job)
+{
+	const uint64_t stop = seg.offset + seg.length;
+	uint64_t limit = stop + blk_len - 1;
+	if (limit > end)
+		limit = end;
+
+	scanner.start (seg.offset, limit);
+	seg_match m;
+	while (scanner.next (stop, m.pos, m.tpos))
+		job.matches.push_back (m);
+
+	job.exit = stop;
+	if (!job.matches.empty () && job.matches.back ().pos + blk_len > stop)
+		job.exit = job.matches.back ().pos + blk_len;
+}
+
+static void delta_worker (void * data)
+{
+	parallel_delta * pd = (parallel_delta *)data;
+	shared_reader reader (*pd->reader, pd->io_lock);
+	hash_stat stat;
+
+	try {
+		ring_buffer buf (XDELTA_BUFFER_LEN);
+		block_scanner scanner (reader, *pd->hashes, pd->blk_len, buf, pd->stat != 0 ? &stat : 0);
+		while (true) {
+			size_t i;
+			{
+				lock_guard<mutex> guard (pd->lock);
+				// ̫࣬ԤĲݻᳬʱȴǰ buffered
+				// Ϊ 0һֱĶȡ
+				while (!pd->stop && pd->next < pd->holes.size ()
+					&& (pd->next >= pd->emitted + pd->window
+						|| pd->buffered + pd->data_limit (pd->next) > XDELTA_PARALLEL_DATA_LEN))
+					pd->cond.wait (pd->lock);
+				if (pd->stop || pd->next >= pd->holes.size ())
+					break;
+				i = pd->next++;
+				pd->buffered += pd->data_limit (i);
+			}
+
+			delta_job & job = *pd->jobs[i];
+			if (pd->segmented)
+				scan_segment (scanner, pd->holes[i], pd->seg_end, pd->blk_len, job);
+			else if (pd->is_direct (i))
+				job.direct = true;	// ݿܳޡ
 			else {
-				if (newhash) {
-					hasher.eat_hash(rdbuf, blk_len);
-					newhash = false;
-				}
-				else
-					hasher.update(outchar, *(rdbuf + blk_len - 1));
+				record_stream stream (job, pd->data_limit (i));
+				delta_hole (reader, stream, *pd->hashes, pd->holes[i], pd->blk_len
+					, pd->need_split_hole, &buf, job.holes2remove, pd->stat != 0 ? &stat : 0);
 			}
 
-			const slow_hash * bsh = hashes.find_block(hasher.hash_value()
-													, rdbuf, blk_len);
-			if (bsh) {
-				// a match was found.
-				uint32_t slipsize = (uint32_t)(rdbuf - sentrybuf);
-				if (slipsize > 0) {
-					if (adddiff)
-						stream.add_block(sentrybuf, slipsize, offset);
+			lock_guard<mutex> guard (pd->lock);
+			job.done = true;
+			pd->cond.notify_all ();
+		}
+	}
+	catch (xdelta_exception & e) {
+		pd->fail (&e);
+	}
+	catch (...) {
+		pd->fail (0);
+	}
 
-					offset += slipsize;
-				}
+	if (pd->stat != 0) {
+		lock_guard<mutex> guard (pd->lock);
+		*pd->stat += stat;
+	}
+}
+
+void parallel_delta::start_workers (const uint32_t threads)
+{
+	window = (size_t)threads * 2;
+	jobs.reserve (holes.size ());
+	for (size_t i = 0; i < holes.size (); ++i)
+		jobs.push_back (new delta_job);
+	for (uint32_t i = 0; i < threads; ++i)
+		workers.push_back (new thread (delta_worker, this));
+}
+
+void parallel_delta::stop_workers ()
+{
+	{
+		lock_guard<mutex> guard (lock);
+		stop = true;
+		cond.notify_all ();
+	}
+	for (size_t i = 0; i < workers.size (); ++i) {
+		workers[i]->join ();
+		delete workers[i];
+	}
+	workers.clear ();
+}
+
+/// \class
+/// \brief ϲֶɨĽõ delta_hole ɨȫͬ
+///
+/// ɨÿλϵΪƥ飬ǰһֽڣֻλ
+/// йأֻҪɨߵĳζɨҲλã˺߾ȫͬ
+/// ɨһʱĳƥм䣬ʹɨ裬ֱ
+/// εɨغϣ뿪Ρȷƥٰ delta_hole Ĺ
+/// ݰ´ reader ȡԲзҲ봮ɨͬ
+class segment_merger
+{
+	xdelta_stream &			stream_;
+	file_reader &			reader_;
+	const hash_table &		hashes_;
+	const int				blk_len_;
+	const bool				adddiff_;
+	const bool				need_split_hole_;
+	const uint64_t			end_;
+	std::list<hole_t> &		holes2remove_;
+	hash_stat *				stat_;
 
-				stream.add_block(bsh->tpos, blk_len, offset);
-				if (need_split_hole) {
+	uint64_t				frontier_;	///< ɨһδȷλã֮ǰƥ鶼ȷ
+	std::deque<seg_match>	pending_;	///< Ѿȷûƥ顣
+
+	//  delta_hole ģ״̬
+	uint64_t				pos_;		///< ڿʼλá
+	uint64_t				read_;		///< Ѿ뻺λá
+	uint64_t				sentry_;	///< ûĲݵĿʼ
+	char_buffer<uchar_t>	diff_;
+
+	ring_buffer *			resync_buf_;
+	block_scanner *			resync_;
+
+	void flush (const uint64_t to)
+	{
+		uint64_t from = sentry_;
+		sentry_ = to;
+		if (to <= from || !adddiff_)
+			return;
+
+		const uint32_t len = (uint32_t)(to - from);
+		uint32_t got = 0;
+		while (got < len) {
+			int size = reader_.read_at (from + got, diff_.begin () + got, len - got);
+			if (size <= 0) {
+				std::string errmsg = "Can't not read file or pipe.";
+				THROW_XDELTA_EXCEPTION (errmsg);
+			}
+			got += size;
+		}
+		stream_.add_block (diff_.begin (), len, from);
+	}
+	/// \brief
+	///  frontier_ ֮ǰĲֶȷ󣬾ǰģ delta_hole 
+	void emit ()
+	{
+		const uint32_t buf_len = XDELTA_BUFFER_LEN;
+		while (true) {
+			if (read_ - pos_ < (uint64_t)blk_len_) {
+				if (read_ == end_) {
+					flush (read_);
+					return;
+				}
+				flush (pos_);
+				uint64_t more = buf_len - (read_ - pos_);
+				read_ += (end_ - read_ > more ? more : end_ - read_);
+				continue;
+			}
+			if (!pending_.empty () && pending_.front ().pos + blk_len_ <= read_) {
+				const seg_match m = pending_.front ();
+				pending_.pop_front ();
+				flush (m.pos);
+				stream_.add_block (m.tpos, blk_len_, m.pos);
+				if (need_split_hole_) {
 					hole_t newhole;
-					newhole.offset = offset;
-					newhole.length = blk_len;
-					holes2remove.push_back(newhole);
+					newhole.offset = m.pos;
+					newhole.length = blk_len_;
+					holes2remove_.push_back (newhole);
 				}
+				pos_ = m.pos + blk_len_;
+				sentry_ = pos_;
+				continue;
+			}
+			// ´ζ֮ǰûƥˣֻߵѾȷλá
+			const uint64_t refill = read_ - blk_len_ + 1;
+			if (refill > frontier_) {
+				if (frontier_ > pos_)
+					pos_ = frontier_;
+				return;
+			}
+			pos_ = refill;
+		}
+	}
+public:
+	segment_merger (xdelta_stream & stream, file_reader & reader, const hash_table & hashes
+				, const int blk_len, const bool need_split_hole, const hole_t & hole
+				, std::list<hole_t> & holes2remove, hash_stat * stat)
+		: stream_ (stream), reader_ (reader), hashes_ (hashes), blk_len_ (blk_len)
+		, adddiff_ (!need_split_hole), need_split_hole_ (need_split_hole)
+		, end_ (hole.offset + hole.length), holes2remove_ (holes2remove), stat_ (stat)
+		, frontier_ (hole.offset), pos_ (hole.offset), read_ (hole.offset), sentry_ (hole.offset)
+		, diff_ (adddiff_ ? XDELTA_BUFFER_LEN : 0), resync_buf_ (0), resync_ (0) {}
+	~segment_merger ()
+	{
+		delete resync_;
+		delete resync_buf_;
+	}
+	/// \brief
+	/// ˳ϲһεɨ
+	void merge (const hole_t & seg, const delta_job & job)
+	{
+		const uint64_t seg_end = seg.offset + seg.length;
+		while (frontier_ < seg_end) {
+			// ɨ辭ġ frontier_ ֮ǰĵһλá
+			uint64_t visit = frontier_;
+			std::vector<seg_match>::const_iterator it;
+			seg_match key;
+			key.pos = frontier_;
+			it = std::upper_bound (job.matches.begin (), job.matches.end (), key);
+			if (it != job.matches.begin ()) {
+				--it;
+				if (it->pos < frontier_ && frontier_ < it->pos + blk_len_)
+					visit = it->pos + blk_len_;
+			}
+			if (visit > seg_end)
+				visit = seg_end;
 
-				rdbuf += blk_len;
-				offset += blk_len;
-				remain -= blk_len;
-				sentrybuf = rdbuf;
-				newhash = true;
+			if (visit == frontier_) {
+				// 뱾εɨغϣ˺ƥͬ
+				std::vector<seg_match>::const_iterator from =
+					std::lower_bound (job.matches.begin (), job.matches.end (), key);
+				pending_.insert (pending_.end (), from, job.matches.end ());
+				frontier_ = job.exit;
+				break;
 			}
-			else {
-				// slip the window by one bytes which size is blk_len.
-				outchar = *rdbuf++;
-				--remain;
+
+			if (resync_ == 0) {
+				resync_buf_ = new ring_buffer (XDELTA_BUFFER_LEN);
+				resync_ = new block_scanner (reader_, hashes_, blk_len_, *resync_buf_, stat_);
+			}
+			uint64_t limit = visit + blk_len_ - 1;
+			if (limit > end_)
+				limit = end_;
+			resync_->start (frontier_, limit);
+
+			seg_match m;
+			if (resync_->next (visit, m.pos, m.tpos)) {
+				pending_.push_back (m);
+				frontier_ = m.pos + blk_len_;
 			}
+			else
+				frontier_ = visit;
 		}
+		emit ();
+	}
+	/// \brief
+	/// жζϲʣµĲ֡
+	void finish ()
+	{
+		frontier_ = end_;
+		emit ();
 	}
+};
+
+void read_and_delta_parallel (file_reader & reader
+					, xdelta_stream & stream
+					, const hash_table & hashes
+					, std::set<hole_t> & hole_set
+					, const int blk_len
+					, bool need_split_hole
+					, uint32_t threads
+					, hash_stat * stat)
+{
+	if (threads == 0)
+		threads = thread::hardware_concurrency ();
+	if (threads <= 1 || hole_set.empty ()) {
+		read_and_delta (reader, stream, hashes, hole_set, blk_len, need_split_hole, stat);
+		return;
+	}
+	if (hole_set.size () < threads) {
+		// ߳٣ÿֶɨ衣
+		read_and_delta_segmented (reader, stream, hashes, hole_set, blk_len, need_split_hole
+			, threads, 0, stat);
+		return;
+	}
+
+	parallel_delta pd;
+	pd.reader = &reader;
+	pd.hashes = &hashes;
+	pd.blk_len = blk_len;
+	pd.need_split_hole = need_split_hole;
+	pd.holes.assign (hole_set.begin (), hole_set.end ());
+	pd.stat = stat;
+	pd.start_workers (threads);
+
+	std::list<hole_t> holes2remove;
+	// ߳̽ʱŰͳƼӵ stat УֱĶͳơ
+	shared_reader direct_reader (reader, pd.io_lock);
+	hash_stat direct_stat;
+	ring_buffer * buf = 0;
+	try {
+		// ˳ȴ
+		for (size_t i = 0; i < pd.jobs.size (); ++i) {
+			delta_job * job = pd.wait_job (i);
+			if (job == 0)
+				break;
+
+			if (job->direct) {
+				if (buf == 0)
+					buf = new ring_buffer (XDELTA_BUFFER_LEN);
+				delta_hole (direct_reader, stream, hashes, pd.holes[i], blk_len, need_split_hole, buf
+					, holes2remove, stat != 0 ? &direct_stat : 0);
+			}
+			typedef std::vector<delta_job::op>::const_iterator op_it;
+			for (op_it it = job->ops.begin (); it != job->ops.end (); ++it) {
+				if (it->data_pos == (uint64_t)-1)
+					stream.add_block (it->tpos, it->blk_len, it->s_offset);
+				else
+					stream.add_block (&job->data[it->data_pos], it->blk_len, it->s_offset);
+			}
+			holes2remove.splice (holes2remove.end (), job->holes2remove);
+			pd.release_job (i);
+		}
+	}
+	catch (...) {
+		delete buf;
+		throw;
+	}
+	delete buf;
+	pd.stop_workers ();
+	pd.check_error ();
+	if (stat != 0)
+		*stat += direct_stat;
 
 	if (need_split_hole) {
-		typedef std::list<hole_t>::iterator it_t;
-		for (it_t begin = holes2remove.begin (); begin != holes2remove.end (); ++begin)
-			split_hole (hole_set, *begin);
+		split_holes (hole_set, std::vector<hole_t> (holes2remove.begin (), holes2remove.end ()));
 	}
-	return;
 }
 
+void read_and_delta_segmented (file_reader & reader
+					, xdelta_stream & stream
+					, const hash_table & hashes
+					, std::set<hole_t> & hole_set
+					, const int blk_len
+					, bool need_split_hole
+					, uint32_t threads
+					, uint64_t segment_len
+					, hash_stat * stat)
+{
+	if (threads == 0)
+		threads = thread::hardware_concurrency ();
+	if (segment_len == 0)
+		segment_len = XDELTA_SEGMENT_LEN;
+	if (segment_len < (uint64_t)blk_len)
+		segment_len = blk_len;
+
+	typedef std::set<hole_t>::iterator it_t;
+	std::list<hole_t> holes2remove;
+	ring_buffer * buf = 0;
+
+	try {
+		for (it_t begin = hole_set.begin (); begin != hole_set.end (); ++begin) {
+			const hole_t & hole = *begin;
+			if (threads <= 1 || hole.length < segment_len * 2) {
+				if (buf == 0 && !reader.can_map ())
+					buf = new ring_buffer (XDELTA_BUFFER_LEN);
+				delta_hole (reader, stream, hashes, hole, blk_len, need_split_hole, buf
+					, holes2remove, stat);
+				continue;
+			}
+
+			parallel_delta pd;
+			pd.reader = &reader;
+			pd.hashes = &hashes;
+			pd.blk_len = blk_len;
+			pd.need_split_hole = need_split_hole;
+			pd.segmented = true;
+			pd.seg_end = hole.offset + hole.length;
+			pd.stat = stat;
+			for (uint64_t off = hole.offset; off < pd.seg_end; off += segment_len) {
+				hole_t seg;
+				seg.offset = off;
+				seg.length = pd.seg_end - off > segment_len ? segment_len : pd.seg_end - off;
+				pd.holes.push_back (seg);
+			}
+
+			// ϲõ reader ̹߳ãݼͬʱҲҪ߳̽ʱŰ
+			// ͳƼӵ stat Уϲʱͳơ
+			hash_stat merge_stat;
+			shared_reader merge_reader (reader, pd.io_lock);
+			segment_merger merger (stream, merge_reader, hashes, blk_len, need_split_hole
+				, hole, holes2remove, stat != 0 ? &merge_stat : 0);
+			pd.start_workers (threads);
+			for (size_t i = 0; i < pd.jobs.size (); ++i) {
+				delta_job * job = pd.wait_job (i);
+				if (job == 0)
+					break;
+				merger.merge (pd.holes[i], *job);
+				pd.release_job (i);
+			}
+			pd.stop_workers ();
+			pd.check_error ();
+			merger.finish ();
+			if (stat != 0)
+				*stat += merge_stat;
+		}
+	}
+	catch (...) {
+		delete buf;
+		throw;
+	}
+	delete buf;
+
+	if (need_split_hole) {
+		split_holes (hole_set, std::vector<hole_t> (holes2remove.begin (), holes2remove.end ()));
+	}
+}
 
 ////////////////////////////////////////////////////////////////////////////
 static uint32_t xdelta_sum_block_size (const uint64_t filesize)
@@ -424,6 +2103,24 @@ uint32_t get_xdelta_block_size (const uint64_t filesize)
 	return rsync_sum_sizes_sqroot (filesize);
 }
 
+uint32_t get_strong_hash_len (const uint64_t filesize, const uint32_t blk_len)
+{
+	//  rsync  s2length ͬ10 λļСÿһλ 2 λ鳤ÿһλ 1 λ
+	// 32 λ Hash Ҳƥ䣬ټ 32 λ
+	int32_t bits = 10;
+	for (uint64_t l = filesize; l >>= 1; )
+		bits += 2;
+	for (uint32_t c = blk_len; (c >>= 1) && bits; )
+		--bits;
+
+	int32_t hlen = (bits + 1 - 32 + 7) / 8;
+	if (hlen < MIN_STRONG_HASH_LEN)
+		hlen = MIN_STRONG_HASH_LEN;
+	if (hlen > DIGEST_BYTES)
+		hlen = DIGEST_BYTES;
+	return (uint32_t)hlen;
+}
+
 
 
 void DLL_EXPORT get_file_digest (file_reader & reader
@@ -34,10 +34,62 @@ struct target_pos
 /// \struct
 ///  Hash ֵ
 struct slow_hash {
-    uchar_t		hash[DIGEST_BYTES]; ///< ݿ MD4 Hash ֵ
+    uchar_t		hash[DIGEST_BYTES]; ///< ݿ Hash ֵ㷨 strong_hash_typeĬΪ MD4
+	uint64_t	check;				///< ݿ 64 λУ Hash Hash кȱȽͬʱż MD4
 	target_pos	tpos;				///< ݿĿļеλϢ
 };
 
+/// \fn uint64_t get_check_hash (const uchar_t * buf, const uint32_t len)
+/// \brief ݿ 64 λУ Hashÿδ 8 ֽڣ MD4 һϣ
+/// Сȡ֤ͬƽ̨ϵĽͬ
+/// \param[in] buf ݿָ롣
+/// \param[in] len ݿ鳤ȡ
+/// \return У Hash ֵ
+inline uint64_t get_check_hash (const uchar_t * buf, const uint32_t len)
+{
+	const uint64_t m1 = 0x9E3779B97F4A7C15ULL;
+	const uint64_t m2 = 0xC2B2AE3D27D4EB4FULL;
+	uint64_t h = len * m1;
+	uint32_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		const uchar_t * p = buf + i;
+		uint64_t w = (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16)
+			| ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+			| ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+		h ^= w * m2;
+		h = ((h << 31) | (h >> 33)) * m1;
+	}
+	for (; i < len; ++i)
+		h = (h ^ buf[i]) * m1;
+
+	h ^= h >> 33;
+	h *= m2;
+	h ^= h >> 29;
+	return h;
+}
+
+/// \struct
+/// ҵƥͳơ Hash кȱȽ 64 λУ HashֻҲͬʱż MD4
+/// fast_hits  strong_hashes ֮ʡȥ MD4 
+struct hash_stat {
+	uint64_t	lookups;		///< Ҵڵλ
+	uint64_t	fast_hits;		///<  Hash еĴ
+	uint64_t	check_hits;		///< 64 λУ Hash ҲеĴ
+	uint64_t	strong_hashes;	///< ʵʼ MD4 Ĵ
+	uint64_t	matches;		///< ƥĿ
+	hash_stat () : lookups (0), fast_hits (0), check_hits (0), strong_hashes (0), matches (0) {}
+	uint64_t strong_avoided () const { return fast_hits - strong_hashes; }
+	hash_stat & operator += (const hash_stat & other)
+	{
+		lookups += other.lookups;
+		fast_hits += other.fast_hits;
+		check_hits += other.check_hits;
+		strong_hashes += other.strong_hashes;
+		matches += other.matches;
+		return *this;
+	}
+};
+
 /// \struct
 /// ڶ Hash ļ Hash ļ
 struct hole_t
@@ -91,7 +143,19 @@ public:
 	virtual void add_block (const uchar_t * data
 							, const uint32_t blk_len
 							, const uint64_t s_offset) { THROW_XDELTA_EXCEPTION ("Not implemented.!"); }
-
+	/// \brief
+	/// Դļһȫ 0 ݣϡļûзռĲ֣ file_reader::get_extent
+	/// ؽʱļֱ¿նĬϰݷֿ
+	/// ֻ wants_zero  true ʱá
+	/// \param[in] length	ݳȣСڿ鳤ȡ
+	/// \param[in] s_offset	Դļеλƫơ
+	/// \return ûз
+	virtual void add_zero (const uint64_t length, const uint64_t s_offset);
+	/// \brief
+	/// Ƿ add_zeroĬϲܣʱնһ delta_hole 㣬
+	/// Ŀļȫ 0 ĿƥΪͬ飬벻նʱȫһ
+	/// \return  add_zero ʱ true
+	virtual bool wants_zero () const { return false; }
 };
 
 class DLL_EXPORT hasher_stream 
@@ -104,6 +168,11 @@ public:
 	/// \param[in] shash		 Hash ֵ
 	virtual void add_block (const uint32_t fhash, const slow_hash & shash)
 	 { THROW_XDELTA_EXCEPTION ("Not implemented.!"); }
+	/// \brief
+	/// ļ MD4 ֵп֮á Hash ض̺󣨼 get_strong_hash_len
+	/// ײĻʻӣԶӦؽļͬʱȵ Hash һΡ
+	/// \param[in] digest	ļ MD4 ֵ
+	virtual void end_hash (const uchar_t digest[DIGEST_BYTES]) {}
 };
 
 /// ڵ Hash еС鳤
@@ -112,36 +181,12 @@ public:
 /// ڵ Hash е鳤
 #define MAX_XDELTA_BLOCK_BYTES ((xdelta::int32_t)1 << 20) // 1024KB
 
-/// һЩڴϵͳУĲúܶ࣬пܵڴù࣬ʹϵͳ
-/// ܵӰ죬崻ԣҪĿϵͳڴԺԼӦ
-/// ĴС MULTIROUND_MAX_BLOCK_SIZE ҪС 512 KBXDELTA_BUFFER_LEN 
-/// MULTIROUND_MAX_BLOCK_SIZEΪ 2  N η 8  ȡ
-/// ϵͳдڴڴʱϴڴŻʵ֡ʹÿͬʱϵͳռڴ
-/// ĴΪ
-///		Դˣͻˣ
-///			߳ * XDELTA_BUFFER_LEN * 3ϵͳڴޣԲ̵߳ķʽдʽ
-///			޷ʹö̵߳ơ
-///		Ŀˣˣ
-///			߳ * XDELTA_BUFFER_LEN * 2߳ܵĿͻ˵ĿԼÿͻͬʱ
-///			õ߳
-/// ͬʱļС߿Сûдﵽ XDELTA_BUFFER_LEN ȣδʹõĵַϵͳ
-/// ڴ棬ʱֻռý̵ĵַռ䣬ȴռϵͳڴ档
-#ifndef BIT32_PLATFORM
-#error "Define BIT32_PLATFORM first, maybe you have to include mytypes.h first!"
-#endif
-#if BIT32_PLATFORM
-	/// ڶ Hash е鳤
-	#define MULTIROUND_MAX_BLOCK_SIZE (1 << 22)
+/// ֶβɨһʱ read_and_delta_segmentedÿεĳȡ
+#define XDELTA_SEGMENT_LEN ((uint64_t)XDELTA_BUFFER_LEN * 4)
 
-	/// ʹû泤
-	#define XDELTA_BUFFER_LEN ((int32_t)1 << 25) // 32MB
-#else
-	/// ڶ Hash е鳤
-	#define MULTIROUND_MAX_BLOCK_SIZE (1 << 20)
-
-	/// ʹû泤
-	#define XDELTA_BUFFER_LEN ((int32_t)1 << 23) // 8MB
-#endif
+/// мʱ read_and_delta_parallelѾȡûĶϼ໺Ĳݣ
+/// ߳޹ءĶɵֱ߳
+#define XDELTA_PARALLEL_DATA_LEN ((uint64_t)XDELTA_BUFFER_LEN * 8)
 
 #define MAX(a,b) ((a)>(b)?(a):(b))
     
@@ -164,17 +209,68 @@ inline int32_t multiround_base ()
 }
 
 class DLL_EXPORT hash_table  {
-#ifdef _WIN32
-	hash_map<uint32_t, std::set<slow_hash> * > hash_table_;
-	typedef hash_map<uint32_t, std::set<slow_hash> *>::const_iterator chit_t;
-	typedef hash_map<uint32_t, std::set<slow_hash> *>::iterator hash_iter;
-#else
-	__gnu_cxx::hash_map<uint32_t, std::set<slow_hash> * > hash_table_;
-	typedef __gnu_cxx::hash_map<uint32_t, std::set<slow_hash> *>::const_iterator chit_t;
-	typedef __gnu_cxx::hash_map<uint32_t, std::set<slow_hash> *>::iterator hash_iter;
-#endif
+	/// \struct
+	///  Hash ֵͬıͨ next ± 10 ʾβ
+	///  Hash ֻǰ hlen_ ֽڣ strong_ Уûֽڡ
+	struct hash_entry {
+		uint64_t	check;
+		uint64_t	t_offset;
+		uint32_t	index;
+		uint32_t	next;
+	};
+	/// \struct
+	/// Ѱַ̽⣩ĲۣԿ Hash ֵΪhead Ϊͷ± 1
+	/// Ϊ 0 ʱʾղۡŵģʱҪڶ϶ת
+	struct hash_slot {
+		uint32_t	fhash;
+		uint32_t	head;
+	};
+	std::vector<hash_slot>	slots_;
+	std::vector<hash_entry>	entries_;
+	std::vector<uchar_t>	strong_;	///< ÿ hlen_ ֽڵ Hash
+	uint32_t				hlen_;		///<  Hash ֽ
+	uint32_t				mask_;		///<  1Ϊ 2  N η
+	uint32_t				shift_;		///< 32 ȥλ
+	uint32_t				used_;		///< ѾʹõĲ
+	/// ʽ Bloom ÿ Hash ͬһ 64 λλ󲿷ִλ
+	/// УȲСöࣨɷ L2λʡȥһζԲʡ
+	std::vector<uint64_t>	filter_;
+	uint32_t				fshift_;	///< 32 ȥλ
+	bool					use_filter_;
+	bool					use_check_;	///< ǷȽУ Hash set_check
+	strong_hash_type		hash_type_;	///<  Hash 㷨
+
+	uint32_t slot_of (const uint32_t fhash) const
+	{
+		//  Hash ĵλֲãó˷ɢȡλΪۺš
+		return (uint32_t)(fhash * 2654435761u) >> shift_;
+	}
+	static uint32_t filter_mix (uint32_t h)
+	{
+		h ^= h >> 16; h *= 0x85ebca6bu;
+		h ^= h >> 13; h *= 0xc2b2ae35u;
+		return h ^ (h >> 16);
+	}
+	static uint64_t filter_bits (const uint32_t mix)
+	{
+		return ((uint64_t)1 << (mix & 63)) | ((uint64_t)1 << ((mix >> 6) & 63));
+	}
+	void filter_add (const uint32_t fhash)
+	{
+		const uint32_t mix = filter_mix (fhash);
+		filter_[mix >> fshift_] |= filter_bits (mix);
+	}
+	bool filter_test (const uint32_t fhash) const
+	{
+		const uint32_t mix = filter_mix (fhash);
+		const uint64_t bits = filter_bits (mix);
+		return (filter_[mix >> fshift_] & bits) == bits;
+	}
+	void rehash (uint32_t slots);
+	void build_filter ();
 public:
-	hash_table () {}
+	hash_table () : hlen_ (DIGEST_BYTES), mask_ (0), shift_ (32), used_ (0), fshift_ (32), use_filter_ (true)
+		, use_check_ (true), hash_type_ (STRONG_HASH_MD4) {}
 	virtual ~hash_table ();
 	/// \brief
 	/// е Hash ֵ
@@ -185,7 +281,45 @@ public:
 	///  Hash ǷΪա
 	/// \return If hash table is empty,return true, otherwise return false
 	///
-	bool empty () const { return hash_table_.empty (); }
+	bool empty () const { return entries_.empty (); }
+	/// \brief
+	/// Ԥȷ nr Ŀռ䣬֪ʱÿԱʱɢС
+	/// \param[in]	nr 
+	/// \return		no return.
+	///
+	void reserve (const uint32_t nr);
+	/// \brief
+	/// 򿪻رղǰλˣĬϴ򿪡
+	/// \param[in]	on Ϊ true ʱ򿪡
+	/// \return		no return.
+	///
+	void set_filter (const bool on);
+	/// \brief
+	/// 򿪻رУ Hash ıȽϣĬϴ򿪡ĿûУ Hash ʱǰİ汾
+	/// Ҫڼ֮ǰرգʱ Hash кֱӱȽ Hash
+	/// \param[in]	on Ϊ true ʱ򿪡
+	/// \return		no return.
+	///
+	void set_check (const bool on) { use_check_ = on; }
+	/// \brief
+	/// ñ Hash 㷨Ҽ hash_it ʱ㷨ĬΪ MD4
+	/// \param[in]	type  Hash 㷨ǩһͬ
+	/// \return		no return.
+	///
+	void set_hash_type (const strong_hash_type type) { hash_type_ = type; }
+	/// \brief
+	/// ر Hash 㷨
+	strong_hash_type get_hash_type () const { return hash_type_; }
+	/// \brief
+	/// ÿ鱣 Hash ֽʱҲֻȽЩֽڣһ get_strong_hash_len
+	/// 㡣Ѿпʱڼ֮ǰá
+	/// \param[in]	hlen ֽ1  DIGEST_BYTES ֮䡣
+	/// \return		no return.
+	///
+	void set_hash_len (const uint32_t hlen);
+	/// \brief
+	/// ÿ鱣 Hash ֽĬΪ DIGEST_BYTES
+	uint32_t get_hash_len () const { return hlen_; }
 	/// \brief
 	///  Hash вһ Hash ԡ
 	/// \param[in]	fhash  Hash ֵ
@@ -199,10 +333,14 @@ public:
 	/// \param[in] fhash	 Hash ֵ
 	/// \param[in] buf		ݿָ롣
 	/// \param[in] len		ݿ鳤
-	/// \return	ָͬ Hash ԣ򷵻 Hash Եָ룬򷵻 0.
-	const slow_hash * find_block (const uint32_t fhash
-									, const uchar_t * buf
-									, const uint32_t len) const;
+	/// \param[out] tpos	ҵʱĿļеλá
+	/// \param[out] stat	ƥͳƣΪ 0 ʱͳơ
+	/// \return	ָͬ Hash ԣ򷵻 true򷵻 false
+	bool find_block (const uint32_t fhash
+						, const uchar_t * buf
+						, const uint32_t len
+						, target_pos & tpos
+						, hash_stat * stat = 0) const;
 	/// \brief
 	/// ļ Hash ԣ
 	/// \param[in] reader	ļݴļжȡݡ
@@ -212,6 +350,18 @@ public:
 };
 
 
+/// \fn uint32_t DLL_EXPORT get_strong_hash_len (const uint64_t filesize, const uint32_t blk_len)
+/// \brief ļС鳤ÿҪ Hash ֽ rsync  s2length ͬ
+/// ԽҪλԽ࣬ԽҪλԽ٣ټȥ 32 λ Hash Ĺסٱ
+/// MIN_STRONG_HASH_LEN ֽڡض̺ļУֵhasher_stream::end_hash
+/// \param[in] filesize ĿļĴС
+/// \param[in] blk_len 鳤ȡ
+/// \return  Hash ֽ MIN_STRONG_HASH_LEN  DIGEST_BYTES ֮䡣
+uint32_t DLL_EXPORT get_strong_hash_len (const uint64_t filesize, const uint32_t blk_len);
+
+/// ض̵ Hash ٱֽ
+#define MIN_STRONG_HASH_LEN 4
+
 /// \fn uint32_t DLL_EXPORT get_xdelta_block_size (const uint64_t filesize)
 /// \brief ļСӦ Hash 鳤ȡ
 /// \param[in] filesize ļĴС
@@ -243,13 +393,9 @@ public:
 	/// \return     ûзء
 	void eat_hash (const uchar_t *buf1, uint32_t len)
 	{
+		// ֽ RollsumRollin Ľȫͬ飨SIMD·
 		RollsumInit ((&sum_));
-#ifdef _WIN32
-		std::for_each (buf1, buf1 + len, std::bind1st (std::mem_fun (&rolling_hasher::_eat), this));
-#else
-		std::for_each (buf1, buf1 + len
-			, std::bind1st (__gnu_cxx::mem_fun1 (&rolling_hasher::_eat), this));
-#endif
+		RollsumUpdate (&sum_, buf1, len);
 	}
 	
 	/// \brief
@@ -268,7 +414,6 @@ public:
     } 
 private:
 	Rollsum sum_;
-	void _eat (uchar_t inchar) { RollsumRollin ((&sum_), inchar); }
 };
 
 /// \fn void get_file_digest (file_reader & reader, uchar_t digest[DIGEST_BYTES])
@@ -315,6 +460,54 @@ inline char_buffer<char_type> &	operator >> (char_buffer<char_type> & buff, slow
 	return buff;
 }
 
+/// 汾ʼ write_slow_hash дУ HashԶ˰汾ϵʱдҲ
+#define XDELTA_CHECK_HASH_VERSION 2
+
+/// \fn char_buffer<char_type> & write_slow_hash (char_buffer<char_type> & buff, const slow_hash & var, const uint32_t hlen, const int16_t version)
+/// \brief  slow_hash  buff У Hash ֻдǰ hlen ֽڡ
+/// \param[in] buff char_buff 
+/// \param[in] var  Slow Hash 
+/// \param[in] hlen  Hash ֽ˱ͬ handshake_header::set_hash_len
+/// \param[in] version Զ˵İ汾handshake_header::version XDELTA_CHECK_HASH_VERSION ʱдУ Hash
+/// \return buff char_buff á
+template <typename char_type>
+inline char_buffer<char_type> & write_slow_hash (char_buffer<char_type> & buff
+									, const slow_hash & var
+									, const uint32_t hlen
+									, const int16_t version)
+{
+	buff << var.tpos.index << var.tpos.t_offset;
+	if (version >= XDELTA_CHECK_HASH_VERSION)
+		buff << var.check;
+	buff.copy (var.hash, hlen);
+	return buff;
+}
+
+/// \fn char_buffer<char_type> & read_slow_hash (char_buffer<char_type> & buff, slow_hash & var, const uint32_t hlen, const int16_t version)
+/// \brief  buff зһ write_slow_hash д slow_hash  Hash ֽ 0
+/// \param[in] buff char_buff 
+/// \param[out] var  Slow Hash 
+/// \param[in] hlen  Hash ֽ
+/// \param[in] version Զ˵İ汾 XDELTA_CHECK_HASH_VERSION ʱûУ Hashvar.check  0
+///			װЩ Hash  hash_table Ҫ set_check (false)
+/// \return buff char_buff á
+template <typename char_type>
+inline char_buffer<char_type> & read_slow_hash (char_buffer<char_type> & buff
+									, slow_hash & var
+									, const uint32_t hlen
+									, const int16_t version)
+{
+	buff >> var.tpos.index >> var.tpos.t_offset;
+	if (version >= XDELTA_CHECK_HASH_VERSION)
+		buff >> var.check;
+	else
+		var.check = 0;
+	memcpy (var.hash, buff.rd_ptr (), hlen);
+	memset (var.hash + hlen, 0, DIGEST_BYTES - hlen);
+	buff.rd_ptr (hlen);
+	return buff;
+}
+
 /// \fn bool is_no_file_error (int32_t error_no)
 /// \brief жϴǷļڵĴĿ¼ڣļ򷵻棬򷵻ؼ١
 /// \param[in] error_no 롣
@@ -335,14 +528,23 @@ inline bool is_no_file_error (const int32_t error_no)
 /// 汾꣬ͨʱͨ BT_CLIENT_BLOCK ʼֽڣ汾
 /// ݣÿθ 1ڿϢʱͻ˷Ͱ汾ϢԼϢ
 #ifdef _WIN32
-	#define XDELTA_VERSION (1)
+	#define XDELTA_VERSION (2)
 #else
-	#define XDELTA_VERSION ((short)1)
+	#define XDELTA_VERSION ((short)2)
 #endif
 /// 汾ƥ
 #define ERR_DISCOMPAT_VERSION (-1)
 #define ERR_UNKNOWN_VERSION (-2)
 #define	ERR_INCORRECT_BLOCK_TYPE (-3)
+/// Զʹ˱˲ֵ֧ Hash 㷨
+#define ERR_UNKNOWN_HASH_TYPE (-4)
+/// ԶԼ Hash ֽ 1  DIGEST_BYTES ֮䡣
+#define ERR_BAD_HASH_LEN (-5)
+
+///  Hash 㷨¼ handshake_header::reserved еλãɰ汾ֽΪ 0 MD4
+#define HANDSHAKE_HASH_TYPE 0
+/// ÿ Hash ֽ¼ handshake_header::reserved еλãɰ汾Ϊ 0 DIGEST_BYTES
+#define HANDSHAKE_HASH_LEN 1
 
 struct handshake_header
 {
@@ -357,6 +559,21 @@ struct handshake_header
 		error_no = 0;
 		memset(reserved, 0, 32);
 	}
+	void set_hash_type (const strong_hash_type type)
+	{
+		reserved[HANDSHAKE_HASH_TYPE] = (uchar_t)type;
+	}
+	/// ȡöԶԼ Hash 㷨 is_valid_hash_type ʹá
+	int get_hash_type () const { return reserved[HANDSHAKE_HASH_TYPE]; }
+	void set_hash_len (const uint32_t hlen)
+	{
+		reserved[HANDSHAKE_HASH_LEN] = (uchar_t)(hlen == DIGEST_BYTES ? 0 : hlen);
+	}
+	/// ȡöԶԼ Hash ֽʹǰǷ 1  DIGEST_BYTES ֮䡣
+	uint32_t get_hash_len () const
+	{
+		return reserved[HANDSHAKE_HASH_LEN] == 0 ? DIGEST_BYTES : reserved[HANDSHAKE_HASH_LEN];
+	}
 	int16_t		version;
 	int32_t		error_no;
 	uchar_t		reserved[32];
@@ -408,14 +625,144 @@ void read_and_hash (file_reader & reader
 							, uint64_t to_read_bytes
 							, const int32_t blk_len
 							, uint64_t t_offset
-							, rs_mdfour_t * pctx);
+							, rs_mdfour_t * pctx
+							, strong_hash_type hash_type = STRONG_HASH_MD4);
+
+/// \fn read_and_hash_parallel()
+/// \brief
+///  read_and_hash ͬÿζݰз֣ɶ߳ͬʱ졢 Hash
+/// ٰ߳˳ stream stream Ҫ̰߳ȫģҲ
+/// read_and_hash ȫͬݼļ MD4pctxһ߳˳㣬
+/// ̶߳ʱޣҪʱ pctx  0 reader Ŀն file_reader::get_extent
+/// \param[in] threads	߳Ϊ 0 ʱȡ CPU ĸֻһ̻߳ݺʱֱӵ
+///						read_and_hash
+void read_and_hash_parallel (file_reader & reader
+							, hasher_stream & stream
+							, uint64_t to_read_bytes
+							, const int32_t blk_len
+							, uint64_t t_offset
+							, rs_mdfour_t * pctx
+							, strong_hash_type hash_type = STRONG_HASH_MD4
+							, uint32_t threads = 0);
 							
 void read_and_delta (file_reader & reader
 					, xdelta_stream & stream
 					, const hash_table & hashes
 					, std::set<hole_t> & hole_set
 					, const int blk_len
-					, bool need_split_hole);
+					, bool need_split_hole
+					, hash_stat * stat = 0);
+
+/// \fn void DLL_EXPORT split_hole (std::set<hole_t> & holeset, const hole_t & hole)
+/// \brief Ӷȥ holeһƥ飩ĶֳΪ 0 Ĳ
+/// ƽÿ O(log n)
+/// \param[in] holeset	ϡ
+/// \param[in] hole		Ҫȥ򣬱ĳУ򶪳쳣
+void DLL_EXPORT split_hole (std::set<hole_t> & holeset, const hole_t & hole);
+
+/// \fn void DLL_EXPORT split_holes (std::set<hole_t> & holeset, const std::vector<hole_t> & holes)
+/// \brief ÿ split_hole ͬ
+/// \param[in] holeset	ϡ
+/// \param[in] holes		Ҫȥ򣬳Ϊ 0 ĺԡ
+void DLL_EXPORT split_holes (std::set<hole_t> & holeset, const std::vector<hole_t> & holes);
+
+/// \fn read_and_delta_parallel()
+/// \brief
+///  read_and_delta ͬö߳ͬʱ㲻ͬĶֻ̹߳ hashes
+/// ÿ߳Լ XDELTA_BUFFER_LEN 棨ֻõĲֲռڴ棩ʱλõ reader  read_atreader 
+/// concurrent_read Ϊ false ʱreader ԶλǹܵĽȻɵ̰߳ԴļƫƵ˳
+///  stream stream Ҫ̰߳ȫģҲ read_and_delta ȫͬ
+/// ΪƻĽֻ threads * 2 ЩĲݺϼƲ
+/// XDELTA_PARALLEL_DATA_LENĳԤҪҳ XDELTA_PARALLEL_DATA_LEN
+/// Ķ棬ֵʱɵֱ߳Ӽ㲢 reader Ŀնֻһ߳ʱ⡣
+/// \param[in] threads	߳Ϊ 0 ʱȡ CPU ĸֻһ߳ʱֱӵ read_and_delta
+///						߳ʱ read_and_delta_segmented
+void read_and_delta_parallel (file_reader & reader
+					, xdelta_stream & stream
+					, const hash_table & hashes
+					, std::set<hole_t> & hole_set
+					, const int blk_len
+					, bool need_split_hole
+					, uint32_t threads = 0
+					, hash_stat * stat = 0);
+
+/// \fn read_and_delta_segmented()
+/// \brief
+///  read_and_delta ͬÿгɳΪ segment_len ĶΣ̸߳ԴӶεĿʼ
+/// ɨ裨һص blk_len - 1 ֽڣֻ¼ƥ顣ٰ߳ɨ
+/// ϲɨһʱĳƥм䣬ʹɨ裬ֱ
+/// ɨغϡзֺּĶ read_and_delta ȫͬ
+/// ʱ´ reader ȡreader Զλ
+/// \param[in] threads		߳Ϊ 0 ʱȡ CPU ĸ
+/// \param[in] segment_len	γΪ 0 ʱȡ XDELTA_SEGMENT_LENεĶֱӴм㡣
+void read_and_delta_segmented (file_reader & reader
+					, xdelta_stream & stream
+					, const hash_table & hashes
+					, std::set<hole_t> & hole_set
+					, const int blk_len
+					, bool need_split_hole
+					, uint32_t threads = 0
+					, uint64_t segment_len = 0
+					, hash_stat * stat = 0);
+
+/// \class
+/// \brief ͷʽ read_and_hash߰һν feedֱڵ߳м
+/// ڴеݣҪ reader ֻ̡߳пԽ feed ĿŸƣһβ
+/// 㣬 read_and_hash ȫͬ
+class DLL_EXPORT hash_feeder
+{
+	hasher_stream &		stream_;
+	const int32_t		blk_len_;
+	const uint64_t		t_offset_;
+	rs_mdfour_t *		pctx_;
+	strong_hash_type	hash_type_;
+	uint64_t			index_;		///< һš
+	std::vector<uchar_t> carry_;	///< һ feed ʣµĲһݡ
+public:
+	hash_feeder (hasher_stream & stream
+				, const int32_t blk_len
+				, const uint64_t t_offset
+				, rs_mdfour_t * pctx
+				, strong_hash_type hash_type = STRONG_HASH_MD4);
+	/// \brief
+	/// һε len ֽݡ
+	void feed (const uchar_t * data, const uint32_t len);
+};
+
+/// \class
+/// \brief ͷʽ read_and_deltaһֶ߰Ѷν feed
+/// ֱڵߵڴлڣֻƿԽ feed Ĵڣһ飩һ feed ʱ
+/// ûнĲȺϲ XDELTA_BUFFER_LENÿθݺʱ
+/// ܶСĲ顣ͬ read_and_delta ȫͬзֿܲͬ
+class DLL_EXPORT delta_feeder
+{
+	xdelta_stream &		stream_;
+	const hash_table &	hashes_;
+	const int32_t		blk_len_;
+	hash_stat *			stat_;
+	uint64_t			offset_;	///< һûֽԴļеƫơ
+	rolling_hasher		hasher_;
+	bool				newhash_;
+	uchar_t				outchar_;
+	std::vector<uchar_t> tail_;		///< ڻûлݣһ顣
+	std::vector<uchar_t> pending_;	///< ϲûĲݡ
+
+	uint32_t scan (const uchar_t * data, uint32_t pos, const uint32_t limit, uint32_t & sentry);
+	void add_diff (const uchar_t * data, const uint32_t len, const bool keep);
+	void flush ();
+public:
+	delta_feeder (xdelta_stream & stream
+				, const hash_table & hashes
+				, const int32_t blk_len
+				, const uint64_t s_offset
+				, hash_stat * stat = 0);
+	/// \brief
+	/// һε len ֽݡ
+	void feed (const uchar_t * data, const uint32_t len);
+	/// \brief
+	/// ѾȫʣµĲݡ
+	void finish ();
+};
 } // namespace xdelta
 #endif /*__XDELTA_LIB_H__*/
 